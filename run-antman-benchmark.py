@@ -0,0 +1,289 @@
+#!/usr/bin/env python3
+
+"""
+    This is an end-to-end benchmark for the antman daemon.
+
+    It simulates a sequencing run from a reference:
+        - read lengths follow a log-normal distribution (like nanopore reads)
+        - errors are substitutions and indels, with extra indels in homopolymer runs
+        - a set fraction of reads come from the reference, the rest are random sequence
+        - reads are written as FASTQ (or FASTQ.gz) batches into a temporary watch directory at a set rate
+
+    It then reports the daemon's sustained reads/s, the stage latencies from the
+    metrics endpoint and the accuracy of the containment check against the ground truth.
+    The read names carry the ground truth (on/off target), so the FASTQ can be kept for other tools.
+
+    The daemon is started with this watch directory and white list, so any running daemon must be stopped first.
+"""
+
+import argparse, gzip, math, os, random, shutil, subprocess, sys, tempfile, time, urllib.request
+
+# base complements for reverse strand reads
+COMPLEMENT = str.maketrans("ACGTacgt", "TGCAtgca")
+
+
+def getArgs():
+    parser = argparse.ArgumentParser(description="End-to-end throughput benchmark for the antman daemon.")
+    parser.add_argument("--ref", default="misc/data/NiV_6_Malaysia.fasta", help="reference to simulate on-target reads from (and to use as the white list)")
+    parser.add_argument("--rate", type=float, default=200.0, help="reads written per second")
+    parser.add_argument("--duration", type=float, default=30.0, help="seconds to write reads for")
+    parser.add_argument("--batchSize", type=int, default=100, help="reads per FASTQ file")
+    parser.add_argument("--meanLength", type=float, default=2000.0, help="mean read length")
+    parser.add_argument("--sdLength", type=float, default=1500.0, help="standard deviation of the read length")
+    parser.add_argument("--minLength", type=int, default=200, help="shortest read to write")
+    parser.add_argument("--onTarget", type=float, default=0.1, help="fraction of reads simulated from the reference")
+    parser.add_argument("--subRate", type=float, default=0.04, help="substitution rate per base")
+    parser.add_argument("--indelRate", type=float, default=0.03, help="insertion/deletion rate per base")
+    parser.add_argument("--homopolymerRate", type=float, default=0.1, help="indel rate per base within homopolymer runs")
+    parser.add_argument("--homopolymerMin", type=int, default=3, help="run length that counts as a homopolymer")
+    parser.add_argument("--calibrationReads", type=int, default=500, help="reads in each of the on/off target accuracy files (0 to skip)")
+    parser.add_argument("--gzip", action="store_true", help="write FASTQ.gz instead of FASTQ")
+    parser.add_argument("--metricsPort", type=int, default=9099, help="the daemon's metrics port (metrics_port in the config)")
+    parser.add_argument("--drainTimeout", type=float, default=120.0, help="seconds to wait for the daemon to finish the queued files")
+    parser.add_argument("--seed", type=int, default=42, help="random seed")
+    parser.add_argument("--keep", action="store_true", help="keep the generated reads")
+    parser.add_argument("--noDaemon", action="store_true", help="only generate reads (into --outDir)")
+    parser.add_argument("--outDir", help="directory to write the reads to (default: a temporary directory)")
+    return parser.parse_args()
+
+
+def loadReference(filename):
+    """ loadReference returns the concatenated sequences from a FASTA file """
+    seqs = []
+    with open(filename) as f:
+        for line in f:
+            if not line.startswith(">"):
+                seqs.append(line.strip().upper())
+    ref = "".join(seqs)
+    if not ref:
+        sys.exit("---\nerror: no sequence found in {}." .format(filename))
+    return ref
+
+
+class ReadSimulator:
+    """ ReadSimulator generates reads with a nanopore-like length and error profile """
+
+    def __init__(self, args, ref, rng):
+        self.args = args
+        self.ref = ref
+        self.rng = rng
+        self.count = 0
+
+        # log-normal parameters from the requested mean and standard deviation
+        variance = math.log(1 + (args.sdLength / args.meanLength) ** 2)
+        self.lengthMu = math.log(args.meanLength) - variance / 2
+        self.lengthSigma = math.sqrt(variance)
+
+    def readLength(self):
+        return max(self.args.minLength, int(self.rng.lognormvariate(self.lengthMu, self.lengthSigma)))
+
+    def addErrors(self, seq):
+        """ addErrors applies substitutions and indels, indels are more likely in homopolymer runs """
+        out = []
+        runLength = 0
+        for i, base in enumerate(seq):
+            runLength = runLength + 1 if i > 0 and seq[i - 1] == base else 1
+            indelRate = self.args.homopolymerRate if runLength >= self.args.homopolymerMin else self.args.indelRate
+            r = self.rng.random()
+            if r < indelRate / 2:
+                continue  # deletion
+            if r < indelRate:
+                out.append(base)  # insertion (homopolymer runs grow with a copy of the base)
+                out.append(base if runLength >= self.args.homopolymerMin else self.rng.choice("ACGT"))
+                continue
+            if self.rng.random() < self.args.subRate:
+                out.append(self.rng.choice([b for b in "ACGT" if b != base]))
+                continue
+            out.append(base)
+        return "".join(out)
+
+    def next(self, onTarget=None):
+        """ next returns (name, sequence, onTarget) for a simulated read """
+        if onTarget is None:
+            onTarget = self.rng.random() < self.args.onTarget
+        length = self.readLength()
+        if onTarget:
+            length = min(length, len(self.ref))
+            start = self.rng.randint(0, len(self.ref) - length)
+            seq = self.ref[start:start + length]
+            strand = "+"
+            if self.rng.random() < 0.5:
+                seq = seq.translate(COMPLEMENT)[::-1]
+                strand = "-"
+            origin = "ref:{}-{}{}" .format(start, start + length, strand)
+        else:
+            seq = "".join(self.rng.choice("ACGT") for _ in range(length))
+            origin = "random"
+        seq = self.addErrors(seq)
+        self.count += 1
+        name = "read{} truth={} origin={}" .format(self.count, "on" if onTarget else "off", origin)
+        return name, seq, onTarget
+
+
+def writeBatch(sim, outDir, stageDir, index, nReads, useGzip, onTarget=None):
+    """
+        writeBatch writes a FASTQ file into the watch directory and returns the number of on-target reads
+        the file is written in a staging directory and hard linked in, so the watcher only sees complete files
+    """
+    filename = "batch{:06d}.fastq{}" .format(index, ".gz" if useGzip else "")
+    stagePath = os.path.join(stageDir, filename)
+    nOnTarget = 0
+    opener = gzip.open if useGzip else open
+    with opener(stagePath, "wt") as f:
+        for _ in range(nReads):
+            name, seq, truth = sim.next(onTarget)
+            nOnTarget += truth
+            f.write("@{}\n{}\n+\n{}\n" .format(name, seq, "5" * len(seq)))
+    os.link(stagePath, os.path.join(outDir, filename))
+    os.remove(stagePath)
+    return nOnTarget
+
+
+def scrapeMetrics(port):
+    """ scrapeMetrics returns the daemon's metrics as a {name{labels}: value} dict """
+    with urllib.request.urlopen("http://127.0.0.1:{}/metrics" .format(port), timeout=5) as response:
+        text = response.read().decode("utf-8")
+    metrics = {}
+    for line in text.splitlines():
+        if line.startswith("#") or not line.strip():
+            continue
+        key, value = line.rsplit(" ", 1)
+        metrics[key] = float(value)
+    return metrics
+
+
+def waitForFiles(port, nFiles, timeout):
+    """ waitForFiles waits until the daemon has processed nFiles files, returns the final metrics (or None on timeout) """
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        metrics = scrapeMetrics(port)
+        if metrics.get("antman_files_processed_total", 0) >= nFiles:
+            return metrics
+        time.sleep(0.1)
+    return None
+
+
+def runAntman(*args):
+    result = subprocess.run(["antman"] + list(args), stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    if result.returncode != 0:
+        sys.exit("---\nerror: `antman {}` failed (error code: {})." .format(" ".join(args), result.returncode))
+    return result.stdout.decode("utf-8").rstrip("\n")
+
+
+def startDaemon(args, watchDir):
+    if runAntman("--getPID") != "-1":
+        sys.exit("---\nerror: antman is already running, stop it before benchmarking.")
+    runAntman("--setWhiteList={}" .format(os.path.abspath(args.ref)))
+    runAntman("--setWatchDir={}" .format(watchDir))
+    runAntman("--start")
+
+    # wait for the reference to load and the metrics server to come up
+    deadline = time.time() + 60
+    while time.time() < deadline:
+        try:
+            return scrapeMetrics(args.metricsPort)
+        except OSError:
+            time.sleep(0.2)
+    runAntman("--stop")
+    sys.exit("---\nerror: no metrics from the daemon on port {}." .format(args.metricsPort))
+
+
+def calibrate(args, sim, watchDir, stageDir, filesWritten):
+    """ calibrate sends an all on-target file then an all off-target file and returns (sensitivity, false positive rate) """
+    results = []
+    for onTarget in (True, False):
+        before = scrapeMetrics(args.metricsPort)
+        writeBatch(sim, watchDir, stageDir, filesWritten, args.calibrationReads, args.gzip, onTarget)
+        filesWritten += 1
+        after = waitForFiles(args.metricsPort, filesWritten, args.drainTimeout)
+        if after is None:
+            sys.exit("---\nerror: the daemon did not process the calibration file in time.")
+        matched = after.get("antman_reads_matched_total", 0) - before.get("antman_reads_matched_total", 0)
+        results.append(matched / args.calibrationReads)
+    return results[0], results[1], filesWritten
+
+
+def main():
+    args = getArgs()
+    rng = random.Random(args.seed)
+    ref = loadReference(args.ref)
+    sim = ReadSimulator(args, ref, rng)
+
+    watchDir = os.path.abspath(args.outDir) if args.outDir else tempfile.mkdtemp(prefix="antman-bench-")
+    os.makedirs(watchDir, exist_ok=True)
+    # stage files next to the watch directory (same filesystem, but not watched)
+    stageDir = watchDir.rstrip("/") + ".staging"
+    os.makedirs(stageDir, exist_ok=True)
+    print("writing reads to {}" .format(watchDir))
+
+    started = False
+    try:
+        if not args.noDaemon:
+            print("starting antman...")
+            startDaemon(args, watchDir)
+            started = True
+        filesWritten = 0
+
+        # accuracy against the ground truth, with nothing else in the queue
+        if not args.noDaemon and args.calibrationReads > 0:
+            print("measuring accuracy...")
+            sensitivity, fpRate, filesWritten = calibrate(args, sim, watchDir, stageDir, filesWritten)
+
+        # throughput at the requested rate
+        print("writing {:.0f} reads/s for {:.0f}s..." .format(args.rate, args.duration))
+        before = scrapeMetrics(args.metricsPort) if started else {}
+        interval = args.batchSize / args.rate
+        runStart = time.time()
+        nextBatch = runStart
+        readsWritten = onTargetWritten = 0
+        while time.time() - runStart < args.duration:
+            onTargetWritten += writeBatch(sim, watchDir, stageDir, filesWritten, args.batchSize, args.gzip)
+            filesWritten += 1
+            readsWritten += args.batchSize
+            nextBatch += interval
+            delay = nextBatch - time.time()
+            if delay > 0:
+                time.sleep(delay)
+        writeEnd = time.time()
+        achievedRate = readsWritten / (writeEnd - runStart)
+        if achievedRate < 0.9 * args.rate:
+            print("warning: the generator only managed {:.1f} reads/s" .format(achievedRate))
+
+        if not started:
+            print("wrote {} reads ({} on target) in {} files" .format(readsWritten, onTargetWritten, filesWritten))
+            return
+
+        print("waiting for antman to finish...")
+        after = waitForFiles(args.metricsPort, filesWritten, args.drainTimeout)
+        drainEnd = time.time()
+        if after is None:
+            after = scrapeMetrics(args.metricsPort)
+            print("warning: the daemon did not finish within {:.0f}s, results are partial" .format(args.drainTimeout))
+
+        delta = lambda key: after.get(key, 0) - before.get(key, 0)
+        reads = delta("antman_reads_total")
+        print("---")
+        print("reads written:          {} ({} on target) in {} files" .format(readsWritten, onTargetWritten, filesWritten))
+        print("write rate:             {:.1f} reads/s" .format(achievedRate))
+        print("reads classified:       {:.0f}" .format(reads))
+        print("sustained throughput:   {:.1f} reads/s, {:.2f} Mbases/s" .format(reads / (drainEnd - runStart), delta("antman_bases_total") / (drainEnd - runStart) / 1e6))
+        print("drain time:             {:.2f}s after the last file" .format(drainEnd - writeEnd))
+        print("reads matched:          {:.0f} (expected {})" .format(delta("antman_reads_matched_total"), onTargetWritten))
+        if args.calibrationReads > 0:
+            print("sensitivity:            {:.3f}" .format(sensitivity))
+            print("false positive rate:    {:.3f}" .format(fpRate))
+        print("stage latencies (cumulative, seconds):")
+        for stage in ("notify", "enqueue", "queue", "parse", "sketch", "containment", "total"):
+            quantiles = ["p{:g}={:.4f}" .format(float(q) * 100, after.get('antman_stage_latency_seconds{{stage="{}",quantile="{}"}}' .format(stage, q), 0))
+                         for q in ("0.5", "0.9", "0.99")]
+            print("    {:<12} {}" .format(stage, "  ".join(quantiles)))
+    finally:
+        if started:
+            runAntman("--stop")
+        shutil.rmtree(stageDir, ignore_errors=True)
+        if not args.keep and not args.outDir:
+            shutil.rmtree(watchDir, ignore_errors=True)
+
+
+if __name__ == "__main__":
+    main()
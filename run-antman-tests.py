@@ -37,6 +37,14 @@ except subprocess.CalledProcessError as e:
     errorCode = e.returncode
     sys.exit("---\nerror: failed to call `antman --setWhiteList=misc/data/NiV_6_Malaysia.fasta` (error code: {})." .format(errorCode))
 
+# check index
+print("indexing white list...")
+try:
+    index = subprocess.run(['antman', 'index'], stdout=subprocess.PIPE)
+except subprocess.CalledProcessError as e:
+    errorCode = e.returncode
+    sys.exit("---\nerror: failed to call `antman index` (error code: {})." .format(errorCode))
+
 # check --setWatchDir
 print("setting watch dir...")
 try:
@@ -90,4 +98,26 @@ except subprocess.CalledProcessError as e:
     errorCode = e.returncode
     sys.exit("---\nerror: failed to stop antman (error code: {})." .format(errorCode))
 
+# check two named instances on their default configs can run side by side
+print("checking named instances...")
+instances = ["runtests-{}-{}" .format(os.getpid(), i) for i in range(2)]
+ports = []
+for instance in instances:
+    startInstance = subprocess.run(['antman', '--instance={}' .format(instance), '--setWatchDir=/tmp', '--setWhiteList=misc/data/NiV_6_Malaysia.fasta', '--start'], stdout=subprocess.PIPE)
+    if startInstance.returncode != 0:
+        sys.exit("---\nerror: failed to start instance {} (error code: {})." .format(instance, startInstance.returncode))
+for instance in instances:
+    getPID3 = subprocess.run(['antman', '--instance={}' .format(instance), '--getPID'], stdout=subprocess.PIPE)
+    if getPID3.stdout.decode('utf-8').rstrip('\n') == "-1":
+        sys.exit("---\nerror: instance {} did not stay up" .format(instance))
+    getStats = subprocess.run(['antman', '--instance={}' .format(instance), '--getStats'], stdout=subprocess.PIPE)
+    if getStats.returncode != 0:
+        sys.exit("---\nerror: instance {} is not serving metrics" .format(instance))
+for instance in instances:
+    subprocess.run(['antman', '--instance={}' .format(instance), '--stop'], stdout=subprocess.PIPE)
+    configFile = "/tmp/.antman.config.{}" .format(instance)
+    for suffix in ["", ".lock", ".pid"]:
+        if os.path.exists(configFile + suffix):
+            os.remove(configFile + suffix)
+
 print("---\npassed all tests.")
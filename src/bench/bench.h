@@ -0,0 +1,143 @@
+// helpers shared by the antman benchmarks
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+// BENCH_SEED keeps the generated inputs the same between runs
+#define BENCH_SEED 0x9E3779B97F4A7C15ULL
+
+/*
+    benchTimer_t times a loop and, where perf_event_open is allowed, counts its cache misses
+*/
+typedef struct benchTimer
+{
+    uint64_t start;
+    uint64_t elapsed;
+    uint64_t misses;
+    int perfFD;
+} benchTimer_t;
+
+// benchNow returns a monotonic timestamp in nanoseconds
+static inline uint64_t benchNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// benchRand is a xorshift generator so the benchmarks don't depend on the libc rand
+static inline uint64_t benchRand(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+// benchRandomSeq fills a buffer with random ACGT (null terminated, buffer must hold len + 1)
+static inline void benchRandomSeq(char *seq, int len, uint64_t *state)
+{
+    static const char bases[4] = {'A', 'C', 'G', 'T'};
+    int i;
+    for (i = 0; i < len; i++)
+        seq[i] = bases[benchRand(state) & 3];
+    seq[len] = '\0';
+}
+
+// benchInit opens the cache miss counter (perfFD is -1 if it isn't available)
+static inline void benchInit(benchTimer_t *t)
+{
+    memset(t, 0, sizeof(*t));
+    t->perfFD = -1;
+#ifdef __linux__
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    t->perfFD = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+}
+
+// benchClose releases the cache miss counter
+static inline void benchClose(benchTimer_t *t)
+{
+    if (t->perfFD >= 0)
+        close(t->perfFD);
+    t->perfFD = -1;
+}
+
+// benchStart starts timing (and counting)
+static inline void benchStart(benchTimer_t *t)
+{
+#ifdef __linux__
+    if (t->perfFD >= 0)
+    {
+        ioctl(t->perfFD, PERF_EVENT_IOC_RESET, 0);
+        ioctl(t->perfFD, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+    t->start = benchNow();
+}
+
+// benchStop stops timing (and counting)
+static inline void benchStop(benchTimer_t *t)
+{
+    t->elapsed = benchNow() - t->start;
+#ifdef __linux__
+    if (t->perfFD >= 0)
+    {
+        ioctl(t->perfFD, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(t->perfFD, &t->misses, sizeof(t->misses)) != sizeof(t->misses))
+            t->misses = 0;
+    }
+#endif
+}
+
+// benchHeader prints the column names for benchPrint
+static inline void benchHeader(void)
+{
+    printf("%-48s %12s %12s %14s\n", "benchmark", "ns/op", "Mbases/s", "cache-miss/op");
+}
+
+// benchPrint reports a timed loop of ops operations covering bases bases (0 if not sequence work)
+static inline void benchPrint(const char *name, const benchTimer_t *t, uint64_t ops, uint64_t bases)
+{
+    double elapsed = t->elapsed ? (double)t->elapsed : 1.0;
+    printf("%-48s %12.1f", name, elapsed / (ops ? ops : 1));
+    if (bases)
+        printf(" %12.2f", bases / elapsed * 1e3);
+    else
+        printf(" %12s", "-");
+    if (t->perfFD >= 0)
+        printf(" %14.3f\n", (double)t->misses / (ops ? ops : 1));
+    else
+        printf(" %14s\n", "n/a");
+}
+
+// benchReport prints the time per operation for a timed loop
+static inline void benchReport(const char *name, uint64_t ops, uint64_t elapsedNs)
+{
+    benchTimer_t t;
+    memset(&t, 0, sizeof(t));
+    t.perfFD = -1;
+    t.elapsed = elapsedNs;
+    benchPrint(name, &t, ops, 0);
+}
+
+#endif
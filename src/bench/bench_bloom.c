@@ -0,0 +1,166 @@
+/*
+    bench_bloom measures the bloom filter and the hash behind it, and the exact Elias-Fano k-mer set that can replace it
+    - filter sizes run from cache resident to well beyond the last level cache
+    - lookups are half hits, half misses, with keys shaped like the hashed k-mers from sketchSequence
+*/
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "../bloom.h"
+#include "../eliasfano.h"
+#include "../murmurhash2.h"
+
+#define BENCH_LOOKUPS 2000000
+#define BENCH_HASHES 10000000
+
+// benchMurmur times murmurhash2 over keys of a given length
+static void benchMurmur(int keyLength)
+{
+    char name[128], key[64];
+    benchTimer_t t;
+    uint64_t state = BENCH_SEED;
+    unsigned int acc = 0;
+    volatile unsigned int sink;
+    int i;
+    for (i = 0; i < keyLength; i++)
+        key[i] = (char)benchRand(&state);
+    benchInit(&t);
+    benchStart(&t);
+    for (i = 0; i < BENCH_HASHES; i++)
+    {
+        key[0] = (char)i;
+        acc ^= murmurhash2(key, keyLength, 0x9747b28c);
+    }
+    benchStop(&t);
+    sink = acc;
+    (void)sink;
+    snprintf(name, sizeof(name), "murmurhash2 len=%d", keyLength);
+    benchPrint(name, &t, BENCH_HASHES, 0);
+    benchClose(&t);
+}
+
+// benchBloom fills a filter sized for entries and then times lookups against it
+static void benchBloom(int entries)
+{
+    char name[128];
+    benchTimer_t t;
+    struct bloom bf;
+    uint64_t state = BENCH_SEED, key;
+    int i, hits = 0;
+    if (bloom_init(&bf, entries, 0.01) != 0)
+    {
+        fprintf(stderr, "could not init the bloom filter\n");
+        exit(1);
+    }
+
+    // add the entries the filter was sized for
+    benchInit(&t);
+    benchStart(&t);
+    for (i = 0; i < entries; i++)
+    {
+        key = benchRand(&state);
+        bloom_add(&bf, &key, sizeof(key));
+    }
+    benchStop(&t);
+    snprintf(name, sizeof(name), "bloom_add entries=%d (%dKB)", entries, bf.bytes / 1024);
+    benchPrint(name, &t, entries, 0);
+
+    // replay the inserted keys for hits and carry on the stream for misses
+    uint64_t hitState = BENCH_SEED;
+    int replayed = 0;
+    benchStart(&t);
+    for (i = 0; i < BENCH_LOOKUPS; i++)
+    {
+        if (!(i & 1) && replayed++ == entries)
+            hitState = BENCH_SEED, replayed = 1;
+        key = (i & 1) ? benchRand(&state) : benchRand(&hitState);
+        hits += bloom_check(&bf, &key, sizeof(key));
+    }
+    benchStop(&t);
+    snprintf(name, sizeof(name), "bloom_check entries=%d (%dKB)", entries, bf.bytes / 1024);
+    benchPrint(name, &t, BENCH_LOOKUPS, 0);
+    if (hits < BENCH_LOOKUPS / 2)
+        fprintf(stderr, "bloom_check returned too few hits: %d\n", hits);
+    benchClose(&t);
+    bloom_free(&bf);
+}
+
+// compareKeys orders keys for qsort
+static int compareKeys(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// benchEliasFano builds an exact set of entries 42-bit keys (21-mer hashes) and times single and batched lookups
+static void benchEliasFano(int entries)
+{
+    char name[128];
+    benchTimer_t t;
+    uint64_t universe = 1ULL << 42, state = BENCH_SEED, size;
+    uint64_t *keys = malloc(entries * sizeof(uint64_t));
+    int i, n = 0, hits = 0;
+    if (keys == NULL)
+    {
+        fprintf(stderr, "could not allocate the keys\n");
+        exit(1);
+    }
+    for (i = 0; i < entries; i++)
+        keys[i] = benchRand(&state) % universe;
+    qsort(keys, entries, sizeof(uint64_t), compareKeys);
+    for (i = 0; i < entries; i++)
+        if (n == 0 || keys[i] != keys[n - 1])
+            keys[n++] = keys[i];
+    void *data = efBuild(keys, n, universe, &size);
+    efSet_t set;
+    if (data == NULL || efMap(&set, data, size) != 0)
+    {
+        fprintf(stderr, "could not build the set\n");
+        exit(1);
+    }
+
+    // half hits, half misses, as for the bloom filter
+    benchInit(&t);
+    benchStart(&t);
+    for (i = 0; i < BENCH_LOOKUPS; i++)
+        hits += efContains(&set, (i & 1) ? benchRand(&state) % universe : keys[(i >> 1) % n]);
+    benchStop(&t);
+    snprintf(name, sizeof(name), "efContains entries=%d (%lluKB, %.1f bits/key)", entries, (unsigned long long)size / 1024, size * 8.0 / n);
+    benchPrint(name, &t, BENCH_LOOKUPS, 0);
+
+    // batches the size of a read sketch
+    uint64_t batch[128];
+    uint8_t found[128];
+    int j;
+    benchStart(&t);
+    for (i = 0; i < BENCH_LOOKUPS; i += 128)
+    {
+        for (j = 0; j < 128; j++)
+            batch[j] = (j & 1) ? benchRand(&state) % universe : keys[((i + j) >> 1) % n];
+        hits += efContainsBatch(&set, batch, 128, found);
+    }
+    benchStop(&t);
+    snprintf(name, sizeof(name), "efContainsBatch entries=%d (batch=128)", entries);
+    benchPrint(name, &t, BENCH_LOOKUPS, 0);
+    if (hits < BENCH_LOOKUPS)
+        fprintf(stderr, "efContains returned too few hits: %d\n", hits);
+    benchClose(&t);
+    free(data);
+    free(keys);
+}
+
+int main(int argc, char **argv)
+{
+    static const int keyLengths[] = {8, 21, 32};
+    static const int entries[] = {10000, 100000, 1000000, 10000000, 50000000};
+    int i;
+    benchHeader();
+    for (i = 0; i < 3; i++)
+        benchMurmur(keyLengths[i]);
+    for (i = 0; i < 5; i++)
+        benchBloom(entries[i]);
+    for (i = 0; i < 5; i++)
+        benchEliasFano(entries[i]);
+    return 0;
+}
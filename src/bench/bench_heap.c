@@ -0,0 +1,121 @@
+/*
+    bench_heap measures the KMV heap and the hashmap that tracks its contents
+    - each round fills the structures to sketch size, then replaces minimums the way sketchSequence does
+*/
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "../hashmap.h"
+#include "../heap.h"
+
+#define BENCH_OPS 2000000
+
+// benchHeap times push and peek+pop+push on a heap holding sketchSize minimums
+static void benchHeap(int sketchSize)
+{
+    char name[128];
+    benchTimer_t t;
+    node_t *heap;
+    uint64_t state = BENCH_SEED;
+    int rounds = BENCH_OPS / sketchSize, r, i;
+    benchInit(&t);
+
+    // fill the heap from empty
+    benchStart(&t);
+    for (r = 0; r < rounds; r++)
+    {
+        heap = initHeap(benchRand(&state));
+        for (i = 1; i < sketchSize; i++)
+            push(&heap, benchRand(&state));
+        destroy(&heap);
+    }
+    benchStop(&t);
+    snprintf(name, sizeof(name), "heap push s=%d", sketchSize);
+    benchPrint(name, &t, (uint64_t)rounds * sketchSize, 0);
+
+    // replace the largest minimum, as happens once the sketch is full
+    heap = initHeap(benchRand(&state));
+    for (i = 1; i < sketchSize; i++)
+        push(&heap, benchRand(&state));
+    benchStart(&t);
+    for (i = 0; i < BENCH_OPS; i++)
+    {
+        uint64_t v = benchRand(&state);
+        if (peek(&heap) <= v)
+            v = peek(&heap) - 1;
+        pop(&heap);
+        push(&heap, v);
+    }
+    benchStop(&t);
+    destroy(&heap);
+    snprintf(name, sizeof(name), "heap replace max s=%d", sketchSize);
+    benchPrint(name, &t, BENCH_OPS, 0);
+    benchClose(&t);
+}
+
+// benchHashmap times insert, search and delete with the map holding sketchSize entries
+static void benchHashmap(int sketchSize)
+{
+    char name[128];
+    benchTimer_t t;
+    uint64_t *keys = malloc(sketchSize * sizeof(uint64_t));
+    uint64_t state = BENCH_SEED;
+    int rounds = BENCH_OPS / sketchSize, r, i, found = 0;
+    if (!keys)
+    {
+        fprintf(stderr, "could not allocate the benchmark input\n");
+        exit(1);
+    }
+    for (i = 0; i < sketchSize; i++)
+        keys[i] = benchRand(&state);
+    benchInit(&t);
+
+    benchStart(&t);
+    for (r = 0; r < rounds; r++)
+    {
+        for (i = 0; i < sketchSize; i++)
+            hmInsert(keys[i]);
+        hmDestroy();
+    }
+    benchStop(&t);
+    snprintf(name, sizeof(name), "hmInsert s=%d", sketchSize);
+    benchPrint(name, &t, (uint64_t)rounds * sketchSize, 0);
+
+    // searches alternate between present and absent keys
+    for (i = 0; i < sketchSize; i++)
+        hmInsert(keys[i]);
+    benchStart(&t);
+    for (i = 0; i < BENCH_OPS; i++)
+        found += hmSearch((i & 1) ? keys[i % sketchSize] : keys[i % sketchSize] + 1);
+    benchStop(&t);
+    snprintf(name, sizeof(name), "hmSearch s=%d", sketchSize);
+    benchPrint(name, &t, BENCH_OPS, 0);
+    if (found < BENCH_OPS / 2)
+        fprintf(stderr, "hmSearch missed keys: %d\n", found);
+
+    benchStart(&t);
+    for (i = 0; i < BENCH_OPS; i++)
+    {
+        hmDelete(keys[i % sketchSize]);
+        hmInsert(keys[i % sketchSize]);
+    }
+    benchStop(&t);
+    snprintf(name, sizeof(name), "hmDelete+hmInsert s=%d", sketchSize);
+    benchPrint(name, &t, BENCH_OPS, 0);
+    hmDestroy();
+    benchClose(&t);
+    free(keys);
+}
+
+int main(int argc, char **argv)
+{
+    static const int sketchSizes[] = {32, 128, 255};
+    int i;
+    benchHeader();
+    for (i = 0; i < 3; i++)
+        benchHeap(sketchSizes[i]);
+    for (i = 0; i < 3; i++)
+        benchHashmap(sketchSizes[i]);
+    return 0;
+}
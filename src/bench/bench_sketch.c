@@ -0,0 +1,100 @@
+/*
+    bench_sketch measures the k-mer hashing and sketching that runs for every read
+    - sketch.c is included directly so the static hash64 can be timed on its own
+    - inputs come from a fixed seed so runs are comparable
+*/
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "../sketch.c"
+
+#define BENCH_HASHES 10000000
+#define BENCH_SKETCH_BASES 20000000
+
+// benchHash64 times hash64 over a stream of k-mers for a given k
+static void benchHash64(int k)
+{
+    char name[128];
+    benchTimer_t t;
+    uint64_t state = BENCH_SEED, mask = (1ULL << 2 * k) - 1, kmer = benchRand(&state) & mask;
+    volatile uint64_t sink = 0;
+    uint64_t acc = 0;
+    int i;
+    benchInit(&t);
+    benchStart(&t);
+    for (i = 0; i < BENCH_HASHES; i++)
+    {
+        kmer = (kmer << 2 | (i & 3)) & mask;
+        acc ^= hash64(kmer, mask);
+    }
+    benchStop(&t);
+    sink = acc;
+    (void)sink;
+    snprintf(name, sizeof(name), "hash64 k=%d", k);
+    benchPrint(name, &t, BENCH_HASHES, BENCH_HASHES);
+    benchClose(&t);
+}
+
+// benchSketch times sketchSequence on random reads, with or without a bloom filter to fill
+static void benchSketch(int k, int sketchSize, int readLength, int withBloom)
+{
+    char name[128];
+    benchTimer_t t;
+    struct bloom bf;
+    uint64_t state = BENCH_SEED;
+    int nReads = BENCH_SKETCH_BASES / readLength, i;
+    if (nReads < 1)
+        nReads = 1;
+    char *seq = malloc(readLength + 1);
+    uint64_t *sketch = calloc(sketchSize, sizeof(uint64_t));
+    if (!seq || !sketch)
+    {
+        fprintf(stderr, "could not allocate the benchmark input\n");
+        exit(1);
+    }
+    if (withBloom && bloom_init(&bf, BENCH_SKETCH_BASES, 0.01) != 0)
+    {
+        fprintf(stderr, "could not init the bloom filter\n");
+        exit(1);
+    }
+    benchRandomSeq(seq, readLength, &state);
+
+    // warm up once so the first allocation isn't timed
+    sketchSequence(seq, readLength, k, sketchSize, NULL, sketch);
+    benchInit(&t);
+    benchStart(&t);
+    for (i = 0; i < nReads; i++)
+    {
+        // change a base each read so the work isn't identical
+        seq[i % readLength] = "ACGT"[i & 3];
+        sketchSequence(seq, readLength, k, sketchSize, withBloom ? &bf : NULL, withBloom ? NULL : sketch);
+    }
+    benchStop(&t);
+    snprintf(name, sizeof(name), "sketchSequence%s k=%d s=%d len=%d", withBloom ? "+bloom" : "", k, sketchSize, readLength);
+    benchPrint(name, &t, nReads, (uint64_t)nReads * readLength);
+    benchClose(&t);
+    if (withBloom)
+        bloom_free(&bf);
+    free(sketch);
+    free(seq);
+}
+
+int main(int argc, char **argv)
+{
+    static const int kSizes[] = {7, 15, 21, 31};
+    static const int sketchSizes[] = {32, 128, 255};
+    static const int readLengths[] = {150, 1000, 10000, 100000};
+    int i, j;
+    benchHeader();
+    for (i = 0; i < 4; i++)
+        benchHash64(kSizes[i]);
+    for (i = 0; i < 4; i++)
+        benchSketch(kSizes[i], 128, 1000, 0);
+    for (i = 0; i < 3; i++)
+        benchSketch(21, sketchSizes[i], 1000, 0);
+    for (j = 0; j < 4; j++)
+        benchSketch(21, 128, readLengths[j], 0);
+    benchSketch(21, 128, 10000, 1);
+    return 0;
+}
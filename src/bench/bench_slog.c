@@ -0,0 +1,80 @@
+/*
+    bench_slog measures the per-read logging overhead of processFastq
+    - each "read" issues the same two slog_hot calls as the sketcher
+    - bench_slog_stripped is the same code built with the hot path compiled out
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "../slog.h"
+
+#define BENCH_READS 100000
+#define BENCH_LOG "./bench_slog.log"
+
+#if SLOG_HOT_COMPILE_MASK == SLOG_MASK_ALL
+#define BENCH_BUILD "compiled in"
+#else
+#define BENCH_BUILD "compiled out"
+#endif
+
+// logRead mimics the per-read log calls in processFastq
+static void logReads(int n)
+{
+    int i;
+    for (i = 0; i < n; i++)
+    {
+        slog_hot(0, SLOG_LIVE, "\t- [sketcher]:\tsketched a %dbp sequence", 1000 + i);
+        slog_hot(0, SLOG_LIVE, "\t- [sketcher]:\tjaccardEst by containment = %f", (double)i / n);
+    }
+}
+
+// runMode times BENCH_READS reads with the given logger setup
+static void runMode(const char *mode, int silent, int async)
+{
+    char name[128];
+    SlogConfig cfg;
+    slog_config_get(&cfg);
+    cfg.nToFile = 1;
+    cfg.nFileStamp = 0;
+    cfg.nPretty = 1;
+    cfg.nSilent = silent;
+    slog_config_set(&cfg);
+    if (async && slog_async_start() != 0)
+    {
+        fprintf(stderr, "could not start the async logger\n");
+        exit(1);
+    }
+
+    // the daemon's stdout is /dev/null, so send console output there too
+    fflush(stdout);
+    int savedStdout = dup(STDOUT_FILENO);
+    if (freopen("/dev/null", "w", stdout) == NULL)
+        exit(1);
+
+    uint64_t start = benchNow();
+    logReads(BENCH_READS);
+    uint64_t elapsed = benchNow() - start;
+
+    if (async)
+        slog_async_stop();
+    fflush(stdout);
+    dup2(savedStdout, STDOUT_FILENO);
+    close(savedStdout);
+
+    snprintf(name, sizeof(name), "slog per read, %s (%s)", mode, BENCH_BUILD);
+    benchReport(name, BENCH_READS, elapsed);
+}
+
+int main(int argc, char **argv)
+{
+    benchHeader();
+    slog_init(BENCH_LOG, NULL, 0, 1);
+    runMode("file logging", 0, 0);
+    runMode("async file logging", 0, 1);
+    runMode("logging disabled", 1, 0);
+    printf("%-48s %12lu\n", "async messages dropped", slog_async_dropped());
+    remove(BENCH_LOG);
+    return 0;
+}
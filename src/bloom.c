@@ -22,17 +22,35 @@
 
 #include "bloom.h"
 #include "murmurhash2.h"
+#include "trace.h"
 
 #define MAKESTRING(n) STRING(n)
 #define STRING(n) #n
 
+// set_bit values for test_bit_set_bit
+#define BLOOM_TEST 0
+#define BLOOM_SET 1
+#define BLOOM_SET_ATOMIC 2
+
 inline static int test_bit_set_bit(unsigned char *buf,
                                    unsigned int x, int set_bit)
 {
   unsigned int byte = x >> 3;
-  unsigned char c = buf[byte]; // expensive memory access
   unsigned int mask = 1 << (x % 8);
 
+  // concurrent adders can share a byte, so set the bit with an atomic OR
+  // (only when it isn't already set, as the locked OR is far slower than a load)
+  if (set_bit == BLOOM_SET_ATOMIC)
+  {
+    if (__atomic_load_n(&buf[byte], __ATOMIC_RELAXED) & mask)
+    {
+      return 1;
+    }
+    return (__atomic_fetch_or(&buf[byte], (unsigned char)mask, __ATOMIC_RELAXED) & mask) != 0;
+  }
+
+  unsigned char c = buf[byte]; // expensive memory access
+
   if (c & mask)
   {
     return 1;
@@ -91,6 +109,24 @@ int bloom_init_size(struct bloom *bloom, int entries, double error,
 }
 
 int bloom_init(struct bloom *bloom, int entries, double error)
+{
+  if (bloom_init_buffer(bloom, entries, error, NULL) != 0)
+  {
+    return 1;
+  }
+
+  bloom->bf = (unsigned char *)calloc(bloom->bytes, sizeof(unsigned char));
+  if (bloom->bf == NULL)
+  { // LCOV_EXCL_START
+    return 1;
+  } // LCOV_EXCL_STOP
+
+  bloom->ready = 1;
+  return 0;
+}
+
+int bloom_init_buffer(struct bloom *bloom, int entries, double error,
+                      unsigned char *buffer)
 {
   bloom->ready = 0;
 
@@ -120,24 +156,34 @@ int bloom_init(struct bloom *bloom, int entries, double error)
 
   bloom->hashes = (int)ceil(0.693147180559945 * bloom->bpe); // ln(2)
 
-  bloom->bf = (unsigned char *)calloc(bloom->bytes, sizeof(unsigned char));
-  if (bloom->bf == NULL)
-  { // LCOV_EXCL_START
-    return 1;
-  } // LCOV_EXCL_STOP
-
-  bloom->ready = 1;
+  if (buffer != NULL)
+  {
+    bloom->bf = buffer;
+    bloom->ready = 1;
+  }
   return 0;
 }
 
 int bloom_check(struct bloom *bloom, const void *buffer, int len)
 {
-  return bloom_check_add(bloom, buffer, len, 0);
+  TRACE_PROBE(bloom_check__start);
+  int ret = bloom_check_add(bloom, buffer, len, BLOOM_TEST);
+  TRACE_PROBE1(bloom_check__done, ret);
+  return ret;
 }
 
 int bloom_add(struct bloom *bloom, const void *buffer, int len)
 {
-  return bloom_check_add(bloom, buffer, len, 1);
+  TRACE_PROBE(bloom_add__start);
+  int ret = bloom_check_add(bloom, buffer, len, BLOOM_SET);
+  TRACE_PROBE1(bloom_add__done, ret);
+  return ret;
+}
+
+
+int bloom_add_atomic(struct bloom *bloom, const void *buffer, int len)
+{
+  return bloom_check_add(bloom, buffer, len, BLOOM_SET_ATOMIC);
 }
 
 void bloom_print(struct bloom *bloom)
@@ -74,6 +74,25 @@ struct bloom
 int bloom_init(struct bloom * bloom, int entries, double error);
 
 
+/** ***************************************************************************
+ * Same as bloom_init(), but the bit field is a buffer owned by the caller
+ * (e.g. shared memory), so bloom_free() must not be called on the filter.
+ *
+ * With a NULL buffer only the public fields are filled in, bloom->bytes
+ * gives the size the buffer needs to be, and the filter is not ready.
+ * The buffer must be zeroed, or hold a filter made with the same entries
+ * and error.
+ *
+ * Return:
+ * -------
+ *     0 - on success
+ *     1 - on failure
+ *
+ */
+int bloom_init_buffer(struct bloom * bloom, int entries, double error,
+                      unsigned char * buffer);
+
+
 /** ***************************************************************************
  * Deprecated, use bloom_init()
  *
@@ -123,6 +142,17 @@ int bloom_check(struct bloom * bloom, const void * buffer, int len);
 int bloom_add(struct bloom * bloom, const void * buffer, int len);
 
 
+/** ***************************************************************************
+ * Same as bloom_add(), but safe to call from several threads at once on the
+ * same filter (each bit is set with an atomic OR). Checks must not run
+ * concurrently with atomic adds.
+ *
+ * Return: as bloom_add()
+ *
+ */
+int bloom_add_atomic(struct bloom * bloom, const void * buffer, int len);
+
+
 /** ***************************************************************************
  * Print (to stdout) info about this bloom filter. Debugging aid.
  *
@@ -0,0 +1,567 @@
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "classify.h"
+#include "config.h"
+#include "ketopt.h"
+#include "kseq.h"
+#include "metrics.h"
+#include "refdb.h"
+#include "sequence.h"
+#include "slog.h"
+#include "stream.h"
+#include "watcher.h"
+#include "workerpool.h"
+
+KSEQ_INIT(gzFile, gzread)
+
+/*
+    classifyJob_t holds the state shared by the reader and the workers
+*/
+typedef struct classifyJob
+{
+    watcherArgs_t wargs;   // the classification settings, shared with the daemon's code path
+    FILE *out;             // the results file
+    int flushResults;      // flush the results file after every batch (streaming)
+    int topN;              // references reported per read
+    pthread_mutex_t outLock;
+    pthread_mutex_t lock;  // protects inFlight
+    pthread_cond_t cond;   // signalled when a batch finishes
+    int inFlight;          // batches queued or being classified
+    int maxInFlight;       // bounds the memory held by queued batches
+    int batchReads;        // reads per batch (batch_reads in the config)
+    uint64_t reads;
+    uint64_t matched;
+    uint64_t skipped;
+} classifyJob_t;
+
+/*
+    classifyBatch_t is a block of reads from one input, packed as "name\0sequence\0"
+*/
+typedef struct classifyBatch
+{
+    classifyJob_t *job;
+    const char *input;
+    int n;
+    int cap;
+    size_t *offsets; // start of each read's name in data
+    int *lengths;    // sequence length of each read
+    char *data;
+    size_t dataLen;
+    size_t dataCap;
+} classifyBatch_t;
+
+/*
+    classifyReader_t collects the reads from one input into batches
+*/
+typedef struct classifyReader
+{
+    classifyJob_t *job;
+    tpool_t *wp;
+    const char *input;
+    classifyBatch_t *batch;
+    uint64_t batchStart; // when the first read in the batch arrived
+    uint64_t maxWait;    // longest a read waits in a partial batch (0 to only send full batches)
+} classifyReader_t;
+
+// printClassifyUsage prints the usage info for antman classify
+static void printClassifyUsage(void)
+{
+    printf("usage:\tantman classify [flags] <file.fastq[.gz]> ...\n\n"
+           "classifies the reads in each file against a reference without the daemon (use - or no files to read stdin)\n\n"
+           "flags:\n"
+           "\t --ref=<path/filename>               \t reference to classify against (required)\n"
+           "\t --threads=<int>                     \t number of worker threads (default: number of cores)\n"
+           "\t --output=<path/filename>            \t results file (default: %s)\n"
+           "\t --threshold=<float>                 \t containment needed to call a match (default: match_threshold from the config)\n"
+           "\t --stream=<path>                     \t classify FASTQ from stdin (-) or a named pipe as it arrives, until interrupted\n"
+           "\t --flush=<ms>                        \t longest a streamed read waits for its batch to fill (default: %d)\n"
+           "\t --top=<int>                         \t number of best matching references to report per read (default: 1)\n"
+           "\t --exact                             \t check reads against every reference k-mer (adds a compressed k-mer set to the reference database)\n"
+           "\t --sprt=<float>                      \t stop checking a read against a bloom filter once a sequential test is this confident (default: sprt_confidence from the config, 0 checks every hash)\n"
+           "\t --config=<path/filename>            \t take the settings from this config file (default: %s)\n"
+           "\t --instance=<name>                   \t take the settings from a named instance's config\n"
+           "\n"
+           "\t -h                                   \t prints this help and exits\n",
+           AM_CLASSIFY_DEFAULT_OUTPUT, AM_STREAM_DEFAULT_FLUSH_MS, CONFIG_LOCATION);
+}
+
+// newBatch allocates an empty batch for an input
+static classifyBatch_t *newBatch(classifyJob_t *job, const char *input)
+{
+    classifyBatch_t *batch = calloc(1, sizeof(classifyBatch_t));
+    if (batch == NULL)
+        return NULL;
+    batch->job = job;
+    batch->input = input;
+    batch->cap = job->batchReads;
+    batch->dataCap = AM_CLASSIFY_BATCH_BASES + 64 * 1024;
+    batch->offsets = malloc(batch->cap * sizeof(size_t));
+    batch->lengths = malloc(batch->cap * sizeof(int));
+    batch->data = malloc(batch->dataCap);
+    if (!batch->offsets || !batch->lengths || !batch->data)
+    {
+        free(batch->offsets);
+        free(batch->lengths);
+        free(batch->data);
+        free(batch);
+        return NULL;
+    }
+    return batch;
+}
+
+// destroyBatch frees a batch
+static void destroyBatch(classifyBatch_t *batch)
+{
+    free(batch->offsets);
+    free(batch->lengths);
+    free(batch->data);
+    free(batch);
+}
+
+// addRead copies a read into a batch, returns 0 on success
+static int addRead(classifyBatch_t *batch, const char *name, size_t nameLen, const char *seq, size_t seqLen)
+{
+    size_t need = nameLen + seqLen + 2;
+    if (batch->dataLen + need > batch->dataCap)
+    {
+        size_t cap = batch->dataCap * 2 > batch->dataLen + need ? batch->dataCap * 2 : batch->dataLen + need;
+        char *data = realloc(batch->data, cap);
+        if (data == NULL)
+            return 1;
+        batch->data = data;
+        batch->dataCap = cap;
+    }
+    batch->offsets[batch->n] = batch->dataLen;
+    batch->lengths[batch->n] = (int)seqLen;
+    memcpy(batch->data + batch->dataLen, name, nameLen);
+    batch->dataLen += nameLen;
+    batch->data[batch->dataLen++] = '\0';
+    memcpy(batch->data + batch->dataLen, seq, seqLen);
+    batch->dataLen += seqLen;
+    batch->data[batch->dataLen++] = '\0';
+    batch->n++;
+    return 0;
+}
+
+// batchFull checks if a batch should be sent to the workers
+static int batchFull(classifyBatch_t *batch)
+{
+    return batch->n == batch->cap || batch->dataLen >= AM_CLASSIFY_BATCH_BASES;
+}
+
+// classifyBatch is run by the workerpool, it classifies a batch and writes the results in one block
+static void classifyBatch(void *arg)
+{
+    classifyBatch_t *batch = (classifyBatch_t *)arg;
+    classifyJob_t *job = batch->job;
+    uint64_t sketchTime = 0, checkTime = 0, matched = 0, skipped = 0;
+    char *results = NULL;
+    size_t resultsLen = 0;
+    int i;
+
+    uint64_t *sketch = malloc(job->wargs.sketch_size * sizeof(uint64_t));
+    refdbHit_t *hits = malloc(job->topN * sizeof(refdbHit_t));
+    FILE *buf = open_memstream(&results, &resultsLen);
+    if (sketch == NULL || hits == NULL || buf == NULL)
+    {
+        slog(0, SLOG_ERROR, "could not allocate the classify buffers");
+        exit(1);
+    }
+    for (i = 0; i < batch->n; i++)
+    {
+        const char *name = batch->data + batch->offsets[i];
+        const char *read = name + strlen(name) + 1;
+        int nHits = job->topN, j;
+        estimate_t est;
+        int match = classifyRead(&job->wargs, read, batch->lengths[i], sketch, hits, &nHits, &est, &sketchTime, &checkTime);
+        if (match < 0)
+        {
+            // too short to sketch, or the reference counters could not be allocated
+            skipped++;
+            fprintf(buf, "%s\t%s\t%d\tNA\tNA\tNA\tNA\t0\tNA\n", batch->input, name, batch->lengths[i]);
+            continue;
+        }
+        matched += match;
+        fprintf(buf, "%s\t%s\t%d\t%.4f\t%.4f\t%.4f\t%.4f\t%d\t", batch->input, name, batch->lengths[i], est.containment, est.lower, est.upper, est.distance, match);
+
+        // the best reference, or the top N with their containments
+        if (nHits == 0)
+            fputs("NA", buf);
+        for (j = 0; j < nHits; j++)
+        {
+            const char *refName = refdbName(job->wargs.refDB, &job->wargs.refDB->toc[hits[j].ref]);
+            if (job->topN == 1)
+                fputs(refName, buf);
+            else
+                fprintf(buf, "%s%s=%.4f", j ? "," : "", refName, hits[j].containment);
+        }
+        fputc('\n', buf);
+    }
+    fclose(buf);
+    free(sketch);
+    free(hits);
+
+    pthread_mutex_lock(&job->outLock);
+    fwrite(results, 1, resultsLen, job->out);
+    if (job->flushResults)
+        fflush(job->out);
+    pthread_mutex_unlock(&job->outLock);
+    free(results);
+
+    pthread_mutex_lock(&job->lock);
+    job->reads += batch->n;
+    job->matched += matched;
+    job->skipped += skipped;
+    job->inFlight--;
+    pthread_cond_signal(&job->cond);
+    pthread_mutex_unlock(&job->lock);
+    destroyBatch(batch);
+}
+
+// sendBatch queues a batch, waiting if too many are already queued
+static int sendBatch(classifyJob_t *job, tpool_t *wp, classifyBatch_t *batch)
+{
+    pthread_mutex_lock(&job->lock);
+    while (job->inFlight >= job->maxInFlight)
+        pthread_cond_wait(&job->cond, &job->lock);
+    job->inFlight++;
+    pthread_mutex_unlock(&job->lock);
+    if (!tpool_add_work(wp, classifyBatch, batch))
+    {
+        pthread_mutex_lock(&job->lock);
+        job->inFlight--;
+        pthread_mutex_unlock(&job->lock);
+        return 1;
+    }
+    return 0;
+}
+
+// flushBatch sends the reader's current batch to the workers, if it has any reads
+static int flushBatch(void *ctx)
+{
+    classifyReader_t *reader = (classifyReader_t *)ctx;
+    classifyBatch_t *batch = reader->batch;
+    if (batch == NULL)
+        return 0;
+    reader->batch = NULL;
+    if (batch->n == 0)
+    {
+        destroyBatch(batch);
+        return 0;
+    }
+    if (sendBatch(reader->job, reader->wp, batch) != 0)
+    {
+        slog(0, SLOG_ERROR, "could not queue reads from input: %s", reader->input);
+        destroyBatch(batch);
+        return 1;
+    }
+    return 0;
+}
+
+// queueRead adds a read to the reader's batch and sends the batch on once it is full (or has waited too long)
+static int queueRead(void *ctx, const char *name, size_t nameLen, const char *seq, size_t seqLen)
+{
+    classifyReader_t *reader = (classifyReader_t *)ctx;
+    if (reader->batch == NULL)
+    {
+        if ((reader->batch = newBatch(reader->job, reader->input)) == NULL)
+        {
+            slog(0, SLOG_ERROR, "could not allocate a batch of reads");
+            return 1;
+        }
+        reader->batchStart = metricsNow();
+    }
+    if (addRead(reader->batch, name, nameLen, seq, seqLen) != 0)
+    {
+        slog(0, SLOG_ERROR, "could not add a read to the batch");
+        return 1;
+    }
+    if (batchFull(reader->batch) || (reader->maxWait && metricsNow() - reader->batchStart >= reader->maxWait))
+        return flushBatch(reader);
+    return 0;
+}
+
+// classifyInput reads an input (- for stdin) and sends its reads to the workers in batches
+static int classifyInput(classifyJob_t *job, tpool_t *wp, const char *input)
+{
+    gzFile fp = (strcmp(input, "-") == 0) ? gzdopen(STDIN_FILENO, "r") : gzopen(input, "r");
+    if (fp == NULL)
+    {
+        slog(0, SLOG_ERROR, "could not open input: %s", input);
+        return 1;
+    }
+    gzbuffer(fp, 128 * 1024);
+    kseq_t *seq = kseq_init(fp);
+    classifyReader_t reader = {.job = job, .wp = wp, .input = input};
+    int l, err = 0;
+    while ((l = kseq_read(seq)) >= 0)
+    {
+        if ((err = queueRead(&reader, seq->name.s, seq->name.l, seq->seq.s, seq->seq.l)) != 0)
+            break;
+    }
+    if (!err && l != -1)
+    {
+        slog(0, SLOG_ERROR, "EOF error for FASTQ file: %s (%d)", input, l);
+        err = 1;
+    }
+
+    // send the last partial batch
+    err |= flushBatch(&reader);
+    kseq_destroy(seq);
+    gzclose(fp);
+    return err;
+}
+
+// classifyStream classifies reads from stdin or a named pipe as they arrive, until the stream ends or is interrupted
+static int classifyStream(classifyJob_t *job, tpool_t *wp, const char *input, int flushMs)
+{
+    classifyReader_t reader = {.job = job, .wp = wp, .input = input, .maxWait = (uint64_t)flushMs * 1000000ULL};
+    streamHandler_t handler = {.ctx = &reader, .onRead = queueRead, .onIdle = flushBatch};
+    int err = streamFastq(input, flushMs, &handler);
+    err |= flushBatch(&reader);
+    return err;
+}
+
+// stopStream is the signal handler used while streaming
+static void stopStream(int signum)
+{
+    streamStop();
+}
+
+/*
+    classifyMain is the entry point for `antman classify`
+    - loads the reference database (or a bloom filter) with the same settings as the daemon
+    - parses the inputs on this thread and classifies batches of reads on the workerpool
+    - each read gets a line in the results file: input, read name, length, containment with its 95% confidence interval, Mash distance, match, best references (NA with a bloom filter)
+*/
+int classifyMain(int argc, char *argv[])
+{
+    static ko_longopt_t longopts[] = {
+        {"ref", ko_required_argument, 401},
+        {"threads", ko_required_argument, 402},
+        {"output", ko_required_argument, 403},
+        {"threshold", ko_required_argument, 404},
+        {"stream", ko_required_argument, 405},
+        {"flush", ko_required_argument, 406},
+        {"top", ko_required_argument, 407},
+        {"exact", ko_no_argument, 408},
+        {"sprt", ko_required_argument, 409},
+        {"config", ko_required_argument, 410},
+        {"instance", ko_required_argument, 411},
+        {0, 0, 0}};
+    char *ref = NULL, *output = AM_CLASSIFY_DEFAULT_OUTPUT, *stream = NULL, *configArg = NULL, *instance = NULL;
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN), flushMs = AM_STREAM_DEFAULT_FLUSH_MS, topN = 1, refFlags = 0;
+    double threshold = -1.0, sprtConfidence = -1.0;
+
+    ketopt_t opt = KETOPT_INIT;
+    int c;
+    while ((c = ketopt(&opt, argc, argv, 1, "h", longopts)) >= 0)
+    {
+        if (c == 'h')
+        {
+            printClassifyUsage();
+            return 0;
+        }
+        else if (c == 401)
+            ref = opt.arg;
+        else if (c == 402)
+            threads = atoi(opt.arg);
+        else if (c == 403)
+            output = opt.arg;
+        else if (c == 404)
+            threshold = atof(opt.arg);
+        else if (c == 405)
+            stream = opt.arg;
+        else if (c == 406)
+            flushMs = atoi(opt.arg);
+        else if (c == 407)
+            topN = atoi(opt.arg);
+        else if (c == 408)
+            refFlags |= AM_REFDB_KMERS;
+        else if (c == 409)
+            sprtConfidence = atof(opt.arg);
+        else if (c == 410)
+            configArg = opt.arg;
+        else if (c == 411)
+            instance = opt.arg;
+        else
+        {
+            fprintf(stderr, "unknown flag or missing argument\n\n");
+            printClassifyUsage();
+            return 1;
+        }
+    }
+    if (ref == NULL)
+    {
+        fprintf(stderr, "no reference given\n\n");
+        printClassifyUsage();
+        return 1;
+    }
+    if (stream != NULL && opt.ind != argc)
+    {
+        fprintf(stderr, "can't classify files and a stream together\n\n");
+        printClassifyUsage();
+        return 1;
+    }
+    if (threads < 1)
+        threads = 1;
+    if (flushMs < 1)
+        flushMs = 1;
+    if (topN < 1)
+        topN = 1;
+
+    // use the daemon's sketch and bloom filter settings if there is a config
+    config_t *amConfig = initConfig();
+    if (amConfig == NULL)
+    {
+        fprintf(stderr, "\nerror: failed to allocate a config (out of memory)\n\n");
+        return 1;
+    }
+    char configFile[PATH_MAX];
+    if (configLocation(configFile, sizeof(configFile), configArg, instance) != 0)
+    {
+        destroyConfig(amConfig);
+        fprintf(stderr, "bad config file path or instance name\n\n");
+        return 1;
+    }
+    if ((configArg != NULL || instance != NULL) && access(configFile, R_OK) != 0)
+    {
+        destroyConfig(amConfig);
+        fprintf(stderr, "can't read the config file: %s\n\n", configFile);
+        return 1;
+    }
+    if (access(configFile, R_OK) == 0 && loadConfig(amConfig, configFile) != 0)
+    {
+        destroyConfig(amConfig);
+        fprintf(stderr, "\nerror: failed to load config file\n\n");
+        return 1;
+    }
+
+    slog_init("antman-classify", "log/slog.cfg", 4, 1);
+    slog(0, SLOG_INFO, "loading reference...");
+    struct bloom refBF;
+    int useBloom = 0;
+    refdb_t *refDB = refdbLoad(ref, amConfig->k_size, amConfig->refdb_scaled, refFlags, threads);
+    if (refDB == NULL)
+    {
+        slog(0, SLOG_LIVE, "\t- no reference database, loading into a bloom filter");
+        if (bloom_init(&refBF, amConfig->bloom_max_elements, amConfig->bloom_fp_rate) != 0)
+        {
+            slog(0, SLOG_ERROR, "could not init bloom filter");
+            destroyConfig(amConfig);
+            return 1;
+        }
+        if (processRef(ref, &refBF, amConfig->k_size, threads) != 0)
+        {
+            slog(0, SLOG_ERROR, "could not load the reference");
+            bloom_free(&refBF);
+            destroyConfig(amConfig);
+            return 1;
+        }
+        useBloom = 1;
+    }
+
+    classifyJob_t job;
+    memset(&job, 0, sizeof(job));
+    job.wargs.bloomFilter = useBloom ? &refBF : NULL;
+    job.wargs.refDB = refDB;
+    job.wargs.k_size = amConfig->k_size;
+    job.wargs.sketch_size = amConfig->sketch_size;
+    job.wargs.fp_rate = amConfig->bloom_fp_rate;
+    job.wargs.match_threshold = (threshold >= 0.0) ? threshold : amConfig->match_threshold;
+    job.wargs.sprt_confidence = (sprtConfidence >= 0.0) ? sprtConfidence : amConfig->sprt_confidence;
+    job.maxInFlight = threads * AM_CLASSIFY_BATCHES_PER_THREAD;
+    job.batchReads = amConfig->batch_reads;
+    job.flushResults = (stream != NULL);
+    job.topN = topN;
+    pthread_mutex_init(&job.outLock, NULL);
+    pthread_mutex_init(&job.lock, NULL);
+    pthread_cond_init(&job.cond, NULL);
+    destroyConfig(amConfig);
+    estimator_t *estimator = referenceEstimator(&job.wargs);
+    if (estimator == NULL)
+    {
+        slog(0, SLOG_ERROR, "could not allocate the containment estimator");
+        if (useBloom)
+            bloom_free(&refBF);
+        refdbClose(refDB);
+        return 1;
+    }
+    job.wargs.estimator = estimator;
+    int sequential = useBloom && estimator->acceptHits != NULL;
+
+    if ((job.out = fopen(output, "w")) == NULL)
+    {
+        slog(0, SLOG_ERROR, "could not open the results file: %s", output);
+        if (useBloom)
+            bloom_free(&refBF);
+        refdbClose(refDB);
+        estimatorDestroy(estimator);
+        return 1;
+    }
+    fprintf(job.out, "#input\tread\tlength\tcontainment\tlower\tupper\tdistance\tmatch\treference\n");
+
+    slog(0, SLOG_INFO, "classifying reads...");
+    slog(0, SLOG_LIVE, "\t- threads: %d", threads);
+    if (sequential)
+        slog(0, SLOG_LIVE, "\t- stopping checks early at %.3g confidence", estimator->confidence);
+    slog(0, SLOG_LIVE, "\t- results: %s", output);
+
+    // the per-read log lines would swamp the console, so quieten them while classifying
+    SlogConfig slogCfg;
+    slog_config_get(&slogCfg);
+    slogCfg.nSilent = 1;
+    slog_config_set(&slogCfg);
+    uint64_t start = metricsNow();
+    tpool_t *wp = tpool_create(threads);
+    int i, err = 0;
+    if (stream != NULL)
+    {
+        // interrupting the stream still finishes the reads already received
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = stopStream;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGINT, &sa, NULL);
+        sigaction(SIGTERM, &sa, NULL);
+        slog(0, SLOG_INFO, "streaming reads from %s (flush every %dms)...", stream, flushMs);
+        err |= classifyStream(&job, wp, stream, flushMs);
+    }
+    else if (opt.ind == argc)
+        err |= classifyInput(&job, wp, "-");
+    for (i = opt.ind; i < argc; i++)
+        err |= classifyInput(&job, wp, argv[i]);
+    tpool_wait(wp);
+    tpool_destroy(wp);
+    double elapsed = (metricsNow() - start) / 1e9;
+    slogCfg.nSilent = 0;
+    slog_config_set(&slogCfg);
+
+    if (fclose(job.out) != 0)
+    {
+        slog(0, SLOG_ERROR, "could not write the results file: %s", output);
+        err = 1;
+    }
+    if (useBloom)
+        bloom_free(&refBF);
+    refdbClose(refDB);
+    estimatorDestroy(estimator);
+    pthread_mutex_destroy(&job.outLock);
+    pthread_mutex_destroy(&job.lock);
+    pthread_cond_destroy(&job.cond);
+
+    slog(0, SLOG_INFO, "finished");
+    slog(0, SLOG_LIVE, "\t- reads: %llu (%llu shorter than k)", (unsigned long long)job.reads, (unsigned long long)job.skipped);
+    slog(0, SLOG_LIVE, "\t- matched: %llu", (unsigned long long)job.matched);
+    if (sequential)
+        slog(0, SLOG_LIVE, "\t- bloom filter lookups: %lld (%lld saved)", (long long)metricsGet(AM_METRIC_BLOOM_LOOKUPS), (long long)metricsGet(AM_METRIC_LOOKUPS_SAVED));
+    slog(0, SLOG_LIVE, "\t- elapsed: %.2fs (%.0f reads/s)", elapsed, elapsed > 0 ? job.reads / elapsed : 0.0);
+    return err;
+}
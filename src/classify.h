@@ -0,0 +1,14 @@
+// classify runs the read classification over a list of FASTQ files without the daemon
+#ifndef CLASSIFY_H
+#define CLASSIFY_H
+
+#define AM_CLASSIFY_DEFAULT_OUTPUT "./antman-classify.tsv"
+#define AM_CLASSIFY_BATCH_BASES (4 * 1024 * 1024)
+#define AM_CLASSIFY_BATCHES_PER_THREAD 4
+
+/*
+    function prototypes
+*/
+int classifyMain(int argc, char *argv[]);
+
+#endif
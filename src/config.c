@@ -1,28 +1,103 @@
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/file.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include "config.h"
+#include "decide.h"
 #include "frozen.h"
+#include "hashmap.h"
+#include "pidfile.h"
+#include "refdb.h"
 
-// initConfig
+// configType_t is the type of a config field
+typedef enum configType
+{
+    AM_CONFIG_STRING,
+    AM_CONFIG_INT,
+    AM_CONFIG_DOUBLE,
+} configType_t;
+
+// configField_t describes a field of config_t that is saved in the config file
+typedef struct configField
+{
+    const char *key;     // the field's key in the config file
+    configType_t type;
+    size_t offset;       // offsetof the field in config_t
+    double defaultValue; // numbers only, strings default to null
+    double min;          // the valid range for numbers, inclusive
+    double max;
+} configField_t;
+
+#define CONFIG_STRING(field) {#field, AM_CONFIG_STRING, offsetof(config_t, field), 0, 0, 0}
+#define CONFIG_INT(field, def, min, max) {#field, AM_CONFIG_INT, offsetof(config_t, field), def, min, max}
+#define CONFIG_DOUBLE(field, def, min, max) {#field, AM_CONFIG_DOUBLE, offsetof(config_t, field), def, min, max}
+
+/*
+    configSchema lists the fields saved in the config file, in the order they are written
+    - the sketcher can't hold HASHMAP_SIZE hashes, and hashed k-mers need 2k bits plus 8 for k (see sketch.c)
+*/
+static const configField_t configSchema[] = {
+    CONFIG_STRING(filename),
+    CONFIG_STRING(created),
+    CONFIG_STRING(modified),
+    CONFIG_STRING(current_log_file),
+    CONFIG_STRING(watch_directory),
+    CONFIG_STRING(white_list),
+    CONFIG_INT(k_size, AM_DEFAULT_K_SIZE, 1, 28),
+    CONFIG_INT(sketch_size, AM_DEFAULT_SKETCH_SIZE, 1, HASHMAP_SIZE - 1),
+    CONFIG_DOUBLE(bloom_fp_rate, AM_DEFAULT_BLOOM_FP_RATE, 1e-12, 0.5),
+    CONFIG_INT(bloom_max_elements, AM_DEFAULT_BLOOM_MAX_EL, 1, INT_MAX),
+    CONFIG_INT(refdb_scaled, AM_DEFAULT_REFDB_SCALED, 1, 1 << 24),
+    CONFIG_INT(metrics_port, AM_DEFAULT_METRICS_PORT, 0, 65535),
+    CONFIG_DOUBLE(sprt_confidence, AM_DEFAULT_SPRT_CONFIDENCE, 0.0, 0.999999),
+    CONFIG_INT(coverage_width, AM_DEFAULT_COVERAGE_WIDTH, 0, 1 << 30),
+    CONFIG_INT(threads, AM_DEFAULT_THREADS, 1, 1024),
+    CONFIG_INT(queue_depth, AM_DEFAULT_QUEUE_DEPTH, 0, 1 << 20),
+    CONFIG_INT(batch_reads, AM_DEFAULT_BATCH_READS, 1, 1 << 16),
+    CONFIG_DOUBLE(match_threshold, AM_DEFAULT_MATCH_THRESHOLD, 0.001, 1.0),
+    CONFIG_INT(write_sketches, AM_DEFAULT_WRITE_SKETCHES, 0, 1),
+    CONFIG_INT(log_silent, AM_DEFAULT_LOG_SILENT, 0, 1),
+    CONFIG_INT(log_level, AM_DEFAULT_LOG_LEVEL, 0, 3),
+    CONFIG_INT(decide_clients, AM_DEFAULT_DECIDE_CLIENTS, 0, 256),
+    CONFIG_INT(decide_deadline_us, AM_DEFAULT_DECIDE_DEADLINE_US, 100, 10000000),
+    CONFIG_INT(decide_max_bases, AM_DEFAULT_DECIDE_MAX_BASES, 1, 1 << 20),
+};
+#define CONFIG_FIELDS (int)(sizeof(configSchema) / sizeof(configSchema[0]))
+
+// fieldString, fieldInt and fieldDouble get a pointer to a field in a config
+#define fieldString(config, field) ((char **)((char *)(config) + (field)->offset))
+#define fieldInt(config, field) ((int *)((char *)(config) + (field)->offset))
+#define fieldDouble(config, field) ((double *)((char *)(config) + (field)->offset))
+
+// initConfig makes a config with the default values from the schema
 config_t *initConfig()
 {
     config_t *c;
     if ((c = malloc(sizeof *c)) != NULL)
     {
-        c->filename = NULL;
-        c->created = NULL;
-        c->modified = NULL;
-        c->current_log_file = NULL;
-        c->watch_directory = NULL;
-        c->white_list = NULL;
-        c->pid = -1;
-        c->k_size = AM_DEFAULT_K_SIZE;
-        c->sketch_size = AM_DEFAULT_SKETCH_SIZE;
-        c->bloom_fp_rate = AM_DEFAULT_BLOOM_FP_RATE;
-        c->bloom_max_elements = AM_DEFAULT_BLOOM_MAX_EL;
+        int i;
+        for (i = 0; i < CONFIG_FIELDS; i++)
+        {
+            const configField_t *field = &configSchema[i];
+            if (field->type == AM_CONFIG_STRING)
+                *fieldString(c, field) = NULL;
+            else if (field->type == AM_CONFIG_INT)
+                *fieldInt(c, field) = (int)field->defaultValue;
+            else
+                *fieldDouble(c, field) = field->defaultValue;
+        }
         c->bloom_filter = NULL;
+        c->dirty = 0;
+        c->lockFD = -1;
     }
     return c;
 }
@@ -30,17 +105,193 @@ config_t *initConfig()
 // destroyConfig
 void destroyConfig(config_t *config)
 {
-    free(config->filename);
-    free(config->created);
-    free(config->modified);
-    free(config->current_log_file);
-    free(config->watch_directory);
-    free(config->white_list);
+    unlockConfig(config);
+    int i;
+    for (i = 0; i < CONFIG_FIELDS; i++)
+        if (configSchema[i].type == AM_CONFIG_STRING)
+            free(*fieldString(config, &configSchema[i]));
     free(config);
     config = NULL;
 }
 
-// writeConfig
+/*
+    validateConfig checks every number in the config is in its valid range
+    - the problems are printed to stderr
+    - returns 0 if the config is valid
+*/
+int validateConfig(const config_t *config)
+{
+    int i, err = 0;
+    for (i = 0; i < CONFIG_FIELDS; i++)
+    {
+        const configField_t *field = &configSchema[i];
+        if (field->type == AM_CONFIG_STRING)
+            continue;
+        double value = (field->type == AM_CONFIG_INT) ? *fieldInt(config, field) : *fieldDouble(config, field);
+        if (!(value >= field->min && value <= field->max))
+        {
+            fprintf(stderr, "config error: %s must be between %.15g and %.15g (got %.15g)\n", field->key, field->min, field->max, value);
+            err = 1;
+        }
+    }
+
+    // the sequential test needs to be more sure than a coin toss
+    if (config->sprt_confidence > 0.0 && config->sprt_confidence < 0.5)
+    {
+        fprintf(stderr, "config error: sprt_confidence must be 0 (off) or at least 0.5 (got %.15g)\n", config->sprt_confidence);
+        err = 1;
+    }
+    return err;
+}
+
+// reservedInstances are the extensions of the default config's lock, PID and socket files, an instance with one of these names would be one of them
+static const char *reservedInstances[] = {AM_CONFIG_LOCK_EXT + 1, AM_PIDFILE_EXT + 1, AM_DECIDE_EXT + 1};
+
+// validInstance checks an instance name has only letters, numbers, '-' and '_', is up to AM_INSTANCE_MAX long and isn't reserved
+static int validInstance(const char *instance)
+{
+    size_t i, len = strlen(instance);
+    if (len == 0 || len > AM_INSTANCE_MAX)
+        return 0;
+    for (i = 0; i < len; i++)
+        if (!isalnum((unsigned char)instance[i]) && instance[i] != '-' && instance[i] != '_')
+            return 0;
+    for (i = 0; i < sizeof(reservedInstances) / sizeof(reservedInstances[0]); i++)
+        if (strcmp(instance, reservedInstances[i]) == 0)
+            return 0;
+    return 1;
+}
+
+/*
+    configLocation gets the path of the config file to use
+    - configFile is used if it is given (e.g. from --config), otherwise the compiled in CONFIG_LOCATION
+    - a named instance gets its own config, CONFIG_LOCATION.<instance>, and so its own lock and PID files
+    - instance names can have letters, numbers, '-' and '_', up to AM_INSTANCE_MAX long, but can't be the name of a sidecar file (lock, pid or sock)
+    - returns 0 on success, or 1 if the instance name isn't allowed or the path doesn't fit
+*/
+int configLocation(char *path, size_t size, const char *configFile, const char *instance)
+{
+    if (configFile != NULL)
+        return snprintf(path, size, "%s", configFile) >= (int)size || configFile[0] == '\0';
+    if (instance == NULL)
+        return snprintf(path, size, "%s", CONFIG_LOCATION) >= (int)size;
+    if (!validInstance(instance))
+        return 1;
+    return snprintf(path, size, "%s.%s", CONFIG_LOCATION, instance) >= (int)size;
+}
+
+/*
+    instancePort picks the metrics port for a new named instance, so that instances on their default configs don't clash
+    - location is the default config, the instances' configs are location.<instance> (see configLocation)
+    - it is the first port after AM_DEFAULT_METRICS_PORT that isn't used by the default config or another instance's config
+    - returns 0 (metrics off) if the next AM_INSTANCE_PORTS ports are all used
+*/
+int instancePort(const char *location)
+{
+    char taken[AM_INSTANCE_PORTS + 1] = {0}, pattern[PATH_MAX];
+    glob_t configs;
+    size_t i, prefix = strlen(location) + 1;
+    if (snprintf(pattern, sizeof(pattern), "%s.*", location) >= (int)sizeof(pattern))
+        return 0;
+    if (glob(pattern, GLOB_NOSORT, NULL, &configs) != 0)
+        configs.gl_pathc = 0;
+
+    // the default config is checked along with the instances, the lock, PID and socket files have a '.' in their instance name so are skipped
+    for (i = 0; i <= configs.gl_pathc; i++)
+    {
+        char *path = (i < configs.gl_pathc) ? configs.gl_pathv[i] : (char *)location;
+        if (i < configs.gl_pathc && !validInstance(path + prefix))
+            continue;
+        config_t *config = initConfig();
+        if (config == NULL)
+            break;
+        if (access(path, R_OK) == 0 && loadConfig(config, path) == 0)
+        {
+            int offset = config->metrics_port - AM_DEFAULT_METRICS_PORT;
+            if (offset > 0 && offset <= AM_INSTANCE_PORTS)
+                taken[offset] = 1;
+        }
+        destroyConfig(config);
+    }
+    if (configs.gl_pathc > 0)
+        globfree(&configs);
+    int offset;
+    for (offset = 1; offset <= AM_INSTANCE_PORTS && AM_DEFAULT_METRICS_PORT + offset <= 65535; offset++)
+        if (!taken[offset])
+            return AM_DEFAULT_METRICS_PORT + offset;
+    return 0;
+}
+
+// configPath makes the name of a file next to the config, returns 0 on success
+static int configPath(char *path, size_t size, const char *configFile, const char *suffix)
+{
+    return snprintf(path, size, "%s%s", configFile, suffix) >= (int)size;
+}
+
+// syncDir flushes the directory holding a file, so a rename into it survives a crash
+static void syncDir(const char *file)
+{
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", file);
+    char *slash = strrchr(dir, '/');
+    if (slash == NULL)
+        snprintf(dir, sizeof(dir), ".");
+    else if (slash == dir)
+        dir[1] = '\0';
+    else
+        *slash = '\0';
+    int fd = open(dir, O_RDONLY);
+    if (fd >= 0)
+    {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+/*
+    lockConfig takes an exclusive advisory lock on a config file, waiting for any other antman process to release it
+    - the lock is on a separate file (see AM_CONFIG_LOCK_EXT) as writes rename a new config over the old one
+    - hold it from loading the config until the last write, so that concurrent CLI calls don't lose each other's changes
+    - returns 0 on success
+*/
+int lockConfig(config_t *config, const char *configFile)
+{
+    char lockPath[PATH_MAX];
+    if (config->lockFD >= 0)
+        return 0;
+    if (configPath(lockPath, sizeof(lockPath), configFile, AM_CONFIG_LOCK_EXT) != 0)
+        return 1;
+    int fd = open(lockPath, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+    if (fd < 0)
+        return 1;
+    while (flock(fd, LOCK_EX) != 0)
+    {
+        if (errno != EINTR)
+        {
+            close(fd);
+            return 1;
+        }
+    }
+    config->lockFD = fd;
+    return 0;
+}
+
+// unlockConfig releases the lock taken by lockConfig
+void unlockConfig(config_t *config)
+{
+    if (config->lockFD < 0)
+        return;
+    flock(config->lockFD, LOCK_UN);
+    close(config->lockFD);
+    config->lockFD = -1;
+}
+
+/*
+    writeConfig writes the config to a file
+    - the JSON is written once to a temporary file, synced and renamed over the config, so readers never see a partial config
+    - the config is locked while it is written, unless the caller already holds the lock
+    - returns 0 on success
+*/
 int writeConfig(config_t *config, char *configFile)
 {
 
@@ -51,78 +302,202 @@ int writeConfig(config_t *config, char *configFile)
     // if this is a new filepath, update with config with the filepath we are writing to
     if (config->filename != configFile)
     {
+        char *filename = strdup(configFile);
         free(config->filename);
-        config->filename = strdup(configFile);
+        config->filename = filename;
     }
 
     // update the created (if new) and the modified date
     SlogDate date;
     slog_get_date(&date);
-    char *timeStamp = malloc(18 * sizeof(char));
-    int ret = sprintf(timeStamp, "%d-%d-%d:%d-%d", date.year, date.mon, date.day, date.hour, date.min);
-    if (ret > 18)
+    char timeStamp[32];
+    snprintf(timeStamp, sizeof(timeStamp), "%d-%d-%d:%d-%d", date.year, date.mon, date.day, date.hour, date.min);
+    if (config->created == NULL)
+    {
+        config->created = strdup(timeStamp);
+    }
+    free(config->modified);
+    config->modified = strdup(timeStamp);
+
+    char tmpPath[PATH_MAX];
+    char tmpSuffix[32];
+    snprintf(tmpSuffix, sizeof(tmpSuffix), ".tmp.%d", (int)getpid());
+    if (configPath(tmpPath, sizeof(tmpPath), configFile, tmpSuffix) != 0)
     {
-        fprintf(stderr, "failed to format time stamp\n");
+        fprintf(stderr, "config file path is too long: %s\n", configFile);
         return 1;
     }
-    if (config->created == NULL)
+    int locked = config->lockFD >= 0;
+    if (!locked && lockConfig(config, configFile) != 0)
     {
-        config->created = strdup(timeStamp);
+        fprintf(stderr, "could not lock the config file: %s (%s)\n", configFile, strerror(errno));
+        return 1;
     }
-    config->modified = timeStamp;
 
     // write it to file
-    ret = json_fprintf(configFile, "{ filename: %Q, created: %Q, modified: %Q, current_log_file: %Q, watch_directory: %Q, white_list: %Q, pid: %d, k_size: %d, sketch_size: %d, bloom_fp_rate: %f, bloom_max_elements: %d }",
-                       config->filename,
-                       config->created,
-                       config->modified,
-                       config->current_log_file,
-                       config->watch_directory,
-                       config->white_list,
-                       config->pid,
-                       config->k_size,
-                       config->sketch_size,
-                       config->bloom_fp_rate,
-                       config->bloom_max_elements);
-    if (ret < 0)
-    {
-        fprintf(stderr, "failed to write config to disk (%d)\n", ret);
+    int err = 1;
+    FILE *fp = fopen(tmpPath, "w");
+    if (fp != NULL)
+    {
+        struct json_out out = JSON_OUT_FILE(fp);
+        int i, ret = json_printf(&out, "{");
+        for (i = 0; i < CONFIG_FIELDS && ret >= 0; i++)
+        {
+            const configField_t *field = &configSchema[i];
+            ret = json_printf(&out, "%s\n  %Q: ", (i == 0) ? "" : ",", field->key);
+            if (ret < 0)
+                break;
+            if (field->type == AM_CONFIG_STRING)
+                ret = json_printf(&out, "%Q", *fieldString(config, field));
+            else if (field->type == AM_CONFIG_INT)
+                ret = json_printf(&out, "%d", *fieldInt(config, field));
+            else
+                ret = json_printf(&out, "%.15g", *fieldDouble(config, field));
+        }
+        if (ret >= 0)
+            ret = json_printf(&out, "\n}\n");
+        err = ret < 0 || fflush(fp) != 0 || fsync(fileno(fp)) != 0;
+        err |= fclose(fp) != 0;
+        if (!err)
+            err = rename(tmpPath, configFile) != 0;
+        if (err)
+            unlink(tmpPath);
+        else
+            syncDir(configFile);
+    }
+    if (!locked)
+        unlockConfig(config);
+    if (err)
+    {
+        fprintf(stderr, "failed to write config to disk: %s\n", strerror(errno));
         return 1;
     }
-
-    // prettify the json
-    json_prettify_file(configFile);
+    config->dirty = 0;
     return 0;
 }
 
-// loadConfig
+// saveConfig writes the config back to the file it came from, if it has changed (returns 0 on success)
+int saveConfig(config_t *config)
+{
+    if (!config->dirty)
+        return 0;
+    return writeConfig(config, config->filename);
+}
+
+// loadState is passed through json_walk by loadConfig
+typedef struct loadState
+{
+    config_t *config;
+    int err;
+} loadState_t;
+
+// loadField is the json_walk callback that sets a config field from its token, checking the token's type
+static void loadField(void *data, const char *name, size_t nameLen, const char *path, const struct json_token *token)
+{
+    loadState_t *state = (loadState_t *)data;
+    const configField_t *field = NULL;
+    int i;
+
+    // only the top level keys are fields, anything else (e.g. keys from older versions) is ignored
+    if (name == NULL || path[0] != '.' || strlen(path) != nameLen + 1)
+        return;
+    for (i = 0; i < CONFIG_FIELDS && field == NULL; i++)
+        if (strlen(configSchema[i].key) == nameLen && strncmp(configSchema[i].key, name, nameLen) == 0)
+            field = &configSchema[i];
+    if (field == NULL)
+        return;
+
+    // strings can be null, numbers can be given as true or false
+    if (field->type == AM_CONFIG_STRING)
+    {
+        char **value = fieldString(state->config, field);
+        if (token->type == JSON_TYPE_NULL)
+        {
+            free(*value);
+            *value = NULL;
+            return;
+        }
+        int len = (token->type == JSON_TYPE_STRING) ? json_unescape(token->ptr, token->len, NULL, 0) : -1;
+        char *str = (len >= 0) ? malloc(len + 1) : NULL;
+        if (str == NULL || json_unescape(token->ptr, token->len, str, len) != len)
+        {
+            free(str);
+            fprintf(stderr, "config error: %s must be a string or null\n", field->key);
+            state->err = 1;
+            return;
+        }
+        str[len] = '\0';
+        free(*value);
+        *value = str;
+        return;
+    }
+    double number;
+    if (token->type == JSON_TYPE_TRUE || token->type == JSON_TYPE_FALSE)
+        number = (token->type == JSON_TYPE_TRUE);
+    else if (token->type == JSON_TYPE_NUMBER && token->len < 64)
+    {
+        char buf[64];
+        memcpy(buf, token->ptr, token->len);
+        buf[token->len] = '\0';
+        number = strtod(buf, NULL);
+    }
+    else
+    {
+        fprintf(stderr, "config error: %s must be a number\n", field->key);
+        state->err = 1;
+        return;
+    }
+    if (field->type == AM_CONFIG_INT)
+    {
+        if (number != (int)number)
+        {
+            fprintf(stderr, "config error: %s must be a whole number (got %.15g)\n", field->key, number);
+            state->err = 1;
+            return;
+        }
+        *fieldInt(state->config, field) = (int)number;
+    }
+    else
+        *fieldDouble(state->config, field) = number;
+}
+
+/*
+    loadConfig reads a config file into a config
+    - fields missing from the file keep their current values (the defaults for a new config)
+    - the config is validated once it is read
+    - its filename is set to configFile, whatever the file says, so a copied config is saved to the copy
+    - returns 0 on success
+*/
 int loadConfig(config_t *config, char *configFile)
 {
 
     // read the file into a buffer
     char *content = json_fread(configFile);
+    if (content == NULL)
+        return 1;
 
-    // scan the file content and populate the tmp config
-    int status = json_scanf(content, strlen(content), "{ filename: %Q, created: %Q, modified: %Q, current_log_file: %Q, watch_directory: %Q, white_list: %Q, pid: %d, k_size: %d, sketch_size: %d, bloom_fp_rate: %f, bloom_max_elements: %d }",
-                            &config->filename,
-                            &config->created,
-                            &config->modified,
-                            &config->current_log_file,
-                            &config->watch_directory,
-                            &config->white_list,
-                            &config->pid,
-                            &config->k_size,
-                            &config->sketch_size,
-                            &config->bloom_fp_rate,
-                            &config->bloom_max_elements);
+    // walk the file content once and populate the config from it
+    loadState_t state = {config, 0};
+    int status = json_walk(content, strlen(content), loadField, &state);
 
     // free the buffer
     free(content);
 
-    // check for error in json scan (-1 == error, 0 == no elements found, >0 == elements parsed)
-    if (status < 1)
+    // check for error in the json walk (negative == error)
+    if (status < 0)
     {
+        fprintf(stderr, "config error: %s is not valid JSON\n", configFile);
+        return 1;
+    }
+    if (state.err || validateConfig(config) != 0)
         return 1;
+    if (config->filename == NULL || strcmp(config->filename, configFile) != 0)
+    {
+        char *filename = strdup(configFile);
+        if (filename == NULL)
+            return 1;
+        free(config->filename);
+        config->filename = filename;
     }
     return 0;
 }
@@ -1,6 +1,8 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#include <stddef.h>
+
 #include "bloom.h"
 #include "slog.h"
 
@@ -8,9 +10,27 @@
 #define AM_DEFAULT_SKETCH_SIZE 128
 #define AM_DEFAULT_BLOOM_FP_RATE 0.001
 #define AM_DEFAULT_BLOOM_MAX_EL 100000
+#define AM_DEFAULT_METRICS_PORT 9099
+#define AM_DEFAULT_MATCH_THRESHOLD 0.5
+#define AM_DEFAULT_SPRT_CONFIDENCE 0.0 // every sketch hash is checked unless a confidence is set
+#define AM_CONFIG_LOCK_EXT ".lock" // the config is locked with an flock on this file next to it, as writes replace the config file
+#define AM_DEFAULT_COVERAGE_WIDTH 1048576 // counters in each row of the coverage count-min sketch (0 turns coverage off)
+#define AM_DEFAULT_THREADS 4 // threads in the daemon's workerpool
+#define AM_DEFAULT_QUEUE_DEPTH 0 // files waiting for the daemon's workerpool before the watcher waits (0 is unbounded)
+#define AM_DEFAULT_BATCH_READS 256 // reads per batch handed to a worker by `antman classify`
+#define AM_DEFAULT_WRITE_SKETCHES 1 // write the file and run sketches (see runsketch.h)
+#define AM_DEFAULT_LOG_SILENT 0 // drop the detail (LIVE and DEBUG) log lines
+#define AM_DEFAULT_LOG_LEVEL 0 // 0 logs everything, 1 drops the detail lines, 2 keeps warnings and errors, 3 only errors
+#define AM_DEFAULT_DECIDE_CLIENTS 8 // connections the decision service serves at once (0 turns it off, see decide.h)
+#define AM_DEFAULT_DECIDE_DEADLINE_US 5000 // decision latency budget, responses over it are flagged late
+#define AM_DEFAULT_DECIDE_MAX_BASES 4096 // bases classified per decision request, longer chunks are truncated
+#define AM_INSTANCE_MAX 64 // longest instance name (see configLocation)
+#define AM_INSTANCE_PORTS 100 // ports after AM_DEFAULT_METRICS_PORT given to new instances (see instancePort)
 
 /*
     config_t is used to record the minimum information required by antman
+    - the fields that are saved are described by the schema in config.c, which gives each one's type, default and valid range
+    - it is loaded and validated once at startup, and the daemon's threads only read it
 */
 typedef struct config
 {
@@ -20,12 +40,27 @@ typedef struct config
     char *current_log_file;
     char *watch_directory;
     char *white_list;
-    int pid;
     int k_size;
     int sketch_size;
     double bloom_fp_rate;
     int bloom_max_elements;
+    int refdb_scaled;
+    int metrics_port;
+    double sprt_confidence;
+    int coverage_width;
+    int threads;
+    int queue_depth;
+    int batch_reads;
+    double match_threshold;
+    int write_sketches;
+    int log_silent;
+    int log_level;
+    int decide_clients;
+    int decide_deadline_us;
+    int decide_max_bases;
     struct bloom *bloom_filter;
+    int dirty;  // changed since it was loaded or written
+    int lockFD; // held by lockConfig (-1 if not locked)
 } config_t;
 
 /*
@@ -34,7 +69,13 @@ typedef struct config
 config_t *initConfig();
 void destroyConfig(config_t *config);
 int writeConfig(config_t *config, char *configFile);
+int saveConfig(config_t *config);
 int loadConfig(config_t *config, char *configFile);
+int validateConfig(const config_t *config);
+int configLocation(char *path, size_t size, const char *configFile, const char *instance);
+int instancePort(const char *location);
+int lockConfig(config_t *config, const char *configFile);
+void unlockConfig(config_t *config);
 void slog_get_date(SlogDate *pDate);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,75 @@
+#include <stdlib.h>
+
+#include "countmin.h"
+
+// the rows use a multiply-shift hash each, with these odd multipliers
+static const uint64_t rowSeeds[CM_MAX_DEPTH] = {
+    0x9e3779b97f4a7c15ULL, 0xbf58476d1ce4e5b9ULL, 0x94d049bb133111ebULL, 0xd6e8feb86659fd93ULL,
+    0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL, 0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL};
+
+// slot finds a key's counter in a row
+static inline uint64_t slot(const countMin_t *cm, uint64_t key, int row)
+{
+    uint64_t h = (key ^ (key >> 31)) * rowSeeds[row];
+    return (uint64_t)row * cm->width + ((h >> 32) & (cm->width - 1));
+}
+
+/*
+    countMinInit makes an empty sketch
+    - width is rounded up to a power of two and depth is capped at CM_MAX_DEPTH
+    - returns NULL if it could not be allocated
+*/
+countMin_t *countMinInit(uint32_t width, int depth)
+{
+    countMin_t *cm = calloc(1, sizeof(countMin_t));
+    if (cm == NULL)
+        return NULL;
+    cm->width = 1;
+    while (cm->width < width && cm->width < (1U << 31))
+        cm->width <<= 1;
+    cm->depth = (depth < 1) ? 1 : (depth > CM_MAX_DEPTH) ? CM_MAX_DEPTH : depth;
+    if ((cm->counters = calloc((size_t)cm->width * cm->depth, sizeof(uint32_t))) == NULL)
+    {
+        free(cm);
+        return NULL;
+    }
+    return cm;
+}
+
+// countMinDestroy frees a sketch
+void countMinDestroy(countMin_t *cm)
+{
+    if (cm == NULL)
+        return;
+    free(cm->counters);
+    free(cm);
+}
+
+// countMinAdd counts a batch of keys
+void countMinAdd(countMin_t *cm, const uint64_t *keys, int n)
+{
+    int i, row;
+    if (n <= 0)
+        return;
+    for (i = 0; i < n; i++)
+        for (row = 0; row < cm->depth; row++)
+            __atomic_fetch_add(&cm->counters[slot(cm, keys[i], row)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&cm->total, n, __ATOMIC_RELAXED);
+}
+
+// countMinEstimate returns the count for a key (never less than the number of times it was added)
+uint32_t countMinEstimate(const countMin_t *cm, uint64_t key)
+{
+    uint32_t min = UINT32_MAX, c;
+    int row;
+    for (row = 0; row < cm->depth; row++)
+        if ((c = __atomic_load_n(&cm->counters[slot(cm, key, row)], __ATOMIC_RELAXED)) < min)
+            min = c;
+    return min;
+}
+
+// countMinTotal returns the number of keys added
+uint64_t countMinTotal(const countMin_t *cm)
+{
+    return __atomic_load_n(&cm->total, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,33 @@
+// countmin is a count-min sketch that workers can update concurrently, it counts keys in fixed memory
+#ifndef COUNTMIN_H
+#define COUNTMIN_H
+
+#include <stdint.h>
+
+#define CM_MAX_DEPTH 8
+
+/*
+    countMin_t has depth rows of width counters, a key adds one to a counter in each row
+    - the count for a key is the smallest of its counters, which is never under the true count
+      and is over it by at most e * total / width with probability 1 - e^-depth
+    - updates use relaxed atomics, so the counters can be read while workers are adding to them
+    - keys are added in batches so the total is only updated once a batch
+*/
+typedef struct countMin
+{
+    uint32_t width; // a power of two
+    int depth;
+    uint32_t *counters;
+    uint64_t total; // keys added
+} countMin_t;
+
+/*
+    function prototypes
+*/
+countMin_t *countMinInit(uint32_t width, int depth);
+void countMinDestroy(countMin_t *cm);
+void countMinAdd(countMin_t *cm, const uint64_t *keys, int n);
+uint32_t countMinEstimate(const countMin_t *cm, uint64_t key);
+uint64_t countMinTotal(const countMin_t *cm);
+
+#endif
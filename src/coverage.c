@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "coverage.h"
+#include "sketch.h"
+
+/*
+    coverageInit sets up the coverage counts for a reference database
+    - width is the number of counters in each count-min row (the counts use AM_COVERAGE_DEPTH * width * 4 bytes)
+    - returns NULL if it could not be allocated
+*/
+coverage_t *coverageInit(const refdb_t *db, uint32_t width)
+{
+    coverage_t *cov = calloc(1, sizeof(coverage_t));
+    if (cov == NULL)
+        return NULL;
+    if ((cov->cm = countMinInit(width, AM_COVERAGE_DEPTH)) == NULL)
+    {
+        free(cov);
+        return NULL;
+    }
+    cov->db = db;
+    return cov;
+}
+
+// coverageDestroy frees the coverage counts
+void coverageDestroy(coverage_t *cov)
+{
+    if (cov == NULL)
+        return;
+    countMinDestroy(cov->cm);
+    free(cov);
+}
+
+/*
+    coverageAddRead counts the reference k-mers in a read
+    - each distinct k-mer is counted once per read
+    - returns the number of k-mers counted, or -1 if the read's k-mers could not be allocated
+*/
+int coverageAddRead(coverage_t *cov, const char *read, int len)
+{
+    uint64_t *hashes;
+    int i, n, kept = 0;
+    __atomic_fetch_add(&cov->reads, 1, __ATOMIC_RELAXED);
+    if (len < cov->db->k)
+        return 0;
+    if ((n = scaledSequence(read, len, cov->db->k, cov->db->maxHash, &hashes)) < 0)
+        return -1;
+
+    // only the k-mers in the reference are counted, so the off-target reads don't fill up the counters
+    for (i = 0; i < n; i++)
+        if (refdbHasHash(cov->db, hashes[i]))
+            hashes[kept++] = hashes[i];
+    countMinAdd(cov->cm, hashes, kept);
+    free(hashes);
+    return kept;
+}
+
+// compareDepth orders references by depth, deepest first
+static int compareDepth(const void *a, const void *b)
+{
+    const coverageRef_t *x = (const coverageRef_t *)a, *y = (const coverageRef_t *)b;
+    if (x->depth != y->depth)
+        return (x->depth < y->depth) - (x->depth > y->depth);
+    return x->ref - y->ref;
+}
+
+/*
+    coverageReport estimates the depth and breadth of every reference
+    - refs must hold an entry for each reference in the database, they are sorted deepest first
+    - the counts can still be changing, so this is a snapshot
+    - returns the number of references
+*/
+int coverageReport(const coverage_t *cov, coverageRef_t *refs)
+{
+    int r;
+    uint64_t i;
+    for (r = 0; r < cov->db->nRefs; r++)
+    {
+        const refdbEntry_t *entry = &cov->db->toc[r];
+        const uint64_t *hashes = cov->db->hashes + entry->hashOffset;
+        uint64_t total = 0, seen = 0;
+        for (i = 0; i < entry->nHashes; i++)
+        {
+            uint32_t c = countMinEstimate(cov->cm, hashes[i]);
+            total += c;
+            seen += (c > 0);
+        }
+        refs[r].ref = r;
+        refs[r].depth = entry->nHashes ? (double)total / entry->nHashes : 0.0;
+        refs[r].breadth = entry->nHashes ? (double)seen / entry->nHashes : 0.0;
+    }
+    qsort(refs, cov->db->nRefs, sizeof(coverageRef_t), compareDepth);
+    return cov->db->nRefs;
+}
+
+// coverageRender returns a table of the references that have been seen, deepest first (caller frees), ctx is the coverage_t
+char *coverageRender(void *ctx)
+{
+    const coverage_t *cov = (const coverage_t *)ctx;
+    coverageRef_t *refs = malloc((cov->db->nRefs ? cov->db->nRefs : 1) * sizeof(coverageRef_t));
+    char *text = NULL;
+    size_t textLen = 0;
+    FILE *buf = open_memstream(&text, &textLen);
+    if (refs == NULL || buf == NULL)
+    {
+        free(refs);
+        if (buf != NULL)
+            fclose(buf);
+        free(text);
+        return NULL;
+    }
+    int i, n = coverageReport(cov, refs);
+    fprintf(buf, "# reads: %llu, reference k-mers counted: %llu\n", (unsigned long long)__atomic_load_n(&cov->reads, __ATOMIC_RELAXED), (unsigned long long)countMinTotal(cov->cm));
+    fprintf(buf, "#reference\tdepth\tbreadth\n");
+    for (i = 0; i < n && refs[i].breadth > 0.0; i++)
+        fprintf(buf, "%s\t%.2f\t%.4f\n", refdbName(cov->db, &cov->db->toc[refs[i].ref]), refs[i].depth, refs[i].breadth);
+    fclose(buf);
+    free(refs);
+    return text;
+}
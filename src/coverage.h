@@ -0,0 +1,41 @@
+// coverage estimates how deeply each reference has been sequenced, by counting the reference k-mers seen in the reads
+#ifndef COVERAGE_H
+#define COVERAGE_H
+
+#include <stdint.h>
+
+#include "countmin.h"
+#include "refdb.h"
+
+#define AM_COVERAGE_DEPTH 4 // count-min rows, the width comes from the config (coverage_width)
+
+/*
+    coverage_t counts the read k-mers that are in the reference sketches
+    - reads are sampled with the database's scaled threshold, so a reference's depth is the mean count of its sketch hashes
+    - the counts are in a count-min sketch, so the memory is fixed however many reads there are and workers update it concurrently
+*/
+typedef struct coverage
+{
+    countMin_t *cm;
+    const refdb_t *db;
+    uint64_t reads; // reads added
+} coverage_t;
+
+// coverageRef_t is the coverage estimate for a reference
+typedef struct coverageRef
+{
+    int ref;        // table of contents position
+    double depth;   // mean times each k-mer was seen
+    double breadth; // fraction of the k-mers seen at least once
+} coverageRef_t;
+
+/*
+    function prototypes
+*/
+coverage_t *coverageInit(const refdb_t *db, uint32_t width);
+void coverageDestroy(coverage_t *cov);
+int coverageAddRead(coverage_t *cov, const char *read, int len);
+int coverageReport(const coverage_t *cov, coverageRef_t *refs);
+char *coverageRender(void *ctx);
+
+#endif
@@ -1,3 +1,4 @@
+#include <errno.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -5,33 +6,67 @@
 #include <unistd.h>   // contains fork(3), chdir(3), sysconf(3)
 #include <signal.h>   //contains signal(3)
 #include <sys/stat.h> // contains umask(3)
+#include <sys/wait.h> // contains waitpid(2)
 
 #include "bloom.h"
 #include "daemonize.h"
+#include "decide.h"
+#include "metrics.h"
+#include "pidfile.h"
 #include "sequence.h"
 #include "slog.h"
+#include "trace.h"
 #include "workerpool.h"
 
-// TODO: set these values by the cli
-const int NUM_THREADS = 4;
+/*
+    blockSignals blocks SIGTERM (sent by `antman --stop`) and SIGUSR2 (toggles the profiling timeline) in the calling thread
+    - call it before any threads are created, they inherit the mask, so the signals stay pending until the main loop takes them with waitSignal
+    - set is filled with the blocked signals
+*/
+void blockSignals(sigset_t *set)
+{
+    sigemptyset(set);
+    sigaddset(set, SIGTERM);
+    sigaddset(set, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, set, NULL);
+}
 
-// done controls when to stop the antman threads
-volatile sig_atomic_t done = 0;
+// waitSignal waits for one of the signals blocked by blockSignals and returns it
+int waitSignal(const sigset_t *set)
+{
+    int signum;
+    while ((signum = sigwaitinfo(set, NULL)) < 0 && errno == EINTR)
+        ;
+    return signum;
+}
 
-// sigTermHandler is called in the event of a SIGTERM signal
-void sigTermHandler(int signum)
+// handleSignal acts on a signal taken by waitSignal, returns 1 if the daemon should stop
+int handleSignal(int signum, const char *traceFile)
 {
+    if (signum == SIGUSR2)
+    {
+        toggleTrace(traceFile);
+        return 0;
+    }
     slog(0, SLOG_INFO, "sigterm received, shutting down the antman daemon...");
-    done = 1;
+    return 1;
 }
 
-// catchSigterm is used to exit the daemon when `antman --stop` is called
-void catchSigterm()
+// toggleTrace switches the profiling timeline on or off
+void toggleTrace(const char *traceFile)
 {
-    static struct sigaction action;
-    memset(&action, 0, sizeof(struct sigaction));
-    action.sa_handler = sigTermHandler;
-    sigaction(SIGTERM, &action, NULL);
+    if (traceEnabled)
+    {
+        traceStop();
+        slog(0, SLOG_INFO, "stopped the profiling timeline: %s", traceFile);
+        return;
+    }
+    if (traceStart(traceFile) != 0)
+    {
+        slog(0, SLOG_ERROR, "could not open the profiling timeline: %s", traceFile);
+        return;
+    }
+    slog(0, SLOG_INFO, "recording a profiling timeline: %s", traceFile);
 }
 
 // startWatching is used to start the directory watcher inside a thread
@@ -46,19 +81,63 @@ void *startWatching(void *param)
     return NULL;
 }
 
-// startDaemon converts the current program to a daemon process, launches some threads and starts directory watching
-int startDaemon(config_t *amConfig, watcherArgs_t *wargs)
+/*
+    startDaemon converts the current program to a daemon process, launches some threads and starts directory watching
+    - the daemon holds the lock on pidFile (see pidfile.h) until it exits, so only one daemon can run per config
+*/
+int startDaemon(const config_t *amConfig, watcherArgs_t *wargs, const char *pidFile)
 {
 
+    // take the PID file lock before forking, so there is no gap where the daemon is running but not registered
+    int pidFD = pidFileLock(pidFile);
+    if (pidFD < 0)
+    {
+        if (pidFD == -2)
+            slog(0, SLOG_ERROR, "another antman daemon is already running (PID file: %s)", pidFile);
+        else
+            slog(0, SLOG_ERROR, "could not lock the PID file: %s", pidFile);
+        return 1;
+    }
+
+    // bind the metrics port and decision socket before forking, so that `antman --start` fails while it can still say why
+    int keepFDs[2], nKeep = 0;
+    if (amConfig->metrics_port > 0)
+    {
+        if ((keepFDs[nKeep] = metricsListen(amConfig->metrics_port)) < 0)
+        {
+            slog(0, SLOG_ERROR, "could not listen on metrics port %d: %s", amConfig->metrics_port, strerror(errno));
+            slog(0, SLOG_LIVE, "\t- is another daemon using it? set a different metrics_port (or 0) in %s", amConfig->filename);
+            close(pidFD);
+            return 1;
+        }
+        nKeep++;
+    }
+
+    // the daemon still works without the decision service, so carry on if the socket can't be made
+    if (wargs->decide != NULL)
+    {
+        if (decideListen(wargs->decide) != 0)
+            slog(0, SLOG_WARN, "could not start the decision service on %s", wargs->decide->path);
+        else
+            keepFDs[nKeep++] = wargs->decide->listenFD;
+    }
+
     // try daemonising the program
     slog(0, SLOG_LIVE, "\t- redirected antman log to file: %s", amConfig->current_log_file);
     int res;
-    if ((res = daemonize(PROG_NAME, NULL, NULL, NULL, NULL)) != 0)
+    if ((res = daemonize(PROG_NAME, NULL, NULL, NULL, NULL, pidFD, keepFDs, nKeep)) != 0)
     {
         slog(0, SLOG_ERROR, "could not start the antman daemon");
+        decideStop(wargs->decide);
+        metricsStopServer();
+        close(pidFD);
         return 1;
     }
 
+    // the signals are taken by the main loop, so block them before the logger and workers start their threads
+    sigset_t signals;
+    blockSignals(&signals);
+
     // divert log to file
     SlogConfig slgCfg;
     slog_config_get(&slgCfg);
@@ -67,22 +146,26 @@ int startDaemon(config_t *amConfig, watcherArgs_t *wargs)
     slgCfg.nTdSafe = 1;
     slog_config_set(&slgCfg);
 
+    // hand file writes over to the async logger so workers don't block on log I/O
+    if (slog_async_start() != 0)
+    {
+        slog(0, SLOG_WARN, "could not start the async logger, logging synchronously");
+    }
+    atexit(slog_async_stop);
+
     // log some progress
     slog(0, SLOG_INFO, "checking the antman daemon...");
     pid_t pid = getpid();
     slog(0, SLOG_LIVE, "\t- daemon pid: %d", pid);
 
-    // update the config with the PID
-    // TODO: this should probably be done in a lock file instead...
-    amConfig->pid = pid;
-    if (writeConfig(amConfig, amConfig->filename) != 0)
-    {
-        slog(0, SLOG_ERROR, "failed to update config file");
-        return 1;
-    }
+    slog(0, SLOG_LIVE, "\t- PID file: %s", pidFile);
 
-    // set up the signal catcher
-    catchSigterm();
+    // record a profiling timeline from the start if requested
+    const char *traceFile = getenv(AM_TRACE_ENV);
+    if (traceFile == NULL)
+        traceFile = AM_DEFAULT_TRACE_FILE;
+    else
+        toggleTrace(traceFile);
 
     // initialise fswatch
     slog(0, SLOG_INFO, "initialising fswatch...");
@@ -105,10 +188,34 @@ int startDaemon(config_t *amConfig, watcherArgs_t *wargs)
     // launch the worker threads
     slog(0, SLOG_INFO, "creating workerpool...");
     tpool_t *wp;
-    wp = tpool_create(NUM_THREADS);
-    slog(0, SLOG_LIVE, "\t- created workerpool of %d threads", NUM_THREADS);
+    wp = tpool_create(amConfig->threads);
+    tpool_set_max_queued(wp, amConfig->queue_depth);
+    tpool_set_metrics(wp, true);
+    slog(0, SLOG_LIVE, "\t- created workerpool of %d threads", amConfig->threads);
+    if (amConfig->queue_depth > 0)
+        slog(0, SLOG_LIVE, "\t- the watcher waits once %d files are queued", amConfig->queue_depth);
     wargs->workerPool = wp;
 
+    // serve the metrics on localhost, the port was bound before forking
+    if (amConfig->metrics_port > 0)
+    {
+        if (metricsStartServer(amConfig->metrics_port) != 0)
+        {
+            slog(0, SLOG_ERROR, "could not start the metrics listener on port %d", amConfig->metrics_port);
+            return 1;
+        }
+        slog(0, SLOG_LIVE, "\t- serving metrics at http://127.0.0.1:%d/metrics", amConfig->metrics_port);
+    }
+
+    // answer decision requests on the socket bound before forking
+    if (wargs->decide != NULL && wargs->decide->listenFD >= 0)
+    {
+        if (decideStart(wargs->decide) != 0)
+            slog(0, SLOG_WARN, "could not start the decision service on %s", wargs->decide->path);
+        else
+            slog(0, SLOG_LIVE, "\t- answering decision requests on %s", wargs->decide->path);
+    }
+
     // set the watcher callback function
     if (FSW_OK != fsw_set_callback(handle, watcherCallback, wargs))
     {
@@ -126,9 +233,14 @@ int startDaemon(config_t *amConfig, watcherArgs_t *wargs)
     slog(0, SLOG_INFO, "antman is waiting for sequence data...");
 
     // run antman until a stop signal is received
-    while (!done)
+    while (!handleSignal(waitSignal(&signals), traceFile))
+        ;
+
+    // stop answering decision requests
+    if (wargs->decide != NULL)
     {
-        pause();
+        slog(0, SLOG_LIVE, "\t- stopping the decision service");
+        decideStop(wargs->decide);
     }
 
     // stop the directory watcher
@@ -159,11 +271,41 @@ int startDaemon(config_t *amConfig, watcherArgs_t *wargs)
     // destroy the workerpool
     tpool_destroy(wp);
 
+    // close any profiling timeline
+    if (traceEnabled)
+        toggleTrace(traceFile);
+
+    // stop serving metrics and dump the stage latencies to the log
+    metricsStopServer();
+    char *stats = metricsRenderStages();
+    if (stats != NULL)
+    {
+        slog(0, SLOG_INFO, "stage latencies (ms):");
+        char *line, *save;
+        for (line = strtok_r(stats, "\n", &save); line != NULL; line = strtok_r(NULL, "\n", &save))
+        {
+            slog(0, SLOG_LIVE, "\t%s", line);
+        }
+        free(stats);
+    }
+
+    // flush the async logger
+    if (slog_async_dropped() != 0)
+    {
+        slog(0, SLOG_WARN, "\t- log messages dropped under load: %lu", slog_async_dropped());
+    }
+    slog_async_stop();
+
     return 0;
 }
 
-// daemonize is used to fork, detach, fork again, change permissions, change directory and then reopen streams
-int daemonize(char *name, char *path, char *outfile, char *errfile, char *infile)
+/*
+    daemonize is used to fork, detach, fork again, change permissions, change directory and then reopen streams
+    - pidFD is a locked PID file (see pidfile.h) to keep open in the daemon and record its PID in, or -1
+    - the nKeep file descriptors in keepFDs (e.g. listening sockets) are also kept open in the daemon
+    - the calling process only exits once the PID has been recorded, so `antman --getPID` straight after `--start` sees it
+*/
+int daemonize(char *name, char *path, char *outfile, char *errfile, char *infile, int pidFD, const int *keepFDs, int nKeep)
 {
     if (!name)
     {
@@ -193,8 +335,11 @@ int daemonize(char *name, char *path, char *outfile, char *errfile, char *infile
     }
     if (child > 0)
     {
-        //parent
-        exit(EXIT_SUCCESS);
+        //parent, wait for the first child to record the daemon's PID
+        int status;
+        while (waitpid(child, &status, 0) < 0 && errno == EINTR)
+            ;
+        exit((WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS) ? EXIT_SUCCESS : EXIT_FAILURE);
     }
     if (setsid() < 0)
     {
@@ -216,7 +361,13 @@ int daemonize(char *name, char *path, char *outfile, char *errfile, char *infile
     }
     if (child > 0)
     {
-        //parent
+        //parent, record the daemon's PID (the daemon shares the PID file lock)
+        if (pidFD >= 0 && pidFileWrite(pidFD, child) != 0)
+        {
+            fprintf(stderr, "error: failed to write the PID file\n");
+            kill(child, SIGTERM);
+            exit(EXIT_FAILURE);
+        }
         exit(EXIT_SUCCESS);
     }
 
@@ -233,11 +384,14 @@ int daemonize(char *name, char *path, char *outfile, char *errfile, char *infile
         }
     }
 
-    //close all open file descriptors
-    int fd;
+    //close all open file descriptors, apart from the PID file and any kept ones
+    int fd, i;
     for (fd = sysconf(_SC_OPEN_MAX); fd > 0; --fd)
     {
-        close(fd);
+        for (i = 0; i < nKeep && keepFDs[i] != fd; i++)
+            ;
+        if (fd != pidFD && i == nKeep)
+            close(fd);
     }
 
     //reopen stdin, stdout, stderr
@@ -2,17 +2,25 @@
 #define DAEMONIZE_H
 
 #include <libfswatch/c/libfswatch.h>
+#include <signal.h>
 
 #include "config.h"
 #include "watcher.h"
 
+// the profiling timeline is recorded from startup if AM_TRACE_ENV names a file,
+// otherwise SIGUSR2 toggles recording to AM_DEFAULT_TRACE_FILE
+#define AM_TRACE_ENV "ANTMAN_TRACE"
+#define AM_DEFAULT_TRACE_FILE "./antman-trace.json"
+
 /*
     function prototypes
 */
-void sigTermHandler(int signum);
-void catchSigterm();
+void blockSignals(sigset_t *set);
+int waitSignal(const sigset_t *set);
+int handleSignal(int signum, const char *traceFile);
+void toggleTrace(const char *traceFile);
 void *startWatching(void *param);
-int startDaemon(config_t *amConfig, watcherArgs_t *wargs);
-int daemonize(char *name, char *path, char *outfile, char *errfile, char *infile);
+int startDaemon(const config_t *amConfig, watcherArgs_t *wargs, const char *pidFile);
+int daemonize(char *name, char *path, char *outfile, char *errfile, char *infile, int pidFD, const int *keepFDs, int nKeep);
 
 #endif
\ No newline at end of file
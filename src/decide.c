@@ -0,0 +1,406 @@
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "decide.h"
+#include "metrics.h"
+#include "sequence.h"
+#include "slog.h"
+
+// the quantiles reported for the decision latency
+#define DECIDE_NUM_QUANTILES 4
+static const double decideQuantiles[DECIDE_NUM_QUANTILES] = {50.0, 90.0, 99.0, 99.9};
+
+// readFull reads len bytes from a socket, returns 0 on success or 1 if the connection closed or failed
+static int readFull(int fd, void *buf, size_t len)
+{
+    char *p = (char *)buf;
+    while (len > 0)
+    {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return 1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// writeFull writes len bytes to a socket without raising SIGPIPE if the client has gone, returns 0 on success
+static int writeFull(int fd, const void *buf, size_t len)
+{
+    const char *p = (const char *)buf;
+    while (len > 0)
+    {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return 1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// skipBytes reads and drops len bytes from a socket, using buf as scratch space
+static int skipBytes(int fd, size_t len, char *buf, size_t bufLen)
+{
+    while (len > 0)
+    {
+        size_t n = (len < bufLen) ? len : bufLen;
+        if (readFull(fd, buf, n) != 0)
+            return 1;
+        len -= n;
+    }
+    return 0;
+}
+
+/*
+    serveRequest reads one request from a client and answers it
+    - the deadline starts when the request header arrives
+    - returns 0 to carry on, or 1 if the connection should be closed
+*/
+static int serveRequest(decideContext_t *ctx)
+{
+    decideService_t *svc = ctx->svc;
+    decideRequest_t req;
+    if (readFull(ctx->fd, &req, sizeof(req)) != 0)
+        return 1;
+    uint64_t start = metricsNow();
+    if (req.length < sizeof(req) - sizeof(req.length) || req.length > AM_DECIDE_MAX_FRAME || req.idLen > req.length - (sizeof(req) - sizeof(req.length)))
+    {
+        slog(0, SLOG_WARN, "bad decision request (length %u, ID length %u), closing the connection", req.length, req.idLen);
+        return 1;
+    }
+    uint32_t nBases = req.length - (sizeof(req) - sizeof(req.length)) - req.idLen;
+    int len = (nBases > (uint32_t)svc->maxBases) ? svc->maxBases : (int)nBases;
+    if (readFull(ctx->fd, ctx->id, req.idLen) != 0 || readFull(ctx->fd, ctx->bases, len) != 0)
+        return 1;
+
+    // bases past maxBases are read and dropped, classifying more would break the latency budget
+    decideResponse_t resp;
+    memset(&resp, 0, sizeof(resp));
+    if ((uint32_t)len < nBases)
+    {
+        char scratch[4096];
+        if (skipBytes(ctx->fd, nBases - len, scratch, sizeof(scratch)) != 0)
+            return 1;
+        resp.flags |= AM_DECIDE_FLAG_TRUNCATED;
+        __atomic_fetch_add(&svc->truncated, 1, __ATOMIC_RELAXED);
+    }
+    estimate_t est;
+    uint64_t sketchTime = 0, checkTime = 0;
+    int match = classifyRead(svc->wargs, ctx->bases, len, ctx->sketch, NULL, NULL, &est, &sketchTime, &checkTime);
+    resp.decision = (match < 0) ? AM_DECIDE_UNKNOWN : (match > 0) ? AM_DECIDE_KEEP : AM_DECIDE_REJECT;
+    resp.score = (match < 0) ? 0.0f : (float)est.containment;
+    resp.idLen = req.idLen;
+    resp.length = sizeof(resp) - sizeof(resp.length) + req.idLen;
+
+    // late responses are still sent, the client can tell from the flag that it may have moved on
+    uint64_t elapsed = metricsNow() - start;
+    if (elapsed > svc->deadlineNs)
+    {
+        resp.flags |= AM_DECIDE_FLAG_LATE;
+        __atomic_fetch_add(&svc->late, 1, __ATOMIC_RELAXED);
+        metricsAdd(AM_METRIC_DECISIONS_LATE, 1);
+    }
+    resp.latencyUs = (uint32_t)(elapsed / 1000);
+    if (writeFull(ctx->fd, &resp, sizeof(resp)) != 0 || writeFull(ctx->fd, ctx->id, req.idLen) != 0)
+        return 1;
+    elapsed = metricsNow() - start;
+    histRecord(&svc->latency, elapsed);
+    metricsObserve(AM_HIST_DECISION, elapsed);
+    metricsAdd(AM_METRIC_DECISIONS, 1);
+    __atomic_fetch_add(&svc->decisions[resp.decision], 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+// serveClient is a context's thread, it waits for the listener to hand it a connection and serves it until it closes
+static void *serveClient(void *arg)
+{
+    decideContext_t *ctx = (decideContext_t *)arg;
+    decideService_t *svc = ctx->svc;
+    pthread_mutex_lock(&svc->lock);
+    while (!svc->stopping)
+    {
+        if (ctx->fd < 0)
+        {
+            pthread_cond_wait(&ctx->wake, &svc->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&svc->lock);
+        while (serveRequest(ctx) == 0)
+            ;
+        pthread_mutex_lock(&svc->lock);
+        close(ctx->fd);
+        ctx->fd = -1;
+        pthread_cond_signal(&svc->idle);
+    }
+
+    // a connection handed over as the service stopped is never served
+    if (ctx->fd >= 0)
+    {
+        close(ctx->fd);
+        ctx->fd = -1;
+    }
+    pthread_mutex_unlock(&svc->lock);
+    return NULL;
+}
+
+// idleContext returns an idle context, waiting up to AM_DECIDE_POLL_MS for one (a client that reconnects can arrive before its old connection is noticed closing), the lock must be held
+static int idleContext(decideService_t *svc)
+{
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_nsec += AM_DECIDE_POLL_MS * 1000000L;
+    until.tv_sec += until.tv_nsec / 1000000000L;
+    until.tv_nsec %= 1000000000L;
+    for (;;)
+    {
+        int i;
+        for (i = 0; i < svc->nContexts && svc->contexts[i].fd >= 0; i++)
+            ;
+        if (i < svc->nContexts || svc->stopping || pthread_cond_timedwait(&svc->idle, &svc->lock, &until) != 0)
+            return i;
+    }
+}
+
+// listenClients is the listener thread, it hands new connections to idle contexts and polls so that it can notice a stop request
+static void *listenClients(void *arg)
+{
+    decideService_t *svc = (decideService_t *)arg;
+    struct pollfd pfd = {svc->listenFD, POLLIN, 0};
+    while (!__atomic_load_n(&svc->stopping, __ATOMIC_ACQUIRE))
+    {
+        if (poll(&pfd, 1, AM_DECIDE_POLL_MS) <= 0)
+            continue;
+        int fd = accept(svc->listenFD, NULL, NULL), i, stopping;
+        if (fd < 0)
+            continue;
+        pthread_mutex_lock(&svc->lock);
+        i = idleContext(svc);
+        stopping = svc->stopping;
+        if (i < svc->nContexts && !stopping)
+        {
+            svc->contexts[i].fd = fd;
+            pthread_cond_signal(&svc->contexts[i].wake);
+        }
+        pthread_mutex_unlock(&svc->lock);
+        if (stopping)
+            close(fd);
+        else if (i == svc->nContexts)
+        {
+            slog(0, SLOG_WARN, "refused a decision client, all %d connections are in use", svc->nContexts);
+            __atomic_fetch_add(&svc->refused, 1, __ATOMIC_RELAXED);
+            close(fd);
+        }
+    }
+    return NULL;
+}
+
+/*
+    decideInit makes the decision service and the contexts for its connections, without starting it
+    - wargs is the daemon's classifier setup, which is only read
+    - nContexts is the most clients served at once, deadlineUs the latency budget and maxBases the most bases classified per request
+    - returns NULL if it could not be allocated or the socket path is too long
+*/
+decideService_t *decideInit(watcherArgs_t *wargs, const char *path, int nContexts, int deadlineUs, int maxBases)
+{
+    decideService_t *svc = calloc(1, sizeof(decideService_t));
+    if (svc == NULL)
+        return NULL;
+    if (snprintf(svc->path, sizeof(svc->path), "%s", path) >= (int)sizeof(svc->path) || (svc->contexts = calloc(nContexts, sizeof(decideContext_t))) == NULL)
+    {
+        free(svc);
+        return NULL;
+    }
+    svc->wargs = wargs;
+    svc->listenFD = -1;
+    svc->nContexts = nContexts;
+    svc->maxBases = maxBases;
+    svc->deadlineNs = (uint64_t)deadlineUs * 1000;
+    pthread_mutex_init(&svc->lock, NULL);
+    pthread_cond_init(&svc->idle, NULL);
+    int i, err = 0;
+    for (i = 0; i < nContexts; i++)
+    {
+        decideContext_t *ctx = &svc->contexts[i];
+        ctx->svc = svc;
+        ctx->fd = -1;
+        pthread_cond_init(&ctx->wake, NULL);
+        ctx->id = malloc(AM_DECIDE_MAX_ID);
+        ctx->bases = malloc(maxBases);
+        ctx->sketch = calloc(wargs->sketch_size, sizeof(uint64_t));
+        err |= !ctx->id || !ctx->bases || !ctx->sketch;
+    }
+    if (err)
+    {
+        decideDestroy(svc);
+        return NULL;
+    }
+    return svc;
+}
+
+/*
+    decideListen binds the socket without serving it yet
+    - any old socket file at the path is replaced (the caller holds the PID file, so it isn't another daemon's)
+    - returns 0 on success
+*/
+int decideListen(decideService_t *svc)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, svc->path, sizeof(svc->path));
+    unlink(svc->path);
+    if ((svc->listenFD = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+        return 1;
+    if (bind(svc->listenFD, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(svc->listenFD, svc->nContexts) != 0)
+    {
+        close(svc->listenFD);
+        svc->listenFD = -1;
+        return 1;
+    }
+    return 0;
+}
+
+// decideStart starts the listener and context threads, binding the socket if decideListen hasn't (returns 0 on success)
+int decideStart(decideService_t *svc)
+{
+    if (svc->listenFD < 0 && decideListen(svc) != 0)
+        return 1;
+    int i;
+    for (i = 0; i < svc->nContexts; i++)
+    {
+        if (pthread_create(&svc->contexts[i].thread, NULL, serveClient, &svc->contexts[i]) != 0)
+            break;
+    }
+    svc->started = i;
+    if (i < svc->nContexts || pthread_create(&svc->listenThread, NULL, listenClients, svc) != 0)
+    {
+        decideStop(svc);
+        return 1;
+    }
+    svc->started++;
+    return 0;
+}
+
+// decideStop closes the socket, drops any clients and waits for the threads
+void decideStop(decideService_t *svc)
+{
+    if (svc == NULL || svc->listenFD < 0)
+        return;
+    int i;
+    pthread_mutex_lock(&svc->lock);
+    __atomic_store_n(&svc->stopping, 1, __ATOMIC_RELEASE);
+    for (i = 0; i < svc->nContexts; i++)
+    {
+        if (svc->contexts[i].fd >= 0)
+            shutdown(svc->contexts[i].fd, SHUT_RDWR);
+        pthread_cond_signal(&svc->contexts[i].wake);
+    }
+    pthread_cond_broadcast(&svc->idle);
+    pthread_mutex_unlock(&svc->lock);
+    for (i = 0; i < svc->started && i < svc->nContexts; i++)
+        pthread_join(svc->contexts[i].thread, NULL);
+    if (svc->started > svc->nContexts)
+        pthread_join(svc->listenThread, NULL);
+    svc->started = 0;
+    close(svc->listenFD);
+    svc->listenFD = -1;
+    unlink(svc->path);
+}
+
+// decideDestroy stops the service if needed and frees it
+void decideDestroy(decideService_t *svc)
+{
+    if (svc == NULL)
+        return;
+    decideStop(svc);
+    int i;
+    for (i = 0; i < svc->nContexts; i++)
+    {
+        pthread_cond_destroy(&svc->contexts[i].wake);
+        free(svc->contexts[i].id);
+        free(svc->contexts[i].bases);
+        free(svc->contexts[i].sketch);
+    }
+    pthread_mutex_destroy(&svc->lock);
+    pthread_cond_destroy(&svc->idle);
+    free(svc->contexts);
+    free(svc);
+}
+
+// decideRender returns the decision counts and latency quantiles as text (caller frees), it is the /decisions page
+char *decideRender(void *ctx)
+{
+    decideService_t *svc = (decideService_t *)ctx;
+    size_t size = 1024;
+    char *text = malloc(size);
+    if (text == NULL)
+        return NULL;
+    uint64_t keep = __atomic_load_n(&svc->decisions[AM_DECIDE_KEEP], __ATOMIC_RELAXED);
+    uint64_t reject = __atomic_load_n(&svc->decisions[AM_DECIDE_REJECT], __ATOMIC_RELAXED);
+    uint64_t unknown = __atomic_load_n(&svc->decisions[AM_DECIDE_UNKNOWN], __ATOMIC_RELAXED);
+    int k, len = snprintf(text, size, "socket: %s\ndecisions: %llu (keep %llu, reject %llu, unknown %llu)\nlate: %llu (deadline %.3f ms), truncated: %llu, refused clients: %llu\n%-12s",
+                          svc->path, (unsigned long long)(keep + reject + unknown), (unsigned long long)keep, (unsigned long long)reject, (unsigned long long)unknown,
+                          (unsigned long long)__atomic_load_n(&svc->late, __ATOMIC_RELAXED), svc->deadlineNs / 1e6,
+                          (unsigned long long)__atomic_load_n(&svc->truncated, __ATOMIC_RELAXED), (unsigned long long)__atomic_load_n(&svc->refused, __ATOMIC_RELAXED), "latency");
+    char label[16];
+    for (k = 0; k < DECIDE_NUM_QUANTILES; k++)
+    {
+        snprintf(label, sizeof(label), "p%g", decideQuantiles[k]);
+        len += snprintf(text + len, size - len, " %10s", label);
+    }
+    len += snprintf(text + len, size - len, " %10s\n%-12s", "max", "(ms)");
+    for (k = 0; k < DECIDE_NUM_QUANTILES; k++)
+        len += snprintf(text + len, size - len, " %10.3f", histPercentile(&svc->latency, decideQuantiles[k]) / 1e6);
+    snprintf(text + len, size - len, " %10.3f\n", histMax(&svc->latency) / 1e6);
+    return text;
+}
+
+// decideConnect connects to a decision service, returns the socket or -1
+int decideConnect(const char *path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path) >= (int)sizeof(addr.sun_path))
+        return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+    decideAsk sends a read chunk to the service and waits for the decision
+    - this is a simple blocking client, for tests and as an example of the protocol
+    - returns 0 on success
+*/
+int decideAsk(int fd, const char *id, const char *bases, int len, decideResponse_t *resp)
+{
+    size_t idLen = strlen(id);
+    if (idLen > AM_DECIDE_MAX_ID)
+        return 1;
+    decideRequest_t req = {(uint32_t)(sizeof(req) - sizeof(req.length) + idLen + len), (uint16_t)idLen, 0};
+    if (writeFull(fd, &req, sizeof(req)) != 0 || writeFull(fd, id, idLen) != 0 || writeFull(fd, bases, len) != 0)
+        return 1;
+    char replyID[AM_DECIDE_MAX_ID];
+    if (readFull(fd, resp, sizeof(*resp)) != 0 || resp->idLen != idLen || readFull(fd, replyID, resp->idLen) != 0)
+        return 1;
+    return memcmp(replyID, id, idLen) != 0;
+}
@@ -0,0 +1,103 @@
+// decide is the adaptive sampling service, it answers keep or reject for read chunks sent over a Unix socket
+#ifndef DECIDE_H
+#define DECIDE_H
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/un.h>
+
+#include "estimate.h"
+#include "histogram.h"
+#include "watcher.h"
+
+#define AM_DECIDE_EXT ".sock"                 // the socket is kept next to the config, with this added to its name
+#define AM_DECIDE_MAX_FRAME (64 * 1024 * 1024) // requests longer than this close the connection
+#define AM_DECIDE_POLL_MS 250                 // how often the listener checks for a stop request, and how long a new client waits for a free connection
+#define AM_DECIDE_MAX_ID 65535
+
+// decisions
+#define AM_DECIDE_REJECT 0  // the read is not from the reference, eject it
+#define AM_DECIDE_KEEP 1    // the read is from the reference, keep sequencing it
+#define AM_DECIDE_UNKNOWN 2 // the chunk is too short to tell, send more of the read
+
+// response flags
+#define AM_DECIDE_FLAG_LATE 1      // the response took longer than the deadline
+#define AM_DECIDE_FLAG_TRUNCATED 2 // only the first decide_max_bases bases were classified
+
+/*
+    the protocol is a stream of length prefixed frames in host byte order (the socket is local)
+    - a request is a decideRequest_t, then idLen bytes of read ID, then the bases (length - 4 - idLen of them)
+    - each request gets a response, in order: a decideResponse_t then the read ID
+    - length counts the bytes after the length field
+    - a client can send the next request before the last response arrives
+*/
+typedef struct decideRequest
+{
+    uint32_t length;
+    uint16_t idLen;
+    uint16_t flags; // reserved, send 0
+} decideRequest_t;
+
+typedef struct decideResponse
+{
+    uint32_t length;
+    uint8_t decision;   // AM_DECIDE_REJECT, AM_DECIDE_KEEP or AM_DECIDE_UNKNOWN
+    uint8_t flags;      // AM_DECIDE_FLAG_*
+    uint16_t idLen;
+    float score;        // containment estimate for the chunk
+    uint32_t latencyUs; // from the request arriving to the response being sent
+} decideResponse_t;
+
+struct decideService;
+
+// decideContext_t is a connection's state, allocated when the service is made so serving a request doesn't allocate
+typedef struct decideContext
+{
+    struct decideService *svc;
+    int fd; // the client, -1 when idle
+    pthread_t thread;
+    pthread_cond_t wake;
+    char *id;
+    char *bases;
+    uint64_t *sketch;
+} decideContext_t;
+
+/*
+    decideService_t answers requests with the daemon's sketcher and reference (see classifyRead)
+    - each of nContexts connections is served by its own thread, further connections are refused if none frees up within AM_DECIDE_POLL_MS
+*/
+typedef struct decideService
+{
+    watcherArgs_t *wargs;
+    char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    int listenFD;
+    int stopping;
+    int nContexts;
+    int maxBases;
+    uint64_t deadlineNs;
+    decideContext_t *contexts;
+    pthread_mutex_t lock;
+    pthread_cond_t idle; // signalled when a connection closes
+    pthread_t listenThread;
+    int started;
+    histogram_t latency; // request arriving -> response sent, in ns
+    uint64_t decisions[3];
+    uint64_t late;
+    uint64_t truncated;
+    uint64_t refused;
+} decideService_t;
+
+/*
+    function prototypes
+*/
+decideService_t *decideInit(watcherArgs_t *wargs, const char *path, int nContexts, int deadlineUs, int maxBases);
+int decideListen(decideService_t *svc);
+int decideStart(decideService_t *svc);
+void decideStop(decideService_t *svc);
+void decideDestroy(decideService_t *svc);
+char *decideRender(void *ctx);
+int decideConnect(const char *path);
+int decideAsk(int fd, const char *id, const char *bases, int len, decideResponse_t *resp);
+
+#endif
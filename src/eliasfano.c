@@ -0,0 +1,258 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "eliasfano.h"
+
+/*
+    a lookup finds the value's bucket (its high bits) with a select on the zeros of the high part,
+    then compares the low bits of the few values in that bucket
+    - with lowBits = log2(universe / n) a bucket holds about one value, so the set costs about 2 + lowBits bits per value
+    - batched lookups overlap their cache misses, or walk forward between nearby buckets when the batch is sorted
+*/
+
+// lowWords is the number of words holding the low bits (plus one so a read never crosses the end)
+static uint64_t lowWords(uint64_t n, int lowBits)
+{
+    return (n * lowBits + 63) / 64 + 1;
+}
+
+// getLow reads the low bits of value i
+static inline uint64_t getLow(const efSet_t *set, uint64_t i)
+{
+    if (set->lowBits == 0)
+        return 0;
+    uint64_t bit = i * set->lowBits, word = bit >> 6, shift = bit & 63;
+    uint64_t v = set->low[word] >> shift;
+    if (shift + set->lowBits > 64)
+        v |= set->low[word + 1] << (64 - shift);
+    return v & ((set->lowBits == 64) ? ~0ULL : (1ULL << set->lowBits) - 1);
+}
+
+// nextZero returns the position of the count-th zero (count >= 1) at or after from, or highLen if there isn't one
+static inline uint64_t nextZero(const efSet_t *set, uint64_t from, uint64_t count)
+{
+    uint64_t w = from >> 6;
+    if (w >= set->nHighWords)
+        return set->highLen;
+    uint64_t x = ~set->high[w] & (~0ULL << (from & 63));
+    while (1)
+    {
+        uint64_t c = __builtin_popcountll(x);
+        if (c >= count)
+        {
+            while (--count)
+                x &= x - 1;
+            uint64_t pos = (w << 6) + __builtin_ctzll(x);
+            return pos < set->highLen ? pos : set->highLen;
+        }
+        count -= c;
+        if (++w >= set->nHighWords)
+            return set->highLen;
+        x = ~set->high[w];
+    }
+}
+
+// bucketStart returns the first high bit position of a bucket
+static inline uint64_t bucketStart(const efSet_t *set, uint64_t bucket)
+{
+    if (bucket == 0)
+        return 0;
+
+    // bucket b starts after zero b - 1, which is found from the nearest sample
+    uint64_t z = bucket - 1, s = z / set->sampleRate, pos = set->samples[s];
+    if (z % set->sampleRate)
+        pos = nextZero(set, pos + 1, z % set->sampleRate);
+    return pos + 1;
+}
+
+// searchBucket looks for the low bits of a value in the bucket starting at pos
+static inline int searchBucket(const efSet_t *set, uint64_t pos, uint64_t bucket, uint64_t low)
+{
+    // values before the bucket = ones before its start
+    uint64_t rank = pos - bucket;
+    while (pos < set->highLen && rank < set->n && (set->high[pos >> 6] >> (pos & 63)) & 1)
+    {
+        uint64_t l = getLow(set, rank);
+        if (l == low)
+            return 1;
+        if (l > low)
+            return 0;
+        pos++;
+        rank++;
+    }
+    return 0;
+}
+
+/*
+    efBuild encodes a sorted set of unique values below universe
+    - returns the serialised set (caller frees) and sets size, or returns NULL if it could not be allocated
+*/
+void *efBuild(const uint64_t *values, uint64_t n, uint64_t universe, uint64_t *size)
+{
+    int lowBits = 0;
+    while (n > 0 && lowBits < 63 && (universe / n) >> (lowBits + 1))
+        lowBits++;
+    uint64_t maxHigh = (n > 0) ? values[n - 1] >> lowBits : 0;
+    uint64_t highLen = n + maxHigh + 1;
+    uint64_t nLow = lowWords(n, lowBits), nHigh = (highLen + 63) / 64, nSamples = maxHigh / EF_SAMPLE_RATE + 1;
+    *size = sizeof(efHeader_t) + (nLow + nHigh + nSamples) * sizeof(uint64_t);
+    char *data = calloc(1, *size);
+    if (data == NULL)
+        return NULL;
+
+    efHeader_t *h = (efHeader_t *)data;
+    uint64_t *low = (uint64_t *)(data + sizeof(efHeader_t)), *high = low + nLow, *samples = high + nHigh;
+    h->n = n;
+    h->universe = universe;
+    h->maxHigh = maxHigh;
+    h->highLen = highLen;
+    h->lowBits = lowBits;
+    h->sampleRate = EF_SAMPLE_RATE;
+    h->nSamples = nSamples;
+
+    uint64_t i, lowMask = (lowBits == 0) ? 0 : (1ULL << lowBits) - 1;
+    for (i = 0; i < n; i++)
+    {
+        uint64_t pos = (values[i] >> lowBits) + i;
+        high[pos >> 6] |= 1ULL << (pos & 63);
+        if (lowBits)
+        {
+            uint64_t bit = i * lowBits, v = values[i] & lowMask;
+            low[bit >> 6] |= v << (bit & 63);
+            if ((bit & 63) + lowBits > 64)
+                low[(bit >> 6) + 1] |= v >> (64 - (bit & 63));
+        }
+    }
+
+    // sample the zeros (zero b ends bucket b)
+    uint64_t zeros = 0, pos;
+    for (pos = 0; pos < highLen; pos++)
+    {
+        if ((high[pos >> 6] >> (pos & 63)) & 1)
+            continue;
+        if (zeros % EF_SAMPLE_RATE == 0)
+            samples[zeros / EF_SAMPLE_RATE] = pos;
+        zeros++;
+    }
+    return data;
+}
+
+// efMap points a set at serialised data, returns 0 if the data is a valid set
+int efMap(efSet_t *set, const void *data, uint64_t size)
+{
+    if (size < sizeof(efHeader_t))
+        return 1;
+    const efHeader_t *h = (const efHeader_t *)data;
+    if (h->lowBits > 63 || h->sampleRate == 0 || h->n > h->universe || h->maxHigh > (h->universe >> h->lowBits))
+        return 1;
+    if (h->highLen != h->n + h->maxHigh + 1 || h->nSamples != h->maxHigh / h->sampleRate + 1)
+        return 1;
+    uint64_t nLow = lowWords(h->n, h->lowBits), nHigh = (h->highLen + 63) / 64;
+    if (size != sizeof(efHeader_t) + (nLow + nHigh + h->nSamples) * sizeof(uint64_t))
+        return 1;
+    set->n = h->n;
+    set->universe = h->universe;
+    set->maxHigh = h->maxHigh;
+    set->highLen = h->highLen;
+    set->lowBits = h->lowBits;
+    set->sampleRate = h->sampleRate;
+    set->low = (const uint64_t *)((const char *)data + sizeof(efHeader_t));
+    set->high = set->low + nLow;
+    set->samples = set->high + nHigh;
+    set->nHighWords = nHigh;
+    uint64_t i;
+    for (i = 0; i < h->nSamples; i++)
+        if (set->samples[i] >= set->highLen)
+            return 1;
+    return 0;
+}
+
+// efContains checks if a value is in the set
+int efContains(const efSet_t *set, uint64_t value)
+{
+    if (set->n == 0 || value >= set->universe)
+        return 0;
+    uint64_t bucket = value >> set->lowBits;
+    if (bucket > set->maxHigh)
+        return 0;
+    uint64_t low = value & ((set->lowBits == 0) ? 0 : (1ULL << set->lowBits) - 1);
+    return searchBucket(set, bucketStart(set, bucket), bucket, low);
+}
+
+// walkSorted looks up values in ascending order, walking forward through the high bits when the next bucket is close
+static int walkSorted(const efSet_t *set, const uint64_t *values, int n, uint8_t *found)
+{
+    uint64_t lowMask = (set->lowBits == 0) ? 0 : (1ULL << set->lowBits) - 1, bucket = 0, pos = 0;
+    int i, nFound = 0, haveBucket = 0;
+    for (i = 0; i < n; i++)
+    {
+        uint64_t b = values[i] >> set->lowBits;
+        if (values[i] >= set->universe || b > set->maxHigh)
+            continue;
+        if (!haveBucket || b - bucket > set->sampleRate)
+            pos = bucketStart(set, b);
+        else if (b != bucket)
+            pos = nextZero(set, pos, b - bucket) + 1;
+        bucket = b;
+        haveBucket = 1;
+        nFound += (found[i] = searchBucket(set, pos, b, values[i] & lowMask));
+    }
+    return nFound;
+}
+
+// prefetchBlock looks up a block of values in stages, prefetching what the next stage reads so the cache misses overlap
+static int prefetchBlock(const efSet_t *set, const uint64_t *values, int n, uint8_t *found)
+{
+    uint64_t lowMask = (set->lowBits == 0) ? 0 : (1ULL << set->lowBits) - 1, pos[EF_PREFETCH_BLOCK];
+    int i, nFound = 0, valid[EF_PREFETCH_BLOCK];
+    for (i = 0; i < n; i++)
+    {
+        uint64_t b = values[i] >> set->lowBits;
+        valid[i] = values[i] < set->universe && b <= set->maxHigh;
+        if (valid[i] && b > 0)
+            __builtin_prefetch(&set->samples[(b - 1) / set->sampleRate]);
+    }
+    for (i = 0; i < n; i++)
+    {
+        uint64_t b = values[i] >> set->lowBits;
+        if (!valid[i] || b == 0)
+            continue;
+        pos[i] = set->samples[(b - 1) / set->sampleRate];
+        __builtin_prefetch(&set->high[pos[i] >> 6]);
+    }
+    for (i = 0; i < n; i++)
+    {
+        uint64_t b = values[i] >> set->lowBits;
+        if (!valid[i])
+            continue;
+        pos[i] = bucketStart(set, b);
+        __builtin_prefetch(&set->high[pos[i] >> 6]);
+        if (set->lowBits)
+            __builtin_prefetch(&set->low[((pos[i] - b) * set->lowBits) >> 6]);
+    }
+    for (i = 0; i < n; i++)
+        if (valid[i])
+            nFound += (found[i] = searchBucket(set, pos[i], values[i] >> set->lowBits, values[i] & lowMask));
+    return nFound;
+}
+
+/*
+    efContainsBatch checks a batch of values
+    - found[i] is set for each value in the set
+    - sorted batches walk forward through the set, others are looked up in blocks with their memory accesses overlapped
+    - returns the number of values found
+*/
+int efContainsBatch(const efSet_t *set, const uint64_t *values, int n, uint8_t *found)
+{
+    int i, nFound = 0, sorted = 1;
+    memset(found, 0, n);
+    if (set->n == 0 || n == 0)
+        return 0;
+    for (i = 1; i < n && sorted; i++)
+        sorted = values[i] >= values[i - 1];
+    if (sorted)
+        return walkSorted(set, values, n, found);
+    for (i = 0; i < n; i += EF_PREFETCH_BLOCK)
+        nFound += prefetchBlock(set, values + i, (n - i < EF_PREFETCH_BLOCK) ? n - i : EF_PREFETCH_BLOCK, found + i);
+    return nFound;
+}
@@ -0,0 +1,53 @@
+// eliasfano is a compressed, exact set of sorted integers (Elias-Fano encoding with a sampled select index)
+#ifndef ELIASFANO_H
+#define ELIASFANO_H
+
+#include <stdint.h>
+
+// every EF_SAMPLE_RATE-th zero in the high bits has its position stored, bounding the scan for a bucket
+#define EF_SAMPLE_RATE 256
+
+// unsorted batches are looked up this many values at a time, with the memory for each stage prefetched
+#define EF_PREFETCH_BLOCK 32
+
+/*
+    the serialised set is an efHeader_t followed by three arrays of 64-bit words:
+    - the low bits of each value, packed lowBits to a value
+    - the high bits, in unary: value i sets bit (value >> lowBits) + i, and a zero ends each bucket
+    - the position of every sampleRate-th zero in the high bits
+*/
+typedef struct efHeader
+{
+    uint64_t n;        // number of values
+    uint64_t universe; // every value is below this
+    uint64_t maxHigh;  // bucket of the largest value
+    uint64_t highLen;  // bits in the high part
+    uint32_t lowBits;
+    uint32_t sampleRate;
+    uint64_t nSamples;
+} efHeader_t;
+
+// efSet_t is a mapped set, it is read-only and can be shared between threads
+typedef struct efSet
+{
+    uint64_t n;
+    uint64_t universe;
+    uint64_t maxHigh;
+    uint64_t highLen;
+    int lowBits;
+    uint32_t sampleRate;
+    const uint64_t *low;
+    const uint64_t *high;
+    const uint64_t *samples;
+    uint64_t nHighWords;
+} efSet_t;
+
+/*
+    function prototypes
+*/
+void *efBuild(const uint64_t *values, uint64_t n, uint64_t universe, uint64_t *size);
+int efMap(efSet_t *set, const void *data, uint64_t size);
+int efContains(const efSet_t *set, uint64_t value);
+int efContainsBatch(const efSet_t *set, const uint64_t *values, int n, uint8_t *found);
+
+#endif
@@ -0,0 +1,220 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include "estimate.h"
+
+/*
+    with a filter false positive rate p, a read k-mer is found if it is in the reference or is a false positive:
+        P(hit) = c + (1 - c) * p
+    so the containment c is estimated as (hits / tested - p) / (1 - p), and the Wilson score interval
+    on the hit rate is mapped through the same correction to give the interval on c
+
+    the sequential test (Wald's SPRT) checks the sketch hashes one at a time, testing P(hit) at a containment
+    of threshold - margin against threshold + margin, and stops once the log likelihood ratio of the hits so far
+    crosses log((1 - b) / a) or log(b / (1 - a)), with both error rates a and b at 1 - confidence
+*/
+
+// clamp01 keeps an estimate between 0 and 1
+static double clamp01(double x)
+{
+    return (x < 0.0) ? 0.0 : (x > 1.0) ? 1.0 : x;
+}
+
+// correct removes the expected false positives from a hit rate
+static double correct(double rate, double fpRate)
+{
+    return clamp01((rate - fpRate) / (1.0 - fpRate));
+}
+
+// containment is the corrected containment for a number of hits, used for both the table and the decisions
+static double containment(int hits, int tested, double fpRate)
+{
+    return correct((double)hits / tested, fpRate);
+}
+
+// wilson sets the corrected confidence interval for a number of hits
+static void wilson(int hits, int tested, double fpRate, double *lower, double *upper)
+{
+    double n = tested, r = hits / n, z2 = AM_ESTIMATE_Z * AM_ESTIMATE_Z;
+    double centre = (r + z2 / (2 * n)) / (1 + z2 / n);
+    double half = AM_ESTIMATE_Z / (1 + z2 / n) * sqrt(r * (1 - r) / n + z2 / (4 * n * n));
+    *lower = (hits == 0) ? 0.0 : correct(centre - half, fpRate);
+    *upper = (hits == tested) ? 1.0 : correct(centre + half, fpRate);
+}
+
+/*
+    estimatorInit sets up the estimates for a reference
+    - fpRate is the filter's measured false positive rate (see estimateBloomFP), or 0 for the exact database
+    - refKmers is used for the Jaccard and distance when the read's reference isn't known
+    - returns NULL if it could not be allocated
+*/
+estimator_t *estimatorInit(int k, int sketchSize, double fpRate, double threshold, uint64_t refKmers)
+{
+    estimator_t *est = calloc(1, sizeof(estimator_t));
+    if (est == NULL)
+        return NULL;
+    est->k = k;
+    est->sketchSize = sketchSize;
+    est->fpRate = (fpRate < 0.0) ? 0.0 : (fpRate > 0.99) ? 0.99 : fpRate;
+    est->threshold = threshold;
+    est->refKmers = refKmers;
+    est->minHits = malloc((sketchSize + 1) * sizeof(int));
+    est->table = malloc((sketchSize + 1) * 3 * sizeof(double));
+    if (est->minHits == NULL || est->table == NULL)
+    {
+        estimatorDestroy(est);
+        return NULL;
+    }
+
+    // the fewest hits giving a containment at the threshold, checked against the same function the estimates use
+    int tested, hits;
+    est->minHits[0] = 1;
+    for (tested = 1; tested <= sketchSize; tested++)
+    {
+        hits = (int)ceil(tested * (est->fpRate + threshold * (1.0 - est->fpRate)));
+        hits = (hits < 0) ? 0 : (hits > tested + 1) ? tested + 1 : hits;
+        while (hits > 0 && containment(hits - 1, tested, est->fpRate) >= threshold)
+            hits--;
+        while (hits <= tested && containment(hits, tested, est->fpRate) < threshold)
+            hits++;
+        est->minHits[tested] = hits;
+    }
+
+    // most reads fill the sketch, so their estimates are looked up
+    for (hits = 0; hits <= sketchSize && sketchSize > 0; hits++)
+    {
+        est->table[hits * 3] = containment(hits, sketchSize, est->fpRate);
+        wilson(hits, sketchSize, est->fpRate, &est->table[hits * 3 + 1], &est->table[hits * 3 + 2]);
+    }
+    return est;
+}
+
+// hitRate is P(hit) for a containment, kept off 0 and 1 so the likelihood ratios stay finite
+static double hitRate(double containment, double fpRate)
+{
+    double r = clamp01(containment) * (1.0 - fpRate) + fpRate;
+    return (r < 1e-9) ? 1e-9 : (r > 1.0 - 1e-9) ? 1.0 - 1e-9 : r;
+}
+
+/*
+    estimatorSequential adds a sequential test to an estimator, so reads can stop being checked once they are decided
+    - confidence is the chance of the test making the same call as the full sketch would (e.g. 0.99)
+    - returns 0 on success, or 1 if the boundaries could not be allocated
+*/
+int estimatorSequential(estimator_t *est, double confidence)
+{
+    free(est->acceptHits);
+    free(est->rejectHits);
+    est->acceptHits = malloc((est->sketchSize + 1) * sizeof(int));
+    est->rejectHits = malloc((est->sketchSize + 1) * sizeof(int));
+    if (est->acceptHits == NULL || est->rejectHits == NULL)
+    {
+        free(est->acceptHits);
+        free(est->rejectHits);
+        est->acceptHits = est->rejectHits = NULL;
+        return 1;
+    }
+    confidence = (confidence < 0.5) ? 0.5 : (confidence > 1.0 - 1e-9) ? 1.0 - 1e-9 : confidence;
+    est->confidence = confidence;
+
+    // each hit adds hitLLR to the log likelihood ratio, each miss adds missLLR
+    double p0 = hitRate(est->threshold - AM_ESTIMATE_SPRT_MARGIN, est->fpRate), p1 = hitRate(est->threshold + AM_ESTIMATE_SPRT_MARGIN, est->fpRate);
+    double hitLLR = log(p1 / p0), missLLR = log((1.0 - p1) / (1.0 - p0));
+    double upper = log(confidence / (1.0 - confidence)), lower = -upper;
+    int tested, hits;
+    est->acceptHits[0] = 1;
+    est->rejectHits[0] = -1;
+    for (tested = 1; tested <= est->sketchSize; tested++)
+    {
+        // the ratio rises with the hits, so each boundary is the first (or last) count past its limit
+        for (hits = 0; hits <= tested && hits * hitLLR + (tested - hits) * missLLR < upper; hits++)
+            ;
+        est->acceptHits[tested] = hits;
+        for (hits = tested; hits >= 0 && hits * hitLLR + (tested - hits) * missLLR > lower; hits--)
+            ;
+        est->rejectHits[tested] = hits;
+    }
+    return 0;
+}
+
+// estimatorDestroy frees an estimator
+void estimatorDestroy(estimator_t *est)
+{
+    if (est == NULL)
+        return;
+    free(est->minHits);
+    free(est->table);
+    free(est->acceptHits);
+    free(est->rejectHits);
+    free(est);
+}
+
+/*
+    estimateRead fills in the estimates for a read
+    - hits of tested sketch hashes were found in the reference
+    - queryKmers is the number of k-mers in the read, refKmers the number in the matching reference (0 to use the estimator's)
+*/
+void estimateRead(const estimator_t *est, int hits, int tested, uint64_t queryKmers, uint64_t refKmers, estimate_t *out)
+{
+    out->hits = hits;
+    out->tested = tested;
+    out->match = estimateMatch(est, hits, tested);
+    out->stopped = 0;
+    if (tested <= 0)
+    {
+        out->containment = out->lower = out->jaccard = 0.0;
+        out->upper = 1.0;
+        out->distance = 1.0;
+        return;
+    }
+    if (tested == est->sketchSize)
+    {
+        out->containment = est->table[hits * 3];
+        out->lower = est->table[hits * 3 + 1];
+        out->upper = est->table[hits * 3 + 2];
+    }
+    else
+    {
+        out->containment = containment(hits, tested, est->fpRate);
+        wilson(hits, tested, est->fpRate, &out->lower, &out->upper);
+    }
+    out->jaccard = estimateJaccard(out->containment, queryKmers, refKmers ? refKmers : est->refKmers);
+    out->distance = estimateDistance(out->jaccard, est->k);
+}
+
+// estimateBloomFP returns the false positive rate of a bloom filter from the fraction of its bits that are set
+double estimateBloomFP(const struct bloom *bf)
+{
+    uint64_t set = 0;
+    int i;
+    for (i = 0; i < bf->bytes; i++)
+        set += __builtin_popcount(bf->bf[i]);
+    return pow((double)set / bf->bits, bf->hashes);
+}
+
+// estimateBloomKmers estimates how many distinct k-mers were added to a bloom filter from the fraction of its bits that are set
+uint64_t estimateBloomKmers(const struct bloom *bf)
+{
+    uint64_t set = 0;
+    int i;
+    for (i = 0; i < bf->bytes; i++)
+        set += __builtin_popcount(bf->bf[i]);
+    if (set >= (uint64_t)bf->bits)
+        return bf->bits;
+    return (uint64_t)(-(double)bf->bits / bf->hashes * log(1.0 - (double)set / bf->bits) + 0.5);
+}
+
+// estimateJaccard converts the containment of a read in a reference to their Jaccard similarity
+double estimateJaccard(double containment, uint64_t queryKmers, uint64_t refKmers)
+{
+    double shared = containment * queryKmers, total = (double)queryKmers + refKmers - shared;
+    return (total > 0.0) ? clamp01(shared / total) : 0.0;
+}
+
+// estimateDistance converts a Jaccard similarity to the Mash distance (1 when nothing is shared)
+double estimateDistance(double jaccard, int k)
+{
+    if (jaccard <= 0.0)
+        return 1.0;
+    return clamp01(-1.0 / k * log(2.0 * jaccard / (1.0 + jaccard)));
+}
@@ -0,0 +1,79 @@
+// estimate turns the hits from a read sketch into containment, Jaccard and Mash distance estimates with confidence intervals
+#ifndef ESTIMATE_H
+#define ESTIMATE_H
+
+#include <stdint.h>
+
+#include "bloom.h"
+
+#define AM_ESTIMATE_Z 1.96 // confidence intervals are 95%
+#define AM_ESTIMATE_SPRT_MARGIN 0.1 // the sequential test decides between containments this far either side of the threshold
+
+/*
+    estimator_t holds what is fixed for a reference, it is read-only once made and can be shared between threads
+    - the match decision for every (hits, tested) pair is a lookup in minHits
+    - estimates for a full sketch (tested == sketchSize) are looked up in a table
+    - with a sequential test (see estimatorSequential), acceptHits and rejectHits hold its stopping boundaries
+*/
+typedef struct estimator
+{
+    double fpRate;      // measured false positive rate of the filter (0 for the exact reference database)
+    double threshold;   // containment needed to call a match
+    uint64_t refKmers;  // distinct k-mers in the reference (or an estimate of them)
+    int k;
+    int sketchSize;
+    int *minHits;       // minHits[tested] = fewest hits that reach the threshold (tested + 1 if none do)
+    double *table;      // containment, lower and upper bound for 0 to sketchSize hits in a full sketch
+    double confidence;  // of the sequential test (0 when every sketch hash is checked)
+    int *acceptHits;    // acceptHits[tested] = fewest hits that stop the test with a match (tested + 1 if none do)
+    int *rejectHits;    // rejectHits[tested] = most hits that stop the test without a match (-1 if none do)
+} estimator_t;
+
+// estimate_t is the estimate for a read
+typedef struct estimate
+{
+    int hits;           // sketch hashes found in the reference
+    int tested;         // sketch hashes checked
+    int match;
+    int stopped;        // the sequential test decided before every sketch hash was checked
+    double containment; // corrected for the filter's false positives
+    double lower;       // confidence interval for the containment
+    double upper;
+    double jaccard;
+    double distance;    // Mash distance
+} estimate_t;
+
+/*
+    function prototypes
+*/
+estimator_t *estimatorInit(int k, int sketchSize, double fpRate, double threshold, uint64_t refKmers);
+int estimatorSequential(estimator_t *est, double confidence);
+void estimatorDestroy(estimator_t *est);
+void estimateRead(const estimator_t *est, int hits, int tested, uint64_t queryKmers, uint64_t refKmers, estimate_t *out);
+double estimateBloomFP(const struct bloom *bf);
+uint64_t estimateBloomKmers(const struct bloom *bf);
+double estimateJaccard(double containment, uint64_t queryKmers, uint64_t refKmers);
+double estimateDistance(double jaccard, int k);
+
+// estimateMatch checks if a read's hits reach the match threshold, using only integer counts
+static inline int estimateMatch(const estimator_t *est, int hits, int tested)
+{
+    return tested > 0 && tested <= est->sketchSize && hits >= est->minHits[tested];
+}
+
+/*
+    estimateStop checks if the sequential test can stop after hits of tested sketch hashes were found
+    - returns 1 to stop with a match, 0 to stop without one, or -1 to keep checking (always -1 without a sequential test)
+*/
+static inline int estimateStop(const estimator_t *est, int hits, int tested)
+{
+    if (est->acceptHits == NULL || tested <= 0 || tested > est->sketchSize)
+        return -1;
+    if (hits >= est->acceptHits[tested])
+        return 1;
+    if (hits <= est->rejectHits[tested])
+        return 0;
+    return -1;
+}
+
+#endif
@@ -4,7 +4,8 @@
 #include <stdbool.h>
 #include "hashmap.h"
 
-kmer* hashArray[HASHMAP_SIZE];
+// each thread sketches with its own map
+__thread kmer* hashArray[HASHMAP_SIZE];
 
 // kmer
 struct kmer { 
@@ -0,0 +1,76 @@
+#include <string.h>
+
+#include "histogram.h"
+
+// bucketIndex returns the bucket for a value
+static inline int bucketIndex(uint64_t value)
+{
+    if (value < HIST_SUB_COUNT)
+        return (int)value;
+    int msb = 63 - __builtin_clzll(value);
+    if (msb >= HIST_MAX_BITS)
+        return HIST_NUM_BUCKETS - 1;
+    int shift = msb - HIST_SUB_BITS;
+    return (msb - HIST_SUB_BITS + 1) * HIST_SUB_COUNT + (int)((value >> shift) & (HIST_SUB_COUNT - 1));
+}
+
+// bucketValue returns the highest value that maps to a bucket
+static inline uint64_t bucketValue(int index)
+{
+    if (index < HIST_SUB_COUNT)
+        return (uint64_t)index;
+    int msb = index / HIST_SUB_COUNT + HIST_SUB_BITS - 1;
+    int shift = msb - HIST_SUB_BITS;
+    uint64_t base = (1ULL << msb) | ((uint64_t)(index % HIST_SUB_COUNT) << shift);
+    return base + (1ULL << shift) - 1;
+}
+
+// histRecord adds a value to the histogram
+void histRecord(histogram_t *hist, uint64_t value)
+{
+    __atomic_fetch_add(&hist->counts[bucketIndex(value)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->total, 1, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+    while (value > max && !__atomic_compare_exchange_n(&hist->max, &max, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+// histCount returns the number of recorded values
+uint64_t histCount(const histogram_t *hist)
+{
+    return __atomic_load_n(&hist->total, __ATOMIC_RELAXED);
+}
+
+// histMax returns the largest recorded value
+uint64_t histMax(const histogram_t *hist)
+{
+    return __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+}
+
+// histPercentile returns the value at a percentile (0-100), accurate to the bucket precision
+uint64_t histPercentile(const histogram_t *hist, double percentile)
+{
+    uint64_t total = histCount(hist);
+    if (total == 0)
+        return 0;
+    uint64_t rank = (uint64_t)(percentile / 100.0 * total + 0.5), seen = 0;
+    if (rank < 1)
+        rank = 1;
+    int i;
+    for (i = 0; i < HIST_NUM_BUCKETS; i++)
+    {
+        seen += __atomic_load_n(&hist->counts[i], __ATOMIC_RELAXED);
+        if (seen >= rank)
+        {
+            uint64_t value = bucketValue(i), max = histMax(hist);
+            return value < max ? value : max;
+        }
+    }
+    return histMax(hist);
+}
+
+// histReset clears the histogram (not safe against concurrent updates)
+void histReset(histogram_t *hist)
+{
+    memset(hist, 0, sizeof(*hist));
+}
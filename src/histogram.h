@@ -0,0 +1,35 @@
+// histogram is a log-linear (HDR style) latency histogram
+// values are bucketed by power of two, with each power split into linear sub-buckets
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+
+// HIST_SUB_BITS sets the precision (4 bits == 16 sub-buckets, so within 6.25% of the true value)
+#define HIST_SUB_BITS 4
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+
+// HIST_MAX_BITS sets the range (2^40ns is ~18 minutes, larger values go in the top bucket)
+#define HIST_MAX_BITS 40
+#define HIST_NUM_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+
+/*
+    histogram_t can be updated concurrently, the counts use relaxed atomics
+*/
+typedef struct histogram
+{
+    uint64_t counts[HIST_NUM_BUCKETS];
+    uint64_t total;
+    uint64_t max;
+} histogram_t;
+
+/*
+    function prototypes
+*/
+void histRecord(histogram_t *hist, uint64_t value);
+uint64_t histCount(const histogram_t *hist);
+uint64_t histMax(const histogram_t *hist);
+uint64_t histPercentile(const histogram_t *hist, double percentile);
+void histReset(histogram_t *hist);
+
+#endif
@@ -0,0 +1,187 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "index.h"
+#include "ketopt.h"
+#include "metrics.h"
+#include "refdb.h"
+#include "slog.h"
+
+// printIndexUsage prints the usage info for antman index
+static void printIndexUsage(void)
+{
+    printf("usage:\tantman index [flags]\n\n"
+           "builds the reference database for the white list, so `antman --start` only has to map it\n\n"
+           "flags:\n"
+           "\t --ref=<path/filename>               \t reference to index (default: the white list in the config)\n"
+           "\t --output=<path/filename>            \t database file (default: <ref>%s, where the daemon looks for it)\n"
+           "\t --threads=<int>                     \t number of worker threads (default: number of cores)\n"
+           "\t --sketches-only                     \t leave out the exact k-mer set (smaller, but reads are only checked against the sketches)\n"
+           "\t --check                             \t check an existing database against its checksums instead of building one\n"
+           "\t --config=<path/filename>            \t take the settings from this config file (default: %s)\n"
+           "\t --instance=<name>                   \t take the settings from a named instance's config\n"
+           "\n"
+           "\t -h                                   \t prints this help and exits\n",
+           AM_REFDB_EXT, CONFIG_LOCATION);
+}
+
+// checkDatabase opens a database and checks it in full, returns 0 if it is sound
+static int checkDatabase(const char *dbPath)
+{
+    refdb_t *db = refdbOpen(dbPath);
+    if (db == NULL)
+    {
+        fprintf(stderr, "could not open the reference database: %s\n", dbPath);
+        return 1;
+    }
+    int err = refdbCheck(db);
+    refdbClose(db);
+    if (err != 0)
+        fprintf(stderr, "reference database failed its check, rebuild it with `antman index`: %s\n", dbPath);
+    return err;
+}
+
+/*
+    indexMain is the entry point for `antman index`
+    - sketches the reference across all the threads and writes the database (sketches, inverted index, exact k-mer set and metadata)
+    - uses the k-mer size from the config, so the daemon will accept the database
+    - the database is written to a temporary file and renamed, so a running daemon or classifier never sees a partial one
+    - the new database is then checked in full (refdbCheck), which opening it skips, and --check does just that for an existing one
+*/
+int indexMain(int argc, char *argv[])
+{
+    static ko_longopt_t longopts[] = {
+        {"ref", ko_required_argument, 501},
+        {"output", ko_required_argument, 502},
+        {"threads", ko_required_argument, 503},
+        {"sketches-only", ko_no_argument, 504},
+        {"config", ko_required_argument, 505},
+        {"instance", ko_required_argument, 506},
+        {"check", ko_no_argument, 507},
+        {0, 0, 0}};
+    char *ref = NULL, *output = NULL, *configArg = NULL, *instance = NULL;
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN), flags = AM_REFDB_KMERS, check = 0;
+
+    ketopt_t opt = KETOPT_INIT;
+    int c;
+    while ((c = ketopt(&opt, argc, argv, 1, "h", longopts)) >= 0)
+    {
+        if (c == 'h')
+        {
+            printIndexUsage();
+            return 0;
+        }
+        else if (c == 501)
+            ref = opt.arg;
+        else if (c == 502)
+            output = opt.arg;
+        else if (c == 503)
+            threads = atoi(opt.arg);
+        else if (c == 504)
+            flags &= ~AM_REFDB_KMERS;
+        else if (c == 505)
+            configArg = opt.arg;
+        else if (c == 506)
+            instance = opt.arg;
+        else if (c == 507)
+            check = 1;
+        else
+        {
+            fprintf(stderr, "unknown flag or missing argument\n\n");
+            printIndexUsage();
+            return 1;
+        }
+    }
+    if (opt.ind != argc)
+    {
+        fprintf(stderr, "unexpected argument: %s\n\n", argv[opt.ind]);
+        printIndexUsage();
+        return 1;
+    }
+    if (threads < 1)
+        threads = 1;
+
+    // the k-mer size and white list come from the config, if there is one
+    config_t *amConfig = initConfig();
+    if (amConfig == NULL)
+    {
+        fprintf(stderr, "\nerror: failed to allocate a config (out of memory)\n\n");
+        return 1;
+    }
+    char configFile[PATH_MAX];
+    if (configLocation(configFile, sizeof(configFile), configArg, instance) != 0)
+    {
+        destroyConfig(amConfig);
+        fprintf(stderr, "bad config file path or instance name\n\n");
+        return 1;
+    }
+    if ((configArg != NULL || instance != NULL) && access(configFile, R_OK) != 0)
+    {
+        destroyConfig(amConfig);
+        fprintf(stderr, "can't read the config file: %s\n\n", configFile);
+        return 1;
+    }
+    if (access(configFile, R_OK) == 0 && loadConfig(amConfig, configFile) != 0)
+    {
+        destroyConfig(amConfig);
+        fprintf(stderr, "\nerror: failed to load config file\n\n");
+        return 1;
+    }
+    if (ref == NULL && (ref = amConfig->white_list) == NULL)
+    {
+        destroyConfig(amConfig);
+        fprintf(stderr, "no reference given and no white list set\n\n");
+        printIndexUsage();
+        return 1;
+    }
+    if (check && (output != NULL || refdbIsDB(ref)))
+    {
+        int err = checkDatabase(output != NULL ? output : ref);
+        destroyConfig(amConfig);
+        return err;
+    }
+    if (refdbIsDB(ref))
+    {
+        fprintf(stderr, "the reference is already a database: %s\n", ref);
+        destroyConfig(amConfig);
+        return 1;
+    }
+    char dbPath[PATH_MAX];
+    if (snprintf(dbPath, sizeof(dbPath), "%s%s", ref, AM_REFDB_EXT) >= (int)sizeof(dbPath))
+    {
+        fprintf(stderr, "reference path is too long: %s\n", ref);
+        destroyConfig(amConfig);
+        return 1;
+    }
+    if (check)
+    {
+        destroyConfig(amConfig);
+        return checkDatabase(dbPath);
+    }
+    if (output == NULL)
+        output = dbPath;
+
+    slog_init("antman-index", "log/slog.cfg", 4, 1);
+    slog(0, SLOG_INFO, "indexing reference...");
+    slog(0, SLOG_LIVE, "\t- reference: %s", ref);
+    slog(0, SLOG_LIVE, "\t- database: %s", output);
+    slog(0, SLOG_LIVE, "\t- k-mer size: %d", amConfig->k_size);
+    slog(0, SLOG_LIVE, "\t- threads: %d", threads);
+    uint64_t start = metricsNow();
+    int err = refdbBuild(ref, output, amConfig->k_size, amConfig->refdb_scaled, flags, threads);
+    destroyConfig(amConfig);
+    if (err != 0)
+    {
+        slog(0, SLOG_ERROR, "could not index the reference");
+        return 1;
+    }
+    if (checkDatabase(output) != 0)
+        return 1;
+    slog(0, SLOG_INFO, "finished");
+    slog(0, SLOG_LIVE, "\t- elapsed: %.2fs", (metricsNow() - start) / 1e9);
+    return 0;
+}
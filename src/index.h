@@ -0,0 +1,10 @@
+// index builds the reference database offline, so the daemon only has to map it when it starts
+#ifndef INDEX_H
+#define INDEX_H
+
+/*
+    function prototypes
+*/
+int indexMain(int argc, char *argv[]);
+
+#endif
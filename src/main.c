@@ -1,17 +1,27 @@
 #include <dirent.h>
 #include <errno.h>
+#include <limits.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
 
 #include "ketopt.h"
 #include "bloom.h"
+#include "classify.h"
 #include "config.h"
+#include "coverage.h"
 #include "daemonize.h"
+#include "decide.h"
+#include "index.h"
+#include "metrics.h"
+#include "pidfile.h"
+#include "refdb.h"
 #include "sequence.h"
+#include "sharedbloom.h"
 #include "slog.h"
 #include "watcher.h"
 
@@ -30,7 +40,9 @@ void greet()
 */
 void printUsage(void)
 {
-    printf("usage:\tantman [flags]\n\n"
+    printf("usage:\tantman [flags]\n"
+           "\tantman index [flags]\n"
+           "\tantman classify [flags] <file.fastq[.gz]> ...\n\n"
            "flags:\n"
            "\t --setWatchDir=<path>                 \t set the watch directory (default: %s)\n"
            "\t --setWhiteList=<path/filename>      \t set the white list\n"
@@ -38,65 +50,36 @@ void printUsage(void)
            "\t --start                              \t start the antman daemon\n"
            "\t --stop                               \t stop the antman daemon\n"
            "\t --getPID                             \t prints PID of the antman daemon and exits\n"
+           "\t --getStats                           \t prints the daemon's per-stage latencies and exits\n"
+           "\t --getCoverage                        \t prints the daemon's depth estimates for each reference and exits\n"
+           "\t --getDecisions                       \t prints the daemon's decision service counts and latencies and exits\n"
+           "\t --config=<path/filename>            \t use this config file (default: %s)\n"
+           "\t --instance=<name>                   \t use the config for a named instance, so several daemons can run side by side (default config: %s.<name>)\n"
            "\n"
-           "\t -h                                   \t prints this help and exits\n"
+           "\t -h                                   \t prints this help and exits (use `antman index -h` or `antman classify -h` for the subcommands)\n"
            "\t -v                                   \t prints version number and exits\n",
-           DEFAULT_WATCH_DIR);
-}
-
-/*
-    checkPID returns the PID of the running daemon
-    - checks if the antman daemon is running
-    - then checks if the PID is correct (-2 if the PID isn't found)
-    - returns the PID of the antman daemon (-1 if no daemon is running)
-
-    TODO: check if PID name is antman:
-        something like #ps -p $(./src/antman --getPID) -o comm=
-*/
-int checkPID(config_t *amConfig)
-{
-    if (amConfig->pid >= 0)
-    {
-        if (kill(amConfig->pid, 0) != 0)
-        {
-            slog(0, SLOG_ERROR, "the registered antman pid is not running");
-            slog(0, SLOG_LIVE, "\t- registered PID: %d", amConfig->pid);
-            slog(0, SLOG_INFO, "updating config file...");
-            amConfig->pid = -1;
-            if (writeConfig(amConfig, amConfig->filename) != 0)
-            {
-                slog(0, SLOG_ERROR, "could not update the config file");
-                return 1;
-            }
-            return (-2);
-        }
-        return amConfig->pid;
-    }
-    else
-    {
-        return -1;
-    }
+           DEFAULT_WATCH_DIR, CONFIG_LOCATION, CONFIG_LOCATION);
 }
 
 /*
     stopAntman stops the daemon
     - issues SIGTERM to antman daemon
-    - updates the config
+    - waits for it to exit and release the PID file, so it can be restarted straight away
 
     TODO: instead of using SIGTERM, use waitpid and then decide to use a SIGKILL before harvesting zombies
 */
-int stopAntman(config_t *amConfig)
+int stopAntman(pid_t daemonPID, const char *pidFile)
 {
-    if (kill(amConfig->pid, SIGTERM) != 0)
+    if (kill(daemonPID, SIGTERM) != 0)
     {
         slog(0, SLOG_ERROR, "could not kill the daemon process");
-        slog(0, SLOG_LIVE, "\t- registered PID: %d", amConfig->pid);
+        slog(0, SLOG_LIVE, "\t- registered PID: %d", daemonPID);
         return 1;
     }
-    amConfig->pid = -1;
-    if (writeConfig(amConfig, amConfig->filename) != 0)
+    if (pidFileWaitExit(pidFile, AM_PIDFILE_STOP_SECS) != 0)
     {
-        slog(0, SLOG_ERROR, "could not update the config file after stopping the daemon");
+        slog(0, SLOG_ERROR, "the daemon did not exit within %d seconds", AM_PIDFILE_STOP_SECS);
+        slog(0, SLOG_LIVE, "\t- registered PID: %d", daemonPID);
         return 1;
     }
     return 0;
@@ -150,6 +133,16 @@ int setWhiteList(config_t *amConfig, char *fileName)
 int main(int argc, char *argv[])
 {
 
+    // the batch classifier and the indexer don't need the config checks or the daemon
+    if (argc > 1 && strcmp(argv[1], "classify") == 0)
+    {
+        return classifyMain(argc - 1, argv + 1);
+    }
+    if (argc > 1 && strcmp(argv[1], "index") == 0)
+    {
+        return indexMain(argc - 1, argv + 1);
+    }
+
     // set up the long flags
     static ko_longopt_t longopts[] = {
         {"start", ko_no_argument, 301},
@@ -158,21 +151,20 @@ int main(int argc, char *argv[])
         {"setWhiteList", ko_optional_argument, 304},
         {"setLog", ko_optional_argument, 305},
         {"getPID", ko_no_argument, 306},
+        {"getStats", ko_no_argument, 307},
+        {"getCoverage", ko_no_argument, 308},
+        {"config", ko_required_argument, 309},
+        {"instance", ko_required_argument, 310},
+        {"getDecisions", ko_no_argument, 311},
         {0, 0, 0}};
 
     // set up the job list
-    int start = 0, stop = 0, getPID = 0;
+    int start = 0, stop = 0, getPID = 0, getStats = 0, getCoverage = 0, getDecisions = 0;
     char *watchDir = NULL;
     char *whiteList = NULL;
     char *logFile = NULL;
-
-    // get a default log name
-    time_t timer;
-    time(&timer);
-    struct tm *tm_info;
-    tm_info = localtime(&timer);
-    static char defaultLog[28];
-    strftime(defaultLog, 28, "./antman-%Y-%m-%d-%H%M.log", tm_info);
+    char *configArg = NULL, *instance = NULL;
+    int setLog = 0;
 
     // get the CLI info
     ketopt_t opt = KETOPT_INIT;
@@ -203,9 +195,22 @@ int main(int argc, char *argv[])
             }
         }
         else if (c == 305)
-            opt.arg ? (logFile = opt.arg) : (logFile = defaultLog);
+        {
+            logFile = opt.arg;
+            setLog = 1;
+        }
         else if (c == 306)
             getPID = 1;
+        else if (c == 307)
+            getStats = 1;
+        else if (c == 308)
+            getCoverage = 1;
+        else if (c == 309)
+            configArg = opt.arg;
+        else if (c == 310)
+            instance = opt.arg;
+        else if (c == 311)
+            getDecisions = 1;
         else if (c == 'u')
             printf("unused flag:  -u %s\n", opt.arg);
         else if (c == '?')
@@ -223,63 +228,107 @@ int main(int argc, char *argv[])
     }
 
     // check we have a job to do, otherwise print the help screen and exit
-    if (start + stop + getPID == 0 && (watchDir == NULL) && (logFile == NULL) && (whiteList == NULL))
+    if (start + stop + getPID + getStats + getCoverage + getDecisions + setLog == 0 && (watchDir == NULL) && (whiteList == NULL))
     {
         fprintf(stderr, "nothing to do: no flags set\n\n");
         printUsage();
         return 1;
     }
 
-    // check the config exists and is accessible
-    if (access(CONFIG_LOCATION, F_OK) == -1)
+    // find the config for this instance, its lock, PID and decision socket files go next to it
+    char configFile[PATH_MAX], pidFile[PATH_MAX], decideSocket[PATH_MAX];
+    if (configLocation(configFile, sizeof(configFile), configArg, instance) != 0 || snprintf(pidFile, sizeof(pidFile), "%s%s", configFile, AM_PIDFILE_EXT) >= (int)sizeof(pidFile) || snprintf(decideSocket, sizeof(decideSocket), "%s%s", configFile, AM_DECIDE_EXT) >= (int)sizeof(decideSocket))
     {
-        // config doesn't exist, so create one
-        config_t *tmp = initConfig();
-        if (tmp == 0)
-        {
-            fprintf(stderr, "\nerror: failed to create a config file (out of memory)\n\n");
-            return 1;
-        }
-        if (writeConfig(tmp, CONFIG_LOCATION) != 0)
-        {
-            destroyConfig(tmp);
-            fprintf(stderr, "\nerror: failed to create a config file\n\n");
-            return 1;
-        }
-        destroyConfig(tmp);
+        if (instance != NULL && configArg == NULL)
+            fprintf(stderr, "bad instance name: %s (use up to %d letters, numbers, '-' or '_', but not lock, pid or sock)\n\n", instance, AM_INSTANCE_MAX);
+        else
+            fprintf(stderr, "bad config file path: %s\n\n", configArg ? configArg : CONFIG_LOCATION);
+        return 1;
     }
-    if (access(CONFIG_LOCATION, W_OK) == -1)
+
+    // get a default log name, named after the instance if there is one
+    time_t timer;
+    time(&timer);
+    struct tm *tm_info;
+    tm_info = localtime(&timer);
+    char stamp[32], defaultLog[PATH_MAX];
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d-%H%M", tm_info);
+    snprintf(defaultLog, sizeof(defaultLog), "./antman-%s%s%s.log", instance ? instance : "", instance ? "-" : "", stamp);
+    if (setLog && logFile == NULL)
+        logFile = defaultLog;
+
+    // get the PID of the running antman daemon from the lock on its PID file (-1 if no daemon is running)
+    pid_t daemonPID = pidFileCheck(pidFile);
+    int running = (daemonPID != -1);
+
+    // handle any --getPID request (and then exit)
+    if (getPID == 1)
     {
-        fprintf(stderr, "\nerror: failed to write to config file (check permissions)\n\n");
-        return 1;
+        printf("%d\n", (int)daemonPID);
+        return 0;
     }
 
-    // load the config
+    // lock the config so that other antman calls wait until we've finished with it
     config_t *amConfig = initConfig();
     if (amConfig == 0)
     {
         fprintf(stderr, "\nerror: failed to load config file (out of memory)\n\n");
         return 1;
     }
-    if (loadConfig(amConfig, CONFIG_LOCATION) != 0)
+    if (lockConfig(amConfig, configFile) != 0)
     {
         destroyConfig(amConfig);
-        fprintf(stderr, "\nerror: failed to load config file\n\n");
+        fprintf(stderr, "\nerror: failed to lock the config file: %s%s\n\n", configFile, AM_CONFIG_LOCK_EXT);
         return 1;
     }
 
-    // get the PID of the running antman daemon (returns -1 if no daemon is running)
-    int daemonPID = checkPID(amConfig);
-    if (daemonPID == -2)
+    // check the config exists, create one with the defaults if not, and then load it
+    if (access(configFile, F_OK) == -1)
+    {
+        // a new instance gets a metrics port that the other instances aren't using
+        if (instance != NULL && configArg == NULL)
+            amConfig->metrics_port = instancePort(CONFIG_LOCATION);
+        if (writeConfig(amConfig, configFile) != 0)
+        {
+            destroyConfig(amConfig);
+            fprintf(stderr, "\nerror: failed to create a config file\n\n");
+            return 1;
+        }
+    }
+    else if (loadConfig(amConfig, configFile) != 0)
+    {
+        destroyConfig(amConfig);
+        fprintf(stderr, "\nerror: failed to load config file\n\n");
+        return 1;
+    }
+    if (access(configFile, W_OK) == -1)
     {
         destroyConfig(amConfig);
+        fprintf(stderr, "\nerror: failed to write to config file (check permissions)\n\n");
         return 1;
     }
 
-    // handle any --getPID request (and then exit)
-    if (getPID == 1)
+    // handle any --getStats, --getCoverage or --getDecisions request (and then exit)
+    if (getStats + getCoverage + getDecisions > 0)
     {
-        printf("%d\n", daemonPID);
+        if (daemonPID < 0)
+        {
+            fprintf(stderr, "no daemon running\n");
+            destroyConfig(amConfig);
+            return 1;
+        }
+        const char *page = getStats ? "stats" : getCoverage ? "coverage" : "decisions";
+        char pagePath[16];
+        snprintf(pagePath, sizeof(pagePath), "/%s", page);
+        char *stats = metricsFetch(amConfig->metrics_port, pagePath);
+        if (stats == NULL)
+        {
+            fprintf(stderr, "could not get %s from the daemon (metrics port: %d)\n", page, amConfig->metrics_port);
+            destroyConfig(amConfig);
+            return 1;
+        }
+        printf("%s", stats);
+        free(stats);
         destroyConfig(amConfig);
         return 0;
     }
@@ -296,13 +345,26 @@ int main(int argc, char *argv[])
     {
         slog_init(amConfig->current_log_file, "log/slog.cfg", 4, 1);
     }
+    if (amConfig->log_silent || amConfig->log_level > 0)
+    {
+        SlogConfig slgCfg;
+        slog_config_get(&slgCfg);
+        slgCfg.nSilent = 1;
+        if (amConfig->log_level >= 2)
+            slgCfg.nFlagMask = SLOG_MASK_ERRORS | ((amConfig->log_level == 2) ? SLOG_FLAG_BIT(SLOG_WARN) : 0);
+        slog_config_set(&slgCfg);
+    }
     slog(0, SLOG_INFO, "reading config...");
-    slog(0, SLOG_LIVE, "\t- config: %s", CONFIG_LOCATION);
+    slog(0, SLOG_LIVE, "\t- config: %s", configFile);
+    if (instance != NULL)
+        slog(0, SLOG_LIVE, "\t- instance: %s", instance);
     slog(0, SLOG_LIVE, "\t- created on: %s", amConfig->created);
     slog(0, SLOG_LIVE, "\t- modified on: %s", amConfig->modified);
     slog(0, SLOG_LIVE, "\t- watch directory: %s", amConfig->watch_directory);
     slog(0, SLOG_LIVE, "\t- white list: %s", amConfig->white_list);
     slog(0, SLOG_LIVE, "\t- current log file: %s", amConfig->current_log_file);
+    slog(0, SLOG_LIVE, "\t- metrics port: %d", amConfig->metrics_port);
+    slog(0, SLOG_LIVE, "\t- k-mer size: %d, sketch size: %d, threads: %d", amConfig->k_size, amConfig->sketch_size, amConfig->threads);
     if (daemonPID != -1)
     {
         slog(0, SLOG_LIVE, "\t- daemon running: true");
@@ -329,11 +391,12 @@ int main(int argc, char *argv[])
             return 1;
         }
         slog(0, SLOG_LIVE, "\t- PID %d", daemonPID);
-        if (stopAntman(amConfig) != 0)
+        if (stopAntman(daemonPID, pidFile) != 0)
         {
             destroyConfig(amConfig);
             return 1;
         }
+        running = 0;
         slog(0, SLOG_LIVE, "\t- stopped the daemon");
         slog(0, SLOG_LIVE, "\t- daemon log: %s", amConfig->current_log_file);
     }
@@ -346,11 +409,12 @@ int main(int argc, char *argv[])
         if (daemonPID >= 0 && stop == 0)
         {
             slog(0, SLOG_INFO, "stopping daemon...");
-            if (stopAntman(amConfig) != 0)
+            if (stopAntman(daemonPID, pidFile) != 0)
             {
                 destroyConfig(amConfig);
                 return 1;
             }
+            running = 0;
         }
 
         // set the watch directory if requested
@@ -384,14 +448,7 @@ int main(int argc, char *argv[])
             amConfig->current_log_file = strdup(logFile);
             slog(0, SLOG_LIVE, "\t- set to: %s", amConfig->current_log_file);
         }
-
-        // update the config
-        if (writeConfig(amConfig, amConfig->filename) != 0)
-        {
-            slog(0, SLOG_ERROR, "could not update the config file");
-            destroyConfig(amConfig);
-            return 1;
-        }
+        amConfig->dirty = 1;
 
         // restart the daemon if we stopped it (only if --stop wasn't also requested)
         if (daemonPID >= 0 && stop == 0)
@@ -401,16 +458,25 @@ int main(int argc, char *argv[])
         }
     }
 
+    // write any changes back in one go, then let other antman calls at the config (the daemon takes the lock again to record its PID)
+    if (saveConfig(amConfig) != 0)
+    {
+        slog(0, SLOG_ERROR, "could not update the config file");
+        destroyConfig(amConfig);
+        return 1;
+    }
+    unlockConfig(amConfig);
+
     // handle any --start request
     if (start == 1)
     {
         slog(0, SLOG_INFO, "checking antman...");
 
         // check the daemon is not already running
-        if (amConfig->pid != -1)
+        if (running)
         {
             slog(0, SLOG_ERROR, "the daemon is already running");
-            slog(0, SLOG_LIVE, "\t- current PID: %d", amConfig->pid);
+            slog(0, SLOG_LIVE, "\t- current PID: %d", daemonPID);
             destroyConfig(amConfig);
             return 1;
         }
@@ -432,47 +498,156 @@ int main(int argc, char *argv[])
         }
         slog(0, SLOG_LIVE, "\t- ready");
 
-        // load the white list into a bloom filter
-        slog(0, SLOG_INFO, "loading white list into bloom filter...");
+        // load the white list, mapping the prebuilt reference database rather than building a bloom filter
+        slog(0, SLOG_INFO, "loading white list...");
         struct bloom refBF;
-        if (bloom_init(&refBF, amConfig->bloom_max_elements, amConfig->bloom_fp_rate) != 0)
+        int useBloom = 0;
+        sharedBloom_t *sharedBF = NULL;
+        refdb_t *refDB = refdbLoad(amConfig->white_list, amConfig->k_size, amConfig->refdb_scaled, AM_REFDB_NO_BUILD, 1);
+        if (refDB != NULL)
         {
-            slog(0, SLOG_ERROR, "could not init bloom filter");
-            destroyConfig(amConfig);
-            return 1;
+            slog(0, SLOG_LIVE, "\t- using the reference database (%d references)", refDB->nRefs);
+        }
+        else if ((sharedBF = sharedBloomAttach(amConfig->white_list, amConfig->k_size, amConfig->bloom_max_elements, amConfig->bloom_fp_rate, (int)sysconf(_SC_NPROCESSORS_ONLN))) != NULL)
+        {
+            // other daemons using the same white list share the filter
+            slog(0, SLOG_LIVE, "\t- no reference database, %s the shared bloom filter: %s", sharedBF->built ? "built" : "attached to", sharedBF->name);
+            slog(0, SLOG_LIVE, "\t- try `antman index` to build one so the daemon starts straight away");
+            amConfig->bloom_filter = &sharedBF->bf;
+        }
+        else
+        {
+            slog(0, SLOG_LIVE, "\t- no reference database, loading into a bloom filter");
+            slog(0, SLOG_LIVE, "\t- try `antman index` to build one so the daemon starts straight away");
+            if (bloom_init(&refBF, amConfig->bloom_max_elements, amConfig->bloom_fp_rate) != 0)
+            {
+                slog(0, SLOG_ERROR, "could not init bloom filter");
+                destroyConfig(amConfig);
+                return 1;
+            }
+            if (processRef(amConfig->white_list, &refBF, amConfig->k_size, (int)sysconf(_SC_NPROCESSORS_ONLN)) != 0)
+            {
+                slog(0, SLOG_ERROR, "could not load the white list");
+                bloom_free(&refBF);
+                destroyConfig(amConfig);
+                return 1;
+            }
+            useBloom = 1;
+            amConfig->bloom_filter = &refBF;
         }
-        processRef(amConfig->white_list, &refBF, amConfig->k_size, amConfig->sketch_size);
         slog(0, SLOG_LIVE, "\t done");
-        amConfig->bloom_filter = &refBF;
 
         // set up the watch directory
         slog(0, SLOG_INFO, "setting up the directory watcher...");
-        watcherArgs_t *wargs = malloc(sizeof(watcherArgs_t));
+        watcherArgs_t *wargs = calloc(1, sizeof(watcherArgs_t));
         if (wargs == NULL)
         {
             slog(0, SLOG_ERROR, "could not allocate the watcher arguments");
-            bloom_free(&refBF);
+            if (useBloom)
+                bloom_free(&refBF);
+            sharedBloomDetach(sharedBF);
+            refdbClose(refDB);
             destroyConfig(amConfig);
             return 1;
         }
         wargs->bloomFilter = amConfig->bloom_filter;
+        wargs->refDB = refDB;
         wargs->k_size = amConfig->k_size;
         wargs->sketch_size = amConfig->sketch_size;
         wargs->fp_rate = amConfig->bloom_fp_rate;
+        wargs->match_threshold = amConfig->match_threshold;
+        wargs->sprt_confidence = amConfig->sprt_confidence;
+        estimator_t *estimator = referenceEstimator(wargs);
+        wargs->estimator = estimator;
+
+        // the reads are summarised in a sketch for the run, kept in the watch directory
+        if (amConfig->write_sketches)
+            wargs->runTracker = runTrackerInit(amConfig->watch_directory, amConfig->k_size, amConfig->sketch_size);
+        if (!amConfig->write_sketches)
+            slog(0, SLOG_LIVE, "\t- not writing sketches (write_sketches is off)");
+        else if (wargs->runTracker == NULL)
+            slog(0, SLOG_WARN, "could not set up the run sketch, only the reads will be classified");
+        else
+            slog(0, SLOG_LIVE, "\t- run sketch: %s", wargs->runTracker->path);
+
+        // count the reference k-mers in the reads for live depth estimates, served at /coverage (this needs the reference names, so the database)
+        if (refDB != NULL && amConfig->coverage_width > 0)
+        {
+            if ((wargs->coverage = coverageInit(refDB, amConfig->coverage_width)) == NULL)
+                slog(0, SLOG_WARN, "could not allocate the coverage counts, depth won't be estimated");
+            else
+            {
+                metricsAddPage("/coverage", coverageRender, wargs->coverage);
+                slog(0, SLOG_LIVE, "\t- estimating coverage with %d x %u counters", wargs->coverage->cm->depth, wargs->coverage->cm->width);
+            }
+        }
+
+        // answer read chunks for adaptive sampling on a socket next to the config, served at /decisions
+        if (estimator != NULL && amConfig->decide_clients > 0)
+        {
+            if ((wargs->decide = decideInit(wargs, decideSocket, amConfig->decide_clients, amConfig->decide_deadline_us, amConfig->decide_max_bases)) == NULL)
+                slog(0, SLOG_WARN, "could not set up the decision service (socket path: %s)", decideSocket);
+            else
+            {
+                metricsAddPage("/decisions", decideRender, wargs->decide);
+                slog(0, SLOG_LIVE, "\t- decision service: %s (%d clients, %d us deadline)", decideSocket, amConfig->decide_clients, amConfig->decide_deadline_us);
+            }
+        }
 
         // start the daemon
-        slog(0, SLOG_INFO, "starting the daemon...");
-        if (startDaemon(amConfig, wargs) != 0)
+        int err = 1;
+        if (estimator == NULL)
+            slog(0, SLOG_ERROR, "could not allocate the containment estimator");
+        else
+        {
+            slog(0, SLOG_LIVE, "\t- reference false positive rate: %.3g", estimator->fpRate);
+            if (estimator->acceptHits != NULL && refDB == NULL)
+                slog(0, SLOG_LIVE, "\t- stopping checks early at %.3g confidence", estimator->confidence);
+            slog(0, SLOG_INFO, "starting the daemon...");
+            err = startDaemon(amConfig, wargs, pidFile);
+        }
+
+        // the daemon has been killed (or failed to start)
+        if (err == 0 && wargs->runTracker != NULL)
+            logSketchSummary(wargs, wargs->runTracker->sketch, "run");
+        if (err == 0 && wargs->coverage != NULL)
+        {
+            char *depths = coverageRender(wargs->coverage);
+            if (depths != NULL)
+            {
+                slog(0, SLOG_INFO, "reference coverage:");
+                char *line, *save;
+                for (line = strtok_r(depths, "\n", &save); line != NULL; line = strtok_r(NULL, "\n", &save))
+                    slog(0, SLOG_LIVE, "\t%s", line);
+                free(depths);
+            }
+        }
+        if (err == 0 && wargs->decide != NULL)
         {
-            free(wargs);
+            char *decisions = decideRender(wargs->decide);
+            if (decisions != NULL)
+            {
+                slog(0, SLOG_INFO, "decision service:");
+                char *line, *save;
+                for (line = strtok_r(decisions, "\n", &save); line != NULL; line = strtok_r(NULL, "\n", &save))
+                    slog(0, SLOG_LIVE, "\t%s", line);
+                free(decisions);
+            }
+        }
+        runTrackerDestroy(wargs->runTracker);
+        coverageDestroy(wargs->coverage);
+        decideDestroy(wargs->decide);
+        free(wargs);
+        estimatorDestroy(estimator);
+        if (useBloom)
             bloom_free(&refBF);
+        sharedBloomDetach(sharedBF);
+        refdbClose(refDB);
+        if (err != 0)
+        {
             destroyConfig(amConfig);
             return 1;
         }
-
-        // daemon has been killed
-        free(wargs);
-        bloom_free(&refBF);
     }
 
     // end of play - no more requests
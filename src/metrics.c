@@ -0,0 +1,466 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "histogram.h"
+#include "metrics.h"
+#include "slog.h"
+
+// shards are handed out to threads round robin, threads beyond the limit share shards
+#define METRICS_MAX_SHARDS 64
+#define METRICS_NUM_BUCKETS 20
+#define METRICS_REQUEST_SIZE 1024
+#define METRICS_POLL_MS 250 // how often the listener checks for a stop request, and how long it waits on a client
+#define METRICS_MAX_PAGES 4
+
+// upper bucket bounds for the histograms in nanoseconds (the final bucket is +Inf)
+static const uint64_t bucketBounds[METRICS_NUM_BUCKETS - 1] = {
+    1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000,
+    1000000, 2500000, 5000000, 10000000, 25000000, 50000000, 100000000,
+    250000000, 500000000, 1000000000};
+
+// metricInfo describes how a metric is exported
+typedef struct metricInfo
+{
+    const char *name;
+    const char *help;
+    const char *type;
+} metricInfo_t;
+
+static const metricInfo_t metricInfo[AM_METRIC_COUNT] = {
+    {"antman_watcher_events_total", "File events seen by the directory watcher.", "counter"},
+    {"antman_files_queued_total", "FASTQ files sent to the workerpool.", "counter"},
+    {"antman_files_processed_total", "FASTQ files processed by the workerpool.", "counter"},
+    {"antman_reads_total", "Reads classified.", "counter"},
+    {"antman_bases_total", "Bases classified.", "counter"},
+    {"antman_reads_matched_total", "Reads with a containment estimate above the match threshold.", "counter"},
+    {"antman_bloom_lookups_total", "Bloom filter lookups.", "counter"},
+    {"antman_bloom_lookups_saved_total", "Bloom filter lookups skipped once the sequential test decided a read.", "counter"},
+    {"antman_queue_depth", "Work waiting in the workerpool queue.", "gauge"},
+    {"antman_workers_busy", "Workers currently processing.", "gauge"},
+    {"antman_decisions_total", "Read chunks answered by the decision service.", "counter"},
+    {"antman_decisions_late_total", "Decision service responses that missed the deadline.", "counter"},
+};
+
+static const metricInfo_t histInfo[AM_HIST_COUNT] = {
+    {"antman_sketch_duration_seconds", "Time to sketch one sequence.", "histogram"},
+    {"antman_bloom_check_duration_seconds", "Time to check one read sketch against the bloom filter.", "histogram"},
+    {"antman_file_duration_seconds", "Time to process one FASTQ file.", "histogram"},
+    {"antman_decision_duration_seconds", "Time to answer one decision service request.", "histogram"},
+};
+
+static const char *stageNames[AM_STAGE_COUNT] = {
+    "notify", "enqueue", "queue", "parse", "sketch", "containment", "total"};
+
+// the quantiles reported for each stage
+#define METRICS_NUM_QUANTILES 4
+static const double stageQuantiles[METRICS_NUM_QUANTILES] = {50.0, 90.0, 99.0, 99.9};
+
+// stage histograms are recorded once per file, so they are shared rather than sharded
+static histogram_t stages[AM_STAGE_COUNT];
+
+// metricsShard holds the values recorded by one thread (padded to avoid false sharing)
+typedef struct metricsShard
+{
+    int64_t values[AM_METRIC_COUNT];
+    uint64_t buckets[AM_HIST_COUNT][METRICS_NUM_BUCKETS];
+    uint64_t sums[AM_HIST_COUNT];
+} __attribute__((aligned(64))) metricsShard_t;
+
+static metricsShard_t shards[METRICS_MAX_SHARDS];
+static unsigned int nextShard = 0;
+static __thread metricsShard_t *threadShard = NULL;
+
+// metricsBuf is a growable string used to render the exposition text
+typedef struct metricsBuf
+{
+    char *s;
+    size_t len;
+    size_t cap;
+} metricsBuf_t;
+
+// the HTTP listener
+static int listenFD = -1;
+static int listening = 0;
+static pthread_t listenThread;
+
+// metricsPage is an extra page served by the listener, rendered by another module
+typedef struct metricsPage
+{
+    const char *path;
+    char *(*render)(void *ctx);
+    void *ctx;
+} metricsPage_t;
+static metricsPage_t pages[METRICS_MAX_PAGES];
+static int nPages = 0;
+
+// getShard returns the calling thread's shard, assigning one on first use
+static inline metricsShard_t *getShard(void)
+{
+    if (threadShard == NULL)
+    {
+        unsigned int id = __atomic_fetch_add(&nextShard, 1, __ATOMIC_RELAXED);
+        threadShard = &shards[id % METRICS_MAX_SHARDS];
+    }
+    return threadShard;
+}
+
+// metricsNow returns a monotonic timestamp in nanoseconds
+uint64_t metricsNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// metricsAdd adds a value to a counter or gauge (use a negative value to decrement a gauge)
+void metricsAdd(metric_t metric, int64_t value)
+{
+    __atomic_fetch_add(&getShard()->values[metric], value, __ATOMIC_RELAXED);
+}
+
+// metricsObserve records a duration in a histogram
+void metricsObserve(metricHist_t hist, uint64_t ns)
+{
+    metricsShard_t *shard = getShard();
+    int i = 0;
+    while (i < METRICS_NUM_BUCKETS - 1 && ns > bucketBounds[i])
+        i++;
+    __atomic_fetch_add(&shard->buckets[hist][i], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&shard->sums[hist], ns, __ATOMIC_RELAXED);
+}
+
+// metricsStage records the latency of a pipeline stage for one file
+void metricsStage(metricStage_t stage, uint64_t ns)
+{
+    histRecord(&stages[stage], ns);
+}
+
+// metricsGet sums a counter or gauge across all shards
+int64_t metricsGet(metric_t metric)
+{
+    int64_t total = 0;
+    int i;
+    for (i = 0; i < METRICS_MAX_SHARDS; i++)
+        total += __atomic_load_n(&shards[i].values[metric], __ATOMIC_RELAXED);
+    return total;
+}
+
+// bufPrintf appends formatted text to a metricsBuf, growing it as needed
+static int bufPrintf(metricsBuf_t *buf, const char *fmt, ...)
+{
+    va_list args;
+    int n;
+    while (1)
+    {
+        va_start(args, fmt);
+        n = vsnprintf(buf->s + buf->len, buf->cap - buf->len, fmt, args);
+        va_end(args);
+        if (n < 0)
+            return 1;
+        if ((size_t)n < buf->cap - buf->len)
+            break;
+        size_t cap = buf->cap * 2 + n;
+        char *s = realloc(buf->s, cap);
+        if (s == NULL)
+            return 1;
+        buf->s = s;
+        buf->cap = cap;
+    }
+    buf->len += n;
+    return 0;
+}
+
+// metricsRender returns the metrics in the Prometheus text format (caller frees)
+char *metricsRender(void)
+{
+    metricsBuf_t buf = {malloc(4096), 0, 4096};
+    if (buf.s == NULL)
+        return NULL;
+    buf.s[0] = '\0';
+    int i, j, k;
+
+    for (i = 0; i < AM_METRIC_COUNT; i++)
+    {
+        bufPrintf(&buf, "# HELP %s %s\n# TYPE %s %s\n%s %lld\n",
+                  metricInfo[i].name, metricInfo[i].help,
+                  metricInfo[i].name, metricInfo[i].type,
+                  metricInfo[i].name, (long long)metricsGet(i));
+    }
+    bufPrintf(&buf, "# HELP antman_log_dropped_total Log messages dropped by the async logger.\n"
+                    "# TYPE antman_log_dropped_total counter\nantman_log_dropped_total %lu\n",
+              slog_async_dropped());
+
+    for (i = 0; i < AM_HIST_COUNT; i++)
+    {
+        uint64_t counts[METRICS_NUM_BUCKETS] = {0}, sum = 0, cumulative = 0;
+        for (j = 0; j < METRICS_MAX_SHARDS; j++)
+        {
+            for (k = 0; k < METRICS_NUM_BUCKETS; k++)
+                counts[k] += __atomic_load_n(&shards[j].buckets[i][k], __ATOMIC_RELAXED);
+            sum += __atomic_load_n(&shards[j].sums[i], __ATOMIC_RELAXED);
+        }
+        bufPrintf(&buf, "# HELP %s %s\n# TYPE %s %s\n", histInfo[i].name, histInfo[i].help, histInfo[i].name, histInfo[i].type);
+        for (k = 0; k < METRICS_NUM_BUCKETS; k++)
+        {
+            cumulative += counts[k];
+            if (k < METRICS_NUM_BUCKETS - 1)
+                bufPrintf(&buf, "%s_bucket{le=\"%g\"} %llu\n", histInfo[i].name, bucketBounds[k] / 1e9, (unsigned long long)cumulative);
+            else
+                bufPrintf(&buf, "%s_bucket{le=\"+Inf\"} %llu\n", histInfo[i].name, (unsigned long long)cumulative);
+        }
+        bufPrintf(&buf, "%s_sum %.9f\n%s_count %llu\n", histInfo[i].name, sum / 1e9, histInfo[i].name, (unsigned long long)cumulative);
+    }
+
+    bufPrintf(&buf, "# HELP antman_stage_latency_seconds Per-file latency of each pipeline stage.\n"
+                    "# TYPE antman_stage_latency_seconds summary\n");
+    for (i = 0; i < AM_STAGE_COUNT; i++)
+    {
+        for (k = 0; k < METRICS_NUM_QUANTILES; k++)
+            bufPrintf(&buf, "antman_stage_latency_seconds{stage=\"%s\",quantile=\"%g\"} %.9f\n",
+                      stageNames[i], stageQuantiles[k] / 100.0, histPercentile(&stages[i], stageQuantiles[k]) / 1e9);
+        bufPrintf(&buf, "antman_stage_latency_seconds_count{stage=\"%s\"} %llu\n", stageNames[i], (unsigned long long)histCount(&stages[i]));
+    }
+    return buf.s;
+}
+
+// metricsRenderStages returns a table of the stage latencies in milliseconds (caller frees)
+char *metricsRenderStages(void)
+{
+    metricsBuf_t buf = {malloc(1024), 0, 1024};
+    if (buf.s == NULL)
+        return NULL;
+    buf.s[0] = '\0';
+    int i, k;
+    bufPrintf(&buf, "%-12s %10s", "stage", "files");
+    for (k = 0; k < METRICS_NUM_QUANTILES; k++)
+        bufPrintf(&buf, "   p%-7g", stageQuantiles[k]);
+    bufPrintf(&buf, "   %-8s\n", "max (ms)");
+    for (i = 0; i < AM_STAGE_COUNT; i++)
+    {
+        bufPrintf(&buf, "%-12s %10llu", stageNames[i], (unsigned long long)histCount(&stages[i]));
+        for (k = 0; k < METRICS_NUM_QUANTILES; k++)
+            bufPrintf(&buf, " %10.3f", histPercentile(&stages[i], stageQuantiles[k]) / 1e6);
+        bufPrintf(&buf, " %10.3f\n", histMax(&stages[i]) / 1e6);
+    }
+    return buf.s;
+}
+
+// writeAll writes a buffer to a socket, retrying on short writes
+static void writeAll(int fd, const char *buf, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, buf, len);
+        if (n <= 0)
+            return;
+        buf += n;
+        len -= n;
+    }
+}
+
+// isPath checks if a request is a GET for a path, so /metrics doesn't also match /metricsXYZ
+static int isPath(const char *request, const char *path)
+{
+    size_t len = strlen(path);
+    return strncmp(request, "GET ", 4) == 0 && strncmp(request + 4, path, len) == 0 && (request[4 + len] == ' ' || request[4 + len] == '?');
+}
+
+/*
+    serveRequest answers a single HTTP request on a connected socket
+    - the socket has send and receive timeouts, so a client that stalls can't hold up the listener (and shutdown)
+*/
+static void serveRequest(int fd)
+{
+    char request[METRICS_REQUEST_SIZE];
+    char header[128];
+    struct timeval timeout = {METRICS_POLL_MS / 1000, (METRICS_POLL_MS % 1000) * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    ssize_t n = read(fd, request, sizeof(request) - 1);
+    if (n <= 0)
+        return;
+    request[n] = '\0';
+
+    char *body = NULL;
+    int i, found = 1;
+    if (isPath(request, "/metrics"))
+        body = metricsRender();
+    else if (isPath(request, "/stats"))
+        body = metricsRenderStages();
+    else
+    {
+        // the pages added by other modules
+        found = 0;
+        for (i = 0; i < nPages && !found; i++)
+        {
+            if (isPath(request, pages[i].path))
+            {
+                body = pages[i].render(pages[i].ctx);
+                found = 1;
+            }
+        }
+    }
+    if (!found)
+    {
+        const char *notFound = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+        writeAll(fd, notFound, strlen(notFound));
+        return;
+    }
+    if (body == NULL)
+        return;
+    size_t bodyLen = strlen(body);
+    int headerLen = snprintf(header, sizeof(header),
+                             "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+                             bodyLen);
+    writeAll(fd, header, headerLen);
+    writeAll(fd, body, bodyLen);
+    free(body);
+}
+
+// serveMetrics is the listener thread, it polls so that it can notice a stop request
+static void *serveMetrics(void *arg)
+{
+    struct pollfd pfd = {listenFD, POLLIN, 0};
+    while (__atomic_load_n(&listening, __ATOMIC_ACQUIRE))
+    {
+        if (poll(&pfd, 1, METRICS_POLL_MS) <= 0)
+            continue;
+        int fd = accept(listenFD, NULL, NULL);
+        if (fd < 0)
+            continue;
+        serveRequest(fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+/*
+    metricsAddPage adds a page to the listener, render returns its body (caller frees) and is called on the listener thread
+    - pages must be added before the listener is started
+    - returns 0 on success, or 1 if there are already METRICS_MAX_PAGES pages
+*/
+int metricsAddPage(const char *path, char *(*render)(void *ctx), void *ctx)
+{
+    if (nPages == METRICS_MAX_PAGES)
+        return 1;
+    pages[nPages++] = (metricsPage_t){.path = path, .render = render, .ctx = ctx};
+    return 0;
+}
+
+/*
+    metricsListen binds the listener's port on localhost without serving it yet
+    - the daemon calls it before forking, so a port that is already in use fails `antman --start`
+    - returns the listening socket, or -1 with errno set
+*/
+int metricsListen(int port)
+{
+    struct sockaddr_in addr;
+    int on = 1;
+    if ((listenFD = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+        return -1;
+    setsockopt(listenFD, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(listenFD, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listenFD, 16) != 0)
+    {
+        int err = errno;
+        close(listenFD);
+        listenFD = -1;
+        errno = err;
+        return -1;
+    }
+    return listenFD;
+}
+
+// metricsStartServer starts a HTTP listener on localhost which serves /metrics, binding the port if metricsListen hasn't
+int metricsStartServer(int port)
+{
+    if (listenFD < 0 && metricsListen(port) < 0)
+        return 1;
+    listening = 1;
+    if (pthread_create(&listenThread, NULL, serveMetrics, NULL))
+    {
+        listening = 0;
+        close(listenFD);
+        listenFD = -1;
+        return 1;
+    }
+    return 0;
+}
+
+// metricsStopServer shuts down the listener and waits for its thread
+void metricsStopServer(void)
+{
+    if (listenFD < 0)
+        return;
+    if (__atomic_exchange_n(&listening, 0, __ATOMIC_ACQ_REL))
+        pthread_join(listenThread, NULL);
+    close(listenFD);
+    listenFD = -1;
+}
+
+// metricsFetch requests a path from a running daemon's listener and returns the body (caller frees)
+char *metricsFetch(int port, const char *path)
+{
+    struct sockaddr_in addr;
+    char request[128];
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return NULL;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        close(fd);
+        return NULL;
+    }
+    int len = snprintf(request, sizeof(request), "GET %s HTTP/1.0\r\n\r\n", path);
+    writeAll(fd, request, len);
+
+    // read the whole response, the server closes the connection when done
+    metricsBuf_t buf = {malloc(4096), 0, 4096};
+    ssize_t n;
+    while (buf.s != NULL)
+    {
+        if (buf.cap - buf.len < 1024)
+        {
+            char *s = realloc(buf.s, buf.cap * 2);
+            if (s == NULL)
+                break;
+            buf.s = s;
+            buf.cap *= 2;
+        }
+        if ((n = read(fd, buf.s + buf.len, buf.cap - buf.len - 1)) <= 0)
+            break;
+        buf.len += n;
+    }
+    close(fd);
+    if (buf.s == NULL)
+        return NULL;
+    buf.s[buf.len] = '\0';
+
+    // only hand back the body of a 200 response
+    char *body = strstr(buf.s, "\r\n\r\n");
+    if (strncmp(buf.s, "HTTP/1.0 200", 12) != 0 || body == NULL)
+    {
+        free(buf.s);
+        return NULL;
+    }
+    memmove(buf.s, body + 4, strlen(body + 4) + 1);
+    return buf.s;
+}
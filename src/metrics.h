@@ -0,0 +1,72 @@
+// metrics is a small registry of counters, gauges and histograms for the daemon
+// updates go to a per-thread shard and are only summed when the metrics are scraped
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    metric_t identifies a counter or gauge
+*/
+typedef enum metric
+{
+    AM_METRIC_WATCHER_EVENTS,  // file events seen by the watcher
+    AM_METRIC_FILES_QUEUED,    // FASTQ files sent to the workerpool
+    AM_METRIC_FILES_PROCESSED, // FASTQ files finished by a worker
+    AM_METRIC_READS,           // reads classified
+    AM_METRIC_BASES,           // bases classified
+    AM_METRIC_READS_MATCHED,   // reads with a containment estimate over the match threshold
+    AM_METRIC_BLOOM_LOOKUPS,   // bloom filter lookups
+    AM_METRIC_LOOKUPS_SAVED,   // bloom filter lookups skipped by the sequential test
+    AM_METRIC_QUEUE_DEPTH,     // gauge: work waiting in the workerpool
+    AM_METRIC_WORKERS_BUSY,    // gauge: workers currently processing
+    AM_METRIC_DECISIONS,       // read chunks answered by the decision service
+    AM_METRIC_DECISIONS_LATE,  // decisions that missed the deadline
+    AM_METRIC_COUNT
+} metric_t;
+
+/*
+    metricHist_t identifies a latency histogram
+*/
+typedef enum metricHist
+{
+    AM_HIST_SKETCH,      // time to sketch one sequence
+    AM_HIST_BLOOM_CHECK, // time to check one read sketch against the bloom filter
+    AM_HIST_FILE,        // time to process one FASTQ file
+    AM_HIST_DECISION,    // time to answer one decision service request
+    AM_HIST_COUNT
+} metricHist_t;
+
+/*
+    metricStage_t identifies a pipeline stage for the per-file latency histograms
+*/
+typedef enum metricStage
+{
+    AM_STAGE_NOTIFY,      // file created -> watcher event (1s resolution)
+    AM_STAGE_ENQUEUE,     // watcher event -> work queued
+    AM_STAGE_QUEUE,       // work queued -> worker picked it up
+    AM_STAGE_PARSE,       // time spent parsing FASTQ records in the file
+    AM_STAGE_SKETCH,      // time spent sketching reads in the file
+    AM_STAGE_CONTAINMENT, // time spent on containment checks in the file
+    AM_STAGE_TOTAL,       // file created -> all reads in the file classified
+    AM_STAGE_COUNT
+} metricStage_t;
+
+/*
+    function prototypes
+*/
+uint64_t metricsNow(void);
+void metricsAdd(metric_t metric, int64_t value);
+void metricsObserve(metricHist_t hist, uint64_t ns);
+void metricsStage(metricStage_t stage, uint64_t ns);
+int64_t metricsGet(metric_t metric);
+char *metricsRender(void);
+char *metricsRenderStages(void);
+char *metricsFetch(int port, const char *path);
+int metricsAddPage(const char *path, char *(*render)(void *ctx), void *ctx);
+int metricsListen(int port);
+int metricsStartServer(int port);
+void metricsStopServer(void);
+
+#endif
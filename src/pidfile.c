@@ -0,0 +1,101 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pidfile.h"
+
+// sleepMS sleeps for a number of milliseconds
+static void sleepMS(int ms)
+{
+    struct timespec ts = {ms / 1000, (ms % 1000) * 1000000L};
+    nanosleep(&ts, NULL);
+}
+
+/*
+    pidFileLock opens the PID file and takes the daemon's lock on it, without waiting
+    - the file descriptor is kept open (and so the lock held) through forks, until the last copy is closed
+    - returns the file descriptor, -2 if another daemon holds the lock, or -1 on error
+*/
+int pidFileLock(const char *path)
+{
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+        return -1;
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0)
+    {
+        int held = (errno == EWOULDBLOCK);
+        close(fd);
+        return held ? -2 : -1;
+    }
+    return fd;
+}
+
+// pidFileWrite replaces the PID in a locked PID file, returns 0 on success
+int pidFileWrite(int fd, pid_t pid)
+{
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), "%d\n", (int)pid);
+    if (ftruncate(fd, 0) != 0 || pwrite(fd, buf, len, 0) != len)
+        return 1;
+    return 0;
+}
+
+// readPID reads the PID from a PID file, returns -1 if it is empty or unreadable
+static pid_t readPID(int fd)
+{
+    char buf[32];
+    ssize_t len = pread(fd, buf, sizeof(buf) - 1, 0);
+    if (len <= 0)
+        return -1;
+    buf[len] = '\0';
+    char *end;
+    long pid = strtol(buf, &end, 10);
+    if (end == buf || *end != '\n' || pid <= 0)
+        return -1;
+    return (pid_t)pid;
+}
+
+/*
+    pidFileCheck returns the PID of the running daemon, or -1 if no daemon is running
+    - a daemon is running if the PID file is locked, in which case the PID is read from it
+    - a daemon that is still starting up is given AM_PIDFILE_WAIT_MS to record its PID
+*/
+pid_t pidFileCheck(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    pid_t pid = -1;
+    int waited;
+    for (waited = 0; waited <= AM_PIDFILE_WAIT_MS; waited += 10)
+    {
+        if (flock(fd, LOCK_SH | LOCK_NB) == 0)
+        {
+            pid = -1;
+            break;
+        }
+        if (errno != EWOULDBLOCK || (pid = readPID(fd)) > 0)
+            break;
+        sleepMS(10);
+    }
+    close(fd);
+    return pid;
+}
+
+// pidFileWaitExit waits up to secs for the daemon to release the PID file, returns 0 once it has
+int pidFileWaitExit(const char *path, int secs)
+{
+    int waited;
+    for (waited = 0; waited <= secs * 1000; waited += 10)
+    {
+        if (pidFileCheck(path) == -1)
+            return 0;
+        sleepMS(10);
+    }
+    return 1;
+}
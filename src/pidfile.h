@@ -0,0 +1,25 @@
+// pidfile records the daemon's PID in a file that the daemon keeps locked for as long as it runs
+#ifndef PIDFILE_H
+#define PIDFILE_H
+
+#include <sys/types.h>
+
+#define AM_PIDFILE_EXT ".pid"     // the PID file is kept next to the config, with this added to its name
+#define AM_PIDFILE_WAIT_MS 1000   // how long to wait for a starting daemon to record its PID
+#define AM_PIDFILE_STOP_SECS 30   // how long pidFileWaitExit waits for a stopping daemon
+
+/*
+    the daemon holds an exclusive flock on the PID file until it exits, so the lock says whether it is running
+    - the kernel drops the lock when the daemon dies, however it dies, so a PID left in the file is never trusted
+    - the file holds the daemon's PID in decimal, followed by a newline
+*/
+
+/*
+    function prototypes
+*/
+int pidFileLock(const char *path);
+int pidFileWrite(int fd, pid_t pid);
+pid_t pidFileCheck(const char *path);
+int pidFileWaitExit(const char *path, int secs);
+
+#endif
@@ -0,0 +1,1121 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "kseq.h"
+#include "refdb.h"
+#include "sketch.h"
+#include "slog.h"
+#include "workerpool.h"
+
+KSEQ_INIT(gzFile, gzread)
+
+/*
+    refdbRef_t holds a reference while the database is being built
+*/
+typedef struct refdbRef
+{
+    char *name;
+    uint64_t length;
+    uint64_t *hashes;
+    int nHashes;
+    uint32_t index;
+} refdbRef_t;
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+// fnv1a hashes a reference name for the table of contents
+static uint64_t fnv1a(const char *str, size_t len)
+{
+    uint64_t h = FNV_OFFSET;
+    size_t i;
+    for (i = 0; i < len; i++)
+    {
+        h ^= (uint8_t)str[i];
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+// checksum carries on an FNV-1a hash over a block a 64 bit word at a time (then any trailing bytes), to spot a damaged database
+static uint64_t checksum(uint64_t h, const void *data, uint64_t size)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    uint64_t i, word;
+    for (i = 0; i + sizeof(word) <= size; i += sizeof(word))
+    {
+        memcpy(&word, p + i, sizeof(word));
+        h ^= word;
+        h *= FNV_PRIME;
+    }
+    for (; i < size; i++)
+    {
+        h ^= p[i];
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+// headerChecksum returns the checksum of a header and its section directory
+static uint64_t headerChecksum(const refdbHeader_t *header, const refdbSection_t *sections)
+{
+    refdbHeader_t copy = *header;
+    copy.checksum = 0;
+    return checksum(checksum(FNV_OFFSET, &copy, sizeof(copy)), sections, header->nSections * sizeof(refdbSection_t));
+}
+
+// alignUp rounds an offset up to the section alignment
+static uint64_t alignUp(uint64_t offset)
+{
+    return (offset + AM_REFDB_ALIGN - 1) & ~(uint64_t)(AM_REFDB_ALIGN - 1);
+}
+
+// compareEntries orders the table of contents by name hash, then by FASTA position
+static int compareEntries(const void *a, const void *b)
+{
+    const refdbEntry_t *x = (const refdbEntry_t *)a, *y = (const refdbEntry_t *)b;
+    if (x->nameHash != y->nameHash)
+        return (x->nameHash > y->nameHash) - (x->nameHash < y->nameHash);
+    return (x->index > y->index) - (x->index < y->index);
+}
+
+// writeAll writes a buffer to a file descriptor, returns 0 on success
+static int writeAll(int fd, const void *buf, size_t len)
+{
+    const char *p = (const char *)buf;
+    while (len > 0)
+    {
+        ssize_t n = write(fd, p, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return 1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// writePadding pads the file out to the next section boundary
+static int writePadding(int fd, uint64_t *offset)
+{
+    static const char zeros[AM_REFDB_ALIGN] = {0};
+    uint64_t next = alignUp(*offset);
+    if (next != *offset && writeAll(fd, zeros, next - *offset) != 0)
+        return 1;
+    *offset = next;
+    return 0;
+}
+
+/*
+    refdbBlock_t is a section waiting to be written
+*/
+typedef struct refdbBlock
+{
+    uint32_t id;
+    const void *data;
+    uint64_t size;
+} refdbBlock_t;
+
+// writeDB writes the header, section directory and sections to an open file
+static int writeDB(int fd, refdbHeader_t *header, const refdbBlock_t *blocks, int nBlocks)
+{
+    refdbSection_t sections[nBlocks];
+    uint64_t offset = sizeof(refdbHeader_t) + sizeof(sections), next = offset;
+    int i;
+
+    // lay out the sections
+    for (i = 0; i < nBlocks; i++)
+    {
+        sections[i] = (refdbSection_t){.id = blocks[i].id, .offset = alignUp(next), .size = blocks[i].size, .checksum = checksum(FNV_OFFSET, blocks[i].data, blocks[i].size)};
+        next = sections[i].offset + sections[i].size;
+    }
+    header->nSections = nBlocks;
+    header->fileSize = next;
+    header->checksum = headerChecksum(header, sections);
+
+    if (writeAll(fd, header, sizeof(*header)) != 0 || writeAll(fd, sections, sizeof(sections)) != 0)
+        return 1;
+    for (i = 0; i < nBlocks; i++)
+    {
+        if (writePadding(fd, &offset) != 0 || writeAll(fd, blocks[i].data, blocks[i].size) != 0)
+            return 1;
+        offset += blocks[i].size;
+    }
+    return 0;
+}
+
+/*
+    refdbPosting_t pairs a hashed k-mer with a reference while the index is built
+*/
+typedef struct refdbPosting
+{
+    uint64_t hash;
+    uint32_t ref;
+} refdbPosting_t;
+
+// comparePostings orders postings by hash, then by reference
+static int comparePostings(const void *a, const void *b)
+{
+    const refdbPosting_t *x = (const refdbPosting_t *)a, *y = (const refdbPosting_t *)b;
+    if (x->hash != y->hash)
+        return (x->hash > y->hash) - (x->hash < y->hash);
+    return (x->ref > y->ref) - (x->ref < y->ref);
+}
+
+// buildIndex builds the inverted index section from the table of contents, returns NULL if it could not be allocated
+static void *buildIndex(const refdbEntry_t *toc, int nRefs, const uint64_t *hashes, uint64_t nHashes, uint64_t *size)
+{
+    refdbPosting_t *pairs = malloc((nHashes ? nHashes : 1) * sizeof(refdbPosting_t));
+    if (pairs == NULL)
+        return NULL;
+    uint64_t n = 0, nKeys = 0, i, j;
+    int r;
+    for (r = 0; r < nRefs; r++)
+        for (i = 0; i < toc[r].nHashes; i++)
+            pairs[n++] = (refdbPosting_t){.hash = hashes[toc[r].hashOffset + i], .ref = (uint32_t)r};
+    qsort(pairs, n, sizeof(refdbPosting_t), comparePostings);
+    for (i = 0; i < n; i++)
+        nKeys += (i == 0 || pairs[i].hash != pairs[i - 1].hash);
+
+    // header, keys and offsets are all 8-byte aligned, so the postings follow straight on
+    *size = sizeof(refdbIndex_t) + nKeys * sizeof(uint64_t) + (nKeys + 1) * sizeof(uint64_t) + n * sizeof(uint32_t);
+    char *index = malloc(*size);
+    if (index == NULL)
+    {
+        free(pairs);
+        return NULL;
+    }
+    refdbIndex_t *header = (refdbIndex_t *)index;
+    uint64_t *keys = (uint64_t *)(index + sizeof(refdbIndex_t));
+    uint64_t *offsets = keys + nKeys;
+    uint32_t *postings = (uint32_t *)(offsets + nKeys + 1);
+    header->nKeys = nKeys;
+    header->nPostings = n;
+    for (i = 0, j = 0; i < n; i++)
+    {
+        if (i == 0 || pairs[i].hash != pairs[i - 1].hash)
+        {
+            keys[j] = pairs[i].hash;
+            offsets[j++] = i;
+        }
+        postings[i] = pairs[i].ref;
+    }
+    offsets[nKeys] = n;
+    free(pairs);
+    return index;
+}
+
+// syncDir flushes a directory entry so a rename survives a crash
+static void syncDir(const char *path)
+{
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", path);
+    int fd = open(dirname(dir), O_RDONLY);
+    if (fd < 0)
+        return;
+    fsync(fd);
+    close(fd);
+}
+
+// compareHashes orders hashed k-mers for qsort
+static int compareHashes(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+    refdbChunk_t is a piece of a reference record, sketched on the workerpool
+    - chunks of a long record overlap by k-1 bases so no k-mer is lost at the boundaries
+*/
+typedef struct refdbChunk
+{
+    struct refdbBuilder *builder;
+    int ref;          // position of the record in the FASTA
+    uint64_t *hashes; // the chunk's scaled sketch
+    int nHashes;
+    uint64_t *kmers;  // and all of its distinct hashed k-mers, with AM_REFDB_KMERS
+    int nKmers;
+    int len;
+    char *seq;        // freed once the chunk is sketched
+} refdbChunk_t;
+
+/*
+    refdbBuilder_t holds the state shared by the reader and the workers
+*/
+typedef struct refdbBuilder
+{
+    int k;
+    uint64_t maxHash;
+    int withKmers;
+    pthread_mutex_t lock;
+    pthread_cond_t cond; // signalled when a chunk finishes
+    int inFlight;        // chunks queued or being sketched
+    int maxInFlight;     // bounds the memory held by queued chunks
+    int err;
+} refdbBuilder_t;
+
+// sketchChunk is run by the workerpool, it sketches a chunk and collects its k-mers
+static void sketchChunk(void *arg)
+{
+    refdbChunk_t *chunk = (refdbChunk_t *)arg;
+    refdbBuilder_t *builder = chunk->builder;
+    int err = 0;
+    if ((chunk->nHashes = scaledSequence(chunk->seq, chunk->len, builder->k, builder->maxHash, &chunk->hashes)) < 0)
+    {
+        chunk->hashes = NULL;
+        chunk->nHashes = 0;
+        err = 1;
+    }
+    if (builder->withKmers && (chunk->nKmers = scaledSequence(chunk->seq, chunk->len, builder->k, scaledMaxHash(builder->k, 1), &chunk->kmers)) < 0)
+    {
+        chunk->kmers = NULL;
+        chunk->nKmers = 0;
+        err = 1;
+    }
+    free(chunk->seq);
+    chunk->seq = NULL;
+    pthread_mutex_lock(&builder->lock);
+    builder->err |= err;
+    builder->inFlight--;
+    pthread_cond_signal(&builder->cond);
+    pthread_mutex_unlock(&builder->lock);
+}
+
+// queueChunk copies part of a record and sends it to the workerpool, waiting if too many are already queued
+static int queueChunk(refdbBuilder_t *builder, tpool_t *wp, refdbChunk_t *chunk, const char *seq, int len)
+{
+    if ((chunk->seq = malloc(len)) == NULL)
+        return 1;
+    chunk->builder = builder;
+    chunk->len = len;
+    memcpy(chunk->seq, seq, len);
+    pthread_mutex_lock(&builder->lock);
+    while (builder->inFlight >= builder->maxInFlight)
+        pthread_cond_wait(&builder->cond, &builder->lock);
+    builder->inFlight++;
+    pthread_mutex_unlock(&builder->lock);
+    if (!tpool_add_work(wp, sketchChunk, chunk))
+    {
+        pthread_mutex_lock(&builder->lock);
+        builder->inFlight--;
+        pthread_mutex_unlock(&builder->lock);
+        free(chunk->seq);
+        chunk->seq = NULL;
+        return 1;
+    }
+    return 0;
+}
+
+// mergeSketch joins the sketches of a record's chunks into one sorted, unique sketch, returns 0 on success
+static int mergeSketch(refdbRef_t *ref, refdbChunk_t **chunks, int nChunks)
+{
+    int i, n = 0, unique = 0;
+    if (nChunks == 1)
+    {
+        ref->hashes = chunks[0]->hashes;
+        ref->nHashes = chunks[0]->nHashes;
+        chunks[0]->hashes = NULL;
+        return 0;
+    }
+    for (i = 0; i < nChunks; i++)
+        n += chunks[i]->nHashes;
+    if ((ref->hashes = malloc((n ? n : 1) * sizeof(uint64_t))) == NULL)
+        return 1;
+    for (i = 0, n = 0; i < nChunks; i++)
+    {
+        memcpy(ref->hashes + n, chunks[i]->hashes, chunks[i]->nHashes * sizeof(uint64_t));
+        n += chunks[i]->nHashes;
+    }
+    qsort(ref->hashes, n, sizeof(uint64_t), compareHashes);
+    for (i = 0; i < n; i++)
+        if (unique == 0 || ref->hashes[i] != ref->hashes[unique - 1])
+            ref->hashes[unique++] = ref->hashes[i];
+    ref->nHashes = unique;
+    return 0;
+}
+
+/*
+    refdbBucket_t is a range of the k-mer hashes, merged from every chunk by one worker
+*/
+typedef struct refdbBucket
+{
+    refdbChunk_t **chunks;
+    int nChunks;
+    const uint64_t *starts; // the bucket is starts[c] to ends[c] in each chunk's k-mers
+    const uint64_t *ends;
+    uint64_t *out;          // where the bucket goes in the merged array
+    uint64_t n;             // k-mers copied in, then distinct k-mer hashes after the merge
+} refdbBucket_t;
+
+// lowerBound returns the position of the first value >= v in a sorted array
+static uint64_t lowerBound(const uint64_t *values, uint64_t n, uint64_t v)
+{
+    uint64_t lo = 0, hi = n;
+    while (lo < hi)
+    {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (values[mid] < v)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// mergeBucket is run by the workerpool, it gathers a bucket from the chunks and sorts it into distinct k-mer hashes
+static void mergeBucket(void *arg)
+{
+    refdbBucket_t *bucket = (refdbBucket_t *)arg;
+    uint64_t n = 0, unique = 0, i;
+    int c;
+    for (c = 0; c < bucket->nChunks; c++)
+    {
+        memcpy(bucket->out + n, bucket->chunks[c]->kmers + bucket->starts[c], (bucket->ends[c] - bucket->starts[c]) * sizeof(uint64_t));
+        n += bucket->ends[c] - bucket->starts[c];
+    }
+    qsort(bucket->out, n, sizeof(uint64_t), compareHashes);
+
+    // the low byte of a hashed k-mer is the k-mer size, so only the hash is kept
+    for (i = 0; i < n; i++)
+        if (unique == 0 || bucket->out[i] != bucket->out[unique - 1])
+            bucket->out[unique++] = bucket->out[i];
+    for (i = 0; i < unique; i++)
+        bucket->out[i] >>= 8;
+    bucket->n = unique;
+}
+
+/*
+    mergeKmers merges the k-mers of every chunk into one sorted array of distinct k-mer hashes
+    - the hash range is split into buckets that are merged in parallel, then packed together
+    - the chunks' k-mers are freed as they are no longer needed
+    - returns the array (caller frees) and sets n, or returns NULL if it could not be allocated
+*/
+static uint64_t *mergeKmers(refdbChunk_t **chunks, int nChunks, int k, tpool_t *wp, int nBuckets, uint64_t *n)
+{
+    uint64_t total = 0, universe = scaledMaxHash(k, 1) + 1;
+    int b, c;
+    for (c = 0; c < nChunks; c++)
+        total += chunks[c]->nKmers;
+    uint64_t *kmers = malloc((total ? total : 1) * sizeof(uint64_t));
+    uint64_t *bounds = malloc((uint64_t)(nBuckets + 1) * (nChunks ? nChunks : 1) * sizeof(uint64_t));
+    refdbBucket_t *buckets = calloc(nBuckets, sizeof(refdbBucket_t));
+    if (kmers == NULL || bounds == NULL || buckets == NULL)
+    {
+        free(kmers);
+        free(bounds);
+        free(buckets);
+        return NULL;
+    }
+
+    // bounds[b * nChunks + c] is where bucket b starts in chunk c
+    for (b = 0; b <= nBuckets; b++)
+        for (c = 0; c < nChunks; c++)
+            bounds[(uint64_t)b * nChunks + c] = (b == nBuckets) ? (uint64_t)chunks[c]->nKmers : lowerBound(chunks[c]->kmers, chunks[c]->nKmers, (universe / nBuckets * b) << 8);
+    uint64_t offset = 0;
+    for (b = 0; b < nBuckets; b++)
+    {
+        buckets[b] = (refdbBucket_t){.chunks = chunks, .nChunks = nChunks, .starts = bounds + (uint64_t)b * nChunks, .ends = bounds + (uint64_t)(b + 1) * nChunks, .out = kmers + offset};
+        for (c = 0; c < nChunks; c++)
+            offset += buckets[b].ends[c] - buckets[b].starts[c];
+        if (!tpool_add_work(wp, mergeBucket, &buckets[b]))
+            mergeBucket(&buckets[b]);
+    }
+    tpool_wait(wp);
+
+    // pack the buckets, which are already in order
+    for (b = 0, *n = 0; b < nBuckets; b++)
+    {
+        memmove(kmers + *n, buckets[b].out, buckets[b].n * sizeof(uint64_t));
+        *n += buckets[b].n;
+    }
+    for (c = 0; c < nChunks; c++)
+    {
+        free(chunks[c]->kmers);
+        chunks[c]->kmers = NULL;
+    }
+    free(bounds);
+    free(buckets);
+    return kmers;
+}
+
+/*
+    refdbBuild sketches each record in a FASTA file and writes the reference database
+    - each reference gets a scaled sketch, keeping roughly 1 in scaled of its distinct k-mers
+    - with AM_REFDB_KMERS, every distinct k-mer across the references is also stored in a compressed exact set
+    - records are parsed on the calling thread and split into chunks that are sketched by nThreads workers
+    - the file is written to a temporary name and renamed, so readers never see a partial database
+    - returns 0 on success
+*/
+int refdbBuild(const char *fastaPath, const char *dbPath, int k, uint64_t scaled, int flags, int nThreads)
+{
+    struct stat st;
+    if (stat(fastaPath, &st) != 0)
+    {
+        slog(0, SLOG_ERROR, "could not access the reference: %s", fastaPath);
+        return 1;
+    }
+    gzFile fp = gzopen(fastaPath, "r");
+    if (fp == NULL)
+    {
+        slog(0, SLOG_ERROR, "could not open the reference: %s", fastaPath);
+        return 1;
+    }
+    if (nThreads < 1)
+        nThreads = 1;
+
+    // split every record into chunks for the workers
+    kseq_t *seq = kseq_init(fp);
+    refdbRef_t *refs = NULL;
+    refdbChunk_t **chunks = NULL;
+    int nRefs = 0, capRefs = 0, nChunks = 0, capChunks = 0, l, i, j, err = 0;
+    uint64_t maxHash = scaledMaxHash(k, scaled), namesSize = 0, nHashes = 0;
+    uint64_t *kmers = NULL, nKmers = 0;
+    refdbBuilder_t builder = {.k = k, .maxHash = maxHash, .withKmers = (flags & AM_REFDB_KMERS), .maxInFlight = nThreads * AM_REFDB_CHUNKS_PER_THREAD};
+    pthread_mutex_init(&builder.lock, NULL);
+    pthread_cond_init(&builder.cond, NULL);
+    tpool_t *wp = tpool_create(nThreads);
+    while (!err && (l = kseq_read(seq)) >= 0)
+    {
+        if (nRefs == capRefs)
+        {
+            capRefs = capRefs ? capRefs * 2 : 64;
+            refdbRef_t *tmp = realloc(refs, capRefs * sizeof(refdbRef_t));
+            if (tmp == NULL)
+            {
+                err = 1;
+                break;
+            }
+            refs = tmp;
+        }
+        refdbRef_t *ref = &refs[nRefs];
+        memset(ref, 0, sizeof(refdbRef_t));
+        ref->length = seq->seq.l;
+        ref->index = nRefs;
+        if ((ref->name = strdup(seq->name.s)) == NULL)
+        {
+            err = 1;
+            break;
+        }
+        namesSize += strlen(ref->name) + 1;
+        nRefs++;
+
+        // each chunk holds the k-mers starting in [start, start + AM_REFDB_CHUNK_SIZE)
+        int start;
+        for (start = 0; !err && start < l - k + 1; start += AM_REFDB_CHUNK_SIZE)
+        {
+            int end = (start + AM_REFDB_CHUNK_SIZE + k - 1 < l) ? start + AM_REFDB_CHUNK_SIZE + k - 1 : l;
+            if (nChunks == capChunks)
+            {
+                capChunks = capChunks ? capChunks * 2 : 64;
+                refdbChunk_t **tmp = realloc(chunks, capChunks * sizeof(refdbChunk_t *));
+                if (tmp == NULL)
+                {
+                    err = 1;
+                    break;
+                }
+                chunks = tmp;
+            }
+            if ((chunks[nChunks] = calloc(1, sizeof(refdbChunk_t))) == NULL)
+            {
+                err = 1;
+                break;
+            }
+            chunks[nChunks]->ref = nRefs - 1;
+            if ((err = queueChunk(&builder, wp, chunks[nChunks], seq->seq.s + start, end - start)) != 0)
+                free(chunks[nChunks]);
+            else
+                nChunks++;
+        }
+    }
+    tpool_wait(wp);
+    kseq_destroy(seq);
+    gzclose(fp);
+    err |= builder.err;
+    if (err)
+        slog(0, SLOG_ERROR, "could not allocate the reference sketches");
+    else if (l != -1)
+    {
+        slog(0, SLOG_ERROR, "could not parse the reference: %s (%d)", fastaPath, l);
+        err = 1;
+    }
+    else if (nRefs == 0)
+    {
+        slog(0, SLOG_ERROR, "no sequences found in the reference: %s", fastaPath);
+        err = 1;
+    }
+
+    // join each record's chunks back together, and merge the k-mers across every record
+    for (i = 0, j = 0; !err && i < nChunks; i = j)
+    {
+        for (j = i; j < nChunks && chunks[j]->ref == chunks[i]->ref; j++)
+            ;
+        if ((err = mergeSketch(&refs[chunks[i]->ref], chunks + i, j - i)) != 0)
+            slog(0, SLOG_ERROR, "could not allocate the reference sketches");
+    }
+    for (i = 0; !err && i < nRefs; i++)
+        nHashes += refs[i].nHashes;
+    if (!err && (flags & AM_REFDB_KMERS) && (kmers = mergeKmers(chunks, nChunks, k, wp, nThreads * AM_REFDB_CHUNKS_PER_THREAD, &nKmers)) == NULL)
+    {
+        slog(0, SLOG_ERROR, "could not allocate the reference k-mers");
+        err = 1;
+    }
+    tpool_destroy(wp);
+    pthread_mutex_destroy(&builder.lock);
+    pthread_cond_destroy(&builder.cond);
+    for (i = 0; i < nChunks; i++)
+    {
+        free(chunks[i]->hashes);
+        free(chunks[i]->kmers);
+        free(chunks[i]);
+    }
+    free(chunks);
+
+    // pack the names and sketches, and build the table of contents
+    refdbEntry_t *toc = NULL;
+    char *names = NULL;
+    uint64_t *hashes = NULL;
+    void *index = NULL, *kmerSet = NULL;
+    uint64_t indexSize = 0, kmerSetSize = 0;
+    if (!err && ((toc = calloc(nRefs, sizeof(refdbEntry_t))) == NULL || (names = malloc(namesSize)) == NULL || (hashes = malloc((nHashes ? nHashes : 1) * sizeof(uint64_t))) == NULL))
+    {
+        slog(0, SLOG_ERROR, "could not allocate the reference table of contents");
+        err = 1;
+    }
+    if (!err)
+    {
+        uint64_t nameOffset = 0, hashOffset = 0;
+        for (i = 0; i < nRefs; i++)
+        {
+            toc[i].nameLen = strlen(refs[i].name);
+            toc[i].nameHash = fnv1a(refs[i].name, toc[i].nameLen);
+            toc[i].length = refs[i].length;
+            toc[i].nameOffset = nameOffset;
+            toc[i].hashOffset = hashOffset;
+            toc[i].nHashes = refs[i].nHashes;
+            toc[i].index = refs[i].index;
+            memcpy(names + nameOffset, refs[i].name, toc[i].nameLen + 1);
+            memcpy(hashes + hashOffset, refs[i].hashes, refs[i].nHashes * sizeof(uint64_t));
+            nameOffset += toc[i].nameLen + 1;
+            hashOffset += refs[i].nHashes;
+        }
+        qsort(toc, nRefs, sizeof(refdbEntry_t), compareEntries);
+        if ((index = buildIndex(toc, nRefs, hashes, nHashes, &indexSize)) == NULL)
+        {
+            slog(0, SLOG_ERROR, "could not allocate the reference index");
+            err = 1;
+        }
+    }
+    if (!err && (flags & AM_REFDB_KMERS) && (kmerSet = efBuild(kmers, nKmers, scaledMaxHash(k, 1) + 1, &kmerSetSize)) == NULL)
+    {
+        slog(0, SLOG_ERROR, "could not allocate the reference k-mer set");
+        err = 1;
+    }
+
+    // write the database to a temporary file and move it into place
+    if (!err)
+    {
+        char tmpPath[PATH_MAX];
+        if (snprintf(tmpPath, sizeof(tmpPath), "%s.tmp.%d", dbPath, (int)getpid()) >= (int)sizeof(tmpPath))
+        {
+            slog(0, SLOG_ERROR, "reference database path is too long: %s", dbPath);
+            err = 1;
+        }
+        int fd = err ? -1 : open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (!err && fd < 0)
+        {
+            slog(0, SLOG_ERROR, "could not create the reference database: %s (%s)", tmpPath, strerror(errno));
+            err = 1;
+        }
+        if (!err)
+        {
+            refdbHeader_t header;
+            memset(&header, 0, sizeof(header));
+            memcpy(header.magic, AM_REFDB_MAGIC, sizeof(AM_REFDB_MAGIC));
+            header.version = AM_REFDB_VERSION;
+            header.k = k;
+            header.scaled = scaled;
+            header.maxHash = maxHash;
+            header.nRefs = nRefs;
+            header.sourceSize = st.st_size;
+            header.sourceMtime = st.st_mtime;
+            refdbBlock_t blocks[] = {
+                {AM_REFDB_SECTION_TOC, toc, nRefs * sizeof(refdbEntry_t)},
+                {AM_REFDB_SECTION_NAMES, names, namesSize},
+                {AM_REFDB_SECTION_HASHES, hashes, nHashes * sizeof(uint64_t)},
+                {AM_REFDB_SECTION_INDEX, index, indexSize},
+                {AM_REFDB_SECTION_KMERS, kmerSet, kmerSetSize},
+            };
+            err = writeDB(fd, &header, blocks, (flags & AM_REFDB_KMERS) ? 5 : 4);
+            if (!err && fsync(fd) != 0)
+                err = 1;
+            if (close(fd) != 0)
+                err = 1;
+            if (!err && rename(tmpPath, dbPath) != 0)
+                err = 1;
+            if (err)
+            {
+                slog(0, SLOG_ERROR, "could not write the reference database: %s (%s)", dbPath, strerror(errno));
+                unlink(tmpPath);
+            }
+            else
+                syncDir(dbPath);
+        }
+    }
+
+    for (i = 0; i < nRefs; i++)
+    {
+        free(refs[i].name);
+        free(refs[i].hashes);
+    }
+    free(refs);
+    free(toc);
+    free(names);
+    free(hashes);
+    free(index);
+    free(kmers);
+    free(kmerSet);
+    if (!err)
+    {
+        slog(0, SLOG_LIVE, "\t- built reference database: %s (%d references, %llu hashes, %d threads)", dbPath, nRefs, (unsigned long long)nHashes, nThreads);
+        if (flags & AM_REFDB_KMERS)
+            slog(0, SLOG_LIVE, "\t- k-mer set: %llu k-mers in %llu bytes (%.1f bits per k-mer)", (unsigned long long)nKmers, (unsigned long long)kmerSetSize, nKmers ? kmerSetSize * 8.0 / nKmers : 0.0);
+    }
+    return err;
+}
+
+// findSection returns a section from the directory, or NULL if the file doesn't have it
+static const refdbSection_t *findSection(const refdbSection_t *sections, uint32_t nSections, uint32_t id)
+{
+    uint32_t i;
+    for (i = 0; i < nSections; i++)
+        if (sections[i].id == id)
+            return &sections[i];
+    return NULL;
+}
+
+/*
+    checkIndex validates the inverted index section layout and points the database at it, returns 0 if it can be used
+    - only the sizes and end offsets are checked, the keys and postings are walked by refdbCheck
+*/
+static int checkIndex(refdb_t *db, const char *section, uint64_t size)
+{
+    if (size < sizeof(refdbIndex_t))
+        return 1;
+    const refdbIndex_t *index = (const refdbIndex_t *)section;
+    uint64_t body = size - sizeof(refdbIndex_t);
+    if (index->nKeys > body / (2 * sizeof(uint64_t)) || index->nPostings > body / sizeof(uint32_t))
+        return 1;
+    if (body != index->nKeys * sizeof(uint64_t) + (index->nKeys + 1) * sizeof(uint64_t) + index->nPostings * sizeof(uint32_t))
+        return 1;
+    const uint64_t *keys = (const uint64_t *)(section + sizeof(refdbIndex_t));
+    const uint64_t *offsets = keys + index->nKeys;
+    const uint32_t *postings = (const uint32_t *)(offsets + index->nKeys + 1);
+    if (offsets[0] != 0 || offsets[index->nKeys] != index->nPostings)
+        return 1;
+    db->keys = keys;
+    db->offsets = offsets;
+    db->postings = postings;
+    db->nKeys = index->nKeys;
+    db->nPostings = index->nPostings;
+    return 0;
+}
+
+/*
+    checkDB validates the header, sections and table of contents of a mapped database, returns 0 if it can be used
+    - this runs on every open, so it only reads the header, section directory and table of contents
+    - the section checksums and the inverted index are checked by refdbCheck (`antman index` runs it)
+*/
+static int checkDB(refdb_t *db)
+{
+    const refdbHeader_t *h = db->header;
+    if (db->mapSize < sizeof(refdbHeader_t) || memcmp(h->magic, AM_REFDB_MAGIC, sizeof(AM_REFDB_MAGIC)) != 0)
+        return 1;
+    if (h->version != AM_REFDB_VERSION || h->fileSize != db->mapSize || h->k < 1 || h->k > 31)
+        return 1;
+    if (h->nSections > (db->mapSize - sizeof(refdbHeader_t)) / sizeof(refdbSection_t))
+        return 1;
+    const refdbSection_t *sections = (const refdbSection_t *)((const char *)db->map + sizeof(refdbHeader_t));
+    if (h->checksum != headerChecksum(h, sections))
+        return 1;
+    uint32_t i;
+    for (i = 0; i < h->nSections; i++)
+        if (sections[i].offset > db->mapSize || sections[i].size > db->mapSize - sections[i].offset || sections[i].offset % AM_REFDB_ALIGN)
+            return 1;
+    const refdbSection_t *toc = findSection(sections, h->nSections, AM_REFDB_SECTION_TOC);
+    const refdbSection_t *names = findSection(sections, h->nSections, AM_REFDB_SECTION_NAMES);
+    const refdbSection_t *hashes = findSection(sections, h->nSections, AM_REFDB_SECTION_HASHES);
+    if (!toc || !names || !hashes || toc->size != (uint64_t)h->nRefs * sizeof(refdbEntry_t))
+        return 1;
+
+    db->toc = (const refdbEntry_t *)((const char *)db->map + toc->offset);
+    db->names = (const char *)db->map + names->offset;
+    db->hashes = (const uint64_t *)((const char *)db->map + hashes->offset);
+    uint64_t nHashes = hashes->size / sizeof(uint64_t);
+    for (i = 0; i < h->nRefs; i++)
+    {
+        const refdbEntry_t *e = &db->toc[i];
+        if (e->nameOffset >= names->size || e->nameLen >= names->size - e->nameOffset || db->names[e->nameOffset + e->nameLen] != '\0')
+            return 1;
+        if (e->hashOffset > nHashes || e->nHashes > nHashes - e->hashOffset)
+            return 1;
+    }
+
+    // the inverted index is optional, the sketches are scanned without it
+    const refdbSection_t *index = findSection(sections, h->nSections, AM_REFDB_SECTION_INDEX);
+    if (index != NULL && checkIndex(db, (const char *)db->map + index->offset, index->size) != 0)
+        return 1;
+
+    // so is the exact k-mer set
+    const refdbSection_t *kmers = findSection(sections, h->nSections, AM_REFDB_SECTION_KMERS);
+    if (kmers != NULL)
+    {
+        if (efMap(&db->kmers, (const char *)db->map + kmers->offset, kmers->size) != 0)
+            return 1;
+        db->hasKmers = 1;
+    }
+    db->k = h->k;
+    db->maxHash = h->maxHash;
+    db->nRefs = h->nRefs;
+    return 0;
+}
+
+/*
+    refdbCheck checks every section of an open database against its checksum and walks the inverted index
+    - the keys have to be sorted and unique, the offsets in order and every posting a table of contents position
+    - this reads the whole file, so it is left to `antman index` rather than done on every open
+    - returns 0 if the database is sound
+*/
+int refdbCheck(const refdb_t *db)
+{
+    const refdbHeader_t *h = db->header;
+    const refdbSection_t *sections = (const refdbSection_t *)((const char *)db->map + sizeof(refdbHeader_t));
+    uint64_t i;
+    for (i = 0; i < h->nSections; i++)
+        if (checksum(FNV_OFFSET, (const char *)db->map + sections[i].offset, sections[i].size) != sections[i].checksum)
+        {
+            slog(0, SLOG_ERROR, "reference database section %u does not match its checksum", sections[i].id);
+            return 1;
+        }
+    if (db->keys == NULL)
+        return 0;
+    for (i = 0; i < db->nKeys; i++)
+        if (db->offsets[i] > db->offsets[i + 1] || (i > 0 && db->keys[i] <= db->keys[i - 1]))
+        {
+            slog(0, SLOG_ERROR, "reference database index keys or offsets are out of order");
+            return 1;
+        }
+    for (i = 0; i < db->nPostings; i++)
+        if (db->postings[i] >= (uint32_t)db->nRefs)
+        {
+            slog(0, SLOG_ERROR, "reference database index points past the table of contents");
+            return 1;
+        }
+    return 0;
+}
+
+// refdbOpen maps a reference database read-only, returns NULL if it can't be opened or is not valid
+refdb_t *refdbOpen(const char *dbPath)
+{
+    int fd = open(dbPath, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(refdbHeader_t))
+    {
+        close(fd);
+        return NULL;
+    }
+    refdb_t *db = calloc(1, sizeof(refdb_t));
+    if (db == NULL)
+    {
+        close(fd);
+        return NULL;
+    }
+    db->mapSize = st.st_size;
+    db->map = mmap(NULL, db->mapSize, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (db->map == MAP_FAILED)
+    {
+        free(db);
+        return NULL;
+    }
+    db->header = (const refdbHeader_t *)db->map;
+    if (checkDB(db) != 0)
+    {
+        if (memcmp(db->header->magic, AM_REFDB_MAGIC, sizeof(AM_REFDB_MAGIC)) == 0 && db->header->version != AM_REFDB_VERSION)
+            slog(0, SLOG_ERROR, "reference database was built by another version of antman: %s", dbPath);
+        else
+            slog(0, SLOG_ERROR, "invalid reference database: %s", dbPath);
+        refdbClose(db);
+        return NULL;
+    }
+    return db;
+}
+
+// refdbClose unmaps a reference database
+void refdbClose(refdb_t *db)
+{
+    if (db == NULL)
+        return;
+    munmap(db->map, db->mapSize);
+    free(db);
+}
+
+// refdbIsDB checks if a file starts with the reference database magic
+int refdbIsDB(const char *path)
+{
+    char magic[8];
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL)
+        return 0;
+    int isDB = fread(magic, 1, sizeof(magic), fp) == sizeof(magic) && memcmp(magic, AM_REFDB_MAGIC, sizeof(AM_REFDB_MAGIC)) == 0;
+    fclose(fp);
+    return isDB;
+}
+
+/*
+    refdbLoad returns a reference database for a reference
+    - a reference database is opened as it is
+    - a FASTA file uses the database next to it (<ref>.amdb), which is rebuilt if it is missing, stale, has different settings or has no index
+    - flags are passed to refdbBuild (with nThreads), and a database without the k-mer set is rebuilt if AM_REFDB_KMERS is asked for
+    - with AM_REFDB_NO_BUILD the database is only mapped, it has to have been built already (`antman index`)
+    - returns NULL if there is no usable database (e.g. the directory is read-only), so the caller can fall back to the bloom filter
+*/
+refdb_t *refdbLoad(const char *refPath, int k, uint64_t scaled, int flags, int nThreads)
+{
+    refdb_t *db;
+    if (refdbIsDB(refPath))
+    {
+        if ((db = refdbOpen(refPath)) != NULL && db->k != k)
+        {
+            slog(0, SLOG_ERROR, "reference database k-mer size (%d) does not match the config (%d)", db->k, k);
+            refdbClose(db);
+            return NULL;
+        }
+        return db;
+    }
+
+    char dbPath[PATH_MAX];
+    struct stat st;
+    if (snprintf(dbPath, sizeof(dbPath), "%s%s", refPath, AM_REFDB_EXT) >= (int)sizeof(dbPath) || stat(refPath, &st) != 0)
+        return NULL;
+    if (access(dbPath, R_OK) == 0 && (db = refdbOpen(dbPath)) != NULL)
+    {
+        const refdbHeader_t *h = db->header;
+        if (db->k == k && h->scaled == scaled && h->sourceSize == (uint64_t)st.st_size && h->sourceMtime == (uint64_t)st.st_mtime && db->keys != NULL && (db->hasKmers || !(flags & AM_REFDB_KMERS)))
+            return db;
+        refdbClose(db);
+        if (flags & AM_REFDB_NO_BUILD)
+        {
+            slog(0, SLOG_ERROR, "reference database is out of date: %s", dbPath);
+            return NULL;
+        }
+        slog(0, SLOG_INFO, "reference database is out of date, rebuilding: %s", dbPath);
+    }
+    else if (flags & AM_REFDB_NO_BUILD)
+        return NULL;
+    if (refdbBuild(refPath, dbPath, k, scaled, flags, nThreads) != 0)
+        return NULL;
+    return refdbOpen(dbPath);
+}
+
+// refdbLookup finds a reference by name, returns NULL if it is not in the database
+const refdbEntry_t *refdbLookup(const refdb_t *db, const char *name)
+{
+    size_t len = strlen(name);
+    uint64_t h = fnv1a(name, len);
+    int lo = 0, hi = db->nRefs;
+    while (lo < hi)
+    {
+        int mid = lo + (hi - lo) / 2;
+        if (db->toc[mid].nameHash < h)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    for (; lo < db->nRefs && db->toc[lo].nameHash == h; lo++)
+        if (db->toc[lo].nameLen == len && memcmp(db->names + db->toc[lo].nameOffset, name, len) == 0)
+            return &db->toc[lo];
+    return NULL;
+}
+
+// refdbName returns the name of a reference
+const char *refdbName(const refdb_t *db, const refdbEntry_t *entry)
+{
+    return db->names + entry->nameOffset;
+}
+
+// findHash looks for a hash in a sorted array, returning its position (or -1)
+static int64_t findHash(const uint64_t *hashes, uint64_t n, uint64_t hash)
+{
+    uint64_t lo = 0, hi = n;
+    while (lo < hi)
+    {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (hashes[mid] < hash)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return (lo < n && hashes[lo] == hash) ? (int64_t)lo : -1;
+}
+
+// each thread scores reads with its own counters, only the references a read touches are reset
+// - the counters and touched list are one allocation, freed by scoreKey's destructor when the thread exits
+static __thread uint32_t *scoreCounts;
+static __thread int *scoreTouched;
+static __thread int scoreCap;
+static pthread_key_t scoreKey;
+static pthread_once_t scoreKeyOnce = PTHREAD_ONCE_INIT;
+
+// scoreKeyInit makes the key that frees a thread's counters
+static void scoreKeyInit(void)
+{
+    pthread_key_create(&scoreKey, free);
+}
+
+// scoreInit makes sure this thread's counters can hold every reference, returns 0 on success
+static int scoreInit(int nRefs)
+{
+    if (scoreCap >= nRefs)
+        return 0;
+    pthread_once(&scoreKeyOnce, scoreKeyInit);
+    uint32_t *counts = calloc(nRefs, sizeof(uint32_t) + sizeof(int));
+    if (counts == NULL)
+        return 1;
+    free(scoreCounts);
+    scoreCounts = counts;
+    scoreTouched = (int *)(counts + nRefs);
+    scoreCap = nRefs;
+    pthread_setspecific(scoreKey, counts);
+    return 0;
+}
+
+// scoreHash counts a read hash against every reference that has it
+static inline void scoreHash(const refdb_t *db, uint64_t hash, int *nTouched)
+{
+    uint64_t p;
+    int r;
+    if (db->keys != NULL)
+    {
+        // one lookup in the inverted index finds all the references
+        int64_t key = findHash(db->keys, db->nKeys, hash);
+        if (key < 0)
+            return;
+
+        // the postings are only walked by refdbCheck, so a damaged database is bounds checked here rather than trusted
+        uint64_t end = db->offsets[key + 1] < db->nPostings ? db->offsets[key + 1] : db->nPostings;
+        for (p = db->offsets[key]; p < end; p++)
+        {
+            if (db->postings[p] >= (uint32_t)db->nRefs)
+                continue;
+            r = db->postings[p];
+            if (scoreCounts[r]++ == 0)
+                scoreTouched[(*nTouched)++] = r;
+        }
+        return;
+    }
+    for (r = 0; r < db->nRefs; r++)
+        if (findHash(db->hashes + db->toc[r].hashOffset, db->toc[r].nHashes, hash) >= 0 && scoreCounts[r]++ == 0)
+            scoreTouched[(*nTouched)++] = r;
+}
+
+/*
+    refdbTopN scores a read sketch against every reference in one pass and returns the best matches
+    - with the inverted index this is O(sketch size + hits), otherwise each reference sketch is searched
+    - only the sketch hashes under the database threshold can be tested, tested is set to how many there were
+    - hits gets up to n references sharing at least one hash, best first (ties go to the earlier table of contents position)
+    - returns the number of hits, or -1 if the counters could not be allocated
+*/
+int refdbTopN(const refdb_t *db, const uint64_t *sketch, int sketchSize, refdbHit_t *hits, int n, int *tested)
+{
+    int i, j, nTouched = 0, nHits = 0;
+    *tested = 0;
+    if (scoreInit(db->nRefs) != 0)
+        return -1;
+    for (i = 0; i < sketchSize; i++)
+    {
+        if (!scaledKeep(sketch[i], db->maxHash))
+            continue;
+        (*tested)++;
+        scoreHash(db, sketch[i], &nTouched);
+    }
+
+    // keep the n best in order, resetting the counters as they are read
+    for (i = 0; i < nTouched; i++)
+    {
+        int r = scoreTouched[i];
+        uint32_t shared = scoreCounts[r];
+        scoreCounts[r] = 0;
+        for (j = nHits; j > 0 && (hits[j - 1].shared < shared || (hits[j - 1].shared == shared && hits[j - 1].ref > r)); j--)
+            if (j < n)
+                hits[j] = hits[j - 1];
+        if (j >= n)
+            continue;
+        hits[j] = (refdbHit_t){.ref = r, .shared = shared, .containment = (double)shared / *tested};
+        if (nHits < n)
+            nHits++;
+    }
+    return nHits;
+}
+
+/*
+    refdbContainment estimates the containment of a read sketch in its best matching reference
+    - bestRef is set to the table of contents position of the best reference (or -1 if no reference shares a hash)
+    - returns the best containment, or -1 if none of the sketch hashes could be tested
+*/
+double refdbContainment(const refdb_t *db, const uint64_t *sketch, int sketchSize, int *bestRef)
+{
+    refdbHit_t best;
+    int tested, nHits = refdbTopN(db, sketch, sketchSize, &best, 1, &tested);
+    *bestRef = (nHits > 0) ? best.ref : -1;
+    if (nHits < 0 || tested == 0)
+        return -1;
+    return (nHits > 0) ? best.containment : 0.0;
+}
+
+// refdbHasHash checks if any reference sketch has a hashed k-mer (only hashes under the database threshold can be found)
+int refdbHasHash(const refdb_t *db, uint64_t hash)
+{
+    int r;
+    if (!scaledKeep(hash, db->maxHash))
+        return 0;
+    if (db->keys != NULL)
+        return findHash(db->keys, db->nKeys, hash) >= 0;
+    for (r = 0; r < db->nRefs; r++)
+        if (findHash(db->hashes + db->toc[r].hashOffset, db->toc[r].nHashes, hash) >= 0)
+            return 1;
+    return 0;
+}
+
+/*
+    refdbKmerHits checks every hash in a read sketch against the exact k-mer set
+    - the database must have the k-mer set (hasKmers)
+    - tested is set to the number of sketch hashes checked (empty slots are skipped)
+    - returns the number found
+*/
+int refdbKmerHits(const refdb_t *db, const uint64_t *sketch, int sketchSize, int *tested)
+{
+    uint64_t values[sketchSize];
+    uint8_t found[sketchSize];
+    int i, n = 0;
+    for (i = 0; i < sketchSize; i++)
+        if (sketch[i] != 0 && (sketch[i] & 0xff) == (uint64_t)db->k)
+            values[n++] = sketch[i] >> 8;
+    *tested = n;
+    return efContainsBatch(&db->kmers, values, n, found);
+}
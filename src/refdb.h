@@ -0,0 +1,132 @@
+// refdb is the on-disk reference database: per-reference scaled sketches, names and lengths in one mmap-able file
+#ifndef REFDB_H
+#define REFDB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "eliasfano.h"
+
+#define AM_REFDB_MAGIC "AMREFDB"
+#define AM_REFDB_VERSION 2
+#define AM_REFDB_ALIGN 64
+#define AM_REFDB_EXT ".amdb"
+#define AM_DEFAULT_REFDB_SCALED 10
+#define AM_REFDB_CHUNK_SIZE (1 << 20) // k-mers per chunk of a record sketched by one worker
+#define AM_REFDB_CHUNKS_PER_THREAD 4
+
+// refdbBuild and refdbLoad flags
+#define AM_REFDB_KMERS 1    // add the exact set of every reference k-mer
+#define AM_REFDB_NO_BUILD 2 // refdbLoad only maps an existing, up to date database
+
+/*
+    the file is written in native byte order:
+    - refdbHeader_t, followed by nSections refdbSection_t entries
+    - the header and section directory carry a checksum that is checked on every open, the sections carry their own that refdbCheck checks
+    - each section starts on an AM_REFDB_ALIGN boundary, readers skip any section id they don't know
+*/
+enum refdbSectionID
+{
+    AM_REFDB_SECTION_TOC = 1,    // refdbEntry_t per reference, sorted by name hash
+    AM_REFDB_SECTION_NAMES = 2,  // reference names, null terminated
+    AM_REFDB_SECTION_HASHES = 3, // sorted hashed k-mers for each reference
+    AM_REFDB_SECTION_INDEX = 4,  // inverted index from hashed k-mer to references (refdbIndex_t)
+    AM_REFDB_SECTION_KMERS = 5,  // every distinct reference k-mer hash (hashed k-mer >> 8), as an Elias-Fano set
+};
+
+// refdbHeader_t starts the file
+typedef struct refdbHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t k;
+    uint64_t scaled;
+    uint64_t maxHash;     // threshold used for the sketches (see scaledKeep)
+    uint32_t nRefs;
+    uint32_t nSections;
+    uint64_t fileSize;
+    uint64_t sourceSize;  // size of the FASTA the database was built from
+    uint64_t sourceMtime; // and its modification time, so a stale database can be spotted
+    uint64_t checksum;    // of the header (with this set to 0) and the section directory
+} refdbHeader_t;
+
+// refdbSection_t is an entry in the section directory
+typedef struct refdbSection
+{
+    uint32_t id;
+    uint32_t flags;
+    uint64_t offset;
+    uint64_t size;
+    uint64_t checksum; // of the section data
+} refdbSection_t;
+
+// refdbEntry_t is the table of contents entry for a reference
+typedef struct refdbEntry
+{
+    uint64_t nameHash;   // FNV-1a of the name
+    uint64_t length;     // reference length in bases
+    uint64_t nameOffset; // into the names section
+    uint64_t hashOffset; // into the hashes section, in hashes
+    uint64_t nHashes;
+    uint32_t nameLen;
+    uint32_t index;      // position of the reference in the FASTA
+} refdbEntry_t;
+
+/*
+    refdbIndex_t starts the index section, it is followed by:
+    - nKeys sorted, unique hashed k-mers
+    - nKeys + 1 offsets into the postings (CSR), the references for keys[i] are postings[offsets[i]] to postings[offsets[i + 1]]
+    - nPostings table of contents positions (uint32_t)
+*/
+typedef struct refdbIndex
+{
+    uint64_t nKeys;
+    uint64_t nPostings;
+} refdbIndex_t;
+
+// refdbHit_t is a reference that shares hashes with a read
+typedef struct refdbHit
+{
+    int ref;            // table of contents position
+    uint32_t shared;    // sketch hashes found in the reference
+    double containment; // shared / tested sketch hashes
+} refdbHit_t;
+
+// refdb_t is an open database
+typedef struct refdb
+{
+    void *map;
+    size_t mapSize;
+    const refdbHeader_t *header;
+    const refdbEntry_t *toc;
+    const char *names;
+    const uint64_t *hashes;
+    const uint64_t *keys; // the inverted index (NULL if the database doesn't have one)
+    const uint64_t *offsets;
+    const uint32_t *postings;
+    uint64_t nKeys;
+    uint64_t nPostings;
+    efSet_t kmers; // the exact k-mer set, if hasKmers is set
+    int hasKmers;
+    int k;
+    uint64_t maxHash;
+    int nRefs;
+} refdb_t;
+
+/*
+    function prototypes
+*/
+int refdbBuild(const char *fastaPath, const char *dbPath, int k, uint64_t scaled, int flags, int nThreads);
+refdb_t *refdbOpen(const char *dbPath);
+int refdbCheck(const refdb_t *db);
+void refdbClose(refdb_t *db);
+int refdbIsDB(const char *path);
+refdb_t *refdbLoad(const char *refPath, int k, uint64_t scaled, int flags, int nThreads);
+const refdbEntry_t *refdbLookup(const refdb_t *db, const char *name);
+const char *refdbName(const refdb_t *db, const refdbEntry_t *entry);
+double refdbContainment(const refdb_t *db, const uint64_t *sketch, int sketchSize, int *bestRef);
+int refdbTopN(const refdb_t *db, const uint64_t *sketch, int sketchSize, refdbHit_t *hits, int n, int *tested);
+int refdbKmerHits(const refdb_t *db, const uint64_t *sketch, int sketchSize, int *tested);
+int refdbHasHash(const refdb_t *db, uint64_t hash);
+
+#endif
@@ -0,0 +1,284 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "metrics.h"
+#include "runsketch.h"
+#include "slog.h"
+
+// compareHashes orders hashes for qsort
+static int compareHashes(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+    runSketchInit makes an empty sketch
+    - size should be the read sketch size (see runsketch.h)
+    - returns NULL if it could not be allocated
+*/
+runSketch_t *runSketchInit(int k, int size)
+{
+    runSketch_t *rs = calloc(1, sizeof(runSketch_t));
+    if (rs == NULL)
+        return NULL;
+    rs->k = k;
+    rs->size = size;
+    rs->hashes = malloc(size * sizeof(uint64_t));
+    rs->counts = malloc(size * sizeof(uint32_t));
+    rs->mergeHashes = malloc(size * sizeof(uint64_t));
+    rs->mergeCounts = malloc(size * sizeof(uint32_t));
+    if (!rs->hashes || !rs->counts || !rs->mergeHashes || !rs->mergeCounts)
+    {
+        runSketchDestroy(rs);
+        return NULL;
+    }
+    return rs;
+}
+
+// runSketchDestroy frees a sketch
+void runSketchDestroy(runSketch_t *rs)
+{
+    if (rs == NULL)
+        return;
+    free(rs->hashes);
+    free(rs->counts);
+    free(rs->mergeHashes);
+    free(rs->mergeCounts);
+    free(rs);
+}
+
+// mergeSorted merges n ascending hashes and their counts into the sketch, keeping the smallest size of them
+static void mergeSorted(runSketch_t *rs, const uint64_t *hashes, const uint32_t *counts, int n)
+{
+    int i = 0, j = 0, m = 0;
+    while (m < rs->size && (i < rs->n || j < n))
+    {
+        if (j == n || (i < rs->n && rs->hashes[i] < hashes[j]))
+        {
+            rs->mergeHashes[m] = rs->hashes[i];
+            rs->mergeCounts[m++] = rs->counts[i++];
+        }
+        else if (i == rs->n || hashes[j] < rs->hashes[i])
+        {
+            rs->mergeHashes[m] = hashes[j];
+            rs->mergeCounts[m++] = counts[j++];
+        }
+        else
+        {
+            rs->mergeHashes[m] = hashes[j];
+            rs->mergeCounts[m++] = rs->counts[i++] + counts[j++];
+        }
+    }
+
+    // swap the merged arrays in
+    uint64_t *h = rs->hashes;
+    uint32_t *c = rs->counts;
+    rs->hashes = rs->mergeHashes;
+    rs->counts = rs->mergeCounts;
+    rs->mergeHashes = h;
+    rs->mergeCounts = c;
+    rs->n = m;
+}
+
+/*
+    runSketchAddRead adds a read to the sketch
+    - sketch is the read's sketch (see sketchSequence), or NULL if the read was too short to sketch
+    - len is the read length and match is 1 if the read matched the reference
+*/
+void runSketchAddRead(runSketch_t *rs, const uint64_t *sketch, int sketchSize, int len, int match)
+{
+    rs->reads++;
+    rs->bases += len;
+    rs->matched += (match > 0);
+    if (sketch == NULL)
+        return;
+
+    // the read sketch is largest first with empty slots at the end, so it is reversed into ascending order
+    uint64_t hashes[sketchSize];
+    uint32_t ones[sketchSize];
+    int i, n = 0, sorted = 1;
+    for (i = sketchSize - 1; i >= 0; i--)
+    {
+        if (sketch[i] == 0)
+            continue;
+        hashes[n] = sketch[i];
+        ones[n] = 1;
+        if (n > 0 && hashes[n] < hashes[n - 1])
+            sorted = 0;
+        n++;
+    }
+    if (!sorted)
+        qsort(hashes, n, sizeof(uint64_t), compareHashes);
+
+    // nothing to do if the sketch is full and the read's smallest hash is past its largest
+    if (n == 0 || (rs->n == rs->size && hashes[0] > rs->hashes[rs->n - 1]))
+        return;
+    mergeSorted(rs, hashes, ones, n);
+}
+
+/*
+    runSketchMerge adds one sketch to another
+    - returns 0 on success, or 1 if the sketches have different k-mer or sketch sizes
+*/
+int runSketchMerge(runSketch_t *dst, const runSketch_t *src)
+{
+    if (dst->k != src->k || dst->size != src->size)
+        return 1;
+    mergeSorted(dst, src->hashes, src->counts, src->n);
+    dst->reads += src->reads;
+    dst->bases += src->bases;
+    dst->matched += src->matched;
+    dst->files += src->files;
+    return 0;
+}
+
+// runSketchDistinct estimates the number of distinct k-mers in the reads from the largest hash kept
+uint64_t runSketchDistinct(const runSketch_t *rs)
+{
+    if (rs->n < rs->size)
+        return rs->n;
+
+    // the hashed k-mers are spread over 4^k values (the hash is a bijection on 2k bits)
+    double universe = (double)(1ULL << (2 * rs->k)), largest = (double)(rs->hashes[rs->n - 1] >> 8) + 1.0;
+    return (uint64_t)((rs->size - 1) * universe / largest + 0.5);
+}
+
+/*
+    runSketchWrite writes a sketch to a file
+    - the sketch is written to a temporary name and renamed, so readers never see a partial file
+    - returns 0 on success
+*/
+int runSketchWrite(const runSketch_t *rs, const char *path)
+{
+    char tmpPath[PATH_MAX];
+    if (snprintf(tmpPath, sizeof(tmpPath), "%s.tmp.%d", path, (int)getpid()) >= (int)sizeof(tmpPath))
+        return 1;
+    FILE *fp = fopen(tmpPath, "wb");
+    if (fp == NULL)
+        return 1;
+    runSketchHeader_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, AM_RUNSKETCH_MAGIC, sizeof(AM_RUNSKETCH_MAGIC));
+    header.version = AM_RUNSKETCH_VERSION;
+    header.k = rs->k;
+    header.size = rs->size;
+    header.n = rs->n;
+    header.reads = rs->reads;
+    header.bases = rs->bases;
+    header.matched = rs->matched;
+    header.files = rs->files;
+    int err = fwrite(&header, sizeof(header), 1, fp) != 1;
+    err |= fwrite(rs->hashes, sizeof(uint64_t), rs->n, fp) != (size_t)rs->n;
+    err |= fwrite(rs->counts, sizeof(uint32_t), rs->n, fp) != (size_t)rs->n;
+    err |= fflush(fp) != 0 || fsync(fileno(fp)) != 0;
+    err |= fclose(fp) != 0;
+    if (!err && rename(tmpPath, path) != 0)
+        err = 1;
+    if (err)
+        unlink(tmpPath);
+    return err;
+}
+
+// runSketchRead reads a sketch from a file, returns NULL if it can't be read or isn't a sketch
+runSketch_t *runSketchRead(const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL)
+        return NULL;
+    runSketchHeader_t header;
+    runSketch_t *rs = NULL;
+    if (fread(&header, sizeof(header), 1, fp) == 1 && memcmp(header.magic, AM_RUNSKETCH_MAGIC, sizeof(AM_RUNSKETCH_MAGIC)) == 0 && header.version == AM_RUNSKETCH_VERSION && header.k > 0 && header.k <= 31 && header.size > 0 && header.n <= header.size)
+        rs = runSketchInit(header.k, header.size);
+    if (rs != NULL)
+    {
+        rs->n = header.n;
+        rs->reads = header.reads;
+        rs->bases = header.bases;
+        rs->matched = header.matched;
+        rs->files = header.files;
+        int i, err = fread(rs->hashes, sizeof(uint64_t), rs->n, fp) != (size_t)rs->n;
+        err |= fread(rs->counts, sizeof(uint32_t), rs->n, fp) != (size_t)rs->n;
+        for (i = 1; i < rs->n && !err; i++)
+            err = rs->hashes[i] <= rs->hashes[i - 1];
+        if (err)
+        {
+            runSketchDestroy(rs);
+            rs = NULL;
+        }
+    }
+    fclose(fp);
+    return rs;
+}
+
+/*
+    runTrackerInit sets up the sketch for a run, written to AM_RUNSKETCH_RUN_FILE in dir
+    - returns NULL if it could not be allocated
+*/
+runTracker_t *runTrackerInit(const char *dir, int k, int size)
+{
+    runTracker_t *tracker = calloc(1, sizeof(runTracker_t));
+    if (tracker == NULL)
+        return NULL;
+    if (snprintf(tracker->path, sizeof(tracker->path), "%s/%s", dir, AM_RUNSKETCH_RUN_FILE) >= (int)sizeof(tracker->path) || (tracker->sketch = runSketchInit(k, size)) == NULL)
+    {
+        free(tracker);
+        return NULL;
+    }
+    pthread_mutex_init(&tracker->lock, NULL);
+    tracker->lastWrite = metricsNow();
+    return tracker;
+}
+
+// writeLocked writes the run sketch, the tracker lock must be held
+static int writeLocked(runTracker_t *tracker)
+{
+    tracker->lastWrite = metricsNow();
+    tracker->pending = 0;
+    if (runSketchWrite(tracker->sketch, tracker->path) != 0)
+    {
+        slog(0, SLOG_ERROR, "could not write the run sketch: %s", tracker->path);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+    runTrackerAdd merges a file's sketch into the run
+    - the run sketch is written out every AM_RUNSKETCH_PERSIST_FILES files or AM_RUNSKETCH_PERSIST_SECS seconds
+    - returns 0 on success
+*/
+int runTrackerAdd(runTracker_t *tracker, const runSketch_t *fileSketch)
+{
+    int err;
+    pthread_mutex_lock(&tracker->lock);
+    err = runSketchMerge(tracker->sketch, fileSketch);
+    if (!err && (++tracker->pending >= AM_RUNSKETCH_PERSIST_FILES || metricsNow() - tracker->lastWrite >= AM_RUNSKETCH_PERSIST_SECS * 1000000000ULL))
+        err = writeLocked(tracker);
+    pthread_mutex_unlock(&tracker->lock);
+    return err;
+}
+
+// runTrackerWrite writes the run sketch if files have been added since it was last written, returns 0 on success
+int runTrackerWrite(runTracker_t *tracker)
+{
+    int err = 0;
+    pthread_mutex_lock(&tracker->lock);
+    if (tracker->pending > 0)
+        err = writeLocked(tracker);
+    pthread_mutex_unlock(&tracker->lock);
+    return err;
+}
+
+// runTrackerDestroy writes out anything pending and frees the tracker
+void runTrackerDestroy(runTracker_t *tracker)
+{
+    if (tracker == NULL)
+        return;
+    runTrackerWrite(tracker);
+    pthread_mutex_destroy(&tracker->lock);
+    runSketchDestroy(tracker->sketch);
+    free(tracker);
+}
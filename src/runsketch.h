@@ -0,0 +1,79 @@
+// runsketch is a mergeable bottom-k sketch of the k-mers seen across many reads, with how many reads had each one
+#ifndef RUNSKETCH_H
+#define RUNSKETCH_H
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+
+#define AM_RUNSKETCH_MAGIC "AMRUNSK"
+#define AM_RUNSKETCH_VERSION 1
+#define AM_RUNSKETCH_EXT ".amsk"             // a file's sketch is written next to it, with this added to its name
+#define AM_RUNSKETCH_RUN_FILE "antman-run.amsk" // the run's sketch is written in the watch directory
+#define AM_RUNSKETCH_PERSIST_FILES 16        // the run sketch is written after this many files
+#define AM_RUNSKETCH_PERSIST_SECS 60         // or once this long has passed since it was last written
+
+/*
+    a bottom-k sketch of a set is the k smallest hashes in it, and the sketch of a union is the k smallest of
+    the sketches of its parts, so read sketches merge into file sketches and file sketches into a run sketch
+    - the run sketch can't be bigger than the read sketches (a hash in the union's bottom k must then be in
+      the bottom k of every read that has it), so it uses the configured sketch size
+    - counts[i] is the number of reads whose sketch had hashes[i], which is exact for the same reason
+
+    the file is written in native byte order: runSketchHeader_t, then n hashes, then n counts
+*/
+typedef struct runSketchHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t k;
+    uint32_t size;
+    uint32_t n;
+    uint64_t reads;
+    uint64_t bases;
+    uint64_t matched;
+    uint64_t files;
+} runSketchHeader_t;
+
+// runSketch_t holds the smallest size hashes seen, in ascending order
+typedef struct runSketch
+{
+    int k;
+    int size;
+    int n;
+    uint64_t *hashes;
+    uint32_t *counts;
+    uint64_t reads;   // reads added (including those too short to sketch)
+    uint64_t bases;
+    uint64_t matched; // reads that matched the reference
+    uint64_t files;
+    uint64_t *mergeHashes; // scratch space for merging
+    uint32_t *mergeCounts;
+} runSketch_t;
+
+// runTracker_t is the sketch for the daemon's run, it is shared by the workers and written out periodically
+typedef struct runTracker
+{
+    runSketch_t *sketch;
+    pthread_mutex_t lock;
+    char path[PATH_MAX];
+    uint64_t lastWrite; // metricsNow() when the sketch was last written
+    int pending;        // files merged since it was last written
+} runTracker_t;
+
+/*
+    function prototypes
+*/
+runSketch_t *runSketchInit(int k, int size);
+void runSketchDestroy(runSketch_t *rs);
+void runSketchAddRead(runSketch_t *rs, const uint64_t *sketch, int sketchSize, int len, int match);
+int runSketchMerge(runSketch_t *dst, const runSketch_t *src);
+uint64_t runSketchDistinct(const runSketch_t *rs);
+int runSketchWrite(const runSketch_t *rs, const char *path);
+runSketch_t *runSketchRead(const char *path);
+runTracker_t *runTrackerInit(const char *dir, int k, int size);
+int runTrackerAdd(runTracker_t *tracker, const runSketch_t *fileSketch);
+int runTrackerWrite(runTracker_t *tracker);
+void runTrackerDestroy(runTracker_t *tracker);
+
+#endif
@@ -1,48 +1,344 @@
-#include <math.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <zlib.h>
+#include "coverage.h"
 #include "slog.h"
+#include "trace.h"
+#include "estimate.h"
 #include "kseq.h"
+#include "metrics.h"
+#include "runsketch.h"
 #include "sketch.h"
 #include "sequence.h"
 #include "watcher.h"
-
-//TODO: these are to be calculated and stored by antman
-#define REF_LENGTH 18246
+#include "workerpool.h"
 
 KSEQ_INIT(gzFile, gzread)
-pthread_mutex_t mutex1 = PTHREAD_MUTEX_INITIALIZER;
 
-// processRef
-void processRef(char *filepath, struct bloom *bf, int kSize, int sketchSize)
+// readRecord wraps kseq_read with the profiling hooks
+static inline int readRecord(kseq_t *seq)
+{
+    TRACE_BEGIN(traceSpan, kseq_read);
+    int l = kseq_read(seq);
+    TRACE_END(traceSpan, kseq_read, "kseq_read");
+    return l;
+}
+
+/*
+    refLoad_t tracks the reference chunks being added to the bloom filter
+*/
+typedef struct refLoad
+{
+    struct bloom *bf;
+    int kSize;
+    int concurrent; // more than one worker is adding to the bloom filter
+    pthread_mutex_t lock;
+    pthread_cond_t cond; // signalled when a chunk finishes
+    int inFlight;        // chunks queued or being added
+    int maxInFlight;     // bounds the memory held by queued chunks
+    uint64_t kmers;
+} refLoad_t;
+
+/*
+    refChunk_t is a piece of a reference sequence
+    - chunks of a long record overlap by k-1 bases so no k-mer is lost at the boundaries
+*/
+typedef struct refChunk
+{
+    refLoad_t *load;
+    int len;
+    char seq[];
+} refChunk_t;
+
+// addRefChunk is run by the workerpool, it adds a chunk's k-mers to the bloom filter
+static void addRefChunk(void *arg)
+{
+    refChunk_t *chunk = (refChunk_t *)arg;
+    refLoad_t *load = chunk->load;
+    int added = bloomSequence(chunk->seq, chunk->len, load->kSize, load->bf, load->concurrent);
+    pthread_mutex_lock(&load->lock);
+    load->kmers += added;
+    load->inFlight--;
+    pthread_cond_signal(&load->cond);
+    pthread_mutex_unlock(&load->lock);
+    free(chunk);
+}
+
+// queueRefChunk copies part of a record and sends it to the workerpool, waiting if too many are already queued
+static int queueRefChunk(refLoad_t *load, tpool_t *wp, const char *seq, int len)
+{
+    refChunk_t *chunk = malloc(sizeof(refChunk_t) + len);
+    if (chunk == NULL)
+        return 1;
+    chunk->load = load;
+    chunk->len = len;
+    memcpy(chunk->seq, seq, len);
+    pthread_mutex_lock(&load->lock);
+    while (load->inFlight >= load->maxInFlight)
+        pthread_cond_wait(&load->cond, &load->lock);
+    load->inFlight++;
+    pthread_mutex_unlock(&load->lock);
+    if (!tpool_add_work(wp, addRefChunk, chunk))
+    {
+        pthread_mutex_lock(&load->lock);
+        load->inFlight--;
+        pthread_mutex_unlock(&load->lock);
+        free(chunk);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+    processRef adds the k-mers from every sequence in a reference file to a bloom filter
+    - records are parsed on the calling thread and split into chunks for nThreads workers
+    - returns 0 on success
+*/
+int processRef(char *filepath, struct bloom *bf, int kSize, int nThreads)
 {
     gzFile fp;
     kseq_t *seq;
-    int l;
-    fp = gzopen(filepath, "r");
-    seq = kseq_init(fp);
-    while ((l = kseq_read(seq)) >= 0)
+    int l, err = 0;
+    if ((fp = gzopen(filepath, "r")) == NULL)
     {
+        slog(0, SLOG_ERROR, "could not open reference file: %s", filepath);
+        return 1;
+    }
+    seq = kseq_init(fp);
 
-        // add the reference k-mers to the bloom filter
-        sketchSequence(seq->seq.s, l, kSize, sketchSize, bf, NULL);
+    if (nThreads < 1)
+        nThreads = 1;
+    refLoad_t load = {.bf = bf, .kSize = kSize, .concurrent = (nThreads > 1), .maxInFlight = nThreads * AM_REF_CHUNKS_PER_THREAD};
+    pthread_mutex_init(&load.lock, NULL);
+    pthread_cond_init(&load.cond, NULL);
+    tpool_t *wp = tpool_create(nThreads);
+    while (!err && (l = readRecord(seq)) >= 0)
+    {
+        // each chunk holds the k-mers starting in [start, start + AM_REF_CHUNK_SIZE)
+        int start;
+        for (start = 0; start < l - kSize + 1; start += AM_REF_CHUNK_SIZE)
+        {
+            int end = (start + AM_REF_CHUNK_SIZE + kSize - 1 < l) ? start + AM_REF_CHUNK_SIZE + kSize - 1 : l;
+            if ((err = queueRefChunk(&load, wp, seq->seq.s + start, end - start)) != 0)
+            {
+                slog(0, SLOG_ERROR, "could not queue reference sequence: %s", seq->name.s);
+                break;
+            }
+        }
 
         slog(0, SLOG_LIVE, "\t- processed sequence");
         slog(0, SLOG_LIVE, "\t\t* sequence: %s", seq->name.s);
         slog(0, SLOG_LIVE, "\t\t* length: %d", l);
         slog(0, SLOG_LIVE, "\t\t* %d-mers: %d", kSize, (l - kSize + 1));
     }
+    tpool_wait(wp);
+    tpool_destroy(wp);
+    pthread_mutex_destroy(&load.lock);
+    pthread_cond_destroy(&load.cond);
     kseq_destroy(seq);
 
     // check for EOF
-    if (l != -1)
+    if (!err && l != -1)
     {
         slog(0, SLOG_ERROR, "EOF error for reference file: %d", l);
+        err = 1;
     }
     gzclose(fp);
-    return;
+    slog(0, SLOG_LIVE, "\t- added %llu k-mers using %d threads", (unsigned long long)load.kmers, nThreads);
+    return err;
+}
+
+/*
+    referenceEstimator sets up the containment estimates for the reference in wargs
+    - the database is exact, the bloom filter's false positive rate is measured from how full it is
+    - a sequential test is added when wargs->sprt_confidence is set, so bloom filter checks can stop early
+    - returns NULL if it could not be allocated
+*/
+estimator_t *referenceEstimator(const watcherArgs_t *wargs)
+{
+    double fpRate = 0.0;
+    uint64_t refKmers = 0;
+    if (wargs->refDB != NULL)
+    {
+        int i;
+        if (wargs->refDB->hasKmers)
+            refKmers = wargs->refDB->kmers.n;
+        else
+            for (i = 0; i < wargs->refDB->nRefs; i++)
+                refKmers += wargs->refDB->toc[i].length;
+    }
+    else
+    {
+        fpRate = estimateBloomFP(wargs->bloomFilter);
+        refKmers = estimateBloomKmers(wargs->bloomFilter);
+        if (fpRate > 2 * wargs->fp_rate)
+            slog(0, SLOG_WARN, "the bloom filter false positive rate is %.2g (%.2g was asked for), it may need more elements", fpRate, wargs->fp_rate);
+    }
+    estimator_t *est = estimatorInit(wargs->k_size, wargs->sketch_size, fpRate, wargs->match_threshold, refKmers);
+    if (est != NULL && wargs->sprt_confidence > 0.0 && estimatorSequential(est, wargs->sprt_confidence) != 0)
+    {
+        estimatorDestroy(est);
+        return NULL;
+    }
+    return est;
+}
+
+/*
+    classifyRead sketches a read and checks the sketch against the reference
+    - the reference database is used if there is one, otherwise the bloom filter
+    - sketch must hold wargs->sketch_size values, it is overwritten
+    - hits (if not NULL) gets up to *nHits of the best matching references from the database, *nHits is set to how many were found
+    - est gets the containment, Jaccard and distance estimates from the hit counts (see estimateRead)
+    - with a sequential test the bloom filter checks stop once the read is decided, est->stopped is set and the estimates use the hashes checked
+    - sketchTime and checkTime are incremented by the time spent in each step
+    - returns 1 if the read matches the reference, 0 if not, -1 if the read is shorter than k, or -2 if the database counters could not be allocated (the read should be skipped)
+*/
+int classifyRead(watcherArgs_t *wargs, const char *read, int len, uint64_t *sketch, refdbHit_t *hits, int *nHits, estimate_t *est, uint64_t *sketchTime, uint64_t *checkTime)
+{
+    int maxHits = (hits != NULL) ? *nHits : 0;
+    if (hits != NULL)
+        *nHits = 0;
+    if (len < wargs->k_size)
+        return -1;
+
+    // sketch the read
+    uint64_t sketchStart = metricsNow();
+    memset(sketch, 0, wargs->sketch_size * sizeof(uint64_t));
+    sketchSequence(read, len, wargs->k_size, wargs->sketch_size, NULL, sketch);
+    slog_hot(0, SLOG_LIVE, "\t- [sketcher]:\tsketched a %dbp sequence", len);
+
+    // count the sketch hashes found in the reference
+    // the bloom filter and database are read-only once the reference is loaded, so no lock is needed
+    int found = 0, tested = 0;
+    uint64_t refKmers = 0, checkStart = metricsNow();
+    est->stopped = 0;
+    if (wargs->refDB != NULL)
+    {
+        // the database is exact, so there are no false positives to correct for
+        // - the k-mer set can check every sketch hash, the reference sketches only those under their threshold
+        refdbHit_t best;
+        int nFound = 0, topTested;
+        TRACE_BEGIN(traceSpan, containment);
+        if (wargs->refDB->hasKmers)
+        {
+            found = refdbKmerHits(wargs->refDB, sketch, wargs->sketch_size, &tested);
+            if (maxHits > 0)
+                nFound = refdbTopN(wargs->refDB, sketch, wargs->sketch_size, hits, maxHits, &topTested);
+        }
+        else
+        {
+            if (maxHits > 0)
+                nFound = refdbTopN(wargs->refDB, sketch, wargs->sketch_size, hits, maxHits, &tested);
+            else
+                nFound = refdbTopN(wargs->refDB, sketch, wargs->sketch_size, hits = &best, 1, &tested);
+            if (nFound > 0)
+            {
+                found = hits[0].shared;
+                refKmers = wargs->refDB->toc[hits[0].ref].length - wargs->k_size + 1;
+            }
+        }
+        TRACE_END(traceSpan, containment, "refdb");
+        if (nFound < 0)
+        {
+            slog(0, SLOG_ERROR, "could not allocate the reference counters, skipping a read");
+            *sketchTime += checkStart - sketchStart;
+            *checkTime += metricsNow() - checkStart;
+            return -2;
+        }
+        if (maxHits > 0)
+            *nHits = nFound;
+    }
+    else
+    {
+        // empty sketch slots (reads with fewer k-mers than the sketch size) aren't checked
+        // - with a sequential test the checks stop once the read is decided, the hashes left are counted as saved lookups
+        int i, decision = -1, saved = 0;
+        TRACE_BEGIN(traceSpan, containment);
+        for (i = 0; i < wargs->sketch_size; i++)
+        {
+            if (sketch[i] == 0)
+                continue;
+            if (decision >= 0)
+            {
+                saved++;
+                continue;
+            }
+            tested++;
+            if (bloom_check(wargs->bloomFilter, &*(sketch + i), sizeof(uint64_t)))
+            {
+                found++;
+            }
+            decision = estimateStop(wargs->estimator, found, tested);
+        }
+        TRACE_END(traceSpan, containment, "bloom_check");
+        metricsAdd(AM_METRIC_BLOOM_LOOKUPS, tested);
+        if (saved > 0)
+        {
+            metricsAdd(AM_METRIC_LOOKUPS_SAVED, saved);
+            estimateRead(wargs->estimator, found, tested, len - wargs->k_size + 1, refKmers, est);
+            est->match = decision;
+            est->stopped = 1;
+        }
+    }
+    if (!est->stopped)
+        estimateRead(wargs->estimator, found, tested, len - wargs->k_size + 1, refKmers, est);
+    uint64_t checkEnd = metricsNow();
+    *sketchTime += checkStart - sketchStart;
+    *checkTime += checkEnd - checkStart;
+    metricsObserve(AM_HIST_BLOOM_CHECK, checkEnd - checkStart);
+
+    slog_hot(0, SLOG_LIVE, "\t- [sketcher]:\tcontainment = %f (%f-%f), jaccard = %f, distance = %f", est->containment, est->lower, est->upper, est->jaccard, est->distance);
+
+    metricsAdd(AM_METRIC_READS, 1);
+    metricsAdd(AM_METRIC_BASES, len);
+    if (est->match)
+        metricsAdd(AM_METRIC_READS_MATCHED, 1);
+    return est->match;
+}
+
+/*
+    sketchSummary checks a file or run sketch against the reference
+    - present is set to the fraction of the sketch's k-mers found in the reference
+    - abundance is set to the same fraction weighted by how many reads had each k-mer
+    - only the k-mers that can be checked are counted (for a database without the k-mer set, those under its threshold)
+    - returns the number of k-mers checked
+*/
+int sketchSummary(const watcherArgs_t *wargs, const runSketch_t *rs, double *present, double *abundance)
+{
+    int i, checked = 0, found = 0;
+    uint64_t reads = 0, foundReads = 0;
+    for (i = 0; i < rs->n; i++)
+    {
+        int tested = 1, hit;
+        if (wargs->refDB == NULL)
+            hit = bloom_check(wargs->bloomFilter, &rs->hashes[i], sizeof(uint64_t));
+        else if (wargs->refDB->hasKmers)
+            hit = refdbKmerHits(wargs->refDB, &rs->hashes[i], 1, &tested);
+        else
+        {
+            refdbHit_t best;
+            hit = refdbTopN(wargs->refDB, &rs->hashes[i], 1, &best, 1, &tested) > 0;
+        }
+        if (!tested)
+            continue;
+        checked++;
+        found += hit;
+        reads += rs->counts[i];
+        foundReads += hit ? rs->counts[i] : 0;
+    }
+    *present = checked ? (double)found / checked : 0.0;
+    *abundance = reads ? (double)foundReads / reads : 0.0;
+    return checked;
+}
+
+// logSketchSummary logs how much of the reference a file or run sketch has
+void logSketchSummary(const watcherArgs_t *wargs, const runSketch_t *rs, const char *label)
+{
+    double present, abundance;
+    sketchSummary(wargs, rs, &present, &abundance);
+    slog(0, SLOG_LIVE, "\t- [sketcher]:\t%s: %llu reads (%llu matched), ~%llu distinct k-mers, %.1f%% in the reference (%.1f%% by abundance)", label, (unsigned long long)rs->reads, (unsigned long long)rs->matched, (unsigned long long)runSketchDistinct(rs), 100.0 * present, 100.0 * abundance);
 }
 
 // processFastq
@@ -50,58 +346,57 @@ void processFastq(void *args)
 {
     watcherArgs_t *wargs;
     wargs = (watcherArgs_t *)args;
+    uint64_t fileStart = metricsNow();
+    metricsStage(AM_STAGE_QUEUE, fileStart - wargs->enqueue_ns);
     gzFile fp;
     kseq_t *seq;
     int l;
     fp = gzopen(wargs->filepath, "r");
     seq = kseq_init(fp);
 
+    // one sketch buffer is reused for every read in the file
+    uint64_t *sketch = calloc(wargs->sketch_size, sizeof(uint64_t));
+    if (!sketch)
+    {
+        slog(0, SLOG_ERROR, "could not allocate a sketch");
+        exit(1);
+    }
+
+    // keep per-file totals for the stage latencies
+    uint64_t parseStart = metricsNow(), parseTime = 0, sketchTime = 0, checkTime = 0;
+
+    // the read sketches are merged into a sketch for the file, which is then merged into the run's
+    runSketch_t *fileSketch = NULL;
+    if (wargs->runTracker != NULL && (fileSketch = runSketchInit(wargs->k_size, wargs->sketch_size)) == NULL)
+        slog(0, SLOG_ERROR, "could not allocate a file sketch");
+
     // process each sequence in the fastq file
-    while ((l = kseq_read(seq)) >= 0)
+    while ((l = readRecord(seq)) >= 0)
     {
+        parseTime += metricsNow() - parseStart;
 
         //slog(0, SLOG_INFO, "name: %s\n", seq->name.s);
         //if (seq->comment.l) printf("comment: %s\n", seq->comment.s);
         //slog(0, SLOG_INFO, "seq: %s\n;len: %d\n", seq->seq.s, l);
         //if (seq->qual.l) printf("qual: %s\n", seq->qual.s);
 
-        // sketch the read
-        uint64_t *sketch = calloc(wargs->sketch_size, sizeof(uint64_t));
-        if (!sketch)
-        {
-            slog(0, SLOG_ERROR, "could not allocate a sketch");
-            exit(1);
-        }
-        sketchSequence(seq->seq.s, l, wargs->k_size, wargs->sketch_size, NULL, sketch);
-        slog(0, SLOG_LIVE, "\t- [sketcher]:\tsketched a %dbp sequence", l);
+        estimate_t est;
+        int match = classifyRead(wargs, seq->seq.s, l, sketch, NULL, NULL, &est, &sketchTime, &checkTime);
+        if (fileSketch != NULL)
+            runSketchAddRead(fileSketch, (match < 0) ? NULL : sketch, wargs->sketch_size, l, match);
 
-        // estimate read containment within the reference
-        // lock the thread whilst using the bloom filter
-        int intersections = 0, i;
-        pthread_mutex_lock(&mutex1);
-        for (i = 0; i < wargs->sketch_size; i++)
+        // count the reference k-mers for the coverage estimates (this is another pass over the read, so it is timed as sketching)
+        if (wargs->coverage != NULL && match >= 0)
         {
-            if (bloom_check(wargs->bloomFilter, &*(sketch + i), wargs->k_size))
-            {
-                intersections++;
-            }
+            uint64_t coverageStart = metricsNow();
+            if (coverageAddRead(wargs->coverage, seq->seq.s, l) < 0)
+                slog(0, SLOG_ERROR, "could not count the k-mers in a read for the coverage estimates");
+            sketchTime += metricsNow() - coverageStart;
         }
-        pthread_mutex_unlock(&mutex1);
-
-        intersections -= (int)floor(wargs->fp_rate * wargs->sketch_size);
-        double containmentEstimate = ((double)intersections / wargs->sketch_size);
-
-        int refTotalKmers = REF_LENGTH - wargs->k_size + 1;
-        int queryTotalKmers = l - wargs->k_size + 1;
-
-        //slog(0, SLOG_INFO, "%d\t%d\t%d\t%f", intersections, refTotalKmers, queryTotalKmers, containmentEstimate);
-
-        double jaccardEst = ((double)(queryTotalKmers * containmentEstimate)) / ((queryTotalKmers + refTotalKmers) - (queryTotalKmers * containmentEstimate));
-
-        slog(0, SLOG_LIVE, "\t- [sketcher]:\tjaccardEst by containment = %f", jaccardEst);
-
-        free(sketch);
+        parseStart = metricsNow();
     }
+    parseTime += metricsNow() - parseStart;
+    free(sketch);
     kseq_destroy(seq);
 
     // check for EOF
@@ -111,6 +406,26 @@ void processFastq(void *args)
     }
 
     gzclose(fp);
+
+    // keep the file's sketch next to it and add it to the run
+    if (fileSketch != NULL)
+    {
+        char sketchPath[PATH_MAX];
+        fileSketch->files = 1;
+        if (snprintf(sketchPath, sizeof(sketchPath), "%s%s", wargs->filepath, AM_RUNSKETCH_EXT) >= (int)sizeof(sketchPath) || runSketchWrite(fileSketch, sketchPath) != 0)
+            slog(0, SLOG_ERROR, "could not write the sketch for FASTQ file: %s", wargs->filepath);
+        logSketchSummary(wargs, fileSketch, wargs->filepath);
+        if (runTrackerAdd(wargs->runTracker, fileSketch) != 0)
+            slog(0, SLOG_ERROR, "could not add the sketch for FASTQ file to the run: %s", wargs->filepath);
+        runSketchDestroy(fileSketch);
+    }
+    uint64_t fileEnd = metricsNow();
+    metricsAdd(AM_METRIC_FILES_PROCESSED, 1);
+    metricsObserve(AM_HIST_FILE, fileEnd - fileStart);
+    metricsStage(AM_STAGE_PARSE, parseTime);
+    metricsStage(AM_STAGE_SKETCH, sketchTime);
+    metricsStage(AM_STAGE_CONTAINMENT, checkTime);
+    metricsStage(AM_STAGE_TOTAL, wargs->notify_ns + (fileEnd - wargs->event_ns));
     free(wargs);
     return;
 }
@@ -1,12 +1,25 @@
 #ifndef SEQUENCE_H
 #define SEQUENCE_H
 
+#include <stdint.h>
+
 #include "bloom.h"
+#include "estimate.h"
+#include "runsketch.h"
+#include "watcher.h"
+
+// the reference is loaded in chunks of this many k-mers
+#define AM_REF_CHUNK_SIZE (1 << 20)
+#define AM_REF_CHUNKS_PER_THREAD 4
 
 /*
     function prototypes
 */
-void processRef(char* filepath, struct bloom* bf, int kSize, int sketchSize);
+int processRef(char *filepath, struct bloom *bf, int kSize, int nThreads);
+estimator_t *referenceEstimator(const watcherArgs_t *wargs);
+int classifyRead(watcherArgs_t *wargs, const char *read, int len, uint64_t *sketch, refdbHit_t *hits, int *nHits, estimate_t *est, uint64_t *sketchTime, uint64_t *checkTime);
+int sketchSummary(const watcherArgs_t *wargs, const runSketch_t *rs, double *present, double *abundance);
+void logSketchSummary(const watcherArgs_t *wargs, const runSketch_t *rs, const char *label);
 void processFastq(void* arg);
 
 #endif
\ No newline at end of file
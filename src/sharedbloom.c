@@ -0,0 +1,241 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sequence.h"
+#include "sharedbloom.h"
+#include "slog.h"
+
+/*
+    the first daemon to start creates the segment and builds the filter in it while holding an exclusive flock,
+    later daemons wait on the lock, check the filter was finished and map it
+    - the last daemon to detach unlinks the segment (a daemon that crashes leaves it behind, see /dev/shm)
+    - an unlinked or unfinished segment is never attached to, a new one is made instead
+    - a finished segment that can't be used (e.g. from another antman version) is left for its daemons, the caller builds a private filter
+*/
+
+// fnv1a hashes the white list details for the segment name
+static uint64_t fnv1a(uint64_t h, const void *data, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    size_t i;
+    for (i = 0; i < len; i++)
+    {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/*
+    sharedBloomName makes the segment name for a white list and filter settings
+    - returns 0 on success, or 1 if the white list can't be found
+*/
+int sharedBloomName(const char *refPath, int k, int entries, double error, char *name, size_t size)
+{
+    char path[PATH_MAX];
+    struct stat st;
+    if (realpath(refPath, path) == NULL || stat(path, &st) != 0)
+        return 1;
+    uint64_t h = 14695981039346656037ULL, ino = st.st_ino, fileSize = st.st_size, mtime = st.st_mtime;
+    uint32_t version = AM_SHARED_VERSION;
+    h = fnv1a(h, path, strlen(path));
+    h = fnv1a(h, &ino, sizeof(ino));
+    h = fnv1a(h, &fileSize, sizeof(fileSize));
+    h = fnv1a(h, &mtime, sizeof(mtime));
+    h = fnv1a(h, &k, sizeof(k));
+    h = fnv1a(h, &entries, sizeof(entries));
+    h = fnv1a(h, &error, sizeof(error));
+    h = fnv1a(h, &version, sizeof(version));
+    snprintf(name, size, "/antman-%016llx", (unsigned long long)h);
+    return 0;
+}
+
+// mapSegment maps an open segment and notes which it is, returns 0 on success
+static int mapSegment(sharedBloom_t *shared, size_t size)
+{
+    shared->map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, shared->fd, 0);
+    struct stat st;
+    if (shared->map == MAP_FAILED || fstat(shared->fd, &st) != 0)
+    {
+        if (shared->map != MAP_FAILED)
+            munmap(shared->map, size);
+        shared->map = NULL;
+        return 1;
+    }
+    shared->mapSize = size;
+    shared->ino = st.st_ino;
+    return 0;
+}
+
+// createSegment makes a new segment and builds the filter in it, returns 0 on success, or -1 if another process created it first
+static int createSegment(sharedBloom_t *shared, const char *refPath, int k, int nThreads)
+{
+    if ((shared->fd = shm_open(shared->name, O_RDWR | O_CREAT | O_EXCL, 0600)) < 0)
+        return (errno == EEXIST) ? -1 : 1;
+    size_t size = AM_SHARED_HEADER_SIZE + shared->bf.bytes;
+    if (flock(shared->fd, LOCK_EX) != 0 || ftruncate(shared->fd, size) != 0 || mapSegment(shared, size) != 0)
+    {
+        slog(0, SLOG_ERROR, "could not create the shared bloom filter: %s (%s)", shared->name, strerror(errno));
+        shm_unlink(shared->name);
+        return 1;
+    }
+    sharedHeader_t *header = (sharedHeader_t *)shared->map;
+    memcpy(header->magic, AM_SHARED_MAGIC, sizeof(AM_SHARED_MAGIC));
+    header->version = AM_SHARED_VERSION;
+    header->k = k;
+    header->bytes = shared->bf.bytes;
+    header->refs = 1;
+    bloom_init_buffer(&shared->bf, shared->bf.entries, shared->bf.error, (unsigned char *)shared->map + AM_SHARED_HEADER_SIZE);
+    if (processRef((char *)refPath, &shared->bf, k, nThreads) != 0)
+    {
+        shm_unlink(shared->name);
+        return 1;
+    }
+    __atomic_store_n(&header->ready, 1, __ATOMIC_RELEASE);
+    flock(shared->fd, LOCK_UN);
+    shared->built = 1;
+    return 0;
+}
+
+// releaseSegment unmaps and closes a segment that is not being used (closing drops the lock)
+static void releaseSegment(sharedBloom_t *shared)
+{
+    if (shared->map != NULL)
+        munmap(shared->map, shared->mapSize);
+    shared->map = NULL;
+    if (shared->fd >= 0)
+        close(shared->fd);
+    shared->fd = -1;
+}
+
+/*
+    openSegment attaches to an existing segment
+    - returns 0 on success, -1 if the creator died before finishing it (it is removed, so a new one should be made)
+    - or 1 if the segment is finished but can't be used, e.g. it can't be mapped or was made by another antman version, it is left for the daemons using it
+*/
+static int openSegment(sharedBloom_t *shared, int k)
+{
+    static const char blank[sizeof(AM_SHARED_MAGIC)];
+    size_t size = AM_SHARED_HEADER_SIZE + shared->bf.bytes;
+    int tries;
+    for (tries = 0; tries < AM_SHARED_WAIT_TRIES; tries++)
+    {
+        if ((shared->fd = shm_open(shared->name, O_RDWR, 0)) < 0)
+            return (errno == ENOENT) ? -1 : 1;
+
+        // the lock is held by the creator until the filter is built
+        struct stat st;
+        if (flock(shared->fd, LOCK_EX) != 0 || fstat(shared->fd, &st) != 0)
+        {
+            releaseSegment(shared);
+            return 1;
+        }
+        if (st.st_nlink == 0)
+        {
+            // the last daemon detached while we were waiting
+            releaseSegment(shared);
+            return -1;
+        }
+        if (st.st_size == 0)
+        {
+            // the creator hasn't taken the lock yet
+            releaseSegment(shared);
+            usleep(AM_SHARED_WAIT_MS * 1000);
+            continue;
+        }
+        if ((size_t)st.st_size != size || mapSegment(shared, size) != 0)
+        {
+            slog(0, SLOG_WARN, "could not map the shared bloom filter: %s", shared->name);
+            releaseSegment(shared);
+            return 1;
+        }
+
+        // holding the lock, a blank or unready header means the creator died, anything else is another daemon's filter
+        sharedHeader_t *header = (sharedHeader_t *)shared->map;
+        int ours = memcmp(header->magic, AM_SHARED_MAGIC, sizeof(AM_SHARED_MAGIC)) == 0 && header->version == AM_SHARED_VERSION;
+        int ready = __atomic_load_n(&header->ready, __ATOMIC_ACQUIRE);
+        if (memcmp(header->magic, blank, sizeof(blank)) == 0 || (ours && !ready))
+            break;
+        if (!ours || !ready || header->k != k || header->bytes != (uint64_t)shared->bf.bytes)
+        {
+            slog(0, SLOG_WARN, "the shared bloom filter was made with different settings: %s", shared->name);
+            releaseSegment(shared);
+            return 1;
+        }
+        header->refs++;
+        flock(shared->fd, LOCK_UN);
+        bloom_init_buffer(&shared->bf, shared->bf.entries, shared->bf.error, (unsigned char *)shared->map + AM_SHARED_HEADER_SIZE);
+        return 0;
+    }
+
+    // the creator died before finishing the filter, so remove the segment
+    slog(0, SLOG_WARN, "removing an unfinished shared bloom filter: %s", shared->name);
+    shm_unlink(shared->name);
+    releaseSegment(shared);
+    return -1;
+}
+
+/*
+    sharedBloomAttach returns the white list bloom filter from shared memory
+    - the filter is built from the reference with nThreads if no other process has it (see processRef)
+    - returns NULL if shared memory can't be used or the filter can't be built, the caller can build a private filter instead
+*/
+sharedBloom_t *sharedBloomAttach(const char *refPath, int k, int entries, double error, int nThreads)
+{
+    sharedBloom_t *shared = calloc(1, sizeof(sharedBloom_t));
+    if (shared == NULL)
+        return NULL;
+    shared->fd = -1;
+    if (sharedBloomName(refPath, k, entries, error, shared->name, sizeof(shared->name)) != 0 || bloom_init_buffer(&shared->bf, entries, error, NULL) != 0)
+    {
+        free(shared);
+        return NULL;
+    }
+
+    // a segment can disappear between the create and the open, so try a few times
+    int tries, err = -1;
+    for (tries = 0; tries < 3 && err < 0; tries++)
+    {
+        if ((err = openSegment(shared, k)) < 0)
+            err = createSegment(shared, refPath, k, nThreads);
+    }
+    if (err != 0)
+    {
+        if (shared->map != NULL)
+            munmap(shared->map, shared->mapSize);
+        if (shared->fd >= 0)
+            close(shared->fd);
+        free(shared);
+        return NULL;
+    }
+    close(shared->fd);
+    shared->fd = -1;
+    return shared;
+}
+
+// sharedBloomDetach releases a filter, the segment is removed when the last process detaches
+void sharedBloomDetach(sharedBloom_t *shared)
+{
+    if (shared == NULL)
+        return;
+    sharedHeader_t *header = (sharedHeader_t *)shared->map;
+    struct stat st;
+    int fd = shm_open(shared->name, O_RDWR, 0);
+    if (fd >= 0 && flock(fd, LOCK_EX) == 0 && fstat(fd, &st) == 0 && (uint64_t)st.st_ino == shared->ino)
+    {
+        if (--header->refs <= 0)
+            shm_unlink(shared->name);
+    }
+    if (fd >= 0)
+        close(fd);
+    munmap(shared->map, shared->mapSize);
+    free(shared);
+}
@@ -0,0 +1,51 @@
+// sharedbloom keeps the white list bloom filter in named shared memory, so daemons on one host share a single copy
+#ifndef SHAREDBLOOM_H
+#define SHAREDBLOOM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bloom.h"
+
+#define AM_SHARED_MAGIC "AMSHBF"
+#define AM_SHARED_VERSION 1
+#define AM_SHARED_HEADER_SIZE 64    // the filter starts on a cache line after the header
+#define AM_SHARED_WAIT_MS 10        // how long to wait for a segment that has just been created
+#define AM_SHARED_WAIT_TRIES 100
+
+/*
+    sharedHeader_t starts a segment, it is followed by the bloom filter bits
+    - the segment name is made from the white list (path, inode, size and mtime) and the filter settings,
+      so a changed white list gets a new segment while daemons still using the old one keep it
+    - refs and the teardown are protected by an flock on the segment
+*/
+typedef struct sharedHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t ready; // set once the filter has been built
+    int32_t refs;   // processes attached
+    int32_t k;
+    uint64_t bytes; // size of the filter
+} sharedHeader_t;
+
+// sharedBloom_t is an attached filter
+typedef struct sharedBloom
+{
+    struct bloom bf; // the filter, its bits are in the segment
+    char name[64];
+    int fd;       // only open while attaching, as daemonizing closes every descriptor
+    uint64_t ino; // identifies the segment when it is reopened to detach
+    void *map;
+    size_t mapSize;
+    int built; // this process built the filter
+} sharedBloom_t;
+
+/*
+    function prototypes
+*/
+sharedBloom_t *sharedBloomAttach(const char *refPath, int k, int entries, double error, int nThreads);
+void sharedBloomDetach(sharedBloom_t *shared);
+int sharedBloomName(const char *refPath, int k, int entries, double error, char *name, size_t size);
+
+#endif
@@ -8,7 +8,10 @@
 #include "bloom.h"
 #include "hashmap.h"
 #include "heap.h"
+#include "metrics.h"
+#include "sketch.h"
 #include "slog.h"
+#include "trace.h"
 
 unsigned char seq_nt4_table[256] = {
 	0, 1, 2, 3,  4, 4, 4, 4,  4, 4, 4, 4,  4, 4, 4, 4,
@@ -62,12 +65,16 @@ void sketchSequence(const char* str, int len, int k, int sketchSize, struct bloo
     // check k-mer size and seq length
 	assert(len > 0 && (k > 0 && k <= 31) && k <= len);
 
+    // time the sketching for the metrics and the profiler
+	uint64_t start = metricsNow();
+	TRACE_BEGIN(traceSpan, sketch);
+
     // declare the variables
 	uint64_t shift1 = 2 * (k - 1), mask = (1ULL<<2*k) - 1, kmer[2] = {0,0}, hashedKmer = 0;
 	int i , l, kmer_span = 0;
 
     // set up the heap for the sketch
-    node_t* kmvSketch;
+    node_t* kmvSketch = NULL;
 	int currentHeapSize = 0;
 
     // iterate over the sequence
@@ -99,7 +106,7 @@ void sketchSequence(const char* str, int len, int k, int sketchSize, struct bloo
 
 		// add the hashed k-mer to the bloom filter if required
 		if (bf != NULL) {
-			bloom_add(bf, &hashedKmer, k);
+			bloom_add(bf, &hashedKmer, sizeof(hashedKmer));
 		}
 
 		// now we have a hashed k-mer, first check if the sketch isn't at capacity yet
@@ -133,10 +140,8 @@ void sketchSequence(const char* str, int len, int k, int sketchSize, struct bloo
 	}
 
 	// the sequence has now been sketched, so collect the minimums from the heap
-	if (sketchPtr != NULL) {
-		
-		// sanity check
-		assert(isEmpty(&kmvSketch) == false);
+	// (a sequence without any valid k-mers leaves the sketch untouched)
+	if (sketchPtr != NULL && !isEmpty(&kmvSketch)) {
 
 		// add the minimums from the kmvSketch heap to the provided sketch array
 		getSketch(&kmvSketch, sketchSize, sketchPtr);
@@ -145,4 +150,107 @@ void sketchSequence(const char* str, int len, int k, int sketchSize, struct bloo
 	// free the kmvSketch heap and the hashmap
 	destroy(&kmvSketch);
 	hmDestroy();
-}
\ No newline at end of file
+	metricsObserve(AM_HIST_SKETCH, metricsNow() - start);
+	TRACE_END(traceSpan, sketch, "sketchSequence");
+}
+
+/*
+	bloomSequence adds every hashed k-mer in a sequence to a bloom filter
+	it hashes k-mers exactly as sketchSequence does, but skips the KMV sketch
+	arguments:
+		str - the sequence
+		len - the sequence length
+		k - k-mer size
+		bf - pointer to a bloom filter
+		concurrent - set if other threads are adding to the same bloom filter (bits are then set atomically)
+	returns the number of k-mers added
+*/
+int bloomSequence(const char* str, int len, int k, struct bloom* bf, int concurrent) {
+	assert(k > 0 && k <= 31);
+	uint64_t shift1 = 2 * (k - 1), mask = (1ULL<<2*k) - 1, kmer[2] = {0,0}, hashedKmer;
+	int i, l, added = 0;
+	for (i = l = 0; i < len; i++) {
+		int c = seq_nt4_table[(uint8_t)str[i]];
+		if (c >= 4) {
+			l = 0;
+			continue;
+		}
+		kmer[0] = (kmer[0] << 2 | c) & mask;
+		kmer[1] = (kmer[1] >> 2) | (3ULL^c) << shift1;
+		if (kmer[0] == kmer[1]) continue;
+		if (++l < k) continue;
+		hashedKmer = hash64(kmer[kmer[0] < kmer[1]? 0 : 1], mask) << 8 | k;
+		if (concurrent)
+			bloom_add_atomic(bf, &hashedKmer, sizeof(hashedKmer));
+		else
+			bloom_add(bf, &hashedKmer, sizeof(hashedKmer));
+		added++;
+	}
+	return added;
+}
+
+// compareHashes orders hashed k-mers for qsort
+static int compareHashes(const void* a, const void* b) {
+	uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+/*
+	scaledSequence collects the distinct hashed k-mers in a sequence that pass the scaled threshold (a FracMinHash sketch)
+	k-mers are hashed exactly as sketchSequence does, so the result can be compared with a read sketch
+	arguments:
+		str - the sequence
+		len - the sequence length
+		k - k-mer size
+		maxHash - threshold from scaledMaxHash
+		hashes - pointer to the output array (allocated here, caller frees)
+	returns the number of hashes (sorted ascending), or -1 if the array could not be allocated
+*/
+int scaledSequence(const char* str, int len, int k, uint64_t maxHash, uint64_t** hashes) {
+	assert(k > 0 && k <= 31);
+	uint64_t shift1 = 2 * (k - 1), mask = (1ULL<<2*k) - 1, kmer[2] = {0,0}, hashedKmer;
+	int i, l, n = 0, cap = 1024;
+	uint64_t* out = malloc(cap * sizeof(uint64_t));
+	if (out == NULL) return -1;
+	for (i = l = 0; i < len; i++) {
+		int c = seq_nt4_table[(uint8_t)str[i]];
+		if (c >= 4) {
+			l = 0;
+			continue;
+		}
+		kmer[0] = (kmer[0] << 2 | c) & mask;
+		kmer[1] = (kmer[1] >> 2) | (3ULL^c) << shift1;
+		if (kmer[0] == kmer[1]) continue;
+		if (++l < k) continue;
+		hashedKmer = hash64(kmer[kmer[0] < kmer[1]? 0 : 1], mask) << 8 | k;
+		if (!scaledKeep(hashedKmer, maxHash)) continue;
+		if (n == cap) {
+			uint64_t* tmp = realloc(out, 2 * cap * sizeof(uint64_t));
+			if (tmp == NULL) {
+				free(out);
+				return -1;
+			}
+			out = tmp;
+			cap *= 2;
+		}
+		out[n++] = hashedKmer;
+	}
+
+	// sort and drop the repeated k-mers
+	qsort(out, n, sizeof(uint64_t), compareHashes);
+	int unique = 0;
+	for (i = 0; i < n; i++) {
+		if (unique == 0 || out[i] != out[unique - 1]) out[unique++] = out[i];
+	}
+	*hashes = out;
+	return unique;
+}
+
+/*
+	scaledMaxHash returns the threshold that keeps roughly 1 in scaled k-mers
+	it applies to the hash part of a hashed k-mer (the value above the 8-bit span), see scaledKeep
+*/
+uint64_t scaledMaxHash(int k, uint64_t scaled) {
+	uint64_t range = (k < 28) ? (1ULL << 2*k) - 1 : (1ULL << 56) - 1;
+	return range / (scaled > 0 ? scaled : 1);
+}
@@ -9,5 +9,14 @@
     function prototypes
 */
 void sketchSequence(const char *str, int len, int k, int sketchSize, struct bloom *bf, uint64_t *sketchPtr);
+int bloomSequence(const char *str, int len, int k, struct bloom *bf, int concurrent);
+int scaledSequence(const char *str, int len, int k, uint64_t maxHash, uint64_t **hashes);
+uint64_t scaledMaxHash(int k, uint64_t scaled);
+
+// scaledKeep checks if a hashed k-mer passes a scaled sketch threshold (0 marks an empty sketch slot)
+static inline int scaledKeep(uint64_t hashedKmer, uint64_t maxHash)
+{
+    return hashedKmer != 0 && (hashedKmer >> 8) <= maxHash;
+}
 
 #endif
\ No newline at end of file
@@ -27,17 +27,56 @@
 #include <string.h>
 #include <stdlib.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdarg.h>
 #include <limits.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <time.h>
+#include <unistd.h>
 #include "slog.h"
 
 /* Max size of string */
 #define MAXMSG 8196
 #define BIGSTR 4098
 
+/* Async backend sizing (SLOG_RING_SLOTS must be a power of two) */
+#define SLOG_RING_SLOTS     512
+#define SLOG_SLOT_SIZE      512
+#define SLOG_BATCH_SIZE     65536
+#define SLOG_POLL_USEC      10000
+#define SLOG_FSYNC_USEC     1000000
+
+/*
+ * Single producer / single consumer ring of log lines. Each logging thread
+ * owns one ring and the writer thread is the only consumer, so the head
+ * and tail indices only need acquire/release ordering. nBusy is set while
+ * the owner is pushing, so slog_async_stop() can wait for it to finish.
+ */
+typedef struct SlogRing {
+    struct SlogRing *pNext;
+    unsigned int nHead;
+    unsigned int nTail;
+    int nActive;
+    int nBusy;
+    unsigned short nLen[SLOG_RING_SLOTS];
+    char sSlot[SLOG_RING_SLOTS][SLOG_SLOT_SIZE];
+} SlogRing;
+
 static SlogConfig g_slogCfg;
+
+unsigned int g_slogFlagMask = SLOG_MASK_ALL;
+unsigned short g_slogMaxLevel = 0;
+
+static SlogRing *g_pRings = NULL;
+static pthread_t g_asyncWriter;
+static pthread_key_t g_ringKey;
+static pthread_once_t g_ringKeyOnce = PTHREAD_ONCE_INIT;
+static __thread SlogRing *t_pRing = NULL;
+static int g_nAsync = 0;
+static int g_nAsyncRun = 0;
+static int g_nAsyncFd = -1;
+static unsigned long g_nDropped = 0;
 static SlogTag g_SlogTags[] =
 {
     { 0, "NONE", NULL },
@@ -126,24 +165,58 @@ static inline int clock_gettime(int clock_id, struct timespec *ts)
 }
 #endif /* DARWIN */
 
-void slog_get_date(SlogDate *pDate)
+/*
+ * Per-thread date cache. localtime_r and the date formatting only run when
+ * the second changes; otherwise just the hundredths are rewritten in place.
+ */
+typedef struct {
+    time_t nSec;
+    SlogDate date;
+    char sDate[32];
+    int nFrac;
+} SlogDateCache;
+
+static __thread SlogDateCache t_dateCache = { (time_t)-1 };
+
+static const char* slog_cached_date(SlogDate *pDate)
 {
-    struct tm timeinfo;
-    time_t rawtime = time(NULL);
-    localtime_r(&rawtime, &timeinfo);
-
-    /* Get System Date */
-    pDate->year = timeinfo.tm_year+1900;
-    pDate->mon = timeinfo.tm_mon+1;
-    pDate->day = timeinfo.tm_mday;
-    pDate->hour = timeinfo.tm_hour;
-    pDate->min = timeinfo.tm_min;
-    pDate->sec = timeinfo.tm_sec;
-
-    /* Get micro seconds */
+    SlogDateCache *pCache = &t_dateCache;
     struct timespec now;
-    clock_gettime(CLOCK_MONOTONIC, &now);
-    pDate->usec = now.tv_nsec / 10000000;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    if (now.tv_sec != pCache->nSec)
+    {
+        struct tm timeinfo;
+        localtime_r(&now.tv_sec, &timeinfo);
+
+        /* Get System Date */
+        pCache->date.year = timeinfo.tm_year+1900;
+        pCache->date.mon = timeinfo.tm_mon+1;
+        pCache->date.day = timeinfo.tm_mday;
+        pCache->date.hour = timeinfo.tm_hour;
+        pCache->date.min = timeinfo.tm_min;
+        pCache->date.sec = timeinfo.tm_sec;
+
+        pCache->nFrac = snprintf(pCache->sDate, sizeof(pCache->sDate), "%02d.%02d.%02d-%02d:%02d:%02d.", 
+                    pCache->date.year, pCache->date.mon, pCache->date.day, pCache->date.hour, 
+                    pCache->date.min, pCache->date.sec);
+        pCache->nSec = now.tv_sec;
+    }
+
+    /* Hundredths of a second */
+    int nCenti = now.tv_nsec / 10000000;
+    pCache->date.usec = nCenti;
+    pCache->sDate[pCache->nFrac] = '0' + nCenti / 10;
+    pCache->sDate[pCache->nFrac + 1] = '0' + nCenti % 10;
+    pCache->sDate[pCache->nFrac + 2] = '\0';
+
+    if (pDate != NULL) *pDate = pCache->date;
+    return pCache->sDate;
+}
+
+void slog_get_date(SlogDate *pDate)
+{
+    slog_cached_date(pDate);
 }
 
 const char* slog_version(int nMin)
@@ -161,13 +234,8 @@ const char* slog_version(int nMin)
     return sVersion;
 }
 
-void slog_prepare_output(const char* pStr, const SlogDate *pDate, int nType, int nColor, char* pOut, int nSize)
+void slog_prepare_output(const char* pStr, const char *sDate, int nType, int nColor, char* pOut, int nSize)
 {
-    char sDate[32];
-    snprintf(sDate, sizeof(sDate), "%02d.%02d.%02d-%02d:%02d:%02d.%02d", 
-                    pDate->year, pDate->mon, pDate->day, pDate->hour, 
-                    pDate->min, pDate->sec, pDate->usec);
-
     /* Walk throu */
     for (int i = 0;; i++)
     {
@@ -189,15 +257,22 @@ void slog_prepare_output(const char* pStr, const SlogDate *pDate, int nType, int
     }
 }
 
+/* Returns 0, or 1 if the (stamped) file name does not fit in pOut */
+static int slog_file_name(char *pOut, int nSize, const char *pFile, const SlogDate *pDate)
+{
+    int nLen;
+    if (g_slogCfg.nFileStamp) 
+        nLen = snprintf(pOut, nSize, "%s-%02d-%02d-%02d", pFile, pDate->year, pDate->mon, pDate->day);
+    else 
+        nLen = snprintf(pOut, nSize, "%s", pFile);
+    return nLen < 0 || nLen >= nSize;
+}
+
 void slog_to_file(char *pStr, const char *pFile, SlogDate *pDate)
 {
     char sFileName[PATH_MAX];
     memset(sFileName, 0, sizeof(sFileName));
-
-    if (g_slogCfg.nFileStamp) 
-        snprintf(sFileName, sizeof(sFileName), "%s-%02d-%02d-%02d", pFile, pDate->year, pDate->mon, pDate->day);
-    else 
-        snprintf(sFileName, sizeof(sFileName), "%s", pFile);
+    if (slog_file_name(sFileName, sizeof(sFileName), pFile, pDate)) return;
 
     FILE *fp = fopen(sFileName, "a");
     if (fp == NULL) return;
@@ -206,6 +281,263 @@ void slog_to_file(char *pStr, const char *pFile, SlogDate *pDate)
     fclose(fp);
 }
 
+static void slog_ring_release(void *pArg)
+{
+    SlogRing *pRing = (SlogRing*)pArg;
+    __atomic_store_n(&pRing->nActive, 0, __ATOMIC_RELEASE);
+}
+
+static void slog_ring_key_init(void)
+{
+    pthread_key_create(&g_ringKey, slog_ring_release);
+}
+
+static SlogRing* slog_ring_get(void)
+{
+    if (t_pRing != NULL) return t_pRing;
+    pthread_once(&g_ringKeyOnce, slog_ring_key_init);
+
+    /* Reuse a ring left behind by an exited thread before allocating */
+    SlogRing *pRing = __atomic_load_n(&g_pRings, __ATOMIC_ACQUIRE);
+    for (; pRing != NULL; pRing = pRing->pNext)
+    {
+        int nExpected = 0;
+        if (__atomic_compare_exchange_n(&pRing->nActive, &nExpected, 1, 0, 
+            __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) break;
+    }
+
+    if (pRing == NULL)
+    {
+        pRing = (SlogRing*)calloc(1, sizeof(SlogRing));
+        if (pRing == NULL) return NULL;
+        pRing->nActive = 1;
+        pRing->pNext = __atomic_load_n(&g_pRings, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&g_pRings, &pRing->pNext, pRing, 1, 
+            __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+
+    pthread_setspecific(g_ringKey, pRing);
+    t_pRing = pRing;
+    return pRing;
+}
+
+/* Returns 1 if the backend was stopped before the line could be queued */
+static int slog_ring_push(const char *pStr)
+{
+    SlogRing *pRing = slog_ring_get();
+    if (pRing == NULL)
+    {
+        __atomic_fetch_add(&g_nDropped, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    /* Mark the ring busy before checking the backend is still running (pairs with slog_async_stop) */
+    __atomic_store_n(&pRing->nBusy, 1, __ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&g_nAsync, __ATOMIC_SEQ_CST))
+    {
+        __atomic_store_n(&pRing->nBusy, 0, __ATOMIC_RELEASE);
+        return 1;
+    }
+
+    /* Bounded: a full ring drops the line rather than blocking the caller */
+    unsigned int nHead = pRing->nHead;
+    unsigned int nTail = __atomic_load_n(&pRing->nTail, __ATOMIC_ACQUIRE);
+    if (nHead - nTail >= SLOG_RING_SLOTS)
+    {
+        __atomic_fetch_add(&g_nDropped, 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&pRing->nBusy, 0, __ATOMIC_RELEASE);
+        return 0;
+    }
+
+    /* Lines longer than a slot are truncated, keeping the newline */
+    char *pSlot = pRing->sSlot[nHead & (SLOG_RING_SLOTS - 1)];
+    size_t nLen = strlen(pStr);
+    if (nLen > SLOG_SLOT_SIZE - 1) nLen = SLOG_SLOT_SIZE - 1;
+    memcpy(pSlot, pStr, nLen);
+    pSlot[nLen++] = '\n';
+    pRing->nLen[nHead & (SLOG_RING_SLOTS - 1)] = (unsigned short)nLen;
+
+    __atomic_store_n(&pRing->nHead, nHead + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&pRing->nBusy, 0, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static void slog_write_all(int nFd, const char *pBuf, size_t nLen)
+{
+    while (nLen > 0)
+    {
+        ssize_t nDone = write(nFd, pBuf, nLen);
+        if (nDone < 0)
+        {
+            if (errno == EINTR) continue;
+            return;
+        }
+        pBuf += nDone;
+        nLen -= nDone;
+    }
+}
+
+static size_t slog_async_drain(char *pBatch)
+{
+    size_t nUsed = 0, nTotal = 0;
+    SlogRing *pRing = __atomic_load_n(&g_pRings, __ATOMIC_ACQUIRE);
+
+    for (; pRing != NULL; pRing = pRing->pNext)
+    {
+        unsigned int nTail = pRing->nTail;
+        unsigned int nHead = __atomic_load_n(&pRing->nHead, __ATOMIC_ACQUIRE);
+
+        while (nTail != nHead)
+        {
+            unsigned int nIdx = nTail & (SLOG_RING_SLOTS - 1);
+            if (nUsed + pRing->nLen[nIdx] > SLOG_BATCH_SIZE)
+            {
+                slog_write_all(g_nAsyncFd, pBatch, nUsed);
+                nTotal += nUsed;
+                nUsed = 0;
+            }
+            memcpy(pBatch + nUsed, pRing->sSlot[nIdx], pRing->nLen[nIdx]);
+            nUsed += pRing->nLen[nIdx];
+            nTail++;
+        }
+        __atomic_store_n(&pRing->nTail, nTail, __ATOMIC_RELEASE);
+    }
+
+    if (nUsed > 0) slog_write_all(g_nAsyncFd, pBatch, nUsed);
+    return nTotal + nUsed;
+}
+
+static long long slog_usec_since(const struct timespec *pStart)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - pStart->tv_sec) * 1000000LL + (now.tv_nsec - pStart->tv_nsec) / 1000;
+}
+
+/* Move to a new file when the date in a stamped file name changes */
+static void slog_async_rotate(char *pBatch, int *pDay)
+{
+    SlogDate date;
+    slog_get_date(&date);
+    if (!g_slogCfg.nFileStamp || date.day == *pDay) return;
+
+    char sFileName[PATH_MAX];
+    if (slog_file_name(sFileName, sizeof(sFileName), g_slogCfg.sFileName, &date)) return;
+    int nFd = open(sFileName, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (nFd < 0) return;
+
+    /* Lines queued before the rollover go to the old file */
+    slog_async_drain(pBatch);
+    fsync(g_nAsyncFd);
+    close(g_nAsyncFd);
+    g_nAsyncFd = nFd;
+    *pDay = date.day;
+}
+
+static void* slog_async_writer(void *pArg)
+{
+    char *pBatch = (char*)pArg;
+    unsigned long nReported = 0;
+    size_t nUnsynced = 0;
+    struct timespec lastSync;
+    clock_gettime(CLOCK_MONOTONIC, &lastSync);
+    SlogDate date;
+    slog_get_date(&date);
+    int nDay = date.day;
+
+    while (__atomic_load_n(&g_nAsyncRun, __ATOMIC_ACQUIRE))
+    {
+        slog_async_rotate(pBatch, &nDay);
+        size_t nWritten = slog_async_drain(pBatch);
+        nUnsynced += nWritten;
+
+        /* Report drops once per batch rather than once per lost line */
+        unsigned long nDropped = __atomic_load_n(&g_nDropped, __ATOMIC_RELAXED);
+        if (nDropped != nReported)
+        {
+            int nLen = snprintf(pBatch, SLOG_BATCH_SIZE, "[WARN] slog dropped %lu messages (total %lu)\n", 
+                                nDropped - nReported, nDropped);
+            slog_write_all(g_nAsyncFd, pBatch, nLen);
+            nReported = nDropped;
+        }
+
+        if (nUnsynced && slog_usec_since(&lastSync) >= SLOG_FSYNC_USEC)
+        {
+            fsync(g_nAsyncFd);
+            clock_gettime(CLOCK_MONOTONIC, &lastSync);
+            nUnsynced = 0;
+        }
+
+        if (!nWritten) usleep(SLOG_POLL_USEC);
+    }
+
+    /* Flush whatever was queued before the stop request */
+    slog_async_drain(pBatch);
+    fsync(g_nAsyncFd);
+    return pBatch;
+}
+
+int slog_async_start(void)
+{
+    if (g_nAsync) return 0;
+
+    char sFileName[PATH_MAX];
+    SlogDate date;
+    slog_get_date(&date);
+    if (slog_file_name(sFileName, sizeof(sFileName), g_slogCfg.sFileName, &date)) return 1;
+
+    g_nAsyncFd = open(sFileName, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (g_nAsyncFd < 0) return 1;
+
+    char *pBatch = (char*)malloc(SLOG_BATCH_SIZE);
+    if (pBatch == NULL)
+    {
+        close(g_nAsyncFd);
+        g_nAsyncFd = -1;
+        return 1;
+    }
+
+    __atomic_store_n(&g_nAsyncRun, 1, __ATOMIC_RELEASE);
+    if (pthread_create(&g_asyncWriter, NULL, slog_async_writer, pBatch))
+    {
+        g_nAsyncRun = 0;
+        free(pBatch);
+        close(g_nAsyncFd);
+        g_nAsyncFd = -1;
+        return 1;
+    }
+
+    __atomic_store_n(&g_nAsync, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void slog_async_stop(void)
+{
+    if (!g_nAsync) return;
+
+    /* New lines go back to the synchronous path while the writer drains */
+    __atomic_store_n(&g_nAsync, 0, __ATOMIC_SEQ_CST);
+
+    /* Wait for pushes that started before the switch, so the final drain sees them */
+    SlogRing *pRing = __atomic_load_n(&g_pRings, __ATOMIC_ACQUIRE);
+    for (; pRing != NULL; pRing = pRing->pNext)
+        while (__atomic_load_n(&pRing->nBusy, __ATOMIC_SEQ_CST)) sched_yield();
+
+    __atomic_store_n(&g_nAsyncRun, 0, __ATOMIC_RELEASE);
+
+    void *pBatch = NULL;
+    pthread_join(g_asyncWriter, &pBatch);
+    free(pBatch);
+
+    close(g_nAsyncFd);
+    g_nAsyncFd = -1;
+}
+
+unsigned long slog_async_dropped(void)
+{
+    return __atomic_load_n(&g_nDropped, __ATOMIC_RELAXED);
+}
+
 int slog_parse_config(const char *pConfig)
 {
     if (pConfig == NULL) return 0;
@@ -251,53 +583,61 @@ int slog_parse_config(const char *pConfig)
     return 1;
 }
 
-void slog(int nLevel, int nFlag, const char *pMsg, ...)
+/* Recompute the cached filter used by slog_enabled() */
+static void slog_update_filter(void)
 {
-    slog_sync_lock();
+    unsigned int nMask = g_slogCfg.nFlagMask ? g_slogCfg.nFlagMask : SLOG_MASK_ALL;
+    if (g_slogCfg.nSilent) nMask &= ~(SLOG_FLAG_BIT(SLOG_DEBUG) | SLOG_FLAG_BIT(SLOG_LIVE));
+
+    g_slogMaxLevel = g_slogCfg.nLogLevel > g_slogCfg.nFileLevel ? 
+        g_slogCfg.nLogLevel : g_slogCfg.nFileLevel;
+    g_slogFlagMask = nMask;
+}
+
+void slog_write(int nLevel, int nFlag, const char *pMsg, ...)
+{
+    /* The async backend has its own per-thread queues, so skip the global lock */
+    int nAsync = __atomic_load_n(&g_nAsync, __ATOMIC_ACQUIRE);
+    if (!nAsync) slog_sync_lock();
 
-    if (g_slogCfg.nSilent && 
-        (nFlag == SLOG_DEBUG || 
-        nFlag == SLOG_LIVE)) 
+    /* Filter before any formatting (covers callers that bypass the slog() macro) */
+    if (!slog_enabled(nLevel, nFlag))
     {
-        slog_sync_unlock();
+        if (!nAsync) slog_sync_unlock();
         return;
     }
 
     char sInput[MAXMSG];
-    memset(sInput, 0, sizeof(sInput));
-
     va_list args;
     va_start(args, pMsg);
-    vsprintf(sInput, pMsg, args);
+    vsnprintf(sInput, sizeof(sInput), pMsg, args);
     va_end(args);
 
-    /* Check logging levels */
-    if(!nLevel || nLevel <= g_slogCfg.nLogLevel || nLevel <= g_slogCfg.nFileLevel)
-    {
-        SlogDate date;
-        slog_get_date(&date);
+    SlogDate date;
+    const char *sDate = slog_cached_date(&date);
 
-        char sMessage[MAXMSG];
-        memset(sMessage, 0, sizeof(sMessage));
+    char sMessage[MAXMSG];
+    slog_prepare_output(sInput, sDate, nFlag, 1, sMessage, sizeof(sMessage));
+    if (nLevel <= g_slogCfg.nLogLevel) printf("%s\n", sMessage);
 
-        slog_prepare_output(sInput, &date, nFlag, 1, sMessage, sizeof(sMessage));
-        if (nLevel <= g_slogCfg.nLogLevel) printf("%s\n", sMessage);
+    /* Save log in the file */
+    if ((g_slogCfg.nToFile && nLevel <= g_slogCfg.nFileLevel) || 
+        (g_slogCfg.nErrLog && (nFlag == (SLOG_ERROR | SLOG_PANIC | SLOG_FATAL))))
+    {
+        if (g_slogCfg.nPretty)
+            slog_prepare_output(sInput, sDate, nFlag, 0, sMessage, sizeof(sMessage));
 
-        /* Save log in the file */
-        if ((g_slogCfg.nToFile && nLevel <= g_slogCfg.nFileLevel) || 
-            (g_slogCfg.nErrLog && (nFlag == (SLOG_ERROR | SLOG_PANIC | SLOG_FATAL))))
+        if (!nAsync) slog_to_file(sMessage, g_slogCfg.sFileName, &date);
+        else if (slog_ring_push(sMessage))
         {
-            if (g_slogCfg.nPretty)
-            {
-                memset(sMessage, 0, sizeof(sMessage));
-                slog_prepare_output(sInput, &date, nFlag, 0, sMessage, sizeof(sMessage));
-            }
-
+            /* The backend stopped after this call started, write it directly */
+            slog_sync_lock();
             slog_to_file(sMessage, g_slogCfg.sFileName, &date);
+            slog_sync_unlock();
         }
     }
 
-    slog_sync_unlock();
+    if (!nAsync) slog_sync_unlock();
 }
 
 void slog_config_get(SlogConfig *pCfg)
@@ -314,6 +654,7 @@ void slog_config_get(SlogConfig *pCfg)
     pCfg->nTdSafe = g_slogCfg.nTdSafe;
     pCfg->nErrLog = g_slogCfg.nErrLog;
     pCfg->nSilent = g_slogCfg.nSilent;
+    pCfg->nFlagMask = g_slogCfg.nFlagMask;
     slog_sync_unlock();
 }
 
@@ -331,6 +672,8 @@ void slog_config_set(SlogConfig *pCfg)
     g_slogCfg.nTdSafe = pCfg->nTdSafe;
     g_slogCfg.nErrLog = pCfg->nErrLog;
     g_slogCfg.nSilent = pCfg->nSilent;
+    g_slogCfg.nFlagMask = pCfg->nFlagMask;
+    slog_update_filter();
 
     if (g_slogCfg.nTdSafe && !g_slogCfg.nSync)
     {
@@ -351,7 +694,7 @@ void slog_init(const char* pName, const char* pConf, int nLogLevel, int nTdSafe)
 {
     /* Set up default values */
     memset(g_slogCfg.sFileName, 0, sizeof(g_slogCfg.sFileName));
-    strcpy(g_slogCfg.sFileName, pName);
+    snprintf(g_slogCfg.sFileName, sizeof(g_slogCfg.sFileName), "%s", pName);
 
     g_slogCfg.nLogLevel = nLogLevel;
     g_slogCfg.nTdSafe = nTdSafe;
@@ -359,6 +702,7 @@ void slog_init(const char* pName, const char* pConf, int nLogLevel, int nTdSafe)
     g_slogCfg.nFileLevel = 0;
     g_slogCfg.nErrLog = 0;
     g_slogCfg.nSilent = 0;
+    g_slogCfg.nFlagMask = SLOG_MASK_ALL;
     g_slogCfg.nToFile = 0;
     g_slogCfg.nPretty = 0;
     g_slogCfg.nSync = 0;
@@ -368,4 +712,5 @@ void slog_init(const char* pName, const char* pConf, int nLogLevel, int nTdSafe)
 
     /* Parse config file */
     slog_parse_config(pConf);
+    slog_update_filter();
 }
\ No newline at end of file
@@ -31,6 +31,7 @@
 extern "C" {
 #endif
 
+#include <limits.h>
 #include <pthread.h>
 
 /* Definations for version info */
@@ -59,10 +60,44 @@ extern "C" {
 #define CLR_WHITE    "\x1B[37m"
 #define CLR_RESET    "\033[0m"
 
+/* Flag masks, used for the runtime and compile-time filters */
+#define SLOG_FLAG_BIT(FLAG) (1U << (FLAG))
+#define SLOG_MASK_ALL       0xFFU
+#define SLOG_MASK_ERRORS    (SLOG_FLAG_BIT(SLOG_ERROR) | SLOG_FLAG_BIT(SLOG_FATAL) | SLOG_FLAG_BIT(SLOG_PANIC))
+
+/* 
+ * Compile-time filters. Calls whose flag is not in the mask compile to 
+ * nothing, including their arguments. SLOG_HOT_COMPILE_MASK only applies
+ * to slog_hot(), which is used for per-read and per-event messages.
+ */
+#ifndef SLOG_COMPILE_MASK
+#define SLOG_COMPILE_MASK SLOG_MASK_ALL
+#endif
+
+#ifndef SLOG_HOT_COMPILE_MASK
+#define SLOG_HOT_COMPILE_MASK SLOG_MASK_ALL
+#endif
+
 #define LVL1(x) #x
 #define LVL2(x) LVL1(x)
 #define SOURCE_THROW_LOCATION "<"__FILE__":"LVL2(__LINE__)"> -- "
 
+/* 
+ * slog() checks the cached runtime filter before doing any formatting,
+ * so disabled messages cost one load and a branch.
+ */
+#define slog(LEVEL, FLAG, ...) \
+    do { \
+        if ((SLOG_COMPILE_MASK & SLOG_FLAG_BIT(FLAG)) && slog_enabled(LEVEL, FLAG)) \
+            slog_write(LEVEL, FLAG, __VA_ARGS__); \
+    } while (0)
+
+#define slog_hot(LEVEL, FLAG, ...) \
+    do { \
+        if ((SLOG_HOT_COMPILE_MASK & SLOG_FLAG_BIT(FLAG)) && slog_enabled(LEVEL, FLAG)) \
+            slog_write(LEVEL, FLAG, __VA_ARGS__); \
+    } while (0)
+
 /* 
  * Define macros to allow us get further informations 
  * on the corresponding erros. These macros used as wrappers 
@@ -94,7 +129,7 @@ extern "C" {
 
 /* Flags */
 typedef struct {
-    char sFileName[64];
+    char sFileName[PATH_MAX];
     unsigned short nFileLevel;
     unsigned short nLogLevel;
     unsigned short nFileStamp:1;
@@ -104,6 +139,7 @@ typedef struct {
     unsigned short nErrLog:1;
     unsigned short nSilent:1;
     unsigned short nSync:1;
+    unsigned int nFlagMask; /* Flags to log (SLOG_FLAG_BIT, 0 for all), nSilent also drops LIVE and DEBUG */
     pthread_mutex_t slogLock;
 } SlogConfig;
 
@@ -130,7 +166,27 @@ void slog_config_get(SlogConfig *pCfg);
 void slog_config_set(SlogConfig *pCfg);
 
 void slog_init(const char* pName, const char* pConf, int nLogLevel, int nTdSafe);
-void slog(int level, int flag, const char *pMsg, ...);
+void slog_write(int level, int flag, const char *pMsg, ...);
+
+/* Runtime filter, refreshed by slog_init() and slog_config_set() */
+extern unsigned int g_slogFlagMask;
+extern unsigned short g_slogMaxLevel;
+
+static inline int slog_enabled(int nLevel, int nFlag)
+{
+    return (g_slogFlagMask & SLOG_FLAG_BIT(nFlag)) && (!nLevel || nLevel <= g_slogMaxLevel);
+}
+
+/* 
+ * Asynchronous file backend. Once started, file output from slog() is
+ * queued on per-thread lock-free rings and written in batches by a 
+ * background thread. Lines are dropped (and counted) if a ring is full.
+ * With nFileStamp set, the writer moves to a new file when the date changes.
+ * Change the config with slog_config_set() before starting, not after.
+ */
+int slog_async_start(void);
+void slog_async_stop(void);
+unsigned long slog_async_dropped(void);
 
 /* For include header in CPP code */
 #ifdef __cplusplus
@@ -0,0 +1,190 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "slog.h"
+#include "stream.h"
+
+/*
+    the stream is parsed straight from a buffer rather than with kseq, as kseq treats a short read as the end of the file
+    and would otherwise hold back the last records until its buffer fills
+    - records must be 4-line FASTQ, which is what basecallers write
+*/
+
+// streamBuffer_t holds the data read from the stream that hasn't been parsed yet
+typedef struct streamBuffer
+{
+    char *data;
+    size_t len;
+    size_t cap;
+} streamBuffer_t;
+
+static volatile sig_atomic_t streamStopping = 0;
+
+// streamStop makes streamFastq return once it has handled the data already read (safe to call from a signal handler)
+void streamStop(void)
+{
+    streamStopping = 1;
+}
+
+// nextLine finds the line starting at p, returns a pointer past its newline (or NULL if the line isn't complete)
+static char *nextLine(char *p, char *end, size_t *lineLen)
+{
+    char *nl = memchr(p, '\n', end - p);
+    if (nl == NULL)
+        return NULL;
+    *lineLen = nl - p;
+    if (*lineLen > 0 && p[*lineLen - 1] == '\r')
+        (*lineLen)--;
+    return nl + 1;
+}
+
+// parseRecords sends the complete records in the buffer to the handler and keeps any partial record
+static int parseRecords(streamBuffer_t *buf, streamHandler_t *handler)
+{
+    char *p = buf->data, *end = buf->data + buf->len;
+    int err = 0;
+    while (p < end)
+    {
+        char *line[4], *next = p;
+        size_t lineLen[4];
+        int i;
+        for (i = 0; i < 4; i++)
+        {
+            line[i] = next;
+            if ((next = nextLine(next, end, &lineLen[i])) == NULL)
+                break;
+        }
+        if (i < 4)
+            break;
+
+        // skip a line at a time until the records line up again
+        if (lineLen[0] == 0 || line[0][0] != '@' || lineLen[2] == 0 || line[2][0] != '+')
+        {
+            slog(0, SLOG_ERROR, "skipping malformed FASTQ line in stream");
+            p = line[1];
+            continue;
+        }
+
+        // the name runs up to the first whitespace, as with kseq
+        size_t nameLen = 1;
+        while (nameLen < lineLen[0] && line[0][nameLen] != ' ' && line[0][nameLen] != '\t')
+            nameLen++;
+        if ((err = handler->onRead(handler->ctx, line[0] + 1, nameLen - 1, line[1], lineLen[1])) != 0)
+            break;
+        p = next;
+    }
+    buf->len = end - p;
+    memmove(buf->data, p, buf->len);
+    return err;
+}
+
+// readStream reads an open stream until it closes, flushing when it goes quiet
+static int readStream(int fd, int flushMs, streamBuffer_t *buf, streamHandler_t *handler)
+{
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    while (!streamStopping)
+    {
+        int ready = poll(&pfd, 1, flushMs);
+        if (ready < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            slog(0, SLOG_ERROR, "could not poll the stream: %s", strerror(errno));
+            return 1;
+        }
+        if (ready == 0)
+        {
+            if (handler->onIdle(handler->ctx) != 0)
+                return 1;
+            continue;
+        }
+
+        // make room for at least one more full read
+        if (buf->cap - buf->len < AM_STREAM_BUFFER_SIZE / 2)
+        {
+            char *data = realloc(buf->data, buf->cap * 2);
+            if (data == NULL)
+            {
+                slog(0, SLOG_ERROR, "could not grow the stream buffer");
+                return 1;
+            }
+            buf->data = data;
+            buf->cap *= 2;
+        }
+        ssize_t n = read(fd, buf->data + buf->len, buf->cap - buf->len);
+        if (n < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            slog(0, SLOG_ERROR, "could not read the stream: %s", strerror(errno));
+            return 1;
+        }
+        if (n == 0)
+        {
+            if (buf->len > 0)
+                slog(0, SLOG_ERROR, "stream closed part way through a record (%zu bytes dropped)", buf->len);
+            buf->len = 0;
+            return 0;
+        }
+        buf->len += n;
+        if (parseRecords(buf, handler) != 0)
+            return 1;
+    }
+    return 0;
+}
+
+/*
+    streamFastq reads FASTQ records from stdin (-) or a named pipe as they arrive
+    - records are passed to handler->onRead as soon as they are complete
+    - handler->onIdle is called after flushMs without any data, so partial batches don't wait for more reads
+    - a named pipe is reopened when its writer closes it, so the stream runs until streamStop is called
+*/
+int streamFastq(const char *path, int flushMs, streamHandler_t *handler)
+{
+    int useStdin = (strcmp(path, "-") == 0), isFifo = 0, err = 0;
+    struct stat st;
+    if (!useStdin)
+    {
+        if (stat(path, &st) != 0)
+        {
+            slog(0, SLOG_ERROR, "could not access the stream: %s", path);
+            return 1;
+        }
+        isFifo = S_ISFIFO(st.st_mode);
+    }
+    streamBuffer_t buf = {.data = malloc(AM_STREAM_BUFFER_SIZE), .len = 0, .cap = AM_STREAM_BUFFER_SIZE};
+    if (buf.data == NULL)
+    {
+        slog(0, SLOG_ERROR, "could not allocate the stream buffer");
+        return 1;
+    }
+    while (!streamStopping)
+    {
+        // opening a named pipe blocks until there is a writer
+        int fd = useStdin ? STDIN_FILENO : open(path, O_RDONLY);
+        if (fd < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            slog(0, SLOG_ERROR, "could not open the stream: %s", path);
+            err = 1;
+            break;
+        }
+        err = readStream(fd, flushMs, &buf, handler);
+        if (!useStdin)
+            close(fd);
+        if (handler->onIdle(handler->ctx) != 0)
+            err = 1;
+        if (err || !isFifo)
+            break;
+        slog(0, SLOG_INFO, "stream writer closed %s, waiting for the next one", path);
+    }
+    free(buf.data);
+    return err;
+}
@@ -0,0 +1,28 @@
+// stream reads FASTQ records from stdin or a named pipe as soon as they arrive
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stddef.h>
+
+#define AM_STREAM_BUFFER_SIZE (1024 * 1024)
+#define AM_STREAM_DEFAULT_FLUSH_MS 1000
+
+/*
+    streamHandler_t receives the records from a stream
+    - onRead gets each complete record (the name and sequence are not null terminated), returns 0 to carry on
+    - onIdle is called when no data has arrived for the flush interval and when the stream closes
+*/
+typedef struct streamHandler
+{
+    void *ctx;
+    int (*onRead)(void *ctx, const char *name, size_t nameLen, const char *seq, size_t seqLen);
+    int (*onIdle)(void *ctx);
+} streamHandler_t;
+
+/*
+    function prototypes
+*/
+int streamFastq(const char *path, int flushMs, streamHandler_t *handler);
+void streamStop(void);
+
+#endif
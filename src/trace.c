@@ -0,0 +1,152 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+// each thread buffers its events and writes them out in blocks
+#define TRACE_BUFFER_EVENTS 4096
+
+// traceEvent is a completed span
+typedef struct traceEvent
+{
+    const char *name;
+    uint64_t start;
+    uint64_t end;
+} traceEvent_t;
+
+// traceBuffer holds the pending events for one thread
+typedef struct traceBuffer
+{
+    struct traceBuffer *next;
+    pthread_mutex_t lock;
+    int tid;
+    int count;
+    traceEvent_t events[TRACE_BUFFER_EVENTS];
+} traceBuffer_t;
+
+int traceEnabled = 0;
+
+// traceLock protects the file and the buffer list, take it before any buffer lock
+static pthread_mutex_t traceLock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *traceFile = NULL;
+static traceBuffer_t *buffers = NULL;
+static int nextTid = 1;
+static int firstEvent = 1;
+static uint64_t traceOrigin = 0;
+static __thread traceBuffer_t *threadBuffer = NULL;
+
+// traceNow returns a monotonic timestamp in nanoseconds
+uint64_t traceNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// getBuffer returns the calling thread's buffer, creating it on first use
+static traceBuffer_t *getBuffer(void)
+{
+    if (threadBuffer != NULL)
+        return threadBuffer;
+    traceBuffer_t *buf = calloc(1, sizeof(traceBuffer_t));
+    if (buf == NULL)
+        return NULL;
+    pthread_mutex_init(&buf->lock, NULL);
+    pthread_mutex_lock(&traceLock);
+    buf->tid = nextTid++;
+    buf->next = buffers;
+    buffers = buf;
+    pthread_mutex_unlock(&traceLock);
+    threadBuffer = buf;
+    return buf;
+}
+
+// flushBuffer writes out a buffer's events (traceLock and the buffer lock must be held)
+static void flushBuffer(traceBuffer_t *buf)
+{
+    int i;
+    if (traceFile != NULL)
+    {
+        for (i = 0; i < buf->count; i++)
+        {
+            traceEvent_t *e = &buf->events[i];
+            fprintf(traceFile, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                    firstEvent ? "\n" : ",\n", e->name, (int)getpid(), buf->tid,
+                    (e->start - traceOrigin) / 1e3, (e->end - e->start) / 1e3);
+            firstEvent = 0;
+        }
+    }
+    buf->count = 0;
+}
+
+// traceRecord adds a completed span to the calling thread's buffer
+void traceRecord(const char *name, uint64_t start, uint64_t end)
+{
+    traceBuffer_t *buf = getBuffer();
+    if (buf == NULL)
+        return;
+    pthread_mutex_lock(&buf->lock);
+    if (buf->count == TRACE_BUFFER_EVENTS)
+    {
+        // respect the lock order when the buffer needs writing out
+        pthread_mutex_unlock(&buf->lock);
+        pthread_mutex_lock(&traceLock);
+        pthread_mutex_lock(&buf->lock);
+        flushBuffer(buf);
+        pthread_mutex_unlock(&traceLock);
+    }
+    if (__atomic_load_n(&traceEnabled, __ATOMIC_RELAXED))
+    {
+        traceEvent_t *e = &buf->events[buf->count++];
+        e->name = name;
+        e->start = start;
+        e->end = end;
+    }
+    pthread_mutex_unlock(&buf->lock);
+}
+
+// traceStart opens a timeline file and starts recording spans
+int traceStart(const char *filename)
+{
+    pthread_mutex_lock(&traceLock);
+    if (traceFile != NULL)
+    {
+        pthread_mutex_unlock(&traceLock);
+        return 0;
+    }
+    if ((traceFile = fopen(filename, "w")) == NULL)
+    {
+        pthread_mutex_unlock(&traceLock);
+        return 1;
+    }
+    fprintf(traceFile, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    firstEvent = 1;
+    traceOrigin = traceNow();
+    __atomic_store_n(&traceEnabled, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&traceLock);
+    return 0;
+}
+
+// traceStop stops recording, writes out any buffered spans and closes the timeline
+void traceStop(void)
+{
+    traceBuffer_t *buf;
+    pthread_mutex_lock(&traceLock);
+    __atomic_store_n(&traceEnabled, 0, __ATOMIC_RELEASE);
+    for (buf = buffers; buf != NULL; buf = buf->next)
+    {
+        pthread_mutex_lock(&buf->lock);
+        flushBuffer(buf);
+        pthread_mutex_unlock(&buf->lock);
+    }
+    if (traceFile != NULL)
+    {
+        fprintf(traceFile, "\n]}\n");
+        fclose(traceFile);
+        traceFile = NULL;
+    }
+    pthread_mutex_unlock(&traceLock);
+}
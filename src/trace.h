@@ -0,0 +1,54 @@
+// trace provides optional profiling hooks for the hot paths
+// - USDT probes (when sys/sdt.h is available) cost a nop until a tracer attaches
+// - a chrome://tracing JSON timeline can be switched on and off while the daemon runs
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define TRACE_PROBE(PROBE) DTRACE_PROBE(antman, PROBE)
+#define TRACE_PROBE1(PROBE, ARG) DTRACE_PROBE1(antman, PROBE, ARG)
+#else
+#define TRACE_PROBE(PROBE)
+#define TRACE_PROBE1(PROBE, ARG)
+#endif
+
+// traceEnabled is set while a timeline is being recorded
+extern int traceEnabled;
+
+/*
+    function prototypes
+*/
+uint64_t traceNow(void);
+void traceRecord(const char *name, uint64_t start, uint64_t end);
+int traceStart(const char *filename);
+void traceStop(void);
+
+// traceBegin returns a start time if the timeline is recording, 0 otherwise
+static inline uint64_t traceBegin(void)
+{
+    return __builtin_expect(traceEnabled, 0) ? traceNow() : 0;
+}
+
+// traceEnd adds a span to the timeline if traceBegin started one
+static inline void traceEnd(const char *name, uint64_t start)
+{
+    if (__builtin_expect(start != 0, 0))
+        traceRecord(name, start, traceNow());
+}
+
+/*
+    TRACE_BEGIN and TRACE_END wrap a span with a pair of USDT probes (PROBE__start/PROBE__done)
+    and a timeline event called NAME
+*/
+#define TRACE_BEGIN(VAR, PROBE)            \
+    TRACE_PROBE(PROBE##__start);           \
+    uint64_t VAR = traceBegin()
+
+#define TRACE_END(VAR, PROBE, NAME) \
+    traceEnd(NAME, VAR);            \
+    TRACE_PROBE(PROBE##__done)
+
+#endif
@@ -1,8 +1,15 @@
 #ifndef TEST_CONFIG
 #define TEST_CONFIG
 
+#include <fcntl.h>
+#include <glob.h>
+#include <limits.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <unistd.h>
 
 #include "minunit.h"
 #include "../config.h"
@@ -15,6 +22,23 @@
 #define ERR_initConf4 "loaded conf file does not match original conf"
 #define ERR_checkConf1 "check failed for existing conf file"
 #define ERR_checkConf2 "could not create new conf file during the checkConfig function"
+#define ERR_atomic1 "temporary file left behind after writing the conf"
+#define ERR_atomic2 "conf file is not pretty printed"
+#define ERR_save1 "unchanged conf was written"
+#define ERR_save2 "changed conf was not written"
+#define ERR_lock1 "could not lock the conf"
+#define ERR_lock2 "conf lock is not exclusive"
+#define ERR_lock3 "conf lock was not released"
+#define ERR_schema1 "default conf is not valid"
+#define ERR_schema2 "out of range value was accepted"
+#define ERR_schema3 "conf with a bad value was loaded"
+#define ERR_schema4 "conf fields did not survive a round trip"
+#define ERR_schema5 "missing fields did not keep their defaults"
+#define ERR_location1 "wrong config location"
+#define ERR_location2 "bad instance name was accepted"
+#define ERR_copy1 "copied conf was not saved to the copy"
+#define ERR_copy2 "saving a copied conf changed the original"
+#define ERR_port "new instance was given a metrics port that is already used"
 
 int tests_run = 0;
 
@@ -26,7 +50,7 @@ static char *test_initConf()
 
   // create a config
   config_t *tmp = initConfig();
-  tmp->pid = 666;
+  tmp->metrics_port = 666;
   if (tmp == 0)
     return ERR_initConf1;
 
@@ -38,7 +62,7 @@ static char *test_initConf()
   config_t *tmp2 = initConfig();
   if (loadConfig(tmp2, TMP_CONFIG) != 0)
     return ERR_initConf3;
-  if (tmp->pid != tmp2->pid)
+  if (tmp->metrics_port != tmp2->metrics_port)
     return ERR_initConf4;
 
   // clean up the test
@@ -48,12 +72,286 @@ static char *test_initConf()
   return 0;
 }
 
+/*
+  test the conf is written in one go, without leaving anything behind, and only when it has changed
+*/
+static char *test_atomicWrite()
+{
+  config_t *tmp = initConfig();
+  if (tmp == 0)
+    return ERR_initConf1;
+  tmp->metrics_port = 42;
+  if (writeConfig(tmp, TMP_CONFIG) != 0)
+    return ERR_initConf2;
+  glob_t leftovers;
+  int found = glob(TMP_CONFIG ".tmp*", 0, NULL, &leftovers) == 0;
+  globfree(&leftovers);
+  if (found)
+    return ERR_atomic1;
+
+  // the conf should be readable by hand, one field to a line
+  char *content = json_fread(TMP_CONFIG);
+  if (content == NULL || strstr(content, "\n  \"metrics_port\": 42,\n") == NULL)
+    return ERR_atomic2;
+  free(content);
+
+  // saveConfig only writes when something has changed
+  remove(TMP_CONFIG);
+  if (saveConfig(tmp) != 0 || access(TMP_CONFIG, F_OK) == 0)
+    return ERR_save1;
+  tmp->metrics_port = 43;
+  tmp->dirty = 1;
+  if (saveConfig(tmp) != 0 || tmp->dirty != 0)
+    return ERR_save2;
+  config_t *tmp2 = initConfig();
+  if (loadConfig(tmp2, TMP_CONFIG) != 0 || tmp2->metrics_port != 43)
+    return ERR_save2;
+
+  destroyConfig(tmp);
+  destroyConfig(tmp2);
+  remove(TMP_CONFIG);
+  return 0;
+}
+
+/*
+  test the conf lock keeps out other holders until it is released
+*/
+static char *test_lock()
+{
+  config_t *tmp = initConfig();
+  if (tmp == 0)
+    return ERR_initConf1;
+  if (lockConfig(tmp, TMP_CONFIG) != 0 || tmp->lockFD < 0)
+    return ERR_lock1;
+
+  // writing while holding the lock must not wait on it
+  if (writeConfig(tmp, TMP_CONFIG) != 0 || tmp->lockFD < 0)
+    return ERR_initConf2;
+
+  // a separate open of the lock file stands in for another antman process
+  int fd = open(TMP_CONFIG AM_CONFIG_LOCK_EXT, O_RDWR);
+  if (fd < 0)
+    return ERR_lock1;
+  if (flock(fd, LOCK_EX | LOCK_NB) == 0)
+    return ERR_lock2;
+  unlockConfig(tmp);
+  if (tmp->lockFD != -1 || flock(fd, LOCK_EX | LOCK_NB) != 0)
+    return ERR_lock3;
+  close(fd);
+
+  destroyConfig(tmp);
+  remove(TMP_CONFIG);
+  remove(TMP_CONFIG AM_CONFIG_LOCK_EXT);
+  return 0;
+}
+
+// writeFile replaces a file with some text
+static void writeFile(const char *path, const char *text)
+{
+  FILE *fp = fopen(path, "w");
+  fputs(text, fp);
+  fclose(fp);
+}
+
+/*
+  test the conf is checked against the schema, when validated and when loaded
+*/
+static char *test_schema()
+{
+  config_t *tmp = initConfig();
+  if (tmp == 0)
+    return ERR_initConf1;
+  if (validateConfig(tmp) != 0 || tmp->threads != AM_DEFAULT_THREADS || tmp->write_sketches != 1)
+    return ERR_schema1;
+
+  // the sketcher can't hold HASHMAP_SIZE hashes, so that's too big
+  tmp->sketch_size = 256;
+  if (validateConfig(tmp) == 0)
+    return ERR_schema2;
+  tmp->sketch_size = AM_DEFAULT_SKETCH_SIZE;
+  tmp->sprt_confidence = 0.3;
+  if (validateConfig(tmp) == 0)
+    return ERR_schema2;
+  tmp->sprt_confidence = 0.0;
+  tmp->log_level = 4;
+  if (validateConfig(tmp) == 0)
+    return ERR_schema2;
+  tmp->log_level = AM_DEFAULT_LOG_LEVEL;
+  tmp->queue_depth = -1;
+  if (validateConfig(tmp) == 0)
+    return ERR_schema2;
+  tmp->queue_depth = AM_DEFAULT_QUEUE_DEPTH;
+  tmp->batch_reads = 0;
+  if (validateConfig(tmp) == 0)
+    return ERR_schema2;
+  tmp->batch_reads = AM_DEFAULT_BATCH_READS;
+
+  // every field survives a round trip, including awkward strings and small rates
+  tmp->white_list = strdup("/data/ref \"one\".fna");
+  tmp->bloom_fp_rate = 1e-7;
+  tmp->threads = 16;
+  tmp->match_threshold = 0.85;
+  tmp->log_silent = 1;
+  if (writeConfig(tmp, TMP_CONFIG) != 0)
+    return ERR_initConf2;
+  config_t *tmp2 = initConfig();
+  if (loadConfig(tmp2, TMP_CONFIG) != 0)
+    return ERR_initConf3;
+  if (strcmp(tmp2->white_list, tmp->white_list) != 0 || tmp2->watch_directory != NULL || tmp2->bloom_fp_rate != 1e-7 || tmp2->threads != 16 || tmp2->match_threshold != 0.85 || tmp2->log_silent != 1)
+    return ERR_schema4;
+  destroyConfig(tmp2);
+
+  // bad values are rejected when loading
+  const char *bad[] = {"{\"sketch_size\": 512}", "{\"k_size\": \"7\"}", "{\"threads\": 2.5}", "{\"white_list\": 3}", "{\"threads\": 4"};
+  int i;
+  for (i = 0; i < (int)(sizeof(bad) / sizeof(bad[0])); i++)
+  {
+    writeFile(TMP_CONFIG, bad[i]);
+    tmp2 = initConfig();
+    if (loadConfig(tmp2, TMP_CONFIG) == 0)
+      return ERR_schema3;
+    destroyConfig(tmp2);
+  }
+
+  // missing fields keep their defaults, and keys that aren't in the schema are ignored
+  writeFile(TMP_CONFIG, "{\"pid\": 1234, \"threads\": 8, \"write_sketches\": false}");
+  tmp2 = initConfig();
+  if (loadConfig(tmp2, TMP_CONFIG) != 0)
+    return ERR_initConf3;
+  if (tmp2->threads != 8 || tmp2->write_sketches != 0 || tmp2->k_size != AM_DEFAULT_K_SIZE || tmp2->metrics_port != AM_DEFAULT_METRICS_PORT)
+    return ERR_schema5;
+
+  destroyConfig(tmp);
+  destroyConfig(tmp2);
+  remove(TMP_CONFIG);
+  remove(TMP_CONFIG AM_CONFIG_LOCK_EXT);
+  return 0;
+}
+
+/*
+  test each instance gets its own config, and instance names can't leave the config's directory
+*/
+static char *test_location()
+{
+  char defaultPath[PATH_MAX], path[PATH_MAX], expected[PATH_MAX + 16];
+  if (configLocation(defaultPath, sizeof(defaultPath), NULL, NULL) != 0 || strlen(defaultPath) == 0)
+    return ERR_location1;
+  if (configLocation(path, sizeof(path), NULL, "flowcell_A-1") != 0)
+    return ERR_location1;
+  snprintf(expected, sizeof(expected), "%s.flowcell_A-1", defaultPath);
+  if (strcmp(path, expected) != 0)
+    return ERR_location1;
+  if (configLocation(path, sizeof(path), TMP_CONFIG, "ignored") != 0 || strcmp(path, TMP_CONFIG) != 0)
+    return ERR_location1;
+
+  char tooLong[AM_INSTANCE_MAX + 2];
+  memset(tooLong, 'a', sizeof(tooLong) - 1);
+  tooLong[sizeof(tooLong) - 1] = '\0';
+  const char *bad[] = {"", "../etc", "a b", "x/y", tooLong, "lock", "pid", "sock"};
+  int i;
+  for (i = 0; i < (int)(sizeof(bad) / sizeof(bad[0])); i++)
+    if (configLocation(path, sizeof(path), NULL, bad[i]) == 0)
+      return ERR_location2;
+  if (configLocation(path, 8, NULL, "flowcell") == 0)
+    return ERR_location1;
+  return 0;
+}
+
+/*
+  test a config copied to a new path is saved to the copy, not the file it was copied from
+*/
+static char *test_copy()
+{
+  config_t *tmp = initConfig();
+  tmp->threads = 2;
+  if (writeConfig(tmp, TMP_CONFIG) != 0)
+    return ERR_initConf2;
+  destroyConfig(tmp);
+  char *content = json_fread(TMP_CONFIG);
+  if (content == NULL)
+    return ERR_initConf3;
+  writeFile(TMP_CONFIG ".copy", content);
+  free(content);
+
+  tmp = initConfig();
+  if (lockConfig(tmp, TMP_CONFIG ".copy") != 0)
+    return ERR_lock1;
+  if (loadConfig(tmp, TMP_CONFIG ".copy") != 0 || strcmp(tmp->filename, TMP_CONFIG ".copy") != 0)
+    return ERR_copy1;
+  tmp->threads = 6;
+  tmp->dirty = 1;
+  if (saveConfig(tmp) != 0)
+    return ERR_copy1;
+  destroyConfig(tmp);
+
+  config_t *copy = initConfig(), *original = initConfig();
+  if (loadConfig(copy, TMP_CONFIG ".copy") != 0 || copy->threads != 6)
+    return ERR_copy1;
+  if (loadConfig(original, TMP_CONFIG) != 0 || original->threads != 2)
+    return ERR_copy2;
+  destroyConfig(copy);
+  destroyConfig(original);
+  remove(TMP_CONFIG);
+  remove(TMP_CONFIG AM_CONFIG_LOCK_EXT);
+  remove(TMP_CONFIG ".copy");
+  remove(TMP_CONFIG ".copy" AM_CONFIG_LOCK_EXT);
+  return 0;
+}
+
+/*
+  test new instances get metrics ports that the default config and the other instances aren't using
+*/
+static char *test_instancePort()
+{
+  const char *files[] = {TMP_CONFIG, TMP_CONFIG ".a", TMP_CONFIG ".b", TMP_CONFIG ".c.tmp.1"};
+  int ports[] = {AM_DEFAULT_METRICS_PORT, AM_DEFAULT_METRICS_PORT + 1, AM_DEFAULT_METRICS_PORT + 3, AM_DEFAULT_METRICS_PORT + 2};
+  int i, n = sizeof(files) / sizeof(files[0]);
+  if (instancePort(TMP_CONFIG) != AM_DEFAULT_METRICS_PORT + 1)
+    return ERR_port;
+
+  // the temporary file isn't an instance's config, so its port is still free
+  for (i = 0; i < n; i++)
+  {
+    config_t *tmp = initConfig();
+    tmp->metrics_port = ports[i];
+    if (writeConfig(tmp, (char *)files[i]) != 0)
+      return ERR_initConf2;
+    destroyConfig(tmp);
+  }
+  if (instancePort(TMP_CONFIG) != AM_DEFAULT_METRICS_PORT + 2)
+    return ERR_port;
+
+  // the default config's port counts, even if it isn't the default
+  config_t *tmp = initConfig();
+  tmp->metrics_port = AM_DEFAULT_METRICS_PORT + 2;
+  if (writeConfig(tmp, TMP_CONFIG) != 0)
+    return ERR_initConf2;
+  destroyConfig(tmp);
+  if (instancePort(TMP_CONFIG) != AM_DEFAULT_METRICS_PORT + 4)
+    return ERR_port;
+
+  char lockPath[PATH_MAX];
+  for (i = 0; i < n; i++)
+  {
+    snprintf(lockPath, sizeof(lockPath), "%s%s", files[i], AM_CONFIG_LOCK_EXT);
+    remove(files[i]);
+    remove(lockPath);
+  }
+  return 0;
+}
+
 /*
   helper function to run all the tests
 */
 static char *all_tests()
 {
   mu_run_test(test_initConf);
+  mu_run_test(test_atomicWrite);
+  mu_run_test(test_lock);
+  mu_run_test(test_schema);
+  mu_run_test(test_location);
+  mu_run_test(test_copy);
+  mu_run_test(test_instancePort);
   return 0;
 }
 
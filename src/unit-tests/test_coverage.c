@@ -0,0 +1,209 @@
+#ifndef TEST_COVERAGE
+#define TEST_COVERAGE
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "minunit.h"
+#include "../countmin.h"
+#include "../coverage.h"
+
+#define ERR_init "could not make the count-min sketch"
+#define ERR_under "count-min estimate was under the true count"
+#define ERR_over "count-min estimates are too far over the true counts"
+#define ERR_total "count-min total is wrong"
+#define ERR_build "could not build the reference database"
+#define ERR_depth "reference depth estimate is wrong"
+#define ERR_render "coverage table is wrong"
+
+#define TEST_K 15
+#define TEST_REF_LENGTH 20000
+#define TEST_READ_LENGTH 1000
+#define TEST_DEPTH 10
+#define TEST_THREADS 4
+#define TEST_KEYS 1000
+#define TEST_REPEATS 100
+
+int tests_run = 0;
+
+// testKey makes a key that looks like a hashed k-mer
+static uint64_t testKey(uint64_t i)
+{
+  return ((i * 0x9e3779b97f4a7c15ULL) >> 20) << 8 | TEST_K;
+}
+
+/*
+  test the estimates are never under the true counts, and are close with enough counters
+*/
+static char *test_countmin()
+{
+  countMin_t *cm = countMinInit(60000, 4);
+  if (!cm || cm->width != 65536 || cm->depth != 4)
+    return ERR_init;
+  uint64_t i, keys[10], over = 0, n = 20000, added = 0;
+  int j;
+  for (i = 0; i < n; i++)
+  {
+    for (j = 0; j < (int)(i % 10) + 1; j++)
+      keys[j] = testKey(i);
+    countMinAdd(cm, keys, j);
+    added += j;
+  }
+  if (countMinTotal(cm) != added)
+    return ERR_total;
+  for (i = 0; i < n; i++)
+  {
+    uint32_t c = countMinEstimate(cm, testKey(i));
+    if (c < i % 10 + 1)
+      return ERR_under;
+    over += c - (i % 10 + 1);
+  }
+
+  // the expected overcount per key is about total / width
+  if ((double)over / n > 2.0 * added / cm->width)
+    return ERR_over;
+  countMinDestroy(cm);
+  return 0;
+}
+
+// addKeys is run by each thread in test_concurrent
+static void *addKeys(void *arg)
+{
+  countMin_t *cm = (countMin_t *)arg;
+  uint64_t keys[TEST_KEYS];
+  int i, r;
+  for (i = 0; i < TEST_KEYS; i++)
+    keys[i] = testKey(i);
+  for (r = 0; r < TEST_REPEATS; r++)
+    countMinAdd(cm, keys, TEST_KEYS);
+  return NULL;
+}
+
+/*
+  test no updates are lost when threads add to the sketch at the same time
+*/
+static char *test_concurrent()
+{
+  countMin_t *cm = countMinInit(1 << 20, 4);
+  if (!cm)
+    return ERR_init;
+  pthread_t threads[TEST_THREADS];
+  int i;
+  for (i = 0; i < TEST_THREADS; i++)
+    pthread_create(&threads[i], NULL, addKeys, cm);
+  for (i = 0; i < TEST_THREADS; i++)
+    pthread_join(threads[i], NULL);
+  if (countMinTotal(cm) != (uint64_t)TEST_THREADS * TEST_REPEATS * TEST_KEYS)
+    return ERR_total;
+  for (i = 0; i < TEST_KEYS; i++)
+    if (countMinEstimate(cm, testKey(i)) < TEST_THREADS * TEST_REPEATS)
+      return ERR_under;
+  countMinDestroy(cm);
+  return 0;
+}
+
+/*
+  test the depth of a reference is estimated from reads taken from it
+*/
+static char *test_coverage()
+{
+  char testDir[] = "/tmp/antman-coverage-XXXXXX", fastaPath[256], dbPath[256];
+  if (!mkdtemp(testDir))
+    return ERR_build;
+  snprintf(fastaPath, sizeof(fastaPath), "%s/refs.fasta", testDir);
+  snprintf(dbPath, sizeof(dbPath), "%s/refs.amdb", testDir);
+
+  // two random references, the reads all come from the first
+  char *refs[2];
+  unsigned int state = 7;
+  int i, r;
+  FILE *fp = fopen(fastaPath, "w");
+  if (!fp)
+    return ERR_build;
+  for (r = 0; r < 2; r++)
+  {
+    refs[r] = malloc(TEST_REF_LENGTH + 1);
+    for (i = 0; i < TEST_REF_LENGTH; i++)
+      refs[r][i] = "ACGT"[rand_r(&state) % 4];
+    refs[r][TEST_REF_LENGTH] = '\0';
+    fprintf(fp, ">ref%d\n%s\n", r + 1, refs[r]);
+  }
+  fclose(fp);
+  if (refdbBuild(fastaPath, dbPath, TEST_K, AM_DEFAULT_REFDB_SCALED, 0, 1) != 0)
+    return ERR_build;
+  refdb_t *db = refdbOpen(dbPath);
+  coverage_t *cov = db ? coverageInit(db, 1 << 16) : NULL;
+  if (!cov)
+    return ERR_init;
+
+  // tile the first reference TEST_DEPTH times over, plus some reads from neither
+  for (r = 0; r < TEST_DEPTH; r++)
+    for (i = r * 97 % TEST_READ_LENGTH; i + TEST_READ_LENGTH <= TEST_REF_LENGTH; i += TEST_READ_LENGTH)
+      coverageAddRead(cov, refs[0] + i, TEST_READ_LENGTH);
+  char random[TEST_READ_LENGTH + 1];
+  for (r = 0; r < 50; r++)
+  {
+    for (i = 0; i < TEST_READ_LENGTH; i++)
+      random[i] = "ACGT"[rand_r(&state) % 4];
+    coverageAddRead(cov, random, TEST_READ_LENGTH);
+  }
+
+  // the read ends cover fewer k-mers, so the depth is a bit under TEST_DEPTH
+  coverageRef_t report[2];
+  if (coverageReport(cov, report) != 2 || report[0].ref != refdbLookup(db, "ref1") - db->toc)
+    return ERR_depth;
+  if (report[0].depth < TEST_DEPTH * 0.75 || report[0].depth > TEST_DEPTH * 1.1 || report[0].breadth < 0.95)
+    return ERR_depth;
+  if (report[1].depth > 0.5 || report[1].breadth > 0.2)
+    return ERR_depth;
+  char *table = coverageRender(cov);
+  if (!table || !strstr(table, "ref1\t") || strstr(table, "reads: 0,"))
+    return ERR_render;
+  free(table);
+
+  coverageDestroy(cov);
+  refdbClose(db);
+  unlink(dbPath);
+  unlink(fastaPath);
+  rmdir(testDir);
+  free(refs[0]);
+  free(refs[1]);
+  return 0;
+}
+
+/*
+  helper function to run all the tests
+*/
+static char *all_tests()
+{
+  mu_run_test(test_countmin);
+  mu_run_test(test_concurrent);
+  mu_run_test(test_coverage);
+  return 0;
+}
+
+/*
+  entrypoint
+*/
+int main(int argc, char **argv)
+{
+  fprintf(stderr, "\t\tcoverage_test...");
+  char *result = all_tests();
+  if (result != 0)
+  {
+    fprintf(stderr, "failed\n");
+    fprintf(stderr, "\ntest function %d failed:\n", tests_run);
+    fprintf(stderr, "%s\n", result);
+  }
+  else
+  {
+    fprintf(stderr, "passed\n");
+  }
+  return result != 0;
+}
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef TEST_DAEMONIZE
+#define TEST_DAEMONIZE
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "minunit.h"
+#include "../daemonize.h"
+#include "../trace.h"
+
+#define ERR_mask "a thread started after blockSignals can take the daemon's signals"
+#define ERR_wait "waitSignal did not return the signal that was sent"
+#define ERR_toggle "SIGUSR2 did not toggle the profiling timeline"
+#define ERR_stop "SIGTERM did not stop the daemon"
+
+#define TEST_THREADS 4
+#define TEST_SIGNALS 20
+#define TEST_TRACE "/tmp/antman-test-daemonize-trace.json"
+
+int tests_run = 0;
+sigset_t signals;
+int stopThreads = 0;
+
+// busyThread stands in for the daemon's workers, it records whether it could take the signals
+static void *busyThread(void *arg)
+{
+  sigset_t mask;
+  pthread_sigmask(SIG_BLOCK, NULL, &mask);
+  *(int *)arg = sigismember(&mask, SIGTERM) && sigismember(&mask, SIGUSR2);
+  while (!__atomic_load_n(&stopThreads, __ATOMIC_ACQUIRE))
+    usleep(1000);
+  return NULL;
+}
+
+/*
+  test signals sent to the process reach the main loop however many other threads there are
+*/
+static char *test_wait()
+{
+  pthread_t threads[TEST_THREADS];
+  int blocked[TEST_THREADS], i;
+  for (i = 0; i < TEST_THREADS; i++)
+    blocked[i] = -1;
+  for (i = 0; i < TEST_THREADS; i++)
+    pthread_create(&threads[i], NULL, busyThread, &blocked[i]);
+  for (i = 0; i < TEST_SIGNALS; i++)
+  {
+    int signum = (i % 2) ? SIGTERM : SIGUSR2;
+    kill(getpid(), signum);
+    if (waitSignal(&signals) != signum)
+      return ERR_wait;
+  }
+  __atomic_store_n(&stopThreads, 1, __ATOMIC_RELEASE);
+  for (i = 0; i < TEST_THREADS; i++)
+  {
+    pthread_join(threads[i], NULL);
+    if (blocked[i] != 1)
+      return ERR_mask;
+  }
+  return 0;
+}
+
+/*
+  test SIGUSR2 switches the timeline on and off, and SIGTERM stops the loop
+*/
+static char *test_handle()
+{
+  unlink(TEST_TRACE);
+  if (handleSignal(SIGUSR2, TEST_TRACE) != 0 || !traceEnabled || access(TEST_TRACE, F_OK) != 0)
+    return ERR_toggle;
+  if (handleSignal(SIGUSR2, TEST_TRACE) != 0 || traceEnabled)
+    return ERR_toggle;
+  if (handleSignal(SIGTERM, TEST_TRACE) != 1)
+    return ERR_stop;
+  unlink(TEST_TRACE);
+  return 0;
+}
+
+/*
+  helper function to run all the tests
+*/
+static char *all_tests()
+{
+  mu_run_test(test_wait);
+  mu_run_test(test_handle);
+  return 0;
+}
+
+/*
+  entrypoint
+*/
+int main(int argc, char **argv)
+{
+  fprintf(stderr, "\t\tdaemonize_test...");
+
+  // fail rather than hang if a signal goes missing
+  alarm(10);
+  blockSignals(&signals);
+  char *result = all_tests();
+  if (result != 0)
+  {
+    fprintf(stderr, "failed\n");
+    fprintf(stderr, "\ntest function %d failed:\n", tests_run);
+    fprintf(stderr, "%s\n", result);
+  }
+  else
+  {
+    fprintf(stderr, "passed\n");
+  }
+  return result != 0;
+}
+
+#endif
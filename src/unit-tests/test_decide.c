@@ -0,0 +1,257 @@
+#ifndef TEST_DECIDE
+#define TEST_DECIDE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "minunit.h"
+#include "../decide.h"
+#include "../sequence.h"
+
+#define ERR_init "could not start the decision service"
+#define ERR_connect "could not connect to the decision service"
+#define ERR_ask "decision request failed"
+#define ERR_decision "wrong decision for a read"
+#define ERR_flags "wrong flags on a decision"
+#define ERR_pipeline "pipelined requests were not answered in order"
+#define ERR_refused "a client over the limit was not refused"
+#define ERR_stats "decision counts or latencies are wrong"
+
+#define TEST_K 11
+#define TEST_SKETCH_SIZE 64
+#define TEST_ENTRIES 20000
+#define TEST_FP 0.01
+#define TEST_REF_LENGTH 10000
+#define TEST_READ_LENGTH 1000
+#define TEST_MAX_BASES 2000
+#define TEST_CLIENTS 2
+#define TEST_DEADLINE_US 1000000
+#define TEST_PIPELINE 20
+
+int tests_run = 0;
+char testDir[] = "/tmp/antman-decide-XXXXXX";
+char fastaPath[256], socketPath[256];
+char ref[TEST_REF_LENGTH + 1];
+decideService_t *svc;
+
+// randomRead fills a read with bases that aren't from the reference
+static void randomRead(char *read, int len, unsigned int *state)
+{
+  int i;
+  for (i = 0; i < len; i++)
+    read[i] = "ACGT"[rand_r(state) % 4];
+}
+
+/*
+  test reads from the reference are kept, others rejected and short chunks left undecided
+*/
+static char *test_decide()
+{
+  int fd = decideConnect(socketPath);
+  if (fd < 0)
+    return ERR_connect;
+  decideResponse_t resp;
+  if (decideAsk(fd, "onTarget", ref + 1234, TEST_READ_LENGTH, &resp) != 0)
+    return ERR_ask;
+  if (resp.decision != AM_DECIDE_KEEP || resp.score < 0.9 || resp.flags != 0)
+    return ERR_decision;
+
+  char read[TEST_READ_LENGTH];
+  unsigned int state = 99;
+  randomRead(read, TEST_READ_LENGTH, &state);
+  if (decideAsk(fd, "offTarget", read, TEST_READ_LENGTH, &resp) != 0)
+    return ERR_ask;
+  if (resp.decision != AM_DECIDE_REJECT || resp.score > 0.2)
+    return ERR_decision;
+  if (decideAsk(fd, "short", ref, TEST_K - 1, &resp) != 0)
+    return ERR_ask;
+  if (resp.decision != AM_DECIDE_UNKNOWN)
+    return ERR_decision;
+
+  // an empty ID is fine
+  if (decideAsk(fd, "", ref + 5000, TEST_READ_LENGTH, &resp) != 0 || resp.decision != AM_DECIDE_KEEP)
+    return ERR_ask;
+  close(fd);
+  return 0;
+}
+
+/*
+  test long chunks are truncated and slow responses flagged, but still answered
+*/
+static char *test_flags()
+{
+  int fd = decideConnect(socketPath);
+  if (fd < 0)
+    return ERR_connect;
+  decideResponse_t resp;
+  if (decideAsk(fd, "long", ref, TEST_REF_LENGTH, &resp) != 0)
+    return ERR_ask;
+  if (resp.decision != AM_DECIDE_KEEP || resp.flags != AM_DECIDE_FLAG_TRUNCATED)
+    return ERR_flags;
+
+  // no request can be answered in 0ns
+  uint64_t deadline = svc->deadlineNs;
+  svc->deadlineNs = 0;
+  if (decideAsk(fd, "late", ref, TEST_READ_LENGTH, &resp) != 0)
+    return ERR_ask;
+  svc->deadlineNs = deadline;
+  if (resp.decision != AM_DECIDE_KEEP || resp.flags != AM_DECIDE_FLAG_LATE)
+    return ERR_flags;
+  close(fd);
+  return 0;
+}
+
+/*
+  test requests sent before the earlier ones are answered come back in order
+*/
+static char *test_pipeline()
+{
+  int fd = decideConnect(socketPath), i;
+  if (fd < 0)
+    return ERR_connect;
+  char id[32];
+  for (i = 0; i < TEST_PIPELINE; i++)
+  {
+    snprintf(id, sizeof(id), "read-%d", i);
+    size_t idLen = strlen(id);
+    decideRequest_t req = {(uint32_t)(sizeof(req) - sizeof(req.length) + idLen + TEST_READ_LENGTH), (uint16_t)idLen, 0};
+    if (write(fd, &req, sizeof(req)) != sizeof(req) || write(fd, id, idLen) != (ssize_t)idLen || write(fd, ref + i * 100, TEST_READ_LENGTH) != TEST_READ_LENGTH)
+      return ERR_ask;
+  }
+  for (i = 0; i < TEST_PIPELINE; i++)
+  {
+    decideResponse_t resp;
+    char replyID[32], expected[32];
+    snprintf(expected, sizeof(expected), "read-%d", i);
+    if (read(fd, &resp, sizeof(resp)) != sizeof(resp) || resp.idLen != strlen(expected) || read(fd, replyID, resp.idLen) != resp.idLen)
+      return ERR_pipeline;
+    if (memcmp(replyID, expected, resp.idLen) != 0 || resp.decision != AM_DECIDE_KEEP)
+      return ERR_pipeline;
+  }
+  close(fd);
+  return 0;
+}
+
+/*
+  test clients over the limit are refused and the others are still served
+*/
+static char *test_refused()
+{
+  int fds[TEST_CLIENTS + 1], i;
+  decideResponse_t resp;
+  for (i = 0; i < TEST_CLIENTS; i++)
+  {
+    if ((fds[i] = decideConnect(socketPath)) < 0)
+      return ERR_connect;
+
+    // a round trip makes sure the listener has handed the connection out before the next one arrives
+    if (decideAsk(fds[i], "held", ref, TEST_READ_LENGTH, &resp) != 0)
+      return ERR_ask;
+  }
+  if ((fds[i] = decideConnect(socketPath)) < 0)
+    return ERR_connect;
+  if (decideAsk(fds[i], "refused", ref, TEST_READ_LENGTH, &resp) == 0 || svc->refused != 1)
+    return ERR_refused;
+  close(fds[i]);
+  if (decideAsk(fds[0], "still served", ref, TEST_READ_LENGTH, &resp) != 0 || resp.decision != AM_DECIDE_KEEP)
+    return ERR_ask;
+  for (i = 0; i < TEST_CLIENTS; i++)
+    close(fds[i]);
+  return 0;
+}
+
+/*
+  test every answer is counted and timed
+*/
+static char *test_stats()
+{
+  uint64_t answered = svc->decisions[AM_DECIDE_KEEP] + svc->decisions[AM_DECIDE_REJECT] + svc->decisions[AM_DECIDE_UNKNOWN];
+  if (answered != 6 + TEST_PIPELINE + TEST_CLIENTS + 1 || svc->decisions[AM_DECIDE_REJECT] != 1 || svc->decisions[AM_DECIDE_UNKNOWN] != 1)
+    return ERR_stats;
+  if (histCount(&svc->latency) != answered || svc->late != 1 || svc->truncated != 1)
+    return ERR_stats;
+  char *table = decideRender(svc);
+  if (!table || !strstr(table, "reject 1, unknown 1") || !strstr(table, " p99 "))
+    return ERR_stats;
+  free(table);
+  return 0;
+}
+
+/*
+  helper function to run all the tests
+*/
+static char *all_tests()
+{
+  mu_run_test(test_decide);
+  mu_run_test(test_flags);
+  mu_run_test(test_pipeline);
+  mu_run_test(test_refused);
+  mu_run_test(test_stats);
+  return 0;
+}
+
+/*
+  entrypoint
+*/
+int main(int argc, char **argv)
+{
+  fprintf(stderr, "\t\tdecide_test...");
+  if (!mkdtemp(testDir))
+    return 1;
+  snprintf(fastaPath, sizeof(fastaPath), "%s/ref.fna", testDir);
+  snprintf(socketPath, sizeof(socketPath), "%s/antman%s", testDir, AM_DECIDE_EXT);
+  unsigned int state = 42;
+  randomRead(ref, TEST_REF_LENGTH, &state);
+  ref[TEST_REF_LENGTH] = '\0';
+  FILE *fp = fopen(fastaPath, "w");
+  if (!fp)
+    return 1;
+  fprintf(fp, ">ref1\n%s\n", ref);
+  fclose(fp);
+
+  // classify against a bloom filter of the reference, as the daemon does without a database
+  struct bloom bf;
+  watcherArgs_t wargs;
+  memset(&wargs, 0, sizeof(wargs));
+  if (bloom_init(&bf, TEST_ENTRIES, TEST_FP) != 0 || processRef(fastaPath, &bf, TEST_K, 1) != 0)
+    return 1;
+  wargs.bloomFilter = &bf;
+  wargs.k_size = TEST_K;
+  wargs.sketch_size = TEST_SKETCH_SIZE;
+  wargs.fp_rate = TEST_FP;
+  wargs.match_threshold = 0.5;
+  estimator_t *estimator = referenceEstimator(&wargs);
+  wargs.estimator = estimator;
+  svc = estimator ? decideInit(&wargs, socketPath, TEST_CLIENTS, TEST_DEADLINE_US, TEST_MAX_BASES) : NULL;
+
+  char *result = (svc && decideStart(svc) == 0) ? all_tests() : ERR_init;
+  if (result != 0)
+  {
+    fprintf(stderr, "failed\n");
+    fprintf(stderr, "\ntest function %d failed:\n", tests_run);
+    fprintf(stderr, "%s\n", result);
+  }
+  else
+  {
+    fprintf(stderr, "passed\n");
+  }
+
+  // stopping removes the socket
+  decideDestroy(svc);
+  if (result == 0 && access(socketPath, F_OK) == 0)
+  {
+    fprintf(stderr, "socket was not removed\n");
+    result = ERR_init;
+  }
+  estimatorDestroy(estimator);
+  bloom_free(&bf);
+  unlink(socketPath);
+  unlink(fastaPath);
+  rmdir(testDir);
+  return result != 0;
+}
+
+#endif
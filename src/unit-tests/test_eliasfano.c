@@ -0,0 +1,177 @@
+#ifndef TEST_ELIASFANO
+#define TEST_ELIASFANO
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "minunit.h"
+#include "../eliasfano.c"
+
+#define ERR_build "could not build the set"
+#define ERR_map "built set was rejected"
+#define ERR_member "a value in the set was not found"
+#define ERR_absent "a value not in the set was found"
+#define ERR_batch "batched lookups do not match single lookups"
+#define ERR_corrupt "a damaged set was accepted"
+#define ERR_alloc "could not allocate"
+
+int tests_run = 0;
+
+// nextRand is a small xorshift generator so the sets are the same on every run
+static uint64_t nextRand(uint64_t *state)
+{
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
+
+// compareU64 orders values for qsort
+static int compareU64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+// randomSet makes n sorted, unique values below universe, returns how many there are
+static uint64_t randomSet(uint64_t *values, uint64_t n, uint64_t universe, uint64_t seed)
+{
+  uint64_t i, unique = 0, state = seed;
+  for (i = 0; i < n; i++)
+    values[i] = nextRand(&state) % universe;
+  qsort(values, n, sizeof(uint64_t), compareU64);
+  for (i = 0; i < n; i++)
+    if (unique == 0 || values[i] != values[unique - 1])
+      values[unique++] = values[i];
+  return unique;
+}
+
+// checkSet builds a set and checks every member and a sample of non-members, singly and in batches
+static char *checkSet(uint64_t n, uint64_t universe, uint64_t seed)
+{
+  uint64_t *values = malloc((n ? n : 1) * sizeof(uint64_t)), size, i;
+  if (!values)
+    return ERR_alloc;
+  n = randomSet(values, n, universe, seed);
+  void *data = efBuild(values, n, universe, &size);
+  if (!data)
+    return ERR_build;
+  efSet_t set;
+  if (efMap(&set, data, size) != 0)
+    return ERR_map;
+  for (i = 0; i < n; i++)
+    if (!efContains(&set, values[i]))
+      return ERR_member;
+
+  // values between the members are not in the set
+  for (i = 0; i + 1 < n; i++)
+    if (values[i + 1] > values[i] + 1 && efContains(&set, values[i] + 1))
+      return ERR_absent;
+  if (efContains(&set, universe) || efContains(&set, universe + 12345))
+    return ERR_absent;
+
+  // a shuffled batch of members and random values agrees with single lookups
+  int batch = 5000, j;
+  uint64_t *queries = malloc(batch * sizeof(uint64_t)), state = seed ^ 0x5555;
+  uint8_t *found = malloc(batch);
+  if (!queries || !found)
+    return ERR_alloc;
+  for (j = 0; j < batch; j++)
+    queries[j] = (n && (j & 1)) ? values[nextRand(&state) % n] : nextRand(&state) % universe;
+  int nFound = efContainsBatch(&set, queries, batch, found), expected = 0;
+  for (j = 0; j < batch; j++)
+  {
+    int single = efContains(&set, queries[j]);
+    expected += single;
+    if (single != found[j])
+      return ERR_batch;
+  }
+  if (nFound != expected)
+    return ERR_batch;
+
+  // and so does a sorted one
+  qsort(queries, batch, sizeof(uint64_t), compareU64);
+  efContainsBatch(&set, queries, batch, found);
+  for (j = 0; j < batch; j++)
+    if (efContains(&set, queries[j]) != found[j])
+      return ERR_batch;
+
+  free(queries);
+  free(found);
+  free(values);
+  free(data);
+  return 0;
+}
+
+/*
+  test sparse, dense and empty sets
+*/
+static char *test_sets()
+{
+  char *err;
+  if ((err = checkSet(100000, 1ULL << 42, 1)))
+    return err;
+  if ((err = checkSet(100000, 1ULL << 56, 2)))
+    return err;
+  if ((err = checkSet(50000, 60000, 3)))
+    return err;
+  if ((err = checkSet(1000, 1000, 4)))
+    return err;
+  if ((err = checkSet(1, 1ULL << 30, 5)))
+    return err;
+  if ((err = checkSet(0, 1ULL << 30, 6)))
+    return err;
+  return 0;
+}
+
+/*
+  test a damaged set is rejected
+*/
+static char *test_corrupt()
+{
+  uint64_t values[3] = {5, 900, 70000}, size;
+  void *data = efBuild(values, 3, 1 << 20, &size);
+  if (!data)
+    return ERR_build;
+  efSet_t set;
+  if (efMap(&set, data, size - 8) == 0)
+    return ERR_corrupt;
+  ((efHeader_t *)data)->highLen++;
+  if (efMap(&set, data, size) == 0)
+    return ERR_corrupt;
+  free(data);
+  return 0;
+}
+
+/*
+  helper function to run all the tests
+*/
+static char *all_tests()
+{
+  mu_run_test(test_sets);
+  mu_run_test(test_corrupt);
+  return 0;
+}
+
+/*
+  entrypoint
+*/
+int main(int argc, char **argv)
+{
+  fprintf(stderr, "\t\teliasfano_test...");
+  char *result = all_tests();
+  if (result != 0)
+  {
+    fprintf(stderr, "failed\n");
+    fprintf(stderr, "\ntest function %d failed:\n", tests_run);
+    fprintf(stderr, "%s\n", result);
+  }
+  else
+  {
+    fprintf(stderr, "passed\n");
+  }
+  return result != 0;
+}
+
+#endif
@@ -0,0 +1,262 @@
+#ifndef TEST_ESTIMATE
+#define TEST_ESTIMATE
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "minunit.h"
+#include "../estimate.h"
+
+#define ERR_init "could not make the estimator"
+#define ERR_decision "match decision does not agree with the containment estimate"
+#define ERR_correct "false positives were not corrected for"
+#define ERR_interval "confidence interval is wrong"
+#define ERR_table "table lookup does not match the computed estimate"
+#define ERR_bloom "measured bloom filter false positive rate or size is wrong"
+#define ERR_jaccard "Jaccard or distance is wrong"
+#define ERR_sequential "sequential test boundaries are wrong"
+#define ERR_stopping "sequential test did not stop early or made the wrong call"
+
+#define TEST_K 21
+#define TEST_SKETCH_SIZE 128
+
+int tests_run = 0;
+
+/*
+  test the integer match decisions agree with the containment for every number of hits and tested hashes
+*/
+static char *test_decisions()
+{
+  double fpRates[3] = {0.0, 0.001, 0.05}, thresholds[3] = {0.0, 0.5, 0.9};
+  int f, t, tested, hits;
+  for (f = 0; f < 3; f++)
+    for (t = 0; t < 3; t++)
+    {
+      estimator_t *est = estimatorInit(TEST_K, TEST_SKETCH_SIZE, fpRates[f], thresholds[t], 1000);
+      if (!est)
+        return ERR_init;
+      for (tested = 1; tested <= TEST_SKETCH_SIZE; tested++)
+        for (hits = 0; hits <= tested; hits++)
+        {
+          estimate_t e;
+          estimateRead(est, hits, tested, 1000, 0, &e);
+          if (e.match != (e.containment >= thresholds[t]))
+            return ERR_decision;
+        }
+      estimatorDestroy(est);
+    }
+
+  // with an exact reference, half the sketch is the threshold
+  estimator_t *est = estimatorInit(TEST_K, TEST_SKETCH_SIZE, 0.0, 0.5, 1000);
+  if (!est || est->minHits[TEST_SKETCH_SIZE] != TEST_SKETCH_SIZE / 2 || estimateMatch(est, 0, 0))
+    return ERR_decision;
+  estimatorDestroy(est);
+  return 0;
+}
+
+/*
+  test the false positive correction and the confidence intervals
+*/
+static char *test_containment()
+{
+  estimator_t *est = estimatorInit(TEST_K, TEST_SKETCH_SIZE, 0.1, 0.5, 1000);
+  if (!est)
+    return ERR_init;
+
+  // hits at the false positive rate are no containment, every hash found is full containment
+  estimate_t e;
+  estimateRead(est, 13, 130, 1000, 0, &e);
+  if (fabs(e.containment) > 1e-9 || e.lower != 0.0)
+    return ERR_correct;
+  estimateRead(est, 100, 100, 1000, 0, &e);
+  if (e.containment != 1.0 || e.upper != 1.0)
+    return ERR_correct;
+  estimateRead(est, 55, 100, 1000, 0, &e);
+  if (fabs(e.containment - 0.5) > 1e-9)
+    return ERR_correct;
+
+  // the interval holds the estimate and narrows as more hashes are tested
+  estimate_t wide;
+  estimateRead(est, 11, 20, 1000, 0, &wide);
+  if (!(wide.lower < wide.containment && wide.containment < wide.upper) || !(wide.lower < e.lower && e.upper < wide.upper))
+    return ERR_interval;
+
+  // a full sketch is looked up, and matches the computed estimate
+  estimator_t *bigger = estimatorInit(TEST_K, TEST_SKETCH_SIZE + 1, 0.1, 0.5, 1000);
+  if (!bigger)
+    return ERR_init;
+  int hits;
+  for (hits = 0; hits <= TEST_SKETCH_SIZE; hits++)
+  {
+    estimate_t looked, computed;
+    estimateRead(est, hits, TEST_SKETCH_SIZE, 1000, 0, &looked);
+    estimateRead(bigger, hits, TEST_SKETCH_SIZE, 1000, 0, &computed);
+    if (looked.containment != computed.containment || looked.lower != computed.lower || looked.upper != computed.upper)
+      return ERR_table;
+  }
+  estimatorDestroy(bigger);
+  estimatorDestroy(est);
+  return 0;
+}
+
+/*
+  test the false positive rate and size measured from a bloom filter
+*/
+static char *test_bloom()
+{
+  struct bloom bf;
+  int entries = 20000, i, falsePositives = 0, trials = 200000;
+  if (bloom_init(&bf, entries, 0.01) != 0)
+    return ERR_bloom;
+  uint64_t v;
+  for (v = 0; v < (uint64_t)entries; v++)
+    bloom_add(&bf, &v, sizeof(v));
+  for (i = 0, v = 1ULL << 40; i < trials; i++, v++)
+    falsePositives += bloom_check(&bf, &v, sizeof(v));
+  double measured = estimateBloomFP(&bf), observed = (double)falsePositives / trials;
+  if (measured < 0.005 || measured > 0.02 || fabs(measured - observed) > 0.3 * measured)
+    return ERR_bloom;
+  uint64_t kmers = estimateBloomKmers(&bf);
+  if (kmers < entries * 0.95 || kmers > entries * 1.05)
+    return ERR_bloom;
+  bloom_free(&bf);
+  return 0;
+}
+
+/*
+  test the Jaccard similarity and Mash distance
+*/
+static char *test_jaccard()
+{
+  if (estimateJaccard(1.0, 500, 500) != 1.0 || estimateDistance(1.0, TEST_K) != 0.0)
+    return ERR_jaccard;
+  if (estimateJaccard(0.0, 500, 500) != 0.0 || estimateDistance(0.0, TEST_K) != 1.0)
+    return ERR_jaccard;
+
+  // a read fully contained in a reference ten times its size
+  double j = estimateJaccard(1.0, 100, 1000);
+  if (fabs(j - 0.1) > 1e-9)
+    return ERR_jaccard;
+  double d = estimateDistance(j, TEST_K);
+  if (fabs(d - (-1.0 / TEST_K * log(2 * 0.1 / 1.1))) > 1e-9)
+    return ERR_jaccard;
+
+  // the estimator uses its reference size unless the read's reference is given
+  estimator_t *est = estimatorInit(TEST_K, TEST_SKETCH_SIZE, 0.0, 0.5, 1000);
+  if (!est)
+    return ERR_init;
+  estimate_t e;
+  estimateRead(est, TEST_SKETCH_SIZE, TEST_SKETCH_SIZE, 100, 0, &e);
+  if (fabs(e.jaccard - 0.1) > 1e-9)
+    return ERR_jaccard;
+  estimateRead(est, TEST_SKETCH_SIZE, TEST_SKETCH_SIZE, 100, 100, &e);
+  if (e.jaccard != 1.0 || e.distance != 0.0)
+    return ERR_jaccard;
+  estimatorDestroy(est);
+  return 0;
+}
+
+// nextRand is a small xorshift generator so the simulated reads are the same on every run
+static uint64_t nextRand(uint64_t *state)
+{
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
+
+// simulate checks reads with a containment one hash at a time, returns the mean hashes checked and sets the fraction matched
+static double simulate(const estimator_t *est, double containment, int reads, uint64_t seed, double *matched)
+{
+  uint64_t state = seed, totalTested = 0;
+  int r, nMatched = 0;
+  double pHit = containment + (1 - containment) * est->fpRate;
+  for (r = 0; r < reads; r++)
+  {
+    int hits = 0, tested = 0, decision = -1;
+    while (decision < 0 && tested < est->sketchSize)
+    {
+      tested++;
+      hits += (nextRand(&state) % 1000000) < pHit * 1000000;
+      decision = estimateStop(est, hits, tested);
+    }
+    nMatched += (decision < 0) ? estimateMatch(est, hits, tested) : decision;
+    totalTested += tested;
+  }
+  *matched = (double)nMatched / reads;
+  return (double)totalTested / reads;
+}
+
+/*
+  test the sequential test stops early for clear reads and makes the same calls as the full sketch
+*/
+static char *test_sequential()
+{
+  estimator_t *est = estimatorInit(TEST_K, TEST_SKETCH_SIZE, 0.001, 0.5, 1000);
+  if (!est)
+    return ERR_init;
+  if (estimateStop(est, 0, 10) != -1 || estimateStop(est, 10, 10) != -1)
+    return ERR_sequential;
+  if (estimatorSequential(est, 0.99) != 0)
+    return ERR_init;
+
+  // the boundaries never overlap and never decide before a few hashes are in
+  int tested;
+  for (tested = 1; tested <= TEST_SKETCH_SIZE; tested++)
+  {
+    if (est->acceptHits[tested] <= est->rejectHits[tested])
+      return ERR_sequential;
+    if (tested > 1 && (est->acceptHits[tested] < est->acceptHits[tested - 1] || est->rejectHits[tested] < est->rejectHits[tested - 1]))
+      return ERR_sequential;
+  }
+  if (estimateStop(est, 0, 1) != -1 || estimateStop(est, 1, 1) != -1)
+    return ERR_sequential;
+
+  // off-target reads are decided in about a tenth of the sketch, and clear calls are right
+  double matched;
+  if (simulate(est, 0.0, 2000, 1, &matched) > TEST_SKETCH_SIZE / 8 || matched > 0.01)
+    return ERR_stopping;
+  if (simulate(est, 0.95, 2000, 2, &matched) > TEST_SKETCH_SIZE / 4 || matched < 0.99)
+    return ERR_stopping;
+  if (simulate(est, 0.2, 2000, 3, &matched) > TEST_SKETCH_SIZE / 4 || matched > 0.01)
+    return ERR_stopping;
+  estimatorDestroy(est);
+  return 0;
+}
+
+/*
+  helper function to run all the tests
+*/
+static char *all_tests()
+{
+  mu_run_test(test_decisions);
+  mu_run_test(test_containment);
+  mu_run_test(test_bloom);
+  mu_run_test(test_jaccard);
+  mu_run_test(test_sequential);
+  return 0;
+}
+
+/*
+  entrypoint
+*/
+int main(int argc, char **argv)
+{
+  fprintf(stderr, "\t\testimate_test...");
+  char *result = all_tests();
+  if (result != 0)
+  {
+    fprintf(stderr, "failed\n");
+    fprintf(stderr, "\ntest function %d failed:\n", tests_run);
+    fprintf(stderr, "%s\n", result);
+  }
+  else
+  {
+    fprintf(stderr, "passed\n");
+  }
+  return result != 0;
+}
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef TEST_HISTOGRAM
+#define TEST_HISTOGRAM
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "minunit.h"
+#include "../histogram.c"
+
+#define ERR_histCount "histogram count does not match number of recorded values"
+#define ERR_histMax "histogram max does not match largest recorded value"
+#define ERR_histExact "small values should be recorded exactly"
+#define ERR_histPrecision "percentile is outside the bucket precision"
+#define ERR_histBucket "bucket index is out of range or not monotonic"
+#define ERR_histReset "histogram did not reset"
+#define ERR_alloc "could not allocate"
+
+int tests_run = 0;
+
+/*
+  test the bucket mapping covers the range and never goes backwards
+*/
+static char *test_buckets()
+{
+  uint64_t value;
+  int last = -1;
+  for (value = 1; value < (1ULL << (HIST_MAX_BITS + 2)); value = value * 3 / 2 + 1)
+  {
+    int index = bucketIndex(value);
+    if (index < last || index >= HIST_NUM_BUCKETS)
+      return ERR_histBucket;
+    if (value < (1ULL << HIST_MAX_BITS) && bucketValue(index) < value)
+      return ERR_histBucket;
+    last = index;
+  }
+  return 0;
+}
+
+/*
+  test the percentiles for a uniform set of values
+*/
+static char *test_percentiles()
+{
+  histogram_t *hist = calloc(1, sizeof(histogram_t));
+  if (!hist)
+    return ERR_alloc;
+
+  // small values land in their own bucket
+  uint64_t i;
+  for (i = 1; i <= 10; i++)
+    histRecord(hist, i);
+  if (histPercentile(hist, 50.0) != 5 || histPercentile(hist, 100.0) != 10)
+    return ERR_histExact;
+  histReset(hist);
+  if (histCount(hist) != 0 || histMax(hist) != 0)
+    return ERR_histReset;
+
+  // 1..100000 microseconds, as nanoseconds
+  for (i = 1; i <= 100000; i++)
+    histRecord(hist, i * 1000);
+  if (histCount(hist) != 100000)
+    return ERR_histCount;
+  if (histMax(hist) != 100000000)
+    return ERR_histMax;
+
+  double pcts[3] = {50.0, 99.0, 99.9};
+  int j;
+  for (j = 0; j < 3; j++)
+  {
+    double expected = pcts[j] / 100.0 * 100000000.0;
+    double got = (double)histPercentile(hist, pcts[j]);
+    if (got < expected * 0.99 || got > expected * (1.0 + 1.0 / HIST_SUB_COUNT))
+      return ERR_histPrecision;
+  }
+  free(hist);
+  return 0;
+}
+
+/*
+  helper function to run all the tests
+*/
+static char *all_tests()
+{
+  mu_run_test(test_buckets);
+  mu_run_test(test_percentiles);
+  return 0;
+}
+
+/*
+  entrypoint
+*/
+int main(int argc, char **argv)
+{
+  fprintf(stderr, "\t\thistogram_test...");
+  char *result = all_tests();
+  if (result != 0)
+  {
+    fprintf(stderr, "failed\n");
+    fprintf(stderr, "\ntest function %d failed:\n", tests_run);
+    fprintf(stderr, "%s\n", result);
+  }
+  else
+  {
+    fprintf(stderr, "passed\n");
+  }
+  return result != 0;
+}
+
+#endif
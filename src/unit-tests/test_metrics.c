@@ -0,0 +1,219 @@
+#ifndef TEST_METRICS
+#define TEST_METRICS
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "minunit.h"
+#include "../metrics.c"
+
+#define ERR_render "metrics exposition text is wrong"
+#define ERR_request "wrong response to a request"
+#define ERR_stalled "a stalled client held up the listener"
+#define ERR_server "could not start the metrics listener"
+#define ERR_listen "a port in use was bound"
+
+int tests_run = 0;
+
+// testPage is a page added by the tests
+static char *testPage(void *ctx)
+{
+  return strdup((const char *)ctx);
+}
+
+// ask sends a request to serveRequest over a socket pair and returns the response (caller frees)
+static char *ask(const char *request)
+{
+  int sv[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+    return NULL;
+  writeAll(sv[0], request, strlen(request));
+  serveRequest(sv[1]);
+  close(sv[1]);
+  char *response = calloc(1, 1 << 16);
+  size_t len = 0;
+  ssize_t n;
+  while (response && len < (1 << 16) - 1 && (n = read(sv[0], response + len, (1 << 16) - 1 - len)) > 0)
+    len += n;
+  close(sv[0]);
+  return response;
+}
+
+// freePort finds a local port that nothing is listening on
+static int freePort()
+{
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || getsockname(fd, (struct sockaddr *)&addr, &len) != 0)
+    return -1;
+  close(fd);
+  return ntohs(addr.sin_port);
+}
+
+/*
+  test the counters and histograms are summed into the exposition text
+*/
+static char *test_render()
+{
+  metricsAdd(AM_METRIC_READS, 5);
+  metricsAdd(AM_METRIC_READS, 5);
+  metricsAdd(AM_METRIC_QUEUE_DEPTH, 3);
+  metricsAdd(AM_METRIC_QUEUE_DEPTH, -1);
+  metricsObserve(AM_HIST_SKETCH, 2000);
+  metricsObserve(AM_HIST_SKETCH, 2000000000);
+  if (metricsGet(AM_METRIC_READS) != 10 || metricsGet(AM_METRIC_QUEUE_DEPTH) != 2)
+    return ERR_render;
+  char *text = metricsRender();
+  if (!text)
+    return ERR_render;
+  if (!strstr(text, "# TYPE antman_reads_total counter\nantman_reads_total 10\n") || !strstr(text, "antman_queue_depth 2\n"))
+    return ERR_render;
+  if (!strstr(text, "antman_sketch_duration_seconds_bucket{le=\"2.5e-06\"} 1\n") || !strstr(text, "antman_sketch_duration_seconds_bucket{le=\"+Inf\"} 2\n"))
+    return ERR_render;
+  if (!strstr(text, "antman_sketch_duration_seconds_count 2\n") || !strstr(text, "antman_stage_latency_seconds_count{stage=\"total\"} 0\n"))
+    return ERR_render;
+  free(text);
+  return 0;
+}
+
+/*
+  test requests are matched to whole paths
+*/
+static char *test_request()
+{
+  const char *notFound[] = {"GET /metricsXYZ HTTP/1.0\r\n\r\n", "GET /stat HTTP/1.0\r\n\r\n", "GET /testing HTTP/1.0\r\n\r\n", "POST /metrics HTTP/1.0\r\n\r\n", "GET"};
+  int i;
+  char *response;
+  for (i = 0; i < (int)(sizeof(notFound) / sizeof(notFound[0])); i++)
+  {
+    if (!(response = ask(notFound[i])) || strncmp(response, "HTTP/1.0 404", 12) != 0)
+      return ERR_request;
+    free(response);
+  }
+  if (!(response = ask("GET /metrics HTTP/1.0\r\n\r\n")) || strncmp(response, "HTTP/1.0 200", 12) != 0 || !strstr(response, "\r\n\r\n# HELP antman_"))
+    return ERR_request;
+  free(response);
+  if (!(response = ask("GET /stats?format=text HTTP/1.0\r\n\r\n")) || strncmp(response, "HTTP/1.0 200", 12) != 0 || !strstr(response, "containment"))
+    return ERR_request;
+  free(response);
+  if (!(response = ask("GET /test HTTP/1.0\r\n\r\n")) || strncmp(response, "HTTP/1.0 200", 12) != 0 || !strstr(response, "Content-Length: 5\r\n") || !strstr(response, "\r\n\r\nhello"))
+    return ERR_request;
+  free(response);
+  return 0;
+}
+
+/*
+  test a client that connects and sends nothing doesn't stop others being served, or the listener stopping
+*/
+static char *test_stalled()
+{
+  int sv[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+    return ERR_stalled;
+  uint64_t start = metricsNow();
+  serveRequest(sv[1]);
+  if (metricsNow() - start > 4ULL * METRICS_POLL_MS * 1000000)
+    return ERR_stalled;
+  close(sv[0]);
+  close(sv[1]);
+
+  // the same through the listener
+  int port = freePort();
+  if (port < 0 || metricsStartServer(port) != 0)
+    return ERR_server;
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  int stalled = socket(AF_INET, SOCK_STREAM, 0);
+  if (stalled < 0 || connect(stalled, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    return ERR_stalled;
+  char *body = metricsFetch(port, "/test");
+  if (!body || strcmp(body, "hello") != 0)
+    return ERR_stalled;
+  free(body);
+  start = metricsNow();
+  metricsStopServer();
+  if (metricsNow() - start > 4ULL * METRICS_POLL_MS * 1000000)
+    return ERR_stalled;
+  close(stalled);
+  return 0;
+}
+
+/*
+  test the port is bound up front, and a port that another listener has is refused
+*/
+static char *test_listen()
+{
+  struct sockaddr_in addr;
+  int port = freePort(), fd;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  int busy = socket(AF_INET, SOCK_STREAM, 0);
+  if (port < 0 || busy < 0 || bind(busy, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(busy, 1) != 0)
+    return ERR_server;
+  if (metricsListen(port) >= 0 || errno != EADDRINUSE || metricsStartServer(port) == 0)
+    return ERR_listen;
+  close(busy);
+
+  // the server uses the port bound by metricsListen
+  if ((fd = metricsListen(port)) < 0 || metricsStartServer(port) != 0 || listenFD != fd)
+    return ERR_server;
+  char *body = metricsFetch(port, "/test");
+  if (!body || strcmp(body, "hello") != 0)
+    return ERR_server;
+  free(body);
+  metricsStopServer();
+
+  // a bound listener that was never started can still be stopped
+  if (metricsListen(port) < 0)
+    return ERR_server;
+  metricsStopServer();
+  return listenFD < 0 ? 0 : ERR_server;
+}
+
+/*
+  helper function to run all the tests
+*/
+static char *all_tests()
+{
+  if (metricsAddPage("/test", testPage, "hello") != 0)
+    return ERR_server;
+  mu_run_test(test_render);
+  mu_run_test(test_request);
+  mu_run_test(test_stalled);
+  mu_run_test(test_listen);
+  return 0;
+}
+
+/*
+  entrypoint
+*/
+int main(int argc, char **argv)
+{
+  fprintf(stderr, "\t\tmetrics_test...");
+  char *result = all_tests();
+  if (result != 0)
+  {
+    fprintf(stderr, "failed\n");
+    fprintf(stderr, "\ntest function %d failed:\n", tests_run);
+    fprintf(stderr, "%s\n", result);
+  }
+  else
+  {
+    fprintf(stderr, "passed\n");
+  }
+  return result != 0;
+}
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef TEST_PIDFILE
+#define TEST_PIDFILE
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "minunit.h"
+#include "../pidfile.h"
+
+#define ERR_lock "could not lock the PID file"
+#define ERR_exclusive "a second daemon could lock the PID file"
+#define ERR_check "the PID of the running daemon was not found"
+#define ERR_stale "a PID was reported with no daemon running"
+#define ERR_exit "waiting for the daemon to exit failed"
+
+#define TEST_PIDFILE_PATH "/tmp/antman-test.config.pid"
+
+int tests_run = 0;
+
+/*
+  test the lock is exclusive and the PID is only reported while it is held
+*/
+static char *test_lock()
+{
+  unlink(TEST_PIDFILE_PATH);
+  if (pidFileCheck(TEST_PIDFILE_PATH) != -1)
+    return ERR_stale;
+  int fd = pidFileLock(TEST_PIDFILE_PATH);
+  if (fd < 0 || pidFileWrite(fd, 4242) != 0)
+    return ERR_lock;
+  if (pidFileLock(TEST_PIDFILE_PATH) != -2)
+    return ERR_exclusive;
+  if (pidFileCheck(TEST_PIDFILE_PATH) != 4242)
+    return ERR_check;
+
+  // once the lock goes the PID left in the file is ignored
+  close(fd);
+  if (pidFileCheck(TEST_PIDFILE_PATH) != -1)
+    return ERR_stale;
+  unlink(TEST_PIDFILE_PATH);
+  return 0;
+}
+
+/*
+  test a daemon that dies without cleaning up is seen as stopped, as the kernel drops its lock
+*/
+static char *test_stale()
+{
+  unlink(TEST_PIDFILE_PATH);
+  int fd = pidFileLock(TEST_PIDFILE_PATH);
+  if (fd < 0)
+    return ERR_lock;
+
+  // the child inherits the lock, which is held until the last copy of the descriptor is closed
+  pid_t child = fork();
+  if (child == 0)
+  {
+    pidFileWrite(fd, getpid());
+    pause();
+    _exit(0);
+  }
+  close(fd);
+  pid_t pid = pidFileCheck(TEST_PIDFILE_PATH);
+  if (pid != child)
+    return ERR_check;
+  kill(child, SIGKILL);
+  waitpid(child, NULL, 0);
+  if (pidFileWaitExit(TEST_PIDFILE_PATH, 1) != 0 || pidFileCheck(TEST_PIDFILE_PATH) != -1)
+    return ERR_exit;
+  unlink(TEST_PIDFILE_PATH);
+  return 0;
+}
+
+/*
+  helper function to run all the tests
+*/
+static char *all_tests()
+{
+  mu_run_test(test_lock);
+  mu_run_test(test_stale);
+  return 0;
+}
+
+/*
+  entrypoint
+*/
+int main(int argc, char **argv)
+{
+  fprintf(stderr, "\t\tpidfile_test...");
+  char *result = all_tests();
+  if (result != 0)
+  {
+    fprintf(stderr, "failed\n");
+    fprintf(stderr, "\ntest function %d failed:\n", tests_run);
+    fprintf(stderr, "%s\n", result);
+  }
+  else
+  {
+    fprintf(stderr, "passed\n");
+  }
+  return result != 0;
+}
+
+#endif
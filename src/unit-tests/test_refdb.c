@@ -0,0 +1,453 @@
+#ifndef TEST_REFDB
+#define TEST_REFDB
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "minunit.h"
+#include "../refdb.h"
+#include "../sketch.h"
+
+#define ERR_build "could not build the reference database"
+#define ERR_open "could not open the reference database"
+#define ERR_header "reference database header does not match the build settings"
+#define ERR_lookup "reference lookup returned the wrong entry"
+#define ERR_sorted "reference sketch is not sorted and unique"
+#define ERR_contained "read taken from a reference was not fully contained"
+#define ERR_random "random read had a high containment"
+#define ERR_reuse "fresh reference database was not reused"
+#define ERR_corrupt "truncated reference database was accepted"
+#define ERR_index "inverted index is missing or does not match the sketches"
+#define ERR_topN "top references are wrong or out of order"
+#define ERR_kmers "exact k-mer set is missing or gave the wrong answer"
+#define ERR_noBuild "database was built when only mapping was asked for"
+#define ERR_parallel "databases built with different numbers of threads are not the same"
+#define ERR_checked "a sound reference database failed its check"
+#define ERR_damaged "a damaged reference database passed its check"
+#define ERR_alloc "could not allocate"
+
+#define TEST_K 15
+#define TEST_REF_LENGTH 20000
+#define TEST_READ_LENGTH 2000
+#define TEST_SKETCH_SIZE 128
+
+int tests_run = 0;
+char testDir[] = "/tmp/antman-refdb-XXXXXX";
+char fastaPath[256], dbPath[256];
+char *refSeqs[3];
+
+// randomSeq fills a buffer with random bases
+static void randomSeq(char *seq, int len, unsigned int *state)
+{
+  int i;
+  for (i = 0; i < len; i++)
+    seq[i] = "ACGT"[rand_r(state) % 4];
+  seq[len] = '\0';
+}
+
+// readContainment sketches a read and checks it against the database
+static double readContainment(refdb_t *db, const char *read, int len, int *bestRef)
+{
+  uint64_t sketch[TEST_SKETCH_SIZE];
+  memset(sketch, 0, sizeof(sketch));
+  sketchSequence(read, len, TEST_K, TEST_SKETCH_SIZE, NULL, sketch);
+  return refdbContainment(db, sketch, TEST_SKETCH_SIZE, bestRef);
+}
+
+/*
+  test building a database from a FASTA file and reading back the header and table of contents
+*/
+static char *test_build()
+{
+  if (refdbBuild(fastaPath, dbPath, TEST_K, AM_DEFAULT_REFDB_SCALED, 0, 1) != 0)
+    return ERR_build;
+  if (!refdbIsDB(dbPath) || refdbIsDB(fastaPath))
+    return ERR_header;
+  refdb_t *db = refdbOpen(dbPath);
+  if (!db)
+    return ERR_open;
+  if (db->k != TEST_K || db->nRefs != 3 || db->header->scaled != AM_DEFAULT_REFDB_SCALED)
+    return ERR_header;
+
+  // names are found through the table of contents
+  const refdbEntry_t *e = refdbLookup(db, "ref2");
+  if (!e || e->index != 1 || e->length != TEST_REF_LENGTH || strcmp(refdbName(db, e), "ref2") != 0)
+    return ERR_lookup;
+  if (refdbLookup(db, "ref4") != NULL)
+    return ERR_lookup;
+
+  // each sketch is sorted, unique and keeps roughly 1 in scaled k-mers
+  uint64_t i;
+  const uint64_t *hashes = db->hashes + e->hashOffset;
+  for (i = 1; i < e->nHashes; i++)
+    if (hashes[i] <= hashes[i - 1])
+      return ERR_sorted;
+  if (e->nHashes < TEST_REF_LENGTH / AM_DEFAULT_REFDB_SCALED / 2 || e->nHashes > TEST_REF_LENGTH / AM_DEFAULT_REFDB_SCALED * 2)
+    return ERR_sorted;
+  refdbClose(db);
+  return 0;
+}
+
+/*
+  test the containment of reads from a reference and of random reads
+*/
+static char *test_containment()
+{
+  refdb_t *db = refdbOpen(dbPath);
+  if (!db)
+    return ERR_open;
+
+  // a read from the second reference is fully contained in it
+  int bestRef;
+  double containment = readContainment(db, refSeqs[1] + 5000, TEST_READ_LENGTH, &bestRef);
+  if (containment != 1.0 || bestRef < 0 || strcmp(refdbName(db, &db->toc[bestRef]), "ref2") != 0)
+    return ERR_contained;
+
+  // a random read shares next to nothing with either reference
+  char read[TEST_READ_LENGTH + 1];
+  unsigned int state = 99;
+  randomSeq(read, TEST_READ_LENGTH, &state);
+  containment = readContainment(db, read, TEST_READ_LENGTH, &bestRef);
+  if (containment < 0 || containment > 0.1)
+    return ERR_random;
+  refdbClose(db);
+  return 0;
+}
+
+/*
+  test the inverted index holds every sketch hash and scores reads like a scan of the sketches
+*/
+static char *test_index()
+{
+  refdb_t *db = refdbOpen(dbPath);
+  if (!db)
+    return ERR_open;
+  if (db->keys == NULL)
+    return ERR_index;
+
+  // every posting points back to a reference with that hash
+  uint64_t key, p;
+  for (key = 0; key < db->nKeys; key++)
+    for (p = db->offsets[key]; p < db->offsets[key + 1]; p++)
+    {
+      const refdbEntry_t *e = &db->toc[db->postings[p]];
+      uint64_t i, found = 0;
+      for (i = 0; i < e->nHashes; i++)
+        found |= (db->hashes[e->hashOffset + i] == db->keys[key]);
+      if (!found)
+        return ERR_index;
+    }
+
+  // a read from the start of ref1 is also in ref3, which shares its first half
+  uint64_t sketch[TEST_SKETCH_SIZE];
+  memset(sketch, 0, sizeof(sketch));
+  sketchSequence(refSeqs[0] + 1000, TEST_READ_LENGTH, TEST_K, TEST_SKETCH_SIZE, NULL, sketch);
+  refdbHit_t hits[3], scanHits[3];
+  int tested, scanTested;
+  int nHits = refdbTopN(db, sketch, TEST_SKETCH_SIZE, hits, 3, &tested);
+  if (nHits != 2 || hits[0].containment != 1.0 || hits[1].containment != 1.0 || hits[0].ref > hits[1].ref)
+    return ERR_topN;
+  const char *first = refdbName(db, &db->toc[hits[0].ref]), *second = refdbName(db, &db->toc[hits[1].ref]);
+  if (!((strcmp(first, "ref1") == 0 && strcmp(second, "ref3") == 0) || (strcmp(first, "ref3") == 0 && strcmp(second, "ref1") == 0)))
+    return ERR_topN;
+
+  // only the best is kept when n is 1
+  if (refdbTopN(db, sketch, TEST_SKETCH_SIZE, scanHits, 1, &scanTested) != 1 || scanHits[0].ref != hits[0].ref)
+    return ERR_topN;
+
+  // scanning the sketches without the index gives the same answer
+  db->keys = NULL;
+  if (refdbTopN(db, sketch, TEST_SKETCH_SIZE, scanHits, 3, &scanTested) != nHits || scanTested != tested)
+    return ERR_index;
+  int i;
+  for (i = 0; i < nHits; i++)
+    if (scanHits[i].ref != hits[i].ref || scanHits[i].shared != hits[i].shared)
+      return ERR_index;
+  refdbClose(db);
+  return 0;
+}
+
+/*
+  test a fresh database is reused and a damaged one is rejected
+*/
+static char *test_load()
+{
+  char cachePath[300];
+  snprintf(cachePath, sizeof(cachePath), "%s%s", fastaPath, AM_REFDB_EXT);
+
+  // a missing database is not built when only mapping is asked for
+  refdb_t *db = refdbLoad(fastaPath, TEST_K, AM_DEFAULT_REFDB_SCALED, AM_REFDB_NO_BUILD, 2);
+  if (db || access(cachePath, F_OK) == 0)
+    return ERR_noBuild;
+  db = refdbLoad(fastaPath, TEST_K, AM_DEFAULT_REFDB_SCALED, 0, 2);
+  if (!db)
+    return ERR_build;
+  refdbClose(db);
+  struct stat before, after;
+  if (stat(cachePath, &before) != 0)
+    return ERR_build;
+  db = refdbLoad(fastaPath, TEST_K, AM_DEFAULT_REFDB_SCALED, 0, 2);
+  if (!db || stat(cachePath, &after) != 0 || before.st_ino != after.st_ino)
+    return ERR_reuse;
+  refdbClose(db);
+  if (!(db = refdbLoad(fastaPath, TEST_K, AM_DEFAULT_REFDB_SCALED, AM_REFDB_NO_BUILD, 2)))
+    return ERR_reuse;
+  refdbClose(db);
+
+  // the file size is checked against the header
+  if (truncate(cachePath, before.st_size - 8) != 0)
+    return ERR_corrupt;
+  if ((db = refdbOpen(cachePath)) != NULL)
+    return ERR_corrupt;
+  unlink(cachePath);
+  return 0;
+}
+
+// patchDB overwrites bytes of a database file
+static int patchDB(const char *path, off_t offset, const void *data, size_t size)
+{
+  int fd = open(path, O_WRONLY);
+  if (fd < 0)
+    return 1;
+  int err = pwrite(fd, data, size, offset) != (ssize_t)size;
+  close(fd);
+  return err;
+}
+
+/*
+  test a damaged header is rejected on open, while damaged postings are only caught by refdbCheck and skipped when scoring
+*/
+static char *test_check()
+{
+  char checkPath[300];
+  snprintf(checkPath, sizeof(checkPath), "%s/check.db", testDir);
+  if (refdbBuild(fastaPath, checkPath, TEST_K, AM_DEFAULT_REFDB_SCALED, AM_REFDB_KMERS, 2) != 0)
+    return ERR_build;
+  refdb_t *db = refdbOpen(checkPath);
+  if (!db || !db->keys || db->nPostings == 0)
+    return ERR_open;
+  if (refdbCheck(db) != 0)
+    return ERR_checked;
+  off_t postingOffset = (const char *)db->postings - (const char *)db->map;
+  uint64_t scaled = db->header->scaled;
+  refdbClose(db);
+
+  // a posting past the table of contents still opens, but fails the check
+  uint32_t badRef = 1000;
+  if (patchDB(checkPath, postingOffset, &badRef, sizeof(badRef)) != 0)
+    return ERR_damaged;
+  if (!(db = refdbOpen(checkPath)))
+    return ERR_open;
+  if (refdbCheck(db) == 0)
+    return ERR_damaged;
+
+  // and scoring every key leaves it out rather than reading past the counters
+  uint64_t key;
+  refdbHit_t hits[3];
+  int tested;
+  for (key = 0; key < db->nKeys; key++)
+    if (refdbTopN(db, &db->keys[key], 1, hits, 3, &tested) < 0)
+      return ERR_damaged;
+  refdbClose(db);
+
+  // a changed header doesn't open at all
+  scaled++;
+  if (patchDB(checkPath, offsetof(refdbHeader_t, scaled), &scaled, sizeof(scaled)) != 0)
+    return ERR_damaged;
+  if ((db = refdbOpen(checkPath)) != NULL)
+    return ERR_damaged;
+  unlink(checkPath);
+  return 0;
+}
+
+/*
+  test asking for the exact k-mer set rebuilds the database with it, and that it holds every reference k-mer
+*/
+static char *test_kmers()
+{
+  char cachePath[300];
+  snprintf(cachePath, sizeof(cachePath), "%s%s", fastaPath, AM_REFDB_EXT);
+  refdb_t *db = refdbLoad(fastaPath, TEST_K, AM_DEFAULT_REFDB_SCALED, 0, 2);
+  if (!db || db->hasKmers)
+    return ERR_kmers;
+  refdbClose(db);
+  if (!(db = refdbLoad(fastaPath, TEST_K, AM_DEFAULT_REFDB_SCALED, AM_REFDB_KMERS, 2)) || !db->hasKmers)
+    return ERR_kmers;
+
+  // every k-mer of every reference is in the set
+  int r;
+  for (r = 0; r < 3; r++)
+  {
+    uint64_t *hashes;
+    int n = scaledSequence(refSeqs[r], TEST_REF_LENGTH, TEST_K, scaledMaxHash(TEST_K, 1), &hashes), i;
+    if (n < TEST_REF_LENGTH / 2)
+      return ERR_kmers;
+    for (i = 0; i < n; i++)
+      if (!efContains(&db->kmers, hashes[i] >> 8))
+        return ERR_kmers;
+    free(hashes);
+  }
+
+  // the whole sketch of a read from a reference is found, and next to none of a random read's
+  uint64_t sketch[TEST_SKETCH_SIZE];
+  int tested;
+  memset(sketch, 0, sizeof(sketch));
+  sketchSequence(refSeqs[1] + 100, TEST_READ_LENGTH, TEST_K, TEST_SKETCH_SIZE, NULL, sketch);
+  if (refdbKmerHits(db, sketch, TEST_SKETCH_SIZE, &tested) != TEST_SKETCH_SIZE || tested != TEST_SKETCH_SIZE)
+    return ERR_kmers;
+  char read[TEST_READ_LENGTH + 1];
+  unsigned int state = 7;
+  randomSeq(read, TEST_READ_LENGTH, &state);
+  memset(sketch, 0, sizeof(sketch));
+  sketchSequence(read, TEST_READ_LENGTH, TEST_K, TEST_SKETCH_SIZE, NULL, sketch);
+  if (refdbKmerHits(db, sketch, TEST_SKETCH_SIZE, &tested) > TEST_SKETCH_SIZE / 10)
+    return ERR_kmers;
+  refdbClose(db);
+  unlink(cachePath);
+  return 0;
+}
+
+// readFile reads a whole file into memory, returns NULL if it can't
+static char *readFile(const char *path, long *size)
+{
+  FILE *fp = fopen(path, "rb");
+  if (!fp)
+    return NULL;
+  fseek(fp, 0, SEEK_END);
+  *size = ftell(fp);
+  rewind(fp);
+  char *data = malloc(*size ? *size : 1);
+  if (data && fread(data, 1, *size, fp) != (size_t)*size)
+  {
+    free(data);
+    data = NULL;
+  }
+  fclose(fp);
+  return data;
+}
+
+/*
+  test a reference split into chunks across several threads gives the same database as one thread
+*/
+static char *test_parallel()
+{
+  char parallelFasta[300], serialDB[300], parallelDB[300];
+  snprintf(parallelFasta, sizeof(parallelFasta), "%s/long.fna", testDir);
+  snprintf(serialDB, sizeof(serialDB), "%s/serial.db", testDir);
+  snprintf(parallelDB, sizeof(parallelDB), "%s/parallel.db", testDir);
+
+  // a record long enough to be split into several chunks, between two short ones
+  int longLen = 2 * AM_REFDB_CHUNK_SIZE + 5000;
+  char *longSeq = malloc(longLen + 1);
+  if (!longSeq)
+    return ERR_alloc;
+  unsigned int state = 5;
+  randomSeq(longSeq, longLen, &state);
+  FILE *fp = fopen(parallelFasta, "w");
+  if (!fp)
+    return ERR_build;
+  fprintf(fp, ">short1\n%s\n>long\n%s\n>short2\n%s\n", refSeqs[0], longSeq, refSeqs[1]);
+  fclose(fp);
+
+  if (refdbBuild(parallelFasta, serialDB, TEST_K, AM_DEFAULT_REFDB_SCALED, AM_REFDB_KMERS, 1) != 0)
+    return ERR_build;
+  if (refdbBuild(parallelFasta, parallelDB, TEST_K, AM_DEFAULT_REFDB_SCALED, AM_REFDB_KMERS, 4) != 0)
+    return ERR_build;
+  long serialSize, parallelSize;
+  char *serial = readFile(serialDB, &serialSize), *parallel = readFile(parallelDB, &parallelSize);
+  if (!serial || !parallel)
+    return ERR_open;
+  if (serialSize != parallelSize || memcmp(serial, parallel, serialSize) != 0)
+    return ERR_parallel;
+  free(serial);
+  free(parallel);
+
+  // and no k-mer of the long record is lost at the chunk boundaries
+  refdb_t *db = refdbOpen(parallelDB);
+  if (!db || !db->hasKmers)
+    return ERR_open;
+  const refdbEntry_t *e = refdbLookup(db, "long");
+  if (!e || e->length != (uint64_t)longLen)
+    return ERR_lookup;
+  uint64_t *hashes;
+  int n = scaledSequence(longSeq, longLen, TEST_K, scaledMaxHash(TEST_K, 1), &hashes), i;
+  for (i = 0; i < n; i++)
+    if (!efContains(&db->kmers, hashes[i] >> 8))
+      return ERR_kmers;
+  free(hashes);
+  free(longSeq);
+  refdbClose(db);
+  unlink(parallelFasta);
+  unlink(serialDB);
+  unlink(parallelDB);
+  return 0;
+}
+
+/*
+  helper function to run all the tests
+*/
+static char *all_tests()
+{
+  mu_run_test(test_build);
+  mu_run_test(test_containment);
+  mu_run_test(test_index);
+  mu_run_test(test_load);
+  mu_run_test(test_check);
+  mu_run_test(test_kmers);
+  mu_run_test(test_parallel);
+  return 0;
+}
+
+/*
+  entrypoint
+*/
+int main(int argc, char **argv)
+{
+  fprintf(stderr, "\t\trefdb_test...");
+
+  // write a FASTA with two random references, and a third that shares the first half of ref1
+  if (!mkdtemp(testDir))
+    return 1;
+  snprintf(fastaPath, sizeof(fastaPath), "%s/ref.fna", testDir);
+  snprintf(dbPath, sizeof(dbPath), "%s/ref.db", testDir);
+  FILE *fp = fopen(fastaPath, "w");
+  if (!fp)
+    return 1;
+  unsigned int state = 42;
+  int i;
+  for (i = 0; i < 3; i++)
+  {
+    if (!(refSeqs[i] = malloc(TEST_REF_LENGTH + 1)))
+      return 1;
+    randomSeq(refSeqs[i], TEST_REF_LENGTH, &state);
+    if (i == 2)
+      memcpy(refSeqs[i], refSeqs[0], TEST_REF_LENGTH / 2);
+    fprintf(fp, ">ref%d test reference\n%s\n", i + 1, refSeqs[i]);
+  }
+  fclose(fp);
+
+  char *result = all_tests();
+  if (result != 0)
+  {
+    fprintf(stderr, "failed\n");
+    fprintf(stderr, "\ntest function %d failed:\n", tests_run);
+    fprintf(stderr, "%s\n", result);
+  }
+  else
+  {
+    fprintf(stderr, "passed\n");
+  }
+  unlink(fastaPath);
+  unlink(dbPath);
+  rmdir(testDir);
+  for (i = 0; i < 3; i++)
+    free(refSeqs[i]);
+  return result != 0;
+}
+
+#endif
@@ -0,0 +1,216 @@
+#ifndef TEST_RUNSKETCH
+#define TEST_RUNSKETCH
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "minunit.h"
+#include "../runsketch.h"
+#include "../sketch.h"
+
+#define ERR_init "could not make the sketch"
+#define ERR_bottom "sketch does not hold the smallest hashes"
+#define ERR_count "sketch counts are wrong"
+#define ERR_merge "merged sketch does not match the sketch of all the reads"
+#define ERR_distinct "distinct k-mer estimate is too far out"
+#define ERR_file "sketch did not survive a round trip to disk"
+#define ERR_corrupt "a damaged sketch file was accepted"
+
+#define TEST_K 11
+#define TEST_SKETCH_SIZE 128
+#define TEST_GENOME 20000
+#define TEST_READS 300
+#define TEST_READ_LEN 1000
+#define TEST_FILE "/tmp/antman-test-runsketch.amsk"
+
+int tests_run = 0;
+
+// genome and the read sketches, shared by the tests
+static char genome[TEST_GENOME + 1];
+static uint64_t sketches[TEST_READS][TEST_SKETCH_SIZE];
+
+// nextRand is a small xorshift generator so the reads are the same on every run
+static uint64_t nextRand(uint64_t *state)
+{
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
+
+// makeReads makes a random genome and sketches reads from it
+static void makeReads()
+{
+  uint64_t state = 42;
+  int i;
+  for (i = 0; i < TEST_GENOME; i++)
+    genome[i] = "ACGT"[nextRand(&state) & 3];
+  for (i = 0; i < TEST_READS; i++)
+  {
+    int start = nextRand(&state) % (TEST_GENOME - TEST_READ_LEN);
+    memset(sketches[i], 0, sizeof(sketches[i]));
+    sketchSequence(genome + start, TEST_READ_LEN, TEST_K, TEST_SKETCH_SIZE, NULL, sketches[i]);
+  }
+}
+
+// compareHashes orders hashes for qsort
+static int compareHashes(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+// checkAgainstReads checks a sketch holds the smallest hashes from the reads, with the number of reads that had each
+static char *checkAgainstReads(const runSketch_t *rs, int from, int to)
+{
+  int n = 0, i, j;
+  uint64_t *all = malloc(TEST_READS * TEST_SKETCH_SIZE * sizeof(uint64_t));
+  for (i = from; i < to; i++)
+    for (j = 0; j < TEST_SKETCH_SIZE; j++)
+      if (sketches[i][j])
+        all[n++] = sketches[i][j];
+  qsort(all, n, sizeof(uint64_t), compareHashes);
+  int distinct = 0;
+  for (i = 0; i < n && distinct < TEST_SKETCH_SIZE; i = j, distinct++)
+  {
+    for (j = i; j < n && all[j] == all[i]; j++)
+      ;
+    if (distinct >= rs->n || rs->hashes[distinct] != all[i])
+      return ERR_bottom;
+    if (rs->counts[distinct] != (uint32_t)(j - i))
+      return ERR_count;
+  }
+  free(all);
+  return (distinct == rs->n) ? 0 : ERR_bottom;
+}
+
+/*
+  test reads are added to a bottom-k sketch with their counts
+*/
+static char *test_add()
+{
+  runSketch_t *rs = runSketchInit(TEST_K, TEST_SKETCH_SIZE);
+  if (!rs)
+    return ERR_init;
+  int i;
+  for (i = 0; i < TEST_READS; i++)
+    runSketchAddRead(rs, sketches[i], TEST_SKETCH_SIZE, TEST_READ_LEN, i % 3 == 0);
+  runSketchAddRead(rs, NULL, TEST_SKETCH_SIZE, 5, -1);
+  if (rs->reads != TEST_READS + 1 || rs->bases != TEST_READS * TEST_READ_LEN + 5 || rs->matched != TEST_READS / 3)
+    return ERR_count;
+  char *err = checkAgainstReads(rs, 0, TEST_READS);
+  if (err)
+    return err;
+
+  // the genome has about TEST_GENOME distinct k-mers
+  uint64_t distinct = runSketchDistinct(rs);
+  if (distinct < TEST_GENOME * 0.7 || distinct > TEST_GENOME * 1.3)
+    return ERR_distinct;
+  runSketchDestroy(rs);
+  return 0;
+}
+
+/*
+  test merging sketches of parts of the reads gives the sketch of all of them
+*/
+static char *test_merge()
+{
+  runSketch_t *run = runSketchInit(TEST_K, TEST_SKETCH_SIZE), *other = runSketchInit(TEST_K + 1, TEST_SKETCH_SIZE);
+  if (!run || !other)
+    return ERR_init;
+  int i, file, perFile = TEST_READS / 4;
+  for (file = 0; file < 4; file++)
+  {
+    runSketch_t *fs = runSketchInit(TEST_K, TEST_SKETCH_SIZE);
+    if (!fs)
+      return ERR_init;
+    for (i = file * perFile; i < (file + 1) * perFile; i++)
+      runSketchAddRead(fs, sketches[i], TEST_SKETCH_SIZE, TEST_READ_LEN, 1);
+    fs->files = 1;
+    char *err = checkAgainstReads(fs, file * perFile, (file + 1) * perFile);
+    if (err)
+      return err;
+    if (runSketchMerge(run, fs) != 0)
+      return ERR_merge;
+    runSketchDestroy(fs);
+  }
+  if (run->files != 4 || run->reads != (uint64_t)4 * perFile || run->matched != run->reads)
+    return ERR_merge;
+  if (checkAgainstReads(run, 0, 4 * perFile))
+    return ERR_merge;
+
+  // sketches of different k-mers can't be merged
+  if (runSketchMerge(run, other) == 0)
+    return ERR_merge;
+  runSketchDestroy(run);
+  runSketchDestroy(other);
+  return 0;
+}
+
+/*
+  test a sketch is written and read back, and a damaged file is rejected
+*/
+static char *test_file()
+{
+  runSketch_t *rs = runSketchInit(TEST_K, TEST_SKETCH_SIZE);
+  if (!rs)
+    return ERR_init;
+  int i;
+  for (i = 0; i < TEST_READS; i++)
+    runSketchAddRead(rs, sketches[i], TEST_SKETCH_SIZE, TEST_READ_LEN, 0);
+  rs->files = 7;
+  if (runSketchWrite(rs, TEST_FILE) != 0)
+    return ERR_file;
+  runSketch_t *loaded = runSketchRead(TEST_FILE);
+  if (!loaded || loaded->k != rs->k || loaded->size != rs->size || loaded->n != rs->n || loaded->reads != rs->reads || loaded->bases != rs->bases || loaded->files != 7)
+    return ERR_file;
+  if (memcmp(loaded->hashes, rs->hashes, rs->n * sizeof(uint64_t)) != 0 || memcmp(loaded->counts, rs->counts, rs->n * sizeof(uint32_t)) != 0)
+    return ERR_file;
+  runSketchDestroy(loaded);
+
+  // a truncated file
+  if (truncate(TEST_FILE, sizeof(runSketchHeader_t) + 8) != 0 || runSketchRead(TEST_FILE) != NULL)
+    return ERR_corrupt;
+  unlink(TEST_FILE);
+  if (runSketchRead(TEST_FILE) != NULL)
+    return ERR_corrupt;
+  runSketchDestroy(rs);
+  return 0;
+}
+
+/*
+  helper function to run all the tests
+*/
+static char *all_tests()
+{
+  makeReads();
+  mu_run_test(test_add);
+  mu_run_test(test_merge);
+  mu_run_test(test_file);
+  return 0;
+}
+
+/*
+  entrypoint
+*/
+int main(int argc, char **argv)
+{
+  fprintf(stderr, "\t\trunsketch_test...");
+  char *result = all_tests();
+  if (result != 0)
+  {
+    fprintf(stderr, "failed\n");
+    fprintf(stderr, "\ntest function %d failed:\n", tests_run);
+    fprintf(stderr, "%s\n", result);
+  }
+  else
+  {
+    fprintf(stderr, "passed\n");
+  }
+  return result != 0;
+}
+
+#endif
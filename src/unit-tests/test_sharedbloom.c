@@ -0,0 +1,192 @@
+#ifndef TEST_SHAREDBLOOM
+#define TEST_SHAREDBLOOM
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "minunit.h"
+#include "../sequence.h"
+#include "../sharedbloom.h"
+
+#define ERR_attach "could not attach the shared bloom filter"
+#define ERR_shared "second attach did not share the first filter"
+#define ERR_bits "shared filter does not match a private one"
+#define ERR_detach "segment was not removed after the last detach"
+#define ERR_version "changed white list did not get a new segment"
+#define ERR_stale "unfinished segment was attached to"
+#define ERR_foreign "a finished segment that couldn't be used was removed"
+
+#define TEST_K 11
+#define TEST_ENTRIES 20000
+#define TEST_FP 0.01
+#define TEST_REF_LENGTH 5000
+
+int tests_run = 0;
+char testDir[] = "/tmp/antman-sharedbloom-XXXXXX";
+char fastaPath[256];
+
+// segmentExists checks if a segment name is still linked
+static int segmentExists(const char *name)
+{
+  int fd = shm_open(name, O_RDONLY, 0);
+  if (fd < 0)
+    return 0;
+  close(fd);
+  return 1;
+}
+
+/*
+  test a second attach shares the filter built by the first, and the last detach removes it
+*/
+static char *test_attach()
+{
+  sharedBloom_t *first = sharedBloomAttach(fastaPath, TEST_K, TEST_ENTRIES, TEST_FP, 2);
+  if (!first || !first->built)
+    return ERR_attach;
+  sharedBloom_t *second = sharedBloomAttach(fastaPath, TEST_K, TEST_ENTRIES, TEST_FP, 2);
+  if (!second || second->built || strcmp(first->name, second->name) != 0 || first->ino != second->ino)
+    return ERR_shared;
+  if (((sharedHeader_t *)second->map)->refs != 2)
+    return ERR_shared;
+
+  // the filter is the same as one built privately
+  struct bloom private;
+  if (bloom_init(&private, TEST_ENTRIES, TEST_FP) != 0 || processRef(fastaPath, &private, TEST_K, 1) != 0)
+    return ERR_attach;
+  if (second->bf.bytes != private.bytes || second->bf.hashes != private.hashes || memcmp(second->bf.bf, private.bf, private.bytes) != 0)
+    return ERR_bits;
+  bloom_free(&private);
+
+  char name[64];
+  strcpy(name, first->name);
+  sharedBloomDetach(first);
+  if (!segmentExists(name) || ((sharedHeader_t *)second->map)->refs != 1)
+    return ERR_detach;
+  sharedBloomDetach(second);
+  if (segmentExists(name))
+    return ERR_detach;
+  return 0;
+}
+
+/*
+  test a changed white list gets a new segment
+*/
+static char *test_version()
+{
+  char before[64], after[64];
+  if (sharedBloomName(fastaPath, TEST_K, TEST_ENTRIES, TEST_FP, before, sizeof(before)) != 0)
+    return ERR_version;
+  struct timeval times[2] = {{1000000000, 0}, {1000000000, 0}};
+  if (utimes(fastaPath, times) != 0 || sharedBloomName(fastaPath, TEST_K, TEST_ENTRIES, TEST_FP, after, sizeof(after)) != 0)
+    return ERR_version;
+  if (strcmp(before, after) == 0)
+    return ERR_version;
+
+  // so do different filter settings
+  if (sharedBloomName(fastaPath, TEST_K + 2, TEST_ENTRIES, TEST_FP, before, sizeof(before)) != 0 || strcmp(before, after) == 0)
+    return ERR_version;
+  return 0;
+}
+
+/*
+  test a segment left unfinished by a crashed daemon is replaced
+*/
+static char *test_stale()
+{
+  char name[64];
+  struct bloom sizes;
+  if (sharedBloomName(fastaPath, TEST_K, TEST_ENTRIES, TEST_FP, name, sizeof(name)) != 0 || bloom_init_buffer(&sizes, TEST_ENTRIES, TEST_FP, NULL) != 0)
+    return ERR_stale;
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0 || ftruncate(fd, AM_SHARED_HEADER_SIZE + sizes.bytes) != 0)
+    return ERR_stale;
+  close(fd);
+
+  sharedBloom_t *shared = sharedBloomAttach(fastaPath, TEST_K, TEST_ENTRIES, TEST_FP, 1);
+  if (!shared || !shared->built || !((sharedHeader_t *)shared->map)->ready)
+    return ERR_stale;
+  sharedBloomDetach(shared);
+  if (segmentExists(name))
+    return ERR_detach;
+  return 0;
+}
+
+/*
+  test a finished segment made by another antman version is left alone, and the caller falls back to a private filter
+*/
+static char *test_foreign()
+{
+  sharedBloom_t *first = sharedBloomAttach(fastaPath, TEST_K, TEST_ENTRIES, TEST_FP, 1);
+  if (!first)
+    return ERR_attach;
+  sharedHeader_t *header = (sharedHeader_t *)first->map;
+  header->version = AM_SHARED_VERSION + 1;
+  if (sharedBloomAttach(fastaPath, TEST_K, TEST_ENTRIES, TEST_FP, 1) != NULL)
+    return ERR_foreign;
+  if (!segmentExists(first->name) || header->refs != 1 || !header->ready)
+    return ERR_foreign;
+  header->version = AM_SHARED_VERSION;
+  char name[64];
+  strcpy(name, first->name);
+  sharedBloomDetach(first);
+  if (segmentExists(name))
+    return ERR_detach;
+  return 0;
+}
+
+/*
+  helper function to run all the tests
+*/
+static char *all_tests()
+{
+  mu_run_test(test_attach);
+  mu_run_test(test_version);
+  mu_run_test(test_stale);
+  mu_run_test(test_foreign);
+  return 0;
+}
+
+/*
+  entrypoint
+*/
+int main(int argc, char **argv)
+{
+  fprintf(stderr, "\t\tsharedbloom_test...");
+  if (!mkdtemp(testDir))
+    return 1;
+  snprintf(fastaPath, sizeof(fastaPath), "%s/ref.fna", testDir);
+  FILE *fp = fopen(fastaPath, "w");
+  if (!fp)
+    return 1;
+  unsigned int state = 42;
+  int i;
+  fprintf(fp, ">ref1\n");
+  for (i = 0; i < TEST_REF_LENGTH; i++)
+    fputc("ACGT"[rand_r(&state) % 4], fp);
+  fprintf(fp, "\n");
+  fclose(fp);
+
+  char *result = all_tests();
+  if (result != 0)
+  {
+    fprintf(stderr, "failed\n");
+    fprintf(stderr, "\ntest function %d failed:\n", tests_run);
+    fprintf(stderr, "%s\n", result);
+  }
+  else
+  {
+    fprintf(stderr, "passed\n");
+  }
+  unlink(fastaPath);
+  rmdir(testDir);
+  return result != 0;
+}
+
+#endif
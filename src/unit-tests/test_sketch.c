@@ -9,6 +9,10 @@
 #include "../sketch.c"
 #include "../hashmap.c"
 #include "../heap.c"
+#include "../histogram.c"
+#include "../metrics.c"
+#include "../slog.c"
+#include "../trace.c"
 #include "../bloom.c"
 #include "../murmurhash2.c"
 
@@ -151,11 +155,11 @@ static char *test_sketchSeq()
   sketchSequence(seq, seqLen, kSize, sketchSize, &bloom, sketch);
 
   // confirm the bloom filter worked
-  if (!bloom_check(&bloom, &hashedKmer, kSize))
+  if (!bloom_check(&bloom, &hashedKmer, sizeof(hashedKmer)))
   {
     return ERR_sketch1;
   }
-  if (bloom_check(&bloom, &dummyHashedKmer, kSize))
+  if (bloom_check(&bloom, &dummyHashedKmer, sizeof(dummyHashedKmer)))
   {
     return ERR_sketch2;
   }
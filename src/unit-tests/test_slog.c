@@ -0,0 +1,152 @@
+#ifndef TEST_SLOG
+#define TEST_SLOG
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "minunit.h"
+#include "../slog.h"
+
+#define ERR_start "could not start the async logger"
+#define ERR_dropped "lines were dropped, the test needs a slower writer"
+#define ERR_missing "a logged line did not reach the file"
+#define ERR_repeated "a logged line reached the file twice"
+#define ERR_late "no lines were logged after the async logger stopped"
+
+#define TEST_LOG "/tmp/antman-test-slog.log"
+#define TEST_THREADS 4
+#define TEST_MAX_LINES 200000
+#define TEST_RUN_MS 200
+
+int tests_run = 0;
+int stopping = 0;
+
+// logger is a thread that logs numbered lines until it is told to stop
+typedef struct logger
+{
+  pthread_t thread;
+  int id;
+  int nLines;
+  int nLate;    // lines logged after slog_async_stop returned
+  int stopped;  // set once slog_async_stop has returned
+  char *seen;
+} logger_t;
+
+// logLines logs lines until stopping is set, keeping the rate under what the writer can drain
+static void *logLines(void *arg)
+{
+  logger_t *l = (logger_t *)arg;
+  while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE) && l->nLines < TEST_MAX_LINES)
+  {
+    int late = __atomic_load_n(&l->stopped, __ATOMIC_ACQUIRE);
+    slog(0, SLOG_INFO, "line t%d-%d", l->id, l->nLines);
+    l->nLines++;
+    l->nLate += late;
+    usleep(200);
+  }
+  return NULL;
+}
+
+/*
+  test every line logged from several threads reaches the file once, including lines logged while the async logger stops
+*/
+static char *test_async()
+{
+  logger_t loggers[TEST_THREADS];
+  int i, j;
+  unlink(TEST_LOG);
+  slog_init(TEST_LOG, NULL, 0, 1);
+  SlogConfig cfg;
+  slog_config_get(&cfg);
+  cfg.nToFile = 1;
+  cfg.nFileStamp = 0;
+  cfg.nTdSafe = 1;
+  slog_config_set(&cfg);
+  if (slog_async_start() != 0)
+    return ERR_start;
+
+  memset(loggers, 0, sizeof(loggers));
+  for (i = 0; i < TEST_THREADS; i++)
+  {
+    loggers[i].id = i;
+    loggers[i].seen = calloc(TEST_MAX_LINES, 1);
+    pthread_create(&loggers[i].thread, NULL, logLines, &loggers[i]);
+  }
+
+  // stop while the threads are logging, then let them carry on a little on the synchronous path
+  usleep(TEST_RUN_MS * 1000);
+  slog_async_stop();
+  for (i = 0; i < TEST_THREADS; i++)
+    __atomic_store_n(&loggers[i].stopped, 1, __ATOMIC_RELEASE);
+  usleep(TEST_RUN_MS * 1000 / 4);
+  __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+  for (i = 0; i < TEST_THREADS; i++)
+    pthread_join(loggers[i].thread, NULL);
+  if (slog_async_dropped() != 0)
+    return ERR_dropped;
+
+  // every numbered line should be in the file exactly once
+  FILE *fp = fopen(TEST_LOG, "r");
+  if (fp == NULL)
+    return ERR_missing;
+  char line[1024];
+  while (fgets(line, sizeof(line), fp) != NULL)
+  {
+    char *p = strstr(line, "line t");
+    int id, n;
+    if (p == NULL || sscanf(p, "line t%d-%d", &id, &n) != 2 || id < 0 || id >= TEST_THREADS || n < 0 || n >= TEST_MAX_LINES)
+      continue;
+    if (loggers[id].seen[n]++)
+      return ERR_repeated;
+  }
+  fclose(fp);
+  for (i = 0; i < TEST_THREADS; i++)
+  {
+    if (loggers[i].nLate == 0)
+      return ERR_late;
+    for (j = 0; j < loggers[i].nLines; j++)
+      if (!loggers[i].seen[j])
+        return ERR_missing;
+    free(loggers[i].seen);
+  }
+  unlink(TEST_LOG);
+  return 0;
+}
+
+/*
+  helper function to run all the tests
+*/
+static char *all_tests()
+{
+  mu_run_test(test_async);
+  return 0;
+}
+
+/*
+  entrypoint
+*/
+int main(int argc, char **argv)
+{
+  fprintf(stderr, "\t\tslog_test...");
+
+  // slog echoes every line to stdout
+  if (freopen("/dev/null", "w", stdout) == NULL)
+    return 1;
+  char *result = all_tests();
+  if (result != 0)
+  {
+    fprintf(stderr, "failed\n");
+    fprintf(stderr, "\ntest function %d failed:\n", tests_run);
+    fprintf(stderr, "%s\n", result);
+  }
+  else
+  {
+    fprintf(stderr, "passed\n");
+  }
+  return result != 0;
+}
+
+#endif
@@ -0,0 +1,158 @@
+#ifndef TEST_WORKERPOOL
+#define TEST_WORKERPOOL
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "minunit.h"
+#include "../metrics.h"
+#include "../workerpool.h"
+
+#define ERR_add "could not add work to the pool"
+#define ERR_bound "work was queued past the queue limit"
+#define ERR_wait "a full queue did not take work once it had room"
+#define ERR_run "not all the work was run"
+#define ERR_unflagged "a pool without metrics moved the queue depth or busy worker gauges"
+#define ERR_flagged "the daemon pool did not report its queue depth or busy workers"
+
+#define TEST_THREADS 2
+#define TEST_MAX_QUEUED 2
+#define TEST_WORK (TEST_THREADS + TEST_MAX_QUEUED + 1)
+
+int tests_run = 0;
+int gateOpen = 0, ran = 0, added = 0;
+pthread_mutex_t gateLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t gateCond = PTHREAD_COND_INITIALIZER;
+
+// gatedWork waits until the test opens the gate, so that the workers stay busy and the queue fills
+static void gatedWork(void *arg)
+{
+  pthread_mutex_lock(&gateLock);
+  while (!gateOpen)
+    pthread_cond_wait(&gateCond, &gateLock);
+  pthread_mutex_unlock(&gateLock);
+  __atomic_add_fetch(&ran, 1, __ATOMIC_ACQ_REL);
+}
+
+// addAll is the producer, it counts the work the pool has taken
+static void *addAll(void *arg)
+{
+  tpool_t *wp = (tpool_t *)arg;
+  int i;
+  for (i = 0; i < TEST_WORK; i++)
+  {
+    if (!tpool_add_work(wp, gatedWork, NULL))
+      return NULL;
+    __atomic_add_fetch(&added, 1, __ATOMIC_ACQ_REL);
+  }
+  return NULL;
+}
+
+/*
+  test a bounded queue makes the producer wait until the workers make room
+*/
+static char *test_bounded()
+{
+  tpool_t *wp = tpool_create(TEST_THREADS);
+  tpool_set_max_queued(wp, TEST_MAX_QUEUED);
+  pthread_t producer;
+  if (pthread_create(&producer, NULL, addAll, wp) != 0)
+    return ERR_add;
+
+  // the workers hold one each and the queue holds the limit, so the last add has to wait
+  usleep(200000);
+  if (__atomic_load_n(&added, __ATOMIC_ACQUIRE) != TEST_THREADS + TEST_MAX_QUEUED)
+    return ERR_bound;
+  pthread_mutex_lock(&gateLock);
+  gateOpen = 1;
+  pthread_cond_broadcast(&gateCond);
+  pthread_mutex_unlock(&gateLock);
+  pthread_join(producer, NULL);
+  if (added != TEST_WORK)
+    return ERR_wait;
+  tpool_wait(wp);
+  if (__atomic_load_n(&ran, __ATOMIC_ACQUIRE) != TEST_WORK)
+    return ERR_run;
+  tpool_destroy(wp);
+  return 0;
+}
+
+// setGate opens or closes the gate the work waits on
+static void setGate(int open)
+{
+  pthread_mutex_lock(&gateLock);
+  gateOpen = open;
+  pthread_cond_broadcast(&gateCond);
+  pthread_mutex_unlock(&gateLock);
+}
+
+// gaugesWhileBusy fills a pool with gated work and reads the gauges while the workers are held and the rest is queued
+static void gaugesWhileBusy(bool metrics, int64_t *depth, int64_t *busy)
+{
+  tpool_t *wp = tpool_create(TEST_THREADS);
+  tpool_set_metrics(wp, metrics);
+  setGate(0);
+  int i;
+  for (i = 0; i < TEST_THREADS + TEST_MAX_QUEUED; i++)
+    tpool_add_work(wp, gatedWork, NULL);
+  usleep(200000);
+  *depth = metricsGet(AM_METRIC_QUEUE_DEPTH);
+  *busy = metricsGet(AM_METRIC_WORKERS_BUSY);
+  setGate(1);
+  tpool_wait(wp);
+  tpool_destroy(wp);
+}
+
+/*
+  test only a pool with metrics set moves the global queue depth and busy worker gauges, and it puts them back once idle
+*/
+static char *test_metrics()
+{
+  int64_t depth, busy;
+  gaugesWhileBusy(false, &depth, &busy);
+  if (depth != 0 || busy != 0)
+    return ERR_unflagged;
+  gaugesWhileBusy(true, &depth, &busy);
+  if (depth != TEST_MAX_QUEUED || busy != TEST_THREADS)
+    return ERR_flagged;
+  if (metricsGet(AM_METRIC_QUEUE_DEPTH) != 0 || metricsGet(AM_METRIC_WORKERS_BUSY) != 0)
+    return ERR_flagged;
+  return 0;
+}
+
+/*
+  helper function to run all the tests
+*/
+static char *all_tests()
+{
+  mu_run_test(test_bounded);
+  mu_run_test(test_metrics);
+  return 0;
+}
+
+/*
+  entrypoint
+*/
+int main(int argc, char **argv)
+{
+  fprintf(stderr, "\t\tworkerpool_test...");
+
+  // fail rather than hang if the producer never gets room
+  alarm(10);
+  char *result = all_tests();
+  if (result != 0)
+  {
+    fprintf(stderr, "failed\n");
+    fprintf(stderr, "\ntest function %d failed:\n", tests_run);
+    fprintf(stderr, "%s\n", result);
+  }
+  else
+  {
+    fprintf(stderr, "passed\n");
+  }
+  return result != 0;
+}
+
+#endif
@@ -1,6 +1,9 @@
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
+#include "metrics.h"
 #include "watcher.h"
 #include "sequence.h"
 #include "slog.h"
@@ -16,6 +19,21 @@ char *getExt(const char *filename)
     return dot + 1;
 }
 
+// isFastq returns 1 if the filename has a FASTQ extension (optionally gzipped), 0 if not
+int isFastq(const char *filename)
+{
+    char *ext = getExt(filename);
+    if (strcmp(ext, "gz") == 0)
+    {
+        // look at the extension before the .gz
+        size_t len = ext - filename - 1;
+        if (len >= 6 && strncmp(filename + len - 6, ".fastq", 6) == 0)
+            return 1;
+        return (len >= 3 && strncmp(filename + len - 3, ".fq", 3) == 0);
+    }
+    return (strcmp(ext, "fastq") == 0) || (strcmp(ext, "fq") == 0);
+}
+
 // watcherCallback is a test callback function for when the watcher spots a change
 void watcherCallback(fsw_cevent const *const events, const unsigned int event_num, void *args)
 {
@@ -46,11 +64,12 @@ void watcherCallback(fsw_cevent const *const events, const unsigned int event_nu
     for (i = 0; i < event_num; i++)
     {
         fsw_cevent const *e = &events[i];
+        metricsAdd(AM_METRIC_WATCHER_EVENTS, 1);
+        uint64_t eventTime = metricsNow();
 
         // check if the event concerns a filetype we are interested in
         // TODO: this is just an extension test for now, will make it more robust...
-        char *ext = getExt(e->path);
-        if ((strcmp(ext, "fastq") == 0) || (strcmp(ext, "fq") == 0))
+        if (isFastq(e->path))
         {
             // combine the flags for the event into a bitmask
             unsigned int setFlags = 0;
@@ -62,17 +81,17 @@ void watcherCallback(fsw_cevent const *const events, const unsigned int event_nu
             // use the bitmask to determine how to handle the event
             if ((setFlags & fileCheckList) == fileCheckList)
             {
-                slog(0, SLOG_LIVE, "\t- [watcher]:\tfound a FASTQ file: %s", e->path);
+                slog_hot(0, SLOG_LIVE, "\t- [watcher]:\tfound a FASTQ file: %s", e->path);
             }
             else
             {
                 if ((setFlags & 1 << 3) == 1 << 3)
                 {
-                    slog(0, SLOG_LIVE, "\t- [watcher]:\tignoring a deleted file");
+                    slog_hot(0, SLOG_LIVE, "\t- [watcher]:\tignoring a deleted file");
                 }
                 else
                 {
-                    slog(0, SLOG_LIVE, "\t- [watcher]:\tignoring a file modification"); // TODO: is this catch right?
+                    slog_hot(0, SLOG_LIVE, "\t- [watcher]:\tignoring a file modification"); // TODO: is this catch right?
                 }
                 continue;
             }
@@ -81,19 +100,44 @@ void watcherCallback(fsw_cevent const *const events, const unsigned int event_nu
             // TODO: this is really clunky, make it better
             watcherArgs_t *wargs2 = malloc(sizeof(watcherArgs_t));
             if (wargs2 == NULL)
+            {
                 slog(0, SLOG_ERROR, "could not allocate watcher arguments");
+                continue;
+            }
             wargs2->workerPool = wargs->workerPool;
             wargs2->bloomFilter = wargs->bloomFilter;
+            wargs2->refDB = wargs->refDB;
+            wargs2->estimator = wargs->estimator;
+            wargs2->runTracker = wargs->runTracker;
+            wargs2->coverage = wargs->coverage;
             wargs2->k_size = wargs->k_size;
             wargs2->sketch_size = wargs->sketch_size;
-            wargs2->fp_rate = wargs2->fp_rate;
-            strcpy(wargs2->filepath, events[i].path);
+            wargs2->fp_rate = wargs->fp_rate;
+            wargs2->match_threshold = wargs->match_threshold;
+            wargs2->sprt_confidence = wargs->sprt_confidence;
+            if (snprintf(wargs2->filepath, sizeof(wargs2->filepath), "%s", events[i].path) >= (int)sizeof(wargs2->filepath))
+            {
+                slog(0, SLOG_ERROR, "\t- [watcher]:\tfilepath is too long: %s", events[i].path);
+                free(wargs2);
+                continue;
+            }
+
+            // the event time from fswatch only has second resolution
+            time_t now = time(NULL);
+            wargs2->notify_ns = (now > e->evt_time) ? (uint64_t)(now - e->evt_time) * 1000000000ULL : 0;
+            wargs2->event_ns = eventTime;
+            wargs2->enqueue_ns = metricsNow();
+            metricsStage(AM_STAGE_NOTIFY, wargs2->notify_ns);
+            metricsStage(AM_STAGE_ENQUEUE, wargs2->enqueue_ns - eventTime);
 
             // process the fastq file using the workerpool
             if (!tpool_add_work(wargs->workerPool, processFastq, wargs2))
             {
                 slog(0, SLOG_ERROR, "\t- failed to send the filepath to the workerpool");
+                free(wargs2);
+                continue;
             }
+            metricsAdd(AM_METRIC_FILES_QUEUED, 1);
         }
     }
 }
@@ -2,8 +2,14 @@
 #define WATCHER_H
 
 #include <libfswatch/c/libfswatch.h>
+#include <limits.h>
+#include <stdint.h>
 
 #include "bloom.h"
+#include "coverage.h"
+#include "estimate.h"
+#include "refdb.h"
+#include "runsketch.h"
 #include "workerpool.h"
 
 // watcherArgs_t
@@ -11,16 +17,27 @@ typedef struct watcherArgs
 {
     tpool_t *workerPool;
     struct bloom *bloomFilter;
-    char filepath[50];
+    refdb_t *refDB; // used instead of the bloom filter when set
+    const estimator_t *estimator; // turns the hits into containment estimates for the reference (see referenceEstimator)
+    runTracker_t *runTracker; // the run's sketch, file sketches are merged into it (NULL to not keep sketches)
+    struct decideService *decide; // answers read chunks over a socket for adaptive sampling (NULL if it is off, see decide.h)
+    coverage_t *coverage; // counts the reference k-mers in the reads for the depth estimates (NULL to not count them)
+    char filepath[PATH_MAX];
     int k_size;
     int sketch_size;
     double fp_rate;
+    double match_threshold;
+    double sprt_confidence; // stop checking a read once the sequential test is this sure (0 to check every sketch hash)
+    uint64_t notify_ns;  // file created -> watcher event
+    uint64_t event_ns;   // monotonic time of the watcher event
+    uint64_t enqueue_ns; // monotonic time the file was queued
 } watcherArgs_t;
 
 /*
     function prototypes
 */
 char *getExt(const char *filename);
+int isFastq(const char *filename);
 void watcherCallback(fsw_cevent const *const events, const unsigned int event_num, void *args);
 
 #endif
\ No newline at end of file
@@ -1,8 +1,10 @@
 #include <pthread.h>
 #include <stdlib.h>
 
+#include "metrics.h"
 #include "workerpool.h"
 #include "slog.h"
+#include "trace.h"
 
 /*
     the worker pool is a simple linked list which stores the function to call and its arguments
@@ -24,8 +26,12 @@ struct tpool
     pthread_mutex_t work_mutex;  // thread lock
     pthread_cond_t work_cond;    // signals the threads that there is work to be processed
     pthread_cond_t working_cond; // signals when there are no threads processing
+    pthread_cond_t space_cond;   // signals tpool_add_work that the queue has room
+    size_t queued_cnt;           // how much work is waiting in the queue
+    size_t max_queued;           // tpool_add_work waits while this much work is queued (0 is unbounded)
     size_t working_cnt;          // how many threads are actively processing work
     size_t thread_cnt;           // helps us prevent running threads from being destroyed prematurely
+    bool metrics;                // report the queue depth and busy workers (only the daemon pool does)
     bool stop;                   // used to stop the threads
 };
 
@@ -71,6 +77,10 @@ static tpool_work_t *tpool_work_get(tpool_t *tp)
     {
         tp->work_first = work->next;
     }
+    tp->queued_cnt--;
+    pthread_cond_signal(&(tp->space_cond));
+    if (tp->metrics)
+        metricsAdd(AM_METRIC_QUEUE_DEPTH, -1);
 
     return work;
 }
@@ -80,6 +90,7 @@ static void *tpool_worker(void *arg)
 {
     tpool_t *tp = arg;
     tpool_work_t *work;
+    bool metrics;
 
     // keep the thread running
     while (1)
@@ -101,6 +112,7 @@ static void *tpool_worker(void *arg)
 
         // notify the pool that this thread is working
         tp->working_cnt++;
+        metrics = tp->metrics;
 
         // unlock the mutex so other threads can get work from the queue
         pthread_mutex_unlock(&(tp->work_mutex));
@@ -118,8 +130,14 @@ static void *tpool_worker(void *arg)
         */
         if (work != NULL)
         {
+            if (metrics)
+                metricsAdd(AM_METRIC_WORKERS_BUSY, 1);
+            TRACE_BEGIN(traceSpan, tpool_work);
             work->func(work->arg);
+            TRACE_END(traceSpan, tpool_work, "tpool_worker");
             tpool_work_destroy(work);
+            if (metrics)
+                metricsAdd(AM_METRIC_WORKERS_BUSY, -1);
         }
 
         // lock the mutex again and clean up the thread
@@ -152,6 +170,7 @@ tpool_t *tpool_create(size_t num)
     pthread_mutex_init(&(tp->work_mutex), NULL);
     pthread_cond_init(&(tp->work_cond), NULL);
     pthread_cond_init(&(tp->working_cond), NULL);
+    pthread_cond_init(&(tp->space_cond), NULL);
 
     tp->work_first = NULL;
     tp->work_last = NULL;
@@ -180,10 +199,16 @@ void tpool_destroy(tpool_t *tp)
     {
         work2 = work->next;
         tpool_work_destroy(work);
+        if (tp->metrics)
+            metricsAdd(AM_METRIC_QUEUE_DEPTH, -1);
         work = work2;
     }
+    tp->work_first = NULL;
+    tp->work_last = NULL;
+    tp->queued_cnt = 0;
     tp->stop = true;
     pthread_cond_broadcast(&(tp->work_cond));
+    pthread_cond_broadcast(&(tp->space_cond));
     pthread_mutex_unlock(&(tp->work_mutex));
 
     tpool_wait(tp);
@@ -191,11 +216,29 @@ void tpool_destroy(tpool_t *tp)
     pthread_mutex_destroy(&(tp->work_mutex));
     pthread_cond_destroy(&(tp->work_cond));
     pthread_cond_destroy(&(tp->working_cond));
+    pthread_cond_destroy(&(tp->space_cond));
 
     free(tp);
 }
 
-// tpool_add_work
+// tpool_set_max_queued bounds the work waiting in the queue, so tpool_add_work waits for room rather than the queue growing without limit (0 is unbounded)
+void tpool_set_max_queued(tpool_t *tp, size_t max)
+{
+    pthread_mutex_lock(&(tp->work_mutex));
+    tp->max_queued = max;
+    pthread_cond_broadcast(&(tp->space_cond));
+    pthread_mutex_unlock(&(tp->work_mutex));
+}
+
+// tpool_set_metrics makes the pool report its queue depth and busy workers, the gauges are global so only one pool (the daemon's) should, and it has to be set before any work is added
+void tpool_set_metrics(tpool_t *tp, bool on)
+{
+    pthread_mutex_lock(&(tp->work_mutex));
+    tp->metrics = on;
+    pthread_mutex_unlock(&(tp->work_mutex));
+}
+
+// tpool_add_work queues work for the threads, waiting for room if the queue is bounded (returns false if the pool is stopping)
 bool tpool_add_work(tpool_t *tp, thread_func_t func, void *arg)
 {
     tpool_work_t *work;
@@ -205,6 +248,14 @@ bool tpool_add_work(tpool_t *tp, thread_func_t func, void *arg)
     if (work == NULL)
         return false;
     pthread_mutex_lock(&(tp->work_mutex));
+    while (!tp->stop && tp->max_queued != 0 && tp->queued_cnt >= tp->max_queued)
+        pthread_cond_wait(&(tp->space_cond), &(tp->work_mutex));
+    if (tp->stop)
+    {
+        pthread_mutex_unlock(&(tp->work_mutex));
+        tpool_work_destroy(work);
+        return false;
+    }
     if (tp->work_first == NULL)
     {
         tp->work_first = work;
@@ -215,12 +266,15 @@ bool tpool_add_work(tpool_t *tp, thread_func_t func, void *arg)
         tp->work_last->next = work;
         tp->work_last = work;
     }
+    tp->queued_cnt++;
+    if (tp->metrics)
+        metricsAdd(AM_METRIC_QUEUE_DEPTH, 1);
     pthread_cond_broadcast(&(tp->work_cond));
     pthread_mutex_unlock(&(tp->work_mutex));
     return true;
 }
 
-// tpool_wait
+// tpool_wait blocks until the queue is empty and no thread is working (or, once stopping, until the threads have exited)
 void tpool_wait(tpool_t *tp)
 {
     if (tp == NULL)
@@ -229,7 +283,8 @@ void tpool_wait(tpool_t *tp)
     pthread_mutex_lock(&(tp->work_mutex));
     while (1)
     {
-        if ((!tp->stop && tp->working_cnt != 0) || (tp->stop && tp->thread_cnt != 0))
+        // work can be queued before any thread has picked it up, so check the queue as well as the working count
+        if ((!tp->stop && (tp->working_cnt != 0 || tp->work_first != NULL)) || (tp->stop && tp->thread_cnt != 0))
         {
             pthread_cond_wait(&(tp->working_cond), &(tp->work_mutex));
         }
@@ -13,6 +13,8 @@ typedef void (*thread_func_t)(void *arg);
 */
 tpool_t* tpool_create(size_t num);
 void tpool_destroy(tpool_t* tm);
+void tpool_set_max_queued(tpool_t* tm, size_t max);
+void tpool_set_metrics(tpool_t* tm, bool on);
 bool tpool_add_work(tpool_t* tm, thread_func_t func, void* arg);
 void tpool_wait(tpool_t* tm);
 